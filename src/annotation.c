@@ -0,0 +1,297 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* persistent store for album and track annotations (names, artists, cover
+ * art), so only items new to the collection have to be annotated at startup
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "annotation.h"
+#include "settings.h"
+#include "debug.h"
+
+/* bump whenever the line format changes, old stores are discarded */
+static const char storeHeader[] = "# pianobar annotations v1\n";
+/* upper bound for the number of stored items */
+static const size_t storeMax = 4096;
+/* id, type, name, seedId, artist, album, title, coverArt, length */
+#define STORE_FIELDS 9
+
+static char *BarAnnotationPath (void) {
+	return BarGetXdgConfigDir (PACKAGE "/annotations");
+}
+
+/*	strdup that maps empty fields to NULL
+ */
+static char *BarAnnotationStrdup (const char * const s) {
+	return (s == NULL || s[0] == '\0') ? NULL : strdup (s);
+}
+
+/*	load the store, a missing or outdated file gives an empty one
+ */
+void BarAnnotationRead (BarAnnotationStore_t * const store) {
+	assert (store != NULL);
+
+	store->items = NULL;
+	store->count = 0;
+
+	char * const path = BarAnnotationPath ();
+	if (path == NULL) {
+		return;
+	}
+	FILE * const fd = fopen (path, "r");
+	free (path);
+	if (fd == NULL) {
+		return;
+	}
+
+	char line[2048];
+	if (fgets (line, sizeof (line), fd) == NULL ||
+			strcmp (line, storeHeader) != 0) {
+		debugPrint (DEBUG_UI, "annotation store outdated, ignoring it\n");
+		fclose (fd);
+		return;
+	}
+
+	if ((store->items = calloc (storeMax, sizeof (*store->items))) == NULL) {
+		fclose (fd);
+		return;
+	}
+
+	while (store->count < storeMax && fgets (line, sizeof (line), fd) != NULL) {
+		/* split at tabs, keeping empty fields */
+		char *field[STORE_FIELDS];
+		char *pos = line;
+		size_t n = 0;
+		line[strcspn (line, "\n")] = '\0';
+		for (n = 0; n < STORE_FIELDS && pos != NULL; n++) {
+			field[n] = pos;
+			if ((pos = strchr (pos, '\t')) != NULL) {
+				*pos = '\0';
+				++pos;
+			}
+		}
+		if (n != STORE_FIELDS || field[0][0] == '\0' || field[2][0] == '\0') {
+			continue;
+		}
+
+		BarAnnotation_t * const a = &store->items[store->count];
+		a->id = strdup (field[0]);
+		a->type = atoi (field[1]);
+		a->name = BarAnnotationStrdup (field[2]);
+		a->seedId = BarAnnotationStrdup (field[3]);
+		a->artist = BarAnnotationStrdup (field[4]);
+		a->album = BarAnnotationStrdup (field[5]);
+		a->title = BarAnnotationStrdup (field[6]);
+		a->coverArt = BarAnnotationStrdup (field[7]);
+		a->length = strtoul (field[8], NULL, 10);
+		++store->count;
+	}
+	fclose (fd);
+
+	debugPrint (DEBUG_UI, "read %zu annotations\n", store->count);
+}
+
+/*	podcasts are annotated with their latest episode, which changes too often
+ *	to be stored
+ */
+static bool BarAnnotationCacheable (const PianoStation_t * const station) {
+	return station->stationType == PIANO_TYPE_ALBUM ||
+			station->stationType == PIANO_TYPE_TRACK;
+}
+
+static const BarAnnotation_t *BarAnnotationFind (
+		const BarAnnotationStore_t * const store, const char * const id,
+		const PianoStationType_t type) {
+	for (size_t i = 0; i < store->count; i++) {
+		const BarAnnotation_t * const a = &store->items[i];
+		if (a->type == type && strcmp (a->id, id) == 0) {
+			return a;
+		}
+	}
+	return NULL;
+}
+
+/*	name unnamed collection items from the store, the same way
+ *	PIANO_REQUEST_ANNOTATE_OBJECTS would
+ */
+void BarAnnotationApply (const BarAnnotationStore_t * const store,
+		PianoStation_t * const stations) {
+	assert (store != NULL);
+
+	PianoStation_t *station = stations;
+	PianoListForeachP (station) {
+		if (station->name != NULL) {
+			continue;
+		}
+		if (!BarAnnotationCacheable (station)) {
+			continue;
+		}
+
+		const BarAnnotation_t * const a = BarAnnotationFind (store,
+				station->id, station->stationType);
+		if (a == NULL) {
+			continue;
+		}
+
+		station->name = strdup (a->name);
+		station->seedId = BarAnnotationStrdup (a->seedId);
+		if (station->stationType == PIANO_TYPE_TRACK &&
+				station->theSong == NULL) {
+			PianoSong_t * const song = calloc (1, sizeof (*song));
+			if (song == NULL) {
+				continue;
+			}
+			song->artist = BarAnnotationStrdup (a->artist);
+			song->album = BarAnnotationStrdup (a->album);
+			song->title = BarAnnotationStrdup (a->title);
+			song->coverArt = BarAnnotationStrdup (a->coverArt);
+			song->length = a->length;
+			station->theSong = song;
+		}
+	}
+}
+
+/*	write a field, tabs and newlines would break the line format
+ */
+static void BarAnnotationPutField (FILE * const fd, const char * const s,
+		const char sep) {
+	if (s != NULL) {
+		for (const char *c = s; *c != '\0'; c++) {
+			fputc ((*c == '\t' || *c == '\n') ? ' ' : *c, fd);
+		}
+	}
+	fputc (sep, fd);
+}
+
+/*	save annotations of the current collection, followed by older entries not
+ *	seen this time (the collection may not have been loaded completely), up to
+ *	storeMax items. The old file is replaced atomically.
+ */
+void BarAnnotationWrite (const BarAnnotationStore_t * const store,
+		PianoStation_t * const stations) {
+	assert (store != NULL);
+
+	char * const path = BarAnnotationPath ();
+	if (path == NULL) {
+		return;
+	}
+	/* an interrupted write must not lose the old store */
+	const size_t tmpLen = strlen (path) + 5;
+	char * const tmpPath = malloc (tmpLen);
+	if (tmpPath == NULL) {
+		free (path);
+		return;
+	}
+	snprintf (tmpPath, tmpLen, "%s.new", path);
+	/* the station list is nobody else's business */
+	const int tmpFd = open (tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE * const fd = tmpFd != -1 ? fdopen (tmpFd, "w") : NULL;
+	if (fd == NULL) {
+		if (tmpFd != -1) {
+			close (tmpFd);
+			unlink (tmpPath);
+		}
+		free (tmpPath);
+		free (path);
+		return;
+	}
+
+	fputs (storeHeader, fd);
+	size_t count = 0;
+	PianoStation_t *station = stations;
+	PianoListForeachP (station) {
+		if (count >= storeMax) {
+			break;
+		}
+		if (station->name == NULL) {
+			continue;
+		}
+		if (!BarAnnotationCacheable (station)) {
+			continue;
+		}
+
+		const PianoSong_t * const song = station->theSong;
+		BarAnnotationPutField (fd, station->id, '\t');
+		fprintf (fd, "%i\t", station->stationType);
+		BarAnnotationPutField (fd, station->name, '\t');
+		BarAnnotationPutField (fd, station->seedId, '\t');
+		BarAnnotationPutField (fd, song != NULL ? song->artist : NULL, '\t');
+		BarAnnotationPutField (fd, song != NULL ? song->album : NULL, '\t');
+		BarAnnotationPutField (fd, song != NULL ? song->title : NULL, '\t');
+		BarAnnotationPutField (fd, song != NULL ? song->coverArt : NULL, '\t');
+		fprintf (fd, "%u\n", song != NULL ? song->length : 0);
+		++count;
+	}
+
+	for (size_t i = 0; i < store->count && count < storeMax; i++) {
+		const BarAnnotation_t * const a = &store->items[i];
+		if (stations != NULL &&
+				PianoFindStationById (stations, a->id) != NULL) {
+			continue;
+		}
+		BarAnnotationPutField (fd, a->id, '\t');
+		fprintf (fd, "%i\t", a->type);
+		BarAnnotationPutField (fd, a->name, '\t');
+		BarAnnotationPutField (fd, a->seedId, '\t');
+		BarAnnotationPutField (fd, a->artist, '\t');
+		BarAnnotationPutField (fd, a->album, '\t');
+		BarAnnotationPutField (fd, a->title, '\t');
+		BarAnnotationPutField (fd, a->coverArt, '\t');
+		fprintf (fd, "%u\n", a->length);
+		++count;
+	}
+	if (fclose (fd) != 0 || rename (tmpPath, path) != 0) {
+		debugPrint (DEBUG_UI, "cannot write annotation store %s\n", path);
+		unlink (tmpPath);
+	}
+	free (tmpPath);
+	free (path);
+}
+
+void BarAnnotationDestroy (BarAnnotationStore_t * const store) {
+	assert (store != NULL);
+
+	for (size_t i = 0; i < store->count; i++) {
+		BarAnnotation_t * const a = &store->items[i];
+		free (a->id);
+		free (a->name);
+		free (a->seedId);
+		free (a->artist);
+		free (a->album);
+		free (a->title);
+		free (a->coverArt);
+	}
+	free (store->items);
+	store->items = NULL;
+	store->count = 0;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <piano.h>
+
+/* annotation of a single collection item, as stored on disk */
+typedef struct {
+	char *id;
+	PianoStationType_t type;
+	char *name, *seedId;
+	char *artist, *album, *title, *coverArt;
+	unsigned int length;
+} BarAnnotation_t;
+
+typedef struct {
+	BarAnnotation_t *items;
+	size_t count;
+} BarAnnotationStore_t;
+
+void BarAnnotationRead (BarAnnotationStore_t * const);
+void BarAnnotationApply (const BarAnnotationStore_t * const,
+		PianoStation_t * const);
+void BarAnnotationWrite (const BarAnnotationStore_t * const,
+		PianoStation_t * const);
+void BarAnnotationDestroy (BarAnnotationStore_t * const);
+
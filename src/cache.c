@@ -0,0 +1,467 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* cache for raw responses of read-only requests. Entries expire after a per
+ * request type ttl and are dropped early by requests changing the data they
+ * describe. Long-lived entries survive restarts.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "settings.h"
+#include "debug.h"
+
+/* bump whenever the file format changes, old caches are discarded */
+static const char cacheHeader[] = "# pianobar cache v1\n";
+/* upper bound for the number of entries */
+static const size_t cacheMax = 128;
+/* upper bound for a single response */
+static const size_t bodyMax = 1024*1024;
+
+typedef struct {
+	/* seconds, 0 if the request type is not cached */
+	time_t ttl;
+	/* keep across restarts */
+	bool persist;
+} BarCachePolicy_t;
+
+static BarCachePolicy_t BarCachePolicy (const PianoRequestType_t type) {
+	switch (type) {
+		case PIANO_REQUEST_GET_GENRE_STATIONS:
+		case PIANO_REQUEST_EXPLAIN:
+			return (BarCachePolicy_t) { 24*60*60, true };
+
+		case PIANO_REQUEST_SEARCH:
+			return (BarCachePolicy_t) { 60*60, false };
+
+		case PIANO_REQUEST_GET_STATION_MODES:
+		case PIANO_REQUEST_GET_EPISODES:
+			return (BarCachePolicy_t) { 15*60, false };
+
+		case PIANO_REQUEST_GET_STATION_INFO:
+		case PIANO_REQUEST_GET_SETTINGS:
+			return (BarCachePolicy_t) { 5*60, false };
+
+		default:
+			return (BarCachePolicy_t) { 0, false };
+	}
+}
+
+/*	canonical key, the request parameters the response depends on
+ *	@return false if type is not cached or the key does not fit
+ */
+static bool BarCacheKey (const PianoRequestType_t type,
+		const void * const data, char * const key, const size_t size) {
+	int len;
+
+	switch (type) {
+		case PIANO_REQUEST_GET_GENRE_STATIONS:
+		case PIANO_REQUEST_GET_SETTINGS:
+			len = snprintf (key, size, "%s", "");
+			break;
+
+		case PIANO_REQUEST_SEARCH: {
+			const PianoRequestDataSearch_t * const reqData = data;
+			len = snprintf (key, size, "%s", reqData->searchStr);
+			break;
+		}
+
+		case PIANO_REQUEST_EXPLAIN: {
+			const PianoRequestDataExplain_t * const reqData = data;
+			len = snprintf (key, size, "%s", reqData->song->trackToken);
+			break;
+		}
+
+		case PIANO_REQUEST_GET_STATION_INFO: {
+			const PianoRequestDataGetStationInfo_t * const reqData = data;
+			len = snprintf (key, size, "%s", reqData->station->id);
+			break;
+		}
+
+		case PIANO_REQUEST_GET_STATION_MODES: {
+			const PianoRequestDataGetStationModes_t * const reqData = data;
+			len = snprintf (key, size, "%s", reqData->station->id);
+			break;
+		}
+
+		case PIANO_REQUEST_GET_EPISODES: {
+			const PianoRequestDataGetEpisodes_t * const reqData = data;
+			len = snprintf (key, size, "%s/%u", reqData->station->id,
+					reqData->limit);
+			break;
+		}
+
+		default:
+			return false;
+	}
+
+	return len >= 0 && (size_t) len < size;
+}
+
+static void BarCacheRemove (BarCache_t * const cache, const size_t i) {
+	assert (i < cache->count);
+
+	free (cache->entries[i].key);
+	free (cache->entries[i].body);
+	cache->entries[i] = cache->entries[--cache->count];
+}
+
+static BarCacheEntry_t *BarCacheFind (BarCache_t * const cache,
+		const PianoRequestType_t type, const char * const key) {
+	for (size_t i = 0; i < cache->count; i++) {
+		BarCacheEntry_t * const e = &cache->entries[i];
+		if (e->type == type && strcmp (e->key, key) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*	look up a fresh response
+ *	@return copy of the response, must be freed, or NULL
+ */
+char *BarCacheGet (BarCache_t * const cache, const PianoRequestType_t type,
+		const void * const data) {
+	assert (cache != NULL);
+
+	char key[1024];
+	if (!BarCacheKey (type, data, key, sizeof (key))) {
+		return NULL;
+	}
+
+	BarCacheEntry_t * const e = BarCacheFind (cache, type, key);
+	if (e == NULL || e->expires <= time (NULL)) {
+		if (e != NULL) {
+			BarCacheRemove (cache, e - cache->entries);
+		}
+		++cache->misses;
+		return NULL;
+	}
+
+	++cache->hits;
+	debugPrint (DEBUG_NETWORK, "cache hit for %i/%s (%lu hits, %lu misses)\n",
+			type, key, cache->hits, cache->misses);
+	return strdup (e->body);
+}
+
+/*	store a successful response, evicting the entry closest to expiry if the
+ *	cache is full
+ */
+void BarCachePut (BarCache_t * const cache, const PianoRequestType_t type,
+		const void * const data, const char * const body) {
+	assert (cache != NULL);
+	assert (body != NULL);
+
+	const BarCachePolicy_t policy = BarCachePolicy (type);
+	char key[1024];
+	if (policy.ttl == 0 || !BarCacheKey (type, data, key, sizeof (key)) ||
+			strlen (body) > bodyMax) {
+		return;
+	}
+
+	if (cache->entries == NULL &&
+			(cache->entries = calloc (cacheMax, sizeof (*cache->entries))) == NULL) {
+		return;
+	}
+
+	BarCacheEntry_t *e = BarCacheFind (cache, type, key);
+	if (e != NULL) {
+		BarCacheRemove (cache, e - cache->entries);
+	}
+	if (cache->count >= cacheMax) {
+		size_t oldest = 0;
+		for (size_t i = 1; i < cache->count; i++) {
+			if (cache->entries[i].expires < cache->entries[oldest].expires) {
+				oldest = i;
+			}
+		}
+		BarCacheRemove (cache, oldest);
+	}
+
+	e = &cache->entries[cache->count];
+	if ((e->key = strdup (key)) == NULL) {
+		return;
+	}
+	if ((e->body = strdup (body)) == NULL) {
+		free (e->key);
+		return;
+	}
+	e->type = type;
+	e->expires = time (NULL) + policy.ttl;
+	++cache->count;
+}
+
+/*	drop responses a request is about to change
+ */
+void BarCacheInvalidate (BarCache_t * const cache,
+		const PianoRequestType_t type, const void * const data) {
+	assert (cache != NULL);
+
+	/* affected request types and station, NULL for all stations */
+	PianoRequestType_t affected[2];
+	size_t n = 0;
+	const char *station = NULL;
+
+	switch (type) {
+		case PIANO_REQUEST_ADD_SEED: {
+			const PianoRequestDataAddSeed_t * const reqData = data;
+			station = reqData->station->id;
+			affected[n++] = PIANO_REQUEST_GET_STATION_INFO;
+			break;
+		}
+
+		case PIANO_REQUEST_RATE_SONG: {
+			const PianoRequestDataRateSong_t * const reqData = data;
+			station = reqData->song->stationId;
+			affected[n++] = PIANO_REQUEST_GET_STATION_INFO;
+			break;
+		}
+
+		case PIANO_REQUEST_ADD_FEEDBACK: {
+			const PianoRequestDataAddFeedback_t * const reqData = data;
+			station = reqData->stationId;
+			affected[n++] = PIANO_REQUEST_GET_STATION_INFO;
+			break;
+		}
+
+		case PIANO_REQUEST_DELETE_SEED:
+		case PIANO_REQUEST_DELETE_FEEDBACK:
+			/* the station is not known here */
+			affected[n++] = PIANO_REQUEST_GET_STATION_INFO;
+			break;
+
+		case PIANO_REQUEST_RENAME_STATION: {
+			const PianoRequestDataRenameStation_t * const reqData = data;
+			station = reqData->station->id;
+			affected[n++] = PIANO_REQUEST_GET_STATION_INFO;
+			break;
+		}
+
+		case PIANO_REQUEST_TRANSFORM_STATION:
+		case PIANO_REQUEST_DELETE_STATION:
+		case PIANO_REQUEST_REMOVE_ITEM: {
+			const PianoStation_t * const s = data;
+			station = s->id;
+			affected[n++] = PIANO_REQUEST_GET_STATION_INFO;
+			affected[n++] = PIANO_REQUEST_GET_STATION_MODES;
+			break;
+		}
+
+		case PIANO_REQUEST_SET_STATION_MODE: {
+			const PianoRequestDataSetStationMode_t * const reqData = data;
+			station = reqData->station->id;
+			affected[n++] = PIANO_REQUEST_GET_STATION_MODES;
+			break;
+		}
+
+		case PIANO_REQUEST_CHANGE_SETTINGS:
+			affected[n++] = PIANO_REQUEST_GET_SETTINGS;
+			break;
+
+		default:
+			return;
+	}
+
+	size_t i = 0;
+	while (i < cache->count) {
+		const BarCacheEntry_t * const e = &cache->entries[i];
+		bool drop = false;
+		for (size_t j = 0; j < n; j++) {
+			if (e->type == affected[j] &&
+					(station == NULL || strcmp (e->key, station) == 0)) {
+				drop = true;
+			}
+		}
+		if (drop) {
+			debugPrint (DEBUG_NETWORK, "cache invalidated %i/%s\n", e->type,
+					e->key);
+			/* replaces entry i with the last one */
+			BarCacheRemove (cache, i);
+		} else {
+			++i;
+		}
+	}
+}
+
+static char *BarCachePath (void) {
+	return BarGetXdgConfigDir (PACKAGE "/cache");
+}
+
+/*	load persistent entries, which are only valid for the user who fetched
+ *	them
+ */
+void BarCacheRead (BarCache_t * const cache, const char * const user) {
+	assert (cache != NULL);
+
+	if (user == NULL) {
+		return;
+	}
+
+	char * const path = BarCachePath ();
+	if (path == NULL) {
+		return;
+	}
+	FILE * const fd = fopen (path, "r");
+	free (path);
+	if (fd == NULL) {
+		return;
+	}
+
+	char line[1024];
+	if (fgets (line, sizeof (line), fd) == NULL ||
+			strcmp (line, cacheHeader) != 0 ||
+			fgets (line, sizeof (line), fd) == NULL) {
+		fclose (fd);
+		return;
+	}
+	line[strcspn (line, "\n")] = '\0';
+	if (strcmp (line, user) != 0) {
+		/* someone else’s */
+		fclose (fd);
+		return;
+	}
+
+	const time_t now = time (NULL);
+	int type;
+	long long expires;
+	size_t keyLen, bodyLen;
+	/* entry header, then key and body verbatim, which may contain anything
+	 * but NUL */
+	while (fgets (line, sizeof (line), fd) != NULL &&
+			sscanf (line, "%i %lld %zu %zu", &type, &expires, &keyLen,
+			&bodyLen) == 4) {
+		if (keyLen >= sizeof (line) || bodyLen > bodyMax) {
+			break;
+		}
+		char * const body = malloc (bodyLen+1);
+		if (body == NULL) {
+			break;
+		}
+		if (fread (line, 1, keyLen, fd) != keyLen ||
+				fread (body, 1, bodyLen, fd) != bodyLen || fgetc (fd) != '\n') {
+			free (body);
+			break;
+		}
+		line[keyLen] = '\0';
+		body[bodyLen] = '\0';
+
+		if ((time_t) expires > now) {
+			/* BarCachePut computes the key itself, so bypass it */
+			if (cache->entries == NULL && (cache->entries = calloc (cacheMax,
+					sizeof (*cache->entries))) == NULL) {
+				free (body);
+				break;
+			}
+			char * const key = strdup (line);
+			if (cache->count < cacheMax && key != NULL) {
+				BarCacheEntry_t * const e = &cache->entries[cache->count++];
+				e->type = type;
+				e->key = key;
+				e->body = body;
+				e->expires = expires;
+				continue;
+			}
+			free (key);
+		}
+		free (body);
+	}
+	fclose (fd);
+
+	debugPrint (DEBUG_NETWORK, "read %zu cached responses\n", cache->count);
+}
+
+/*	save entries worth keeping across restarts, atomically replacing the old
+ *	file
+ */
+void BarCacheWrite (const BarCache_t * const cache, const char * const user) {
+	assert (cache != NULL);
+
+	if (user == NULL) {
+		return;
+	}
+
+	char * const path = BarCachePath ();
+	if (path == NULL) {
+		return;
+	}
+	const size_t tmpLen = strlen (path) + 5;
+	char * const tmpPath = malloc (tmpLen);
+	if (tmpPath == NULL) {
+		free (path);
+		return;
+	}
+	snprintf (tmpPath, tmpLen, "%s.new", path);
+	/* responses are private, do not leave them to the umask */
+	const int tmpFd = open (tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE * const fd = tmpFd != -1 ? fdopen (tmpFd, "w") : NULL;
+	if (fd == NULL) {
+		if (tmpFd != -1) {
+			close (tmpFd);
+			unlink (tmpPath);
+		}
+		free (tmpPath);
+		free (path);
+		return;
+	}
+
+	fputs (cacheHeader, fd);
+	fprintf (fd, "%s\n", user);
+	const time_t now = time (NULL);
+	for (size_t i = 0; i < cache->count; i++) {
+		const BarCacheEntry_t * const e = &cache->entries[i];
+		if (!BarCachePolicy (e->type).persist || e->expires <= now) {
+			continue;
+		}
+		fprintf (fd, "%i %lld %zu %zu\n", e->type, (long long) e->expires,
+				strlen (e->key), strlen (e->body));
+		fputs (e->key, fd);
+		fputs (e->body, fd);
+		fputc ('\n', fd);
+	}
+	if (fclose (fd) != 0 || rename (tmpPath, path) != 0) {
+		/* keep the old file, do not leave the new one lying around */
+		debugPrint (DEBUG_NETWORK, "cannot write %s\n", path);
+		unlink (tmpPath);
+	}
+	free (tmpPath);
+	free (path);
+}
+
+void BarCacheDestroy (BarCache_t * const cache) {
+	assert (cache != NULL);
+
+	while (cache->count > 0) {
+		BarCacheRemove (cache, cache->count-1);
+	}
+	free (cache->entries);
+	cache->entries = NULL;
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <time.h>
+
+#include <piano.h>
+
+/* raw response of a read-only request */
+typedef struct {
+	PianoRequestType_t type;
+	char *key;
+	char *body;
+	time_t expires;
+} BarCacheEntry_t;
+
+typedef struct {
+	BarCacheEntry_t *entries;
+	size_t count;
+	unsigned long hits, misses;
+} BarCache_t;
+
+void BarCacheRead (BarCache_t * const, const char * const);
+void BarCacheWrite (const BarCache_t * const, const char * const);
+void BarCacheDestroy (BarCache_t * const);
+char *BarCacheGet (BarCache_t * const, const PianoRequestType_t,
+		const void * const);
+void BarCachePut (BarCache_t * const, const PianoRequestType_t,
+		const void * const, const char * const);
+void BarCacheInvalidate (BarCache_t * const, const PianoRequestType_t,
+		const void * const);
+
@@ -0,0 +1,296 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* control socket. Clients connect to a unix domain socket and exchange
+ * newline-delimited messages with pianobar. Requests are handed to a callback
+ * one line at a time, replies and notifications are queued per client, so a
+ * client that stops reading never blocks pianobar. It is dropped instead.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "control.h"
+#include "listen.h"
+#include "debug.h"
+
+/* clients with more unread output than this are disconnected */
+static const size_t outMax = 256*1024;
+
+static void BarControlInitClient (BarControlClient_t * const c) {
+	c->fd = -1;
+	c->inLen = 0;
+	c->out = NULL;
+	c->outLen = 0;
+	c->topics = 0;
+}
+
+static void BarControlDrop (BarControlClient_t * const c) {
+	if (c->fd != -1) {
+		debugPrint (DEBUG_UI, "control client %i disconnected\n", c->fd);
+		close (c->fd);
+	}
+	free (c->out);
+	BarControlInitClient (c);
+}
+
+/*	start listening at path, which is only accessible by the current user
+ */
+bool BarControlOpen (BarControl_t * const ctl, const char * const path) {
+	assert (ctl != NULL);
+
+	ctl->fd = -1;
+	ctl->path = NULL;
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		BarControlInitClient (&ctl->clients[i]);
+	}
+	memset (ctl->published, 0, sizeof (ctl->published));
+
+	if (path == NULL) {
+		return false;
+	}
+
+	const int fd = BarListenOpenUnix (path);
+	if (fd == -1) {
+		return false;
+	}
+
+	ctl->fd = fd;
+	ctl->path = strdup (path);
+	return true;
+}
+
+void BarControlClose (BarControl_t * const ctl) {
+	assert (ctl != NULL);
+
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		BarControlDrop (&ctl->clients[i]);
+	}
+	if (ctl->fd != -1) {
+		close (ctl->fd);
+		ctl->fd = -1;
+	}
+	if (ctl->path != NULL) {
+		unlink (ctl->path);
+		free (ctl->path);
+		ctl->path = NULL;
+	}
+}
+
+/*	add the sockets to select()’s sets
+ *	@return new highest fd + 1
+ */
+int BarControlFdSet (const BarControl_t * const ctl, fd_set * const rd,
+		fd_set * const wr, int maxfd) {
+	assert (ctl != NULL);
+
+	if (ctl->fd == -1) {
+		return maxfd;
+	}
+	FD_SET (ctl->fd, rd);
+	if (ctl->fd >= maxfd) {
+		maxfd = ctl->fd + 1;
+	}
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		const BarControlClient_t * const c = &ctl->clients[i];
+		if (c->fd == -1) {
+			continue;
+		}
+		FD_SET (c->fd, rd);
+		if (c->outLen > 0) {
+			FD_SET (c->fd, wr);
+		}
+		if (c->fd >= maxfd) {
+			maxfd = c->fd + 1;
+		}
+	}
+	return maxfd;
+}
+
+static void BarControlAccept (BarControl_t * const ctl) {
+	const int fd = accept (ctl->fd, NULL, NULL);
+	if (fd == -1) {
+		return;
+	}
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		BarControlClient_t * const c = &ctl->clients[i];
+		if (c->fd == -1) {
+			if (!BarListenSetFlags (fd)) {
+				break;
+			}
+			c->fd = fd;
+			debugPrint (DEBUG_UI, "control client %i connected\n", fd);
+			return;
+		}
+	}
+	/* too many clients */
+	close (fd);
+}
+
+/*	write as much queued output as the socket takes
+ */
+static void BarControlFlush (BarControlClient_t * const c) {
+	while (c->outLen > 0) {
+		const ssize_t ret = write (c->fd, c->out, c->outLen);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				BarControlDrop (c);
+			}
+			return;
+		}
+		memmove (c->out, c->out + ret, c->outLen - ret);
+		c->outLen -= ret;
+	}
+}
+
+/*	read requests and pass complete lines to handler
+ */
+static void BarControlRead (BarControl_t * const ctl,
+		BarControlClient_t * const c, BarControlRequestFunc_t handler,
+		void * const data) {
+	const ssize_t ret = read (c->fd, c->in + c->inLen,
+			sizeof (c->in) - c->inLen - 1);
+	if (ret <= 0) {
+		if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)) {
+			BarControlDrop (c);
+		}
+		return;
+	}
+	c->inLen += ret;
+	c->in[c->inLen] = '\0';
+
+	char *line = c->in, *end;
+	while ((end = strchr (line, '\n')) != NULL) {
+		*end = '\0';
+		if (end > line && end[-1] == '\r') {
+			end[-1] = '\0';
+		}
+		if (*line != '\0') {
+			handler (data, ctl, c, line);
+			if (c->fd == -1) {
+				/* dropped while handling the request */
+				return;
+			}
+		}
+		line = end + 1;
+	}
+	c->inLen -= line - c->in;
+	memmove (c->in, line, c->inLen);
+
+	if (c->inLen >= sizeof (c->in) - 1) {
+		debugPrint (DEBUG_UI, "control request too long\n");
+		BarControlDrop (c);
+	}
+}
+
+/*	handle sockets select() reported ready
+ */
+void BarControlHandle (BarControl_t * const ctl, const fd_set * const rd,
+		const fd_set * const wr, BarControlRequestFunc_t handler,
+		void * const data) {
+	assert (ctl != NULL);
+	assert (handler != NULL);
+
+	if (ctl->fd == -1) {
+		return;
+	}
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		BarControlClient_t * const c = &ctl->clients[i];
+		if (c->fd != -1 && FD_ISSET (c->fd, wr)) {
+			BarControlFlush (c);
+		}
+		if (c->fd != -1 && FD_ISSET (c->fd, rd)) {
+			BarControlRead (ctl, c, handler, data);
+		}
+	}
+	/* after the clients, so a new fd is not looked up in stale sets */
+	if (FD_ISSET (ctl->fd, rd)) {
+		BarControlAccept (ctl);
+	}
+}
+
+/*	queue line for client, a newline is appended
+ */
+void BarControlSend (BarControl_t * const ctl, BarControlClient_t * const c,
+		const char * const line) {
+	assert (ctl != NULL);
+	assert (c != NULL);
+	assert (line != NULL);
+
+	if (c->fd == -1) {
+		return;
+	}
+	const size_t len = strlen (line);
+	if (c->outLen + len + 1 > outMax) {
+		debugPrint (DEBUG_UI, "control client %i is not reading\n", c->fd);
+		BarControlDrop (c);
+		return;
+	}
+	char * const out = realloc (c->out, c->outLen + len + 1);
+	if (out == NULL) {
+		BarControlDrop (c);
+		return;
+	}
+	c->out = out;
+	memcpy (c->out + c->outLen, line, len);
+	c->out[c->outLen + len] = '\n';
+	c->outLen += len + 1;
+	BarControlFlush (c);
+}
+
+/*	send notification to all clients subscribed to topic
+ */
+void BarControlPublish (BarControl_t * const ctl,
+		const BarControlTopic_t topic, const char * const line) {
+	assert (ctl != NULL);
+
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		BarControlClient_t * const c = &ctl->clients[i];
+		if (c->fd != -1 && (c->topics & topic)) {
+			BarControlSend (ctl, c, line);
+		}
+	}
+}
+
+/*	@return true if anyone wants to know about topic
+ */
+bool BarControlSubscribed (const BarControl_t * const ctl,
+		const BarControlTopic_t topic) {
+	assert (ctl != NULL);
+
+	for (size_t i = 0; i < BAR_CONTROL_MAX_CLIENTS; i++) {
+		const BarControlClient_t * const c = &ctl->clients[i];
+		if (c->fd != -1 && (c->topics & topic)) {
+			return true;
+		}
+	}
+	return false;
+}
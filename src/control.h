@@ -0,0 +1,81 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/select.h>
+
+#include "settings.h"
+
+#define BAR_CONTROL_MAX_CLIENTS 16
+
+/* push notifications a client can subscribe to */
+typedef enum {
+	BAR_CONTROL_SONG = 1,
+	BAR_CONTROL_POSITION = 2,
+	BAR_CONTROL_BUFFER = 4,
+} BarControlTopic_t;
+
+typedef struct {
+	/* -1 if the slot is free */
+	int fd;
+	/* partial request line */
+	char in[4096];
+	size_t inLen;
+	/* replies and notifications the socket did not take yet */
+	char *out;
+	size_t outLen;
+	unsigned int topics;
+} BarControlClient_t;
+
+/* state last pushed to subscribers */
+typedef struct {
+	unsigned int played, underruns, throughput;
+} BarControlZoneState_t;
+
+typedef struct {
+	/* listening socket, -1 if disabled */
+	int fd;
+	char *path;
+	BarControlClient_t clients[BAR_CONTROL_MAX_CLIENTS];
+	BarControlZoneState_t published[BAR_MAX_ZONES];
+} BarControl_t;
+
+typedef void (*BarControlRequestFunc_t) (void *, BarControl_t *,
+		BarControlClient_t *, const char *);
+
+bool BarControlOpen (BarControl_t * const, const char * const);
+void BarControlClose (BarControl_t * const);
+int BarControlFdSet (const BarControl_t * const, fd_set * const,
+		fd_set * const, int);
+void BarControlHandle (BarControl_t * const, const fd_set * const,
+		const fd_set * const, BarControlRequestFunc_t, void *);
+void BarControlSend (BarControl_t * const, BarControlClient_t * const,
+		const char * const);
+void BarControlPublish (BarControl_t * const, const BarControlTopic_t,
+		const char * const);
+bool BarControlSubscribed (const BarControl_t * const,
+		const BarControlTopic_t);
+
@@ -0,0 +1,260 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* local index of podcast episodes. An index is valid as long as the podcast’s
+ * latest episode (station->seedId, from annotateObjects) did not change, so
+ * the full episode list is only fetched again once a new episode appears.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "episodes.h"
+#include "settings.h"
+#include "debug.h"
+
+/* bump whenever the line format changes, old indexes are discarded */
+static const char indexHeader[] = "# pianobar episodes v1\n";
+/* number of podcasts kept, the least recently updated ones are dropped */
+static const size_t indexMaxPodcasts = 32;
+/* podcastId, latestEpisodeId, trackToken, release date, length, title */
+#define INDEX_FIELDS 6
+
+static char *BarEpisodesPath (void) {
+	return BarGetXdgConfigDir (PACKAGE "/episodes");
+}
+
+/*	split line at tabs, keeping empty fields
+ *	@return number of fields found
+ */
+static size_t BarEpisodesSplit (char * const line, char **field) {
+	char *pos = line;
+	size_t n;
+	line[strcspn (line, "\n")] = '\0';
+	for (n = 0; n < INDEX_FIELDS && pos != NULL; n++) {
+		field[n] = pos;
+		if ((pos = strchr (pos, '\t')) != NULL) {
+			*pos = '\0';
+			++pos;
+		}
+	}
+	return n;
+}
+
+/*	open the index for reading, skipping the header
+ *	@return file or NULL if it is missing or outdated
+ */
+static FILE *BarEpisodesOpen (void) {
+	char * const path = BarEpisodesPath ();
+	if (path == NULL) {
+		return NULL;
+	}
+	FILE * const fd = fopen (path, "r");
+	free (path);
+	if (fd == NULL) {
+		return NULL;
+	}
+
+	char line[sizeof (indexHeader)];
+	if (fgets (line, sizeof (line), fd) == NULL ||
+			strcmp (line, indexHeader) != 0) {
+		debugPrint (DEBUG_UI, "episode index outdated, ignoring it\n");
+		fclose (fd);
+		return NULL;
+	}
+	return fd;
+}
+
+/*	get the podcast’s episodes, ordered by release date, from the index
+ *	@return episode list or NULL if the index is missing or outdated
+ */
+PianoSong_t *BarEpisodesGet (const PianoStation_t * const podcast) {
+	assert (podcast != NULL);
+
+	if (podcast->seedId == NULL) {
+		return NULL;
+	}
+
+	FILE * const fd = BarEpisodesOpen ();
+	if (fd == NULL) {
+		return NULL;
+	}
+
+	PianoSong_t *episodes = NULL;
+	char line[1024];
+	while (fgets (line, sizeof (line), fd) != NULL) {
+		char *field[INDEX_FIELDS];
+		if (BarEpisodesSplit (line, field) != INDEX_FIELDS ||
+				strcmp (field[0], podcast->id) != 0) {
+			continue;
+		}
+		if (strcmp (field[1], podcast->seedId) != 0) {
+			/* a new episode was published since */
+			debugPrint (DEBUG_UI, "episode index for %s is outdated\n",
+					podcast->id);
+			break;
+		}
+
+		PianoSong_t * const song = calloc (1, sizeof (*song));
+		if (song == NULL) {
+			break;
+		}
+		song->trackToken = strdup (field[2]);
+		/* release date, used for sorting */
+		song->fileGain = strtol (field[3], NULL, 10);
+		song->length = strtoul (field[4], NULL, 10);
+		song->title = strdup (field[5]);
+		episodes = PianoListAppendP (episodes, song);
+	}
+	fclose (fd);
+
+	return episodes;
+}
+
+/*	find episode by trackToken in list
+ */
+const PianoSong_t *BarEpisodesFind (const PianoSong_t *episodes,
+		const char * const trackToken) {
+	assert (trackToken != NULL);
+
+	PianoListForeachP (episodes) {
+		if (episodes->trackToken != NULL &&
+				strcmp (episodes->trackToken, trackToken) == 0) {
+			return episodes;
+		}
+	}
+	return NULL;
+}
+
+/*	find an episode’s title in the index
+ *	@return title, must be freed, or NULL
+ */
+char *BarEpisodesTitle (const PianoStation_t * const podcast,
+		const char * const trackToken) {
+	PianoSong_t * const episodes = BarEpisodesGet (podcast);
+	const PianoSong_t * const song = BarEpisodesFind (episodes, trackToken);
+	char * const title = song != NULL ? strdup (song->title) : NULL;
+	PianoDestroyPlaylist (episodes);
+	return title;
+}
+
+/*	write a field, tabs and newlines would break the line format
+ */
+static void BarEpisodesPutField (FILE * const fd, const char * const s,
+		const char sep) {
+	if (s != NULL) {
+		for (const char *c = s; *c != '\0'; c++) {
+			fputc ((*c == '\t' || *c == '\n') ? ' ' : *c, fd);
+		}
+	}
+	fputc (sep, fd);
+}
+
+/*	replace the podcast’s index with episodes
+ */
+void BarEpisodesPut (const PianoStation_t * const podcast,
+		const PianoSong_t *episodes) {
+	assert (podcast != NULL);
+
+	if (podcast->seedId == NULL) {
+		/* nothing to validate the index against later */
+		return;
+	}
+
+	char * const path = BarEpisodesPath ();
+	if (path == NULL) {
+		return;
+	}
+	const size_t tmpLen = strlen (path) + 5;
+	char * const tmpPath = malloc (tmpLen);
+	if (tmpPath == NULL) {
+		free (path);
+		return;
+	}
+	snprintf (tmpPath, tmpLen, "%s.new", path);
+
+	const int tmpFd = open (tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE * const out = tmpFd != -1 ? fdopen (tmpFd, "w") : NULL;
+	if (out == NULL) {
+		if (tmpFd != -1) {
+			close (tmpFd);
+			unlink (tmpPath);
+		}
+		free (tmpPath);
+		free (path);
+		return;
+	}
+	fputs (indexHeader, out);
+
+	/* this podcast goes first */
+	const PianoSong_t *song = episodes;
+	PianoListForeachP (song) {
+		if (song->trackToken == NULL || song->title == NULL) {
+			continue;
+		}
+		BarEpisodesPutField (out, podcast->id, '\t');
+		BarEpisodesPutField (out, podcast->seedId, '\t');
+		BarEpisodesPutField (out, song->trackToken, '\t');
+		fprintf (out, "%ld\t%u\t", (long int) song->fileGain, song->length);
+		BarEpisodesPutField (out, song->title, '\n');
+	}
+
+	/* then the others, up to indexMaxPodcasts */
+	FILE * const in = BarEpisodesOpen ();
+	if (in != NULL) {
+		size_t podcasts = 1;
+		char last[256] = "";
+		char line[1024];
+		while (fgets (line, sizeof (line), in) != NULL) {
+			char copy[sizeof (line)];
+			char *field[INDEX_FIELDS];
+			strcpy (copy, line);
+			if (BarEpisodesSplit (copy, field) != INDEX_FIELDS ||
+					strcmp (field[0], podcast->id) == 0) {
+				continue;
+			}
+			if (strcmp (field[0], last) != 0) {
+				if (++podcasts > indexMaxPodcasts) {
+					break;
+				}
+				snprintf (last, sizeof (last), "%s", field[0]);
+			}
+			fputs (line, out);
+		}
+		fclose (in);
+	}
+
+	/* a short write would replace the index with a truncated one */
+	if (fclose (out) != 0 || rename (tmpPath, path) != 0) {
+		debugPrint (DEBUG_UI, "cannot write episode index %s\n", path);
+		unlink (tmpPath);
+	}
+	free (tmpPath);
+	free (path);
+}
@@ -71,28 +71,32 @@ char *PianoDecryptString (gcry_cipher_hd_t h, const char * const input,
  *	@return encrypted, hex-encoded string
  */
 char *PianoEncryptString (gcry_cipher_hd_t h, const char *s) {
-	unsigned char *paddedInput, *hexOutput;
-	size_t inputLen = strlen (s);
+	static const char hex[] = "0123456789abcdef";
+	const size_t inputLen = strlen (s);
 	/* blowfish expects two 32 bit blocks */
-	size_t paddedInputLen = (inputLen % 8 == 0) ? inputLen : inputLen + (8-inputLen%8);
-	gcry_error_t gret;
-
-	paddedInput = calloc (paddedInputLen+1, sizeof (*paddedInput));
-	memcpy (paddedInput, s, inputLen);
+	const size_t paddedInputLen = (inputLen % 8 == 0) ? inputLen : inputLen + (8-inputLen%8);
 
-	gret = gcry_cipher_encrypt (h, paddedInput, paddedInputLen, NULL, 0);
-	if (gret) {
-		free (paddedInput);
+	/* encrypt in place at the start of the output buffer, then hex-encode
+	 * back to front, so every byte is read before it is overwritten */
+	unsigned char * const output = malloc (paddedInputLen*2+1);
+	if (output == NULL) {
 		return NULL;
 	}
+	memcpy (output, s, inputLen);
+	memset (output + inputLen, 0, paddedInputLen - inputLen);
 
-	hexOutput = calloc (paddedInputLen*2+1, sizeof (*hexOutput));
-	for (size_t i = 0; i < paddedInputLen; i++) {
-		snprintf ((char * restrict) &hexOutput[i*2], 3, "%02x", paddedInput[i]);
+	if (gcry_cipher_encrypt (h, output, paddedInputLen, NULL, 0)) {
+		free (output);
+		return NULL;
 	}
 
-	free (paddedInput);
+	output[paddedInputLen*2] = '\0';
+	for (size_t i = paddedInputLen; i > 0; i--) {
+		const unsigned char c = output[i-1];
+		output[(i-1)*2] = hex[c >> 4];
+		output[(i-1)*2+1] = hex[c & 0xf];
+	}
 
-	return (char *) hexOutput;
+	return (char *) output;
 }
 
@@ -4,27 +4,32 @@
 
 #include "debug_log.h"
 
-static ErrMsgCallback_t gPianoPrintErrMsgCB;
-
-void PianoRegisterErrMsgCallback(ErrMsgCallback_t Arg)
+/*	send error messages of this handle to callback instead of stdout
+ *	@param callback, NULL restores the default
+ *	@param passed to callback
+ */
+void PianoSetErrMsgCallback (PianoHandle_t *ph, PianoErrMsgCallback_t cb,
+		void *data)
 {
-   gPianoPrintErrMsgCB = Arg;
+   assert (ph != NULL);
+
+   ph->errMsg = cb;
+   ph->errMsgData = data;
 }
 
-void PianoPrintErrMsg(const char *format, ...)
+void PianoPrintErrMsg(const PianoHandle_t *ph, const char *format, ...)
 {
    va_list fmtargs;
 
+   assert (ph != NULL);
    assert (format != NULL);
    va_start (fmtargs, format);
 
-   if(gPianoPrintErrMsgCB != NULL) {
-      gPianoPrintErrMsgCB(format,fmtargs);
+   if(ph->errMsg != NULL) {
+      ph->errMsg(ph->errMsgData,format,fmtargs);
    }
    else {
-      va_start (fmtargs, format);
       vprintf (format, fmtargs);
-      va_end (fmtargs);
    }
+   va_end (fmtargs);
 }
-
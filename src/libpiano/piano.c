@@ -136,6 +136,9 @@ void PianoDestroyPlaylist (PianoSong_t *playlist) {
 		free (curSong->seedId);
 		free (curSong->detailUrl);
 		free (curSong->trackToken);
+		for (size_t i = 0; i < PIANO_AQ_LAST; i++) {
+			free (curSong->audioUrls[i]);
+		}
 		lastSong = curSong;
 		curSong = (PianoSong_t *) curSong->head.next;
 		free (lastSong);
@@ -169,6 +172,9 @@ static void PianoDestroyGenres (PianoGenre_t *genres) {
 void PianoDestroyUserInfo (PianoUserInfo_t *user) {
 	free (user->authToken);
 	free (user->listenerId);
+	free (user->urlParams);
+	/* rebuilt from the new token after reauthentication */
+	user->urlParams = NULL;
 }
 
 /*	destroy partner
@@ -247,6 +253,31 @@ PianoStation_t *PianoFindStationById (PianoStation_t * const stations,
 	return NULL;
 }
 
+/*	select one of the song’s audio qualities for playback
+ *	@param song
+ *	@param quality
+ *	@return _RET_OK or _RET_QUALITY_UNAVAILABLE if the song does not offer it
+ */
+PianoReturn_t PianoSongSetQuality (PianoSong_t * const song,
+		const PianoAudioQuality_t quality) {
+	assert (song != NULL);
+	assert (quality < PIANO_AQ_LAST);
+
+	if (song->audioUrls[quality] == NULL) {
+		return PIANO_RET_QUALITY_UNAVAILABLE;
+	}
+
+	char * const url = strdup (song->audioUrls[quality]);
+	if (url == NULL) {
+		return PIANO_RET_OUT_OF_MEMORY;
+	}
+	free (song->audioUrl);
+	song->audioUrl = url;
+	song->audioFormat = song->audioFormats[quality];
+
+	return PIANO_RET_OK;
+}
+
 /*	convert return value to human-readable string
  *	@param enum
  *	@return error string
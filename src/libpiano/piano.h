@@ -26,6 +26,8 @@ THE SOFTWARE.
 #include "../config.h"
 
 #include <stdbool.h>
+#include <stdarg.h>
+#include <time.h>
 #ifdef __FreeBSD__
 #define _GCRYPT_IN_LIBGCRYPT
 #endif
@@ -50,6 +52,8 @@ typedef struct PianoListHead {
 typedef struct PianoUserInfo {
 	char *listenerId;
 	char *authToken;
+	/* url-encoded authentication parameters, derived from the above */
+	char *urlParams;
 	bool IsSubscriber;
 	bool IsPremiumUser;
 	int PlayListCount;
@@ -96,6 +100,7 @@ typedef enum {
 	PIANO_AQ_LOW = 1,
 	PIANO_AQ_MEDIUM = 2,
 	PIANO_AQ_HIGH = 3,
+	PIANO_AQ_LAST,
 } PianoAudioQuality_t;
 
 typedef struct PianoSong {
@@ -115,6 +120,11 @@ typedef struct PianoSong {
 	unsigned int length; /* song length in seconds */
 	PianoSongRating_t rating;
 	PianoAudioFormat_t audioFormat;
+	/* every quality offered, audioUrl/audioFormat is the selected one */
+	char *audioUrls[PIANO_AQ_LAST];
+	PianoAudioFormat_t audioFormats[PIANO_AQ_LAST];
+	/* when playback info was retrieved, 0 if it came with the playlist */
+	time_t audioUrlTime;
 } PianoSong_t;
 
 typedef struct PianoStation {
@@ -133,6 +143,8 @@ typedef struct {
 	PianoStation_t *station;
 	PianoSong_t *playList;
 	bool bGetAll;
+	/* number of latest episodes to look at, 0 for the default */
+	unsigned int limit;
 } PianoRequestDataGetEpisodes_t;
 
 /* currently only used for search results */
@@ -162,6 +174,17 @@ typedef struct PianoPartner {
 	unsigned int id;
 } PianoPartner_t;
 
+/* receives error messages, with the data passed to PianoSetErrMsgCallback */
+typedef void (*PianoErrMsgCallback_t) (void *, const char *, va_list);
+
+/* libpiano keeps no global state, all of it lives in the handle. Different
+ * handles can be used from different threads at the same time. A single
+ * handle is not locked internally: PianoRequest caches login parameters and
+ * PianoResponse replaces the station list and genre cache, so callers must
+ * not use one handle from several threads at once, and must not read
+ * stations or genreStations while a request on that handle is parsed.
+ * libgcrypt has to be initialized (gcry_check_version) before threads
+ * are started. */
 typedef struct PianoHandle {
 	PianoUserInfo_t user;
 	/* linked lists */
@@ -169,6 +192,8 @@ typedef struct PianoHandle {
 	PianoGenreCategory_t *genreStations;
 	PianoPartner_t partner;
 	int timeOffset;
+	PianoErrMsgCallback_t errMsg;
+	void *errMsgData;
 } PianoHandle_t;
 
 typedef struct PianoSearchResult {
@@ -326,6 +351,24 @@ typedef struct {
 	unsigned int id;
 } PianoRequestDataSetStationMode_t;
 
+typedef struct {
+	/* items per page */
+	unsigned int limit;
+	/* next page, NULL for the first one */
+	char *cursor;
+	/* set once the last page has been received */
+	bool done;
+} PianoRequestDataGetItems_t;
+
+typedef struct {
+	/* first station to look at, NULL for all of them */
+	PianoStation_t *start;
+	/* unnamed ids per request */
+	unsigned int limit;
+	/* where the next batch starts, NULL once all stations were covered */
+	PianoStation_t *next;
+} PianoRequestDataAnnotateObjects_t;
+
 /* pandora error code offset */
 #define PIANO_RET_OFFSET 1024
 typedef enum {
@@ -426,5 +469,7 @@ void PianoDestroyRequest (PianoRequest_t *);
 /* misc */
 PianoStation_t *PianoFindStationById (PianoStation_t * const,
 		const char * const);
+PianoReturn_t PianoSongSetQuality (PianoSong_t * const,
+		const PianoAudioQuality_t);
 const char *PianoErrorToStr (PianoReturn_t);
 
@@ -23,16 +23,62 @@ THE SOFTWARE.
 
 #include "../config.h"
 
-#include <curl/curl.h>
 #include <json.h>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "piano.h"
 #include "piano_private.h"
 #include "crypt.h"
-#include "debug.h"
+
+/*	percent-encode everything but unreserved characters (RFC 3986)
+ *	@return encoded string, must be freed, or NULL
+ */
+static char *PianoUrlEncode (const char * const s) {
+	static const char hex[] = "0123456789ABCDEF";
+	char * const out = malloc (strlen (s) * 3 + 1);
+	if (out == NULL) {
+		return NULL;
+	}
+	char *o = out;
+	for (const unsigned char *c = (const unsigned char *) s; *c != '\0'; c++) {
+		if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+				(*c >= '0' && *c <= '9') || *c == '-' || *c == '.' ||
+				*c == '_' || *c == '~') {
+			*o++ = *c;
+		} else {
+			*o++ = '%';
+			*o++ = hex[*c >> 4];
+			*o++ = hex[*c & 0xf];
+		}
+	}
+	*o = '\0';
+	return out;
+}
+
+/*	url parameters shared by all authenticated requests, built once per login
+ *	@return parameters or NULL
+ */
+static const char *PianoUserUrlParams (PianoHandle_t * const ph) {
+	if (ph->user.urlParams == NULL) {
+		char * const urlencAuthToken = PianoUrlEncode (ph->user.authToken);
+		if (urlencAuthToken == NULL) {
+			return NULL;
+		}
+		const int len = snprintf (NULL, 0, "auth_token=%s&partner_id=%i&"
+				"user_id=%s", urlencAuthToken, ph->partner.id,
+				ph->user.listenerId);
+		if (len >= 0 && (ph->user.urlParams = malloc (len + 1)) != NULL) {
+			snprintf (ph->user.urlParams, len + 1, "auth_token=%s&"
+					"partner_id=%i&user_id=%s", urlencAuthToken, ph->partner.id,
+					ph->user.listenerId);
+		}
+		free (urlencAuthToken);
+	}
+	return ph->user.urlParams;
+}
 
 /*	prepare piano request (initializes request type, urlpath and postData)
  *	@param piano handle
@@ -100,16 +146,16 @@ PianoReturn_t PianoRequest (PianoHandle_t *ph, PianoRequest_t *req,
 					json_object_object_add (j, "returnIsSubscriber",
 					json_object_new_boolean (true));
 
-					CURL * const curl = curl_easy_init ();
-					urlencAuthToken = curl_easy_escape (curl,
-							ph->partner.authToken, 0);
-					assert (urlencAuthToken != NULL);
+					if ((urlencAuthToken = PianoUrlEncode (
+							ph->partner.authToken)) == NULL) {
+						ret = PIANO_RET_OUT_OF_MEMORY;
+						goto cleanup;
+					}
 					snprintf (req->urlPath, sizeof (req->urlPath),
 							PIANO_RPC_PATH "method=auth.userLogin&"
 							"auth_token=%s&partner_id=%i", urlencAuthToken,
 							ph->partner.id);
-					curl_free (urlencAuthToken);
-					curl_easy_cleanup (curl);
+					free (urlencAuthToken);
 
 					break;
 				}
@@ -591,26 +637,50 @@ PianoReturn_t PianoRequest (PianoHandle_t *ph, PianoRequest_t *req,
 		}
 
 		case PIANO_REQUEST_GET_ITEMS: {
+			PianoRequestDataGetItems_t *reqData = req->data;
+
+			assert (reqData != NULL);
+			assert (!reqData->done);
+
 			req->secure = true;
 
 			json_object *a = json_object_new_object ();
 			json_object_object_add(j,"request",a);
-	#if 0
-	// test ability to continue after hitting limit
-			json_object_object_add(a,"limit",json_object_new_int(4));
-			json_object_object_add(a,"cursor",json_object_new_string("g6FjzwAFdTr1OqMYoXbAoXSWokFSolRSolBMolBDokFMolBF"));
-	#endif
+			if (reqData->limit > 0) {
+				json_object_object_add(a,"limit",
+						json_object_new_int(reqData->limit));
+			}
+			if (reqData->cursor != NULL) {
+				json_object_object_add(a,"cursor",
+						json_object_new_string(reqData->cursor));
+			}
 			json_object_object_add(j,"deviceId",json_object_new_string("1880"));
 			method = "collections.v7.getItems";
 			break;
 		}
 
 		case PIANO_REQUEST_ANNOTATE_OBJECTS: {
-			json_object *a = json_object_new_array();
+			PianoRequestDataAnnotateObjects_t *reqData = req->data;
+			assert (reqData != NULL);
+
+			/* start is not dereferenced before it was found, the request may
+			 * be repeated after it was removed from the list */
 			PianoStation_t *station = ph->stations;
+			while (reqData->start != NULL && station != NULL &&
+					station != reqData->start) {
+				station = (PianoStation_t *) station->head.next;
+			}
+			if (station == NULL) {
+				ret = PIANO_RET_ERR;
+				goto cleanup;
+			}
+
+			json_object *a = json_object_new_array();
+			unsigned int count = 0;
 			req->secure = true;
 
-			while(station != NULL) {
+			while(station != NULL &&
+					(reqData->limit == 0 || count < reqData->limit)) {
 				assert(station->id != NULL);
 				if(station->name == NULL) {
 					switch(station->stationType) {
@@ -618,11 +688,13 @@ PianoReturn_t PianoRequest (PianoHandle_t *ph, PianoRequest_t *req,
 						case PIANO_TYPE_ALBUM:
 						case PIANO_TYPE_TRACK:
 							json_object_array_add(a,json_object_new_string(station->id));
+							++count;
 							break;
 					}
 				}
 				station = (PianoStation_t *) station->head.next;
 			}
+			reqData->next = station;
 			json_object_object_add(j,"pandoraIds",a);
 			json_object_object_add(j,"annotateAlbumTracks",
 										  json_object_new_boolean(false));
@@ -649,7 +721,8 @@ PianoReturn_t PianoRequest (PianoHandle_t *ph, PianoRequest_t *req,
 			assert (station != NULL);
 
 			req->secure = true;
-			json_object_object_add(j,"annotationLimit",json_object_new_int(20));
+			json_object_object_add(j,"annotationLimit",json_object_new_int(
+					reqData->limit > 0 ? reqData->limit : 20));
 			json_object_object_add(j,"catalogVersion",json_object_new_int(4));
 			json_object_object_add(j,"pandoraId",json_object_new_string(station->id));
 			json_object_object_add(j,"sortingOrder",json_object_new_string(""));
@@ -659,21 +732,15 @@ PianoReturn_t PianoRequest (PianoHandle_t *ph, PianoRequest_t *req,
 	}
 	/* standard parameter */
 	if (method != NULL) {
-		char *urlencAuthToken;
-
 		assert (ph->user.authToken != NULL);
 
-		CURL * const curl = curl_easy_init ();
-		urlencAuthToken = curl_easy_escape (curl,
-				ph->user.authToken, 0);
-		assert (urlencAuthToken != NULL);
-
+		const char * const urlParams = PianoUserUrlParams (ph);
+		if (urlParams == NULL) {
+			ret = PIANO_RET_OUT_OF_MEMORY;
+			goto cleanup;
+		}
 		snprintf (req->urlPath, sizeof (req->urlPath), PIANO_RPC_PATH
-				"method=%s&auth_token=%s&partner_id=%i&user_id=%s", method,
-				urlencAuthToken, ph->partner.id, ph->user.listenerId);
-
-		curl_free (urlencAuthToken);
-		curl_easy_cleanup (curl);
+				"method=%s&%s", method, urlParams);
 
 		json_object_object_add (j, "userAuthToken",
 				json_object_new_string (ph->user.authToken));
@@ -681,8 +748,12 @@ PianoReturn_t PianoRequest (PianoHandle_t *ph, PianoRequest_t *req,
 				json_object_new_int (timestamp));
 	}
 
-	/* json to string */
-	jsonSendBuf = json_object_to_json_string (j);
+	/* json to string, without pretty-printing whitespace. The tree is cheap
+	 * enough: for a playlist request it costs 17 allocations and about as
+	 * much cpu time as encrypting the result, parsing the response costs
+	 * some 30 times more. A hand-written writer is not worth it, see
+	 * test/piano_bench.c (make bench). */
+	jsonSendBuf = json_object_to_json_string_ext (j, JSON_C_TO_STRING_PLAIN);
 	if (encrypted) {
 		if ((req->postData = PianoEncryptString (ph->partner.out,
 				jsonSendBuf)) == NULL) {
@@ -33,15 +33,15 @@ THE SOFTWARE.
 #include "piano_private.h"
 #include "crypt.h"
 
-static const char *qualityMap[] = {
+static const char * const qualityMap[] = {
 	"", "lowQuality", "mediumQuality","highQuality"
 };
 
-static const char *formatMap[] = {
+static const char * const formatMap[] = {
 	"", "aacplus", "mp3"
 };
 
-static const char *imageHost = "https://content-images.p-cdn.com/";
+static const char * const imageHost = "https://content-images.p-cdn.com/";
 static char *PianoJsonStrdup (json_object *j, const char *key) {
 	assert (j != NULL);
 	assert (key != NULL);
@@ -54,6 +54,35 @@ static char *PianoJsonStrdup (json_object *j, const char *key) {
 	}
 }
 
+/*	store url and format of every quality in audioUrlMap
+ */
+static void PianoJsonAudioUrlMap (json_object * const umap,
+		PianoSong_t * const song) {
+	assert (umap != NULL);
+	assert (song != NULL);
+	assert (sizeof (qualityMap)/sizeof (*qualityMap) == PIANO_AQ_LAST);
+
+	for (size_t q = PIANO_AQ_LOW; q < PIANO_AQ_LAST; q++) {
+		json_object *qmap, *jsonEncoding;
+		if (!json_object_object_get_ex (umap, qualityMap[q], &qmap)) {
+			continue;
+		}
+		assert (qmap != NULL);
+		if (json_object_object_get_ex (qmap, "encoding", &jsonEncoding)) {
+			const char *encoding = json_object_get_string (jsonEncoding);
+			assert (encoding != NULL);
+			for (size_t k = 0; k < sizeof (formatMap)/sizeof (*formatMap); k++) {
+				if (strcmp (formatMap[k], encoding) == 0) {
+					song->audioFormats[q] = k;
+					break;
+				}
+			}
+		}
+		free (song->audioUrls[q]);
+		song->audioUrls[q] = PianoJsonStrdup (qmap, "audioUrl");
+	}
+}
+
 static bool getBoolDefault (json_object * const j, const char * const key, const bool def) {
 	assert (j != NULL);
 	assert (key != NULL);
@@ -511,32 +540,18 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 					continue;
 				}
 
-				/* get audio url based on selected quality */
-				static const char *qualityMap[] = {"", "lowQuality", "mediumQuality",
-						"highQuality"};
-				assert (reqData->quality < sizeof (qualityMap)/sizeof (*qualityMap));
-				static const char *formatMap[] = {"", "aacplus", "mp3"};
+				/* keep all qualities, select the requested one */
+				assert (reqData->quality < PIANO_AQ_LAST);
 
 				json_object *umap;
 				if (json_object_object_get_ex (s, "audioUrlMap", &umap)) {
 					assert (umap != NULL);
-					json_object *jsonEncoding, *qmap;
-					if (json_object_object_get_ex (umap, qualityMap[reqData->quality], &qmap) &&
-							json_object_object_get_ex (qmap, "encoding", &jsonEncoding)) {
-						assert (qmap != NULL);
-						const char *encoding = json_object_get_string (jsonEncoding);
-						assert (encoding != NULL);
-						for (size_t k = 0; k < sizeof (formatMap)/sizeof (*formatMap); k++) {
-							if (strcmp (formatMap[k], encoding) == 0) {
-								song->audioFormat = k;
-								break;
-							}
-						}
-						song->audioUrl = PianoJsonStrdup (qmap, "audioUrl");
-					} else {
+					PianoJsonAudioUrlMap (umap, song);
+					if (PianoSongSetQuality (song, reqData->quality) !=
+							PIANO_RET_OK) {
 						/* requested quality is not available */
 						ret = PIANO_RET_QUALITY_UNAVAILABLE;
-						free (song);
+						PianoDestroyPlaylist (song);
 						PianoDestroyPlaylist (playlist);
 						goto cleanup;
 					}
@@ -972,30 +987,16 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 			assert (audioUrlMap != NULL);
 
 			const char *quality = qualityMap[reqData->quality];
-			json_object *umap;
-
-			json_object *jsonEncoding = NULL;
-			if (json_object_object_get_ex (audioUrlMap, quality, &umap)) {
-				assert (umap != NULL);
-				if (json_object_object_get_ex (umap, "encoding", &jsonEncoding)) {
-					assert (jsonEncoding != NULL);
-					const char *encoding = json_object_get_string (jsonEncoding);
-					assert (encoding != NULL);
-					for (size_t k = 0; k < sizeof (formatMap)/sizeof (*formatMap); k++) {
-						if (strcmp (formatMap[k], encoding) == 0) {
-							song->audioFormat = k;
-							break;
-						}
-					}
-					song->audioUrl = PianoJsonStrdup (umap, "audioUrl");
-				}
-			}
+
+			PianoJsonAudioUrlMap (audioUrlMap, song);
+			PianoSongSetQuality (song, reqData->quality);
+			song->audioUrlTime = time (NULL);
 
 			if(song->audioUrl == NULL) {
-			/* requested quality is not available */
+			/* requested quality is not available. The song is part of the
+			 * caller’s playlist, leave it alone. */
 				LOG("quality %s not found in audioUrlMap\n",quality);
 				ret = PIANO_RET_QUALITY_UNAVAILABLE;
-				PianoDestroyPlaylist (reqData->retPlaylist);
 				goto cleanup;
 			}
 			break;
@@ -1047,12 +1048,24 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 		}
 
 		case PIANO_REQUEST_GET_ITEMS: {
+			PianoRequestDataGetItems_t *reqData = req->data;
+
 			assert (req->responseData != NULL);
+			assert (reqData != NULL);
+
+			/* a cursor is returned as long as there are more pages */
+			free (reqData->cursor);
+			const char * const cursor = PianoJsonGetStr (result, "cursor");
+			reqData->cursor = cursor != NULL ? strdup (cursor) : NULL;
 			json_object *items = NULL;
-			if (!json_object_object_get_ex (result, "items", &items)) {
+			if (!json_object_object_get_ex (result, "items", &items) ||
+					json_object_array_length (items) == 0 ||
+					reqData->cursor == NULL || reqData->cursor[0] == '\0') {
+				reqData->done = true;
+			}
+			if (items == NULL) {
 				break;
 			}
-			assert (items != NULL);
 			for (int i = 0; i < json_object_array_length (items); i++) {
 				json_object *s = json_object_array_get_idx (items, i);
 				const char *type = PianoJsonGetStr(s,"pandoraType");
@@ -1100,81 +1113,68 @@ PianoReturn_t PianoResponse (PianoHandle_t *ph, PianoRequest_t *req) {
 		case PIANO_REQUEST_ANNOTATE_OBJECTS: {
 			assert (req->responseData != NULL);
 			assert (req->data != NULL);
-			PianoStation_t *station = ph->stations;
-			PianoRequestDataGetPlaylist_t *reqData = req->data;
 
-			while(station != NULL) {
-				assert(station->id != NULL);
+			/* the station list may have changed while the request was
+			 * running, look up every answer by id instead of walking the
+			 * batch */
+			if (result == NULL || ph->stations == NULL) {
+				break;
+			}
+			json_object_object_foreach(result,Key,Val) {
+				PianoStation_t * const station = PianoFindStationById (
+						ph->stations, Key);
+				if (station == NULL || station->name != NULL) {
+					LOG("station %s is gone or named already\n",Key);
+					continue;
+				}
 				switch(station->stationType) {
 					case PIANO_TYPE_PODCAST: {
-						json_object_object_foreach(result,Key,Val) {
-							if(strcmp(Key,station->id) == 0) {
-								PianoSong_t *song = station->theSong;
-								assert (song == NULL);
-								if ((song = calloc (1, sizeof (*song))) == NULL) {
-									return PIANO_RET_OUT_OF_MEMORY;
-								}
-								station->name = PianoJsonStrdup(Val,"name");
-								station->seedId = PianoJsonStrdup(Val,"latestEpisodeId");
-								station->theSong = song;
-								song->album = strdup(station->name);
-								song->coverArt = getCoverArt(Val);  // podcast coverArt
-								LOG("podcast coverart %s\n",song->coverArt);
-								break;
-							}
-						}
-						if(station->name == NULL) {
-							LOG("Couldn't find station %s\n",station->id);
+						PianoSong_t *song = station->theSong;
+						assert (song == NULL);
+						if ((song = calloc (1, sizeof (*song))) == NULL) {
+							return PIANO_RET_OUT_OF_MEMORY;
 						}
+						station->name = PianoJsonStrdup(Val,"name");
+						station->seedId = PianoJsonStrdup(Val,"latestEpisodeId");
+						station->theSong = song;
+						song->album = strdup(station->name);
+						song->coverArt = getCoverArt(Val);  // podcast coverArt
+						LOG("podcast coverart %s\n",song->coverArt);
 						break;
 					}
 
 					case PIANO_TYPE_ALBUM: {
-						json_object_object_foreach(result,Key,Val) {
-							if(strcmp(Key,station->id) == 0) {
-								char Temp[120];
-								snprintf(Temp,sizeof(Temp),"%s - %s",
-											PianoJsonGetStr(Val,"artistName"),
-											PianoJsonGetStr(Val,"name"));
-								station->name = strdup(Temp);
-								station->seedId = PianoJsonStrdup(Val,"pandoraId");
-								break;
-							}
-						}
-						if(station->name == NULL) {
-							LOG("Couldn't find station %s\n",station->id);
-						}
+						char Temp[120];
+						snprintf(Temp,sizeof(Temp),"%s - %s",
+									PianoJsonGetStr(Val,"artistName"),
+									PianoJsonGetStr(Val,"name"));
+						station->name = strdup(Temp);
+						station->seedId = PianoJsonStrdup(Val,"pandoraId");
 						break;
 					}
 
 					case PIANO_TYPE_TRACK: {
-						json_object_object_foreach(result,Key,Val) {
-							if(strcmp(Key,station->id) == 0) {
-								station->name = PianoJsonStrdup(Val,"name");
-								station->seedId = PianoJsonStrdup(Val,"albumId");
-
-								PianoSong_t *song = station->theSong;
-								assert (song == NULL);
-								if ((song = calloc (1, sizeof (*song))) == NULL) {
-									return PIANO_RET_OUT_OF_MEMORY;
-								}
-								station->theSong = song;
-								song->artist = PianoJsonStrdup(Val, "artistName");
-								song->album = PianoJsonStrdup(Val, "albumName");
-								song->title = PianoJsonStrdup(Val, "name");
-								song->length = getInt(Val, "duration");
-								song->coverArt = getCoverArt(Val);
-								song->fileGain = 0.0;
-								break;
-							}
-						}
-						if(station->name == NULL) {
-							LOG("Couldn't find station %s\n",station->id);
+						station->name = PianoJsonStrdup(Val,"name");
+						station->seedId = PianoJsonStrdup(Val,"albumId");
+
+						PianoSong_t *song = station->theSong;
+						assert (song == NULL);
+						if ((song = calloc (1, sizeof (*song))) == NULL) {
+							return PIANO_RET_OUT_OF_MEMORY;
 						}
+						station->theSong = song;
+						song->artist = PianoJsonStrdup(Val, "artistName");
+						song->album = PianoJsonStrdup(Val, "albumName");
+						song->title = PianoJsonStrdup(Val, "name");
+						song->length = getInt(Val, "duration");
+						song->coverArt = getCoverArt(Val);
+						song->fileGain = 0.0;
 						break;
 					}
+
+					default:
+						break;
 				}
-				station = (PianoStation_t *) station->head.next;
 			}
 			break;
 		}
@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* listening sockets shared by the servers in pianobar. An address is either
+ * an absolute path for a unix domain socket or host:port for tcp.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "listen.h"
+
+/*	make fd non-blocking and keep it out of eventcmd children
+ */
+bool BarListenSetFlags (const int fd) {
+	const int fl = fcntl (fd, F_GETFL);
+	return fl != -1 && fcntl (fd, F_SETFL, fl | O_NONBLOCK) != -1 &&
+			fcntl (fd, F_SETFD, FD_CLOEXEC) != -1;
+}
+
+/*	listen on unix domain socket path, which is only accessible by the
+ *	current user
+ */
+static int BarListenUnix (const char * const path) {
+	struct sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen (path) >= sizeof (addr.sun_path)) {
+		return -1;
+	}
+	strcpy (addr.sun_path, path);
+
+	/* a socket left behind by a crashed instance */
+	struct stat st;
+	if (lstat (path, &st) == 0 && S_ISSOCK (st.st_mode)) {
+		const int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+		if (fd == -1) {
+			return -1;
+		}
+		const bool alive = connect (fd, (const struct sockaddr *) &addr,
+				sizeof (addr)) == 0;
+		close (fd);
+		if (alive) {
+			return -1;
+		}
+		unlink (path);
+	}
+
+	const int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	const mode_t oldMask = umask (077);
+	const int ret = bind (fd, (const struct sockaddr *) &addr, sizeof (addr));
+	umask (oldMask);
+	if (ret != 0) {
+		close (fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*	listen on host:port, host may be an ipv6 address in brackets
+ */
+static int BarListenTcp (const char * const listenAddr) {
+	char host[256];
+	const char * const colon = strrchr (listenAddr, ':');
+	if (colon == NULL || (size_t) (colon - listenAddr) >= sizeof (host)) {
+		return -1;
+	}
+	const char *hostStart = listenAddr;
+	size_t hostLen = colon - listenAddr;
+	if (hostLen >= 2 && hostStart[0] == '[' && hostStart[hostLen-1] == ']') {
+		++hostStart;
+		hostLen -= 2;
+	}
+	memcpy (host, hostStart, hostLen);
+	host[hostLen] = '\0';
+
+	struct addrinfo hints, *res;
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo (hostLen > 0 ? host : NULL, colon + 1, &hints, &res) != 0) {
+		return -1;
+	}
+
+	int fd = -1;
+	for (const struct addrinfo *ai = res; ai != NULL && fd == -1;
+			ai = ai->ai_next) {
+		fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd == -1) {
+			continue;
+		}
+		const int one = 1;
+		setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+		if (bind (fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+			close (fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo (res);
+	return fd;
+}
+
+/*	listen on a socket bound to path, or tcp if path is NULL
+ *	@return fd or -1, fd is closed on failure
+ */
+static int BarListenStart (const int fd, const char * const path) {
+	if (fd == -1) {
+		return -1;
+	}
+	if (listen (fd, 8) != 0 || !BarListenSetFlags (fd)) {
+		close (fd);
+		if (path != NULL) {
+			unlink (path);
+		}
+		return -1;
+	}
+	return fd;
+}
+
+/*	start listening on unix domain socket path, even if it is relative
+ *	@return non-blocking socket or -1
+ */
+int BarListenOpenUnix (const char * const path) {
+	return BarListenStart (BarListenUnix (path), path);
+}
+
+/*	start listening at addr
+ *	@return non-blocking socket or -1
+ */
+int BarListenOpen (const char * const addr) {
+	if (addr[0] == '/') {
+		return BarListenOpenUnix (addr);
+	}
+	return BarListenStart (BarListenTcp (addr), NULL);
+}
@@ -46,6 +46,7 @@ THE SOFTWARE.
 /* waitpid () */
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 
 /* pandora.com library */
 #include <piano.h>
@@ -54,9 +55,12 @@ THE SOFTWARE.
 #include "debug.h"
 #include "terminal.h"
 #include "ui.h"
+#include "ui_control.h"
 #include "ui_dispatch.h"
 #include "ui_readline.h"
 #include "debug_log.h"
+#include "episodes.h"
+#include "trace.h"
 
 /*	authenticate user
  */
@@ -72,7 +76,7 @@ static bool BarMainLoginUser (BarApp_t *app) {
 
 	BarUiMsg (&app->settings, MSG_INFO, "Login... ");
 	ret = BarUiPianoCall (app, PIANO_REQUEST_LOGIN, &reqData, &pRet, &wRet);
-	BarUiStartEventCmd (&app->settings, "userlogin", NULL, NULL, &app->player,
+	BarUiStartEventCmd (&app->settings, "userlogin", NULL, NULL, &app->zone->player,
 			NULL, pRet, wRet);
 
 	return ret;
@@ -174,7 +178,7 @@ static bool BarMainGetStations (BarApp_t *app) {
 
 	BarUiMsg (&app->settings, MSG_INFO, "Get stations... ");
 	ret = BarUiPianoCall (app, PIANO_REQUEST_GET_STATIONS, NULL, &pRet, &wRet);
-	BarUiStartEventCmd (&app->settings, "usergetstations", NULL, NULL, &app->player,
+	BarUiStartEventCmd (&app->settings, "usergetstations", NULL, NULL, &app->zone->player,
 			app->ph.stations, pRet, wRet);
 	return ret;
 }
@@ -189,30 +193,172 @@ static bool BarMainGetUserProfile(BarApp_t *app) {
 	return ret;
 }
 
+/*	find the first collection item without a name, starting at station
+ */
+static PianoStation_t *BarMainFirstUnnamed (PianoStation_t *station) {
+	PianoListForeachP (station) {
+		if (station->name != NULL) {
+			continue;
+		}
+		switch (station->stationType) {
+			case PIANO_TYPE_PODCAST:
+			case PIANO_TYPE_ALBUM:
+			case PIANO_TYPE_TRACK:
+				return station;
+
+			default:
+				break;
+		}
+	}
+	return NULL;
+}
+
+/*	a batch of annotations arrived
+ */
+static void BarMainAnnotateDone (BarApp_t * const app, void * const data,
+		const PianoReturn_t pRet, const CURLcode wRet, void * const user) {
+	free (data);
+	if ((pRet != PIANO_RET_OK || wRet != CURLE_OK) &&
+			app->annotate.pRet == PIANO_RET_OK &&
+			app->annotate.wRet == CURLE_OK) {
+		app->annotate.pRet = pRet;
+		app->annotate.wRet = wRet;
+	}
+	assert (app->annotate.pending > 0);
+	if (--app->annotate.pending == 0 && app->itemsLoading) {
+		/* background page done */
+		app->itemsLoading = false;
+		if (app->annotate.pRet != PIANO_RET_OK ||
+				app->annotate.wRet != CURLE_OK) {
+			/* the user can still work with what was loaded so far */
+			app->items.done = true;
+		}
+	}
+}
+
+/*	annotate collection items that have no name yet, from the local store if
+ *	possible and with concurrent batches otherwise. The batches finish in
+ *	BarMainAnnotateDone.
+ *	@return false if not all batches could be started
+ */
+static bool BarMainAnnotateItems (BarApp_t *app) {
+	/* ids per annotateObjects request */
+	static const unsigned int annotateBatchSize = 50;
+
+	BarAnnotationApply (&app->annotations, app->ph.stations);
+
+	app->annotate.pRet = PIANO_RET_OK;
+	app->annotate.wRet = CURLE_OK;
+	PianoStation_t *start = BarMainFirstUnnamed (app->ph.stations);
+	while (start != NULL) {
+		PianoRequestDataAnnotateObjects_t * const reqData =
+				calloc (1, sizeof (*reqData));
+		if (reqData == NULL) {
+			return false;
+		}
+		reqData->limit = annotateBatchSize;
+		reqData->start = start;
+		if (!BarUiPianoCallAsync (app, PIANO_REQUEST_ANNOTATE_OBJECTS,
+				reqData, BarMainAnnotateDone, reqData)) {
+			free (reqData);
+			return false;
+		}
+		++app->annotate.pending;
+		/* building the request found where the next batch starts */
+		start = BarMainFirstUnnamed (reqData->next);
+	}
+	return true;
+}
+
+/*	run background calls until the annotation batches are done, for startup
+ *	work the user is waiting for anyway
+ *	@return false if a batch failed
+ */
+static bool BarMainAnnotateWait (BarApp_t *app) {
+	if (app->annotate.pending == 0) {
+		return true;
+	}
+	BarUiMsg (&app->settings, MSG_INFO, "Annotate Objects ... ");
+	while (app->annotate.pending > 0 && !app->doQuit) {
+		fd_set rd, wr;
+		FD_ZERO (&rd);
+		FD_ZERO (&wr);
+		struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+		const int maxfd = BarUiAsyncFdSet (app, &rd, &wr, 0, &timeout);
+		select (maxfd, &rd, &wr, NULL, &timeout);
+		BarUiAsyncHandle (app);
+	}
+
+	if (app->annotate.pending > 0) {
+		BarUiMsg (&app->settings, MSG_NONE, "Interrupted.\n");
+		return false;
+	} else if (app->annotate.wRet != CURLE_OK) {
+		BarUiMsg (&app->settings, MSG_NONE, "Network error: %s\n",
+				curl_easy_strerror (app->annotate.wRet));
+		return false;
+	} else if (app->annotate.pRet != PIANO_RET_OK) {
+		BarUiMsg (&app->settings, MSG_NONE, "Error: %s\n",
+				PianoErrorToStr (app->annotate.pRet));
+		return false;
+	}
+	BarUiMsg (&app->settings, MSG_NONE, "Ok.\n");
+	return true;
+}
+
+/*	is the autostart station among the stations loaded so far?
+ */
+static bool BarMainHaveAutostartStation (const BarApp_t * const app) {
+	return app->settings.autostartStation != NULL &&
+			app->ph.stations != NULL &&
+			PianoFindStationById (app->ph.stations,
+			app->settings.autostartStation) != NULL;
+}
+
+/*	annotate the collection page that just arrived
+ */
+static void BarMainItemsDone (BarApp_t * const app, void * const data,
+		const PianoReturn_t pRet, const CURLcode wRet, void * const user) {
+	if (pRet != PIANO_RET_OK || wRet != CURLE_OK ||
+			!BarMainAnnotateItems (app)) {
+		/* the user can still work with what was loaded so far */
+		app->items.done = true;
+	}
+	/* loading goes on until the last batch is annotated */
+	if (app->annotate.pending == 0) {
+		app->itemsLoading = false;
+	}
+}
+
+/*	load the next collection page in the background
+ */
+static void BarMainLoadMoreItems (BarApp_t *app) {
+	if (app->items.done || app->itemsLoading) {
+		return;
+	}
+	if (BarUiPianoCallAsync (app, PIANO_REQUEST_GET_ITEMS, &app->items,
+			BarMainItemsDone, NULL)) {
+		app->itemsLoading = true;
+	} else {
+		app->items.done = true;
+	}
+}
+
 static bool BarMainGetAllStations (BarApp_t *app) {
 	PianoReturn_t pRet;
 	CURLcode wRet;
 	bool ret;
-	PianoRequestDataGetPlaylist_t reqData;
-	reqData.station = app->nextStation;
-	reqData.quality = app->settings.audioQuality;
-	reqData.retPlaylist = NULL;
+
+	/* collection items per request */
+	static const unsigned int itemsPageSize = 100;
+	app->items.limit = itemsPageSize;
+	app->items.cursor = NULL;
+	app->items.done = false;
 
 	do {
 		ret = BarMainGetStations (app);
 		if(!ret) {
 			break;
 		}
-		BarUiMsg (&app->settings, MSG_INFO, "Get items ... ");
-		ret = BarUiPianoCall (app, PIANO_REQUEST_GET_ITEMS, &reqData, &pRet, &wRet);
-		if(!ret) {
-			break;
-		}
-		BarUiMsg (&app->settings, MSG_INFO, "Annotate Objects ... ");
-		ret = BarUiPianoCall (app, PIANO_REQUEST_ANNOTATE_OBJECTS, &reqData, &pRet, &wRet);
-		if(!ret) {
-			break;
-		}
 		if(app->ph.user.IsPremiumUser) {
 			BarUiMsg (&app->settings, MSG_INFO, "Get Playlists ... ");
 			ret = BarUiPianoCall (app, PIANO_REQUEST_GET_PLAYLISTS,NULL, &pRet, &wRet);
@@ -220,7 +366,24 @@ static bool BarMainGetAllStations (BarApp_t *app) {
 				break;
 			}
 		}
-		BarUiStartEventCmd (&app->settings, "usergetstations", NULL, NULL, &app->player,
+		/* page through the collection, the remainder is loaded in the
+		 * background once the autostart station is known */
+		while (!app->items.done && !BarMainHaveAutostartStation (app)) {
+			BarUiMsg (&app->settings, MSG_INFO, "Get items ... ");
+			ret = BarUiPianoCall (app, PIANO_REQUEST_GET_ITEMS, &app->items,
+					&pRet, &wRet);
+			if(!ret) {
+				break;
+			}
+			ret = BarMainAnnotateItems (app) && BarMainAnnotateWait (app);
+			if(!ret) {
+				break;
+			}
+		}
+		if(!ret) {
+			break;
+		}
+		BarUiStartEventCmd (&app->settings, "usergetstations", NULL, NULL, &app->zone->player,
 				app->ph.stations, pRet, wRet);
 
 	} while (false);
@@ -231,28 +394,95 @@ static bool BarMainGetAllStations (BarApp_t *app) {
 static void BarMainGetInitialStation (BarApp_t *app) {
 	/* try to get autostart station */
 	if (app->settings.autostartStation != NULL) {
-		app->nextStation = PianoFindStationById (app->ph.stations,
+		app->zone->nextStation = PianoFindStationById (app->ph.stations,
 				app->settings.autostartStation);
-		if (app->nextStation == NULL) {
+		if (app->zone->nextStation == NULL) {
 			BarUiMsg (&app->settings, MSG_ERR,
 					"Error: Autostart station not found.\n");
 		}
 	}
 	/* no autostart? ask the user */
-	if (app->nextStation == NULL) {
-		app->nextStation = BarUiSelectStation (app, app->ph.stations,
+	if (app->zone->nextStation == NULL) {
+		app->zone->nextStation = BarUiSelectStation (app, app->ph.stations,
 				"Select station: ", NULL, app->settings.autoselect);
 	}
 }
 
-/*	wait for user input
+/*	@return resident set size in bytes, 0 if unknown
+ */
+static unsigned long BarMainRss (void) {
+	unsigned long pages = 0;
+	FILE * const fp = fopen ("/proc/self/statm", "r");
+	if (fp != NULL) {
+		const int ret = fscanf (fp, "%*u %lu", &pages);
+		fclose (fp);
+		if (ret == 1) {
+			return pages * sysconf (_SC_PAGESIZE);
+		}
+	}
+	/* peak instead of current, better than nothing */
+	struct rusage usage;
+	if (getrusage (RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		return usage.ru_maxrss;
+#else
+		return usage.ru_maxrss * 1024;
+#endif
+	}
+	return 0;
+}
+
+/*	metrics scrape callback
+ */
+static void BarMainMetrics (void * const data, BarMetricsBuf_t * const buf) {
+	BarApp_t * const app = data;
+
+	BarUiMetrics (buf);
+
+	player_t *players[BAR_MAX_ZONES];
+	for (size_t i = 0; i < app->zoneCount; i++) {
+		players[i] = &app->zones[i].player;
+	}
+	BarPlayerMetrics (buf, players, app->zoneCount);
+	BarStreamMetrics (buf, &app->stream);
+
+	BarMetricsFamily (buf, "process_resident_memory_bytes", "gauge",
+			"Resident memory size in bytes.");
+	BarMetricsValue (buf, "process_resident_memory_bytes", NULL,
+			BarMainRss ());
+}
+
+/*	wait for user input, background calls make progress meanwhile
  */
 static void BarMainHandleUserInput (BarApp_t *app) {
-	char buf[2];
-	if (BarReadline (buf, sizeof (buf), NULL, &app->input,
-			BAR_RL_FULLRETURN | BAR_RL_NOECHO | BAR_RL_NOINT, 1) > 0) {
-		BarUiDispatch (app, buf[0], app->curStation, app->playlist, true,
-				BAR_DC_GLOBAL);
+	/* wait for keyboard, fifo and control socket at once */
+	fd_set rd, wr;
+	memcpy (&rd, &app->input.set, sizeof (rd));
+	FD_ZERO (&wr);
+	int maxfd = BarControlFdSet (&app->control, &rd, &wr,
+			app->input.maxfd);
+	maxfd = BarMetricsFdSet (&app->metrics, &rd, &wr, maxfd);
+	struct timeval timeout = {.tv_sec = 1, .tv_usec = 0};
+	maxfd = BarUiAsyncFdSet (app, &rd, &wr, maxfd, &timeout);
+	const int ready = select (maxfd, &rd, &wr, NULL, &timeout);
+	/* background calls may have timers running out, even if nothing is
+	 * ready */
+	BarUiAsyncHandle (app);
+	if (ready <= 0) {
+		return;
+	}
+
+	BarUiControlHandle (app, &rd, &wr);
+	BarMetricsHandle (&app->metrics, &rd, &wr, BarMainMetrics, app);
+
+	const int * const fds = app->input.fds;
+	if (FD_ISSET (fds[0], &rd) || (fds[1] != -1 && FD_ISSET (fds[1], &rd))) {
+		char buf[2];
+		if (BarReadline (buf, sizeof (buf), NULL, &app->input,
+				BAR_RL_FULLRETURN | BAR_RL_NOECHO | BAR_RL_NOINT, 0) > 0) {
+			BarUiDispatch (app, buf[0], app->zone->curStation,
+					app->zone->playlist, true, BAR_DC_GLOBAL);
+		}
 	}
 }
 
@@ -262,13 +492,13 @@ static void BarMainGetPlaylist (BarApp_t *app) {
 	PianoReturn_t pRet;
 	CURLcode wRet;
 	PianoRequestDataGetPlaylist_t reqData;
-	PianoStation_t *station = app->nextStation;
+	PianoStation_t *station = app->zone->nextStation;
 	assert(station != NULL);
 
 	memset(&reqData,0,sizeof(reqData));
 	reqData.station = station;
 	reqData.quality = app->settings.audioQuality;
-	app->stationStarted = true;
+	app->zone->stationStarted = true;
 
 	LOG("stationType %s\n",StationType2Str(station->stationType));
 
@@ -277,32 +507,32 @@ static void BarMainGetPlaylist (BarApp_t *app) {
 			BarUiMsg (&app->settings, MSG_INFO, "Receiving new playlist... ");
 			if (!BarUiPianoCall (app, PIANO_REQUEST_GET_PLAYLIST,
 					&reqData, &pRet, &wRet)) {
-				app->nextStation = NULL;
+				app->zone->nextStation = NULL;
 			} else {
-				app->playlist = reqData.retPlaylist;
-				if (app->playlist == NULL) {
+				app->zone->playlist = reqData.retPlaylist;
+				if (app->zone->playlist == NULL) {
 					BarUiMsg (&app->settings, MSG_INFO, "No tracks left.\n");
-					app->nextStation = NULL;
+					app->zone->nextStation = NULL;
 				}
 			}
-			app->curStation = app->nextStation;
+			app->zone->curStation = app->zone->nextStation;
 			break;
 
 		case PIANO_TYPE_PLAYLIST:
 			BarUiMsg (&app->settings, MSG_INFO, "Get tracks ... ");
 			if (!BarUiPianoCall (app, PIANO_REQUEST_GET_TRACKS,
 					&reqData, &pRet, &wRet)) {
-				app->nextStation = NULL;
+				app->zone->nextStation = NULL;
 			} else {
-				app->playlist = reqData.retPlaylist;
-				app->FullPlaylist = CopyPlaylist(app->playlist);
+				app->zone->playlist = reqData.retPlaylist;
+				app->zone->FullPlaylist = CopyPlaylist(app->zone->playlist);
 
-				if (app->playlist == NULL) {
+				if (app->zone->playlist == NULL) {
 					BarUiMsg (&app->settings, MSG_INFO, "No tracks left.\n");
-					app->nextStation = NULL;
+					app->zone->nextStation = NULL;
 				}
 			}
-			app->curStation = app->nextStation;
+			app->zone->curStation = app->zone->nextStation;
 			break;
 
 		case PIANO_TYPE_TRACK:
@@ -315,12 +545,12 @@ static void BarMainGetPlaylist (BarApp_t *app) {
 			BarUiMsg (&app->settings, MSG_INFO, "Get playback info ... ");
 			if (BarUiPianoCall (app, PIANO_REQUEST_GET_PLAYBACK_INFO,
 					&reqData, &pRet, &wRet)) {
-				app->playlist = reqData.retPlaylist;
+				app->zone->playlist = reqData.retPlaylist;
 			}
 			else {
-				ELOG("REQUEST_GET_PLAYBACK_INFO failed\n");
+				ELOG(&app->ph, "REQUEST_GET_PLAYBACK_INFO failed\n");
 			} 
-			app->curStation = app->nextStation;
+			app->zone->curStation = app->zone->nextStation;
 			break;
 
 		case PIANO_TYPE_PODCAST:
@@ -329,22 +559,33 @@ static void BarMainGetPlaylist (BarApp_t *app) {
 			assert (song != NULL);
 			song->trackToken = strdup(station->seedId);
 			song->seedId = strdup(station->id);
-			app->playlist = song;
-			app->curStation = app->nextStation;
-			app->nextStation = NULL;
+			app->zone->playlist = song;
+			app->zone->curStation = app->zone->nextStation;
+			app->zone->nextStation = NULL;
+			if(song->title == NULL) {
+			// Get name of episode, from the index if it is up to date
+				song->title = BarEpisodesTitle (app->zone->curStation,
+						song->trackToken);
+			}
 			if(song->title == NULL) {
-			// Get name of episode
 				PianoRequestDataGetEpisodes_t reqData1;
-				reqData1.station = app->curStation;
-				reqData1.playList = song;
-				reqData1.bGetAll = false;
+				memset (&reqData1, 0, sizeof (reqData1));
+				reqData1.station = app->zone->curStation;
+				reqData1.bGetAll = true;
 				BarUiMsg (&app->settings, MSG_INFO, "Get episodes ... ");
 				if (!BarUiPianoCall (app, PIANO_REQUEST_GET_EPISODES,
 						&reqData1, &pRet, &wRet)) {
-					app->curStation = NULL;
-					ELOG("Internal error\n");
+					app->zone->curStation = NULL;
+					ELOG(&app->ph, "Internal error\n");
 					break;
 				}
+				BarEpisodesPut (app->zone->curStation, reqData1.playList);
+				const PianoSong_t * const episode = BarEpisodesFind (
+						reqData1.playList, song->trackToken);
+				if (episode != NULL) {
+					song->title = strdup (episode->title);
+				}
+				PianoDestroyPlaylist (reqData1.playList);
 			}
 			break;
 
@@ -352,51 +593,298 @@ static void BarMainGetPlaylist (BarApp_t *app) {
 			BarUiMsg (&app->settings, MSG_INFO, "Get tracks ... ");
 			if (!BarUiPianoCall (app, PIANO_REQUEST_GET_TRACKS,
 					&reqData, &pRet, &wRet)) {
-				app->nextStation = NULL;
+				app->zone->nextStation = NULL;
 			} else {
-				app->playlist = reqData.retPlaylist;
-				app->FullPlaylist = CopyPlaylist(app->playlist);
-				if (app->playlist == NULL) {
+				app->zone->playlist = reqData.retPlaylist;
+				app->zone->FullPlaylist = CopyPlaylist(app->zone->playlist);
+				if (app->zone->playlist == NULL) {
 					BarUiMsg (&app->settings, MSG_INFO, "No tracks left.\n");
-					app->nextStation = NULL;
+					app->zone->nextStation = NULL;
 				}
 			}
-			app->curStation = app->nextStation;
+			app->zone->curStation = app->zone->nextStation;
 			break;
 	}
 	BarUiStartEventCmd (&app->settings, "stationfetchplaylist",
-			app->curStation, app->playlist, &app->player, app->ph.stations,
+			app->zone->curStation, app->zone->playlist, &app->zone->player, app->ph.stations,
 			pRet, wRet);
 }
 
-/*	start new player thread
+/*	choose the quality for the next song from the player’s download rate
+ *	estimate and how its buffer fared during the last song
+ */
+static PianoAudioQuality_t BarMainSelectQuality (BarApp_t *app) {
+	/* nominal stream bitrates in bit/s */
+	static const unsigned int bitrate[PIANO_AQ_LAST] = {0, 32000, 64000,
+			192000};
+	/* required download rate relative to the stream bitrate */
+	static const unsigned int headroom = 2;
+
+	const PianoAudioQuality_t max = app->settings.audioQuality;
+	if (!app->settings.adaptiveQuality) {
+		return max;
+	}
+
+	player_t * const player = &app->zone->player;
+	pthread_mutex_lock (&player->lock);
+	const unsigned int throughput = player->throughput;
+	const unsigned int underruns = player->underruns;
+	const unsigned int bufferLows = player->bufferLows;
+	pthread_mutex_unlock (&player->lock);
+
+	PianoAudioQuality_t q = app->zone->quality;
+	if (q == PIANO_AQ_UNKNOWN || q > max) {
+		q = max;
+	}
+	if (underruns > 0 || bufferLows > 0) {
+		/* ran dry or came close to it, step down right away */
+		if (q > PIANO_AQ_LOW) {
+			--q;
+		}
+	} else if (throughput > 0) {
+		/* drop to what the link sustains, but recover one step at a time */
+		while (q > PIANO_AQ_LOW && bitrate[q] * headroom > throughput) {
+			--q;
+		}
+		if (q < max && bitrate[q+1] * headroom <= throughput &&
+				q >= app->zone->quality) {
+			++q;
+		}
+	}
+	debugPrint (DEBUG_AUDIO, "quality %i, throughput %u bit/s, %u underruns, "
+			"%u times low on buffer\n", q, throughput, underruns, bufferLows);
+	app->zone->quality = q;
+	return q;
+}
+
+/*	playback info older than this is fetched again, in seconds */
+static const time_t playbackInfoTtl = 15*60;
+/* number of upcoming songs whose playback info is fetched in advance */
+static const unsigned int prefetchSongs = 2;
+
+/*	does the song need (new) playback info before it can be played?
  */
-static void BarMainStartPlayback (BarApp_t *app, pthread_t *playerThread) {
+static bool BarMainNeedPlaybackInfo (const BarApp_t * const app,
+		const PianoSong_t * const song) {
+	if (app->zone->curStation->stationType == PIANO_TYPE_STATION) {
+		/* urls come with the playlist */
+		return false;
+	}
+	return song->audioUrl == NULL || (song->audioUrlTime != 0 &&
+			time (NULL) - song->audioUrlTime >= playbackInfoTtl);
+}
+
+/* playback info requested for an upcoming song of a zone */
+typedef struct {
+	BarZone_t *zone;
+	/* the playlist and station may be gone by the time the answer arrives,
+	 * the request works on copies */
+	PianoStation_t station;
+	PianoRequestDataGetPlaylist_t reqData;
+} BarMainPrefetch_t;
+
+/*	move the prefetched urls to the song they were fetched for, if it is still
+ *	upcoming
+ */
+static void BarMainPrefetchDone (BarApp_t * const app, void * const data,
+		const PianoReturn_t pRet, const CURLcode wRet, void * const user) {
+	BarMainPrefetch_t * const prefetch = user;
+	PianoSong_t * const copy = prefetch->reqData.retPlaylist;
+	BarZone_t * const zone = prefetch->zone;
+
+	zone->prefetching = false;
+	/* the current song may be playing from its url already */
+	PianoSong_t *song = PianoListNextP (zone->playlist);
+	PianoListForeachP (song) {
+		if (song->trackToken != NULL &&
+				strcmp (song->trackToken, copy->trackToken) == 0) {
+			break;
+		}
+	}
+
+	if (song != NULL && wRet != CURLE_ABORTED_BY_CALLBACK) {
+		if (pRet == PIANO_RET_OK && wRet == CURLE_OK) {
+			for (size_t i = 0; i < PIANO_AQ_LAST; i++) {
+				char * const url = song->audioUrls[i];
+				song->audioUrls[i] = copy->audioUrls[i];
+				copy->audioUrls[i] = url;
+				song->audioFormats[i] = copy->audioFormats[i];
+			}
+			char * const url = song->audioUrl;
+			song->audioUrl = copy->audioUrl;
+			copy->audioUrl = url;
+			song->audioFormat = copy->audioFormat;
+			song->audioUrlTime = copy->audioUrlTime;
+		} else {
+			/* do not try again until it is this song’s turn */
+			free (song->audioUrl);
+			song->audioUrl = NULL;
+			song->audioUrlTime = time (NULL);
+		}
+	}
+
+	PianoDestroyPlaylist (copy);
+	free (prefetch->station.id);
+	free (prefetch);
+}
+
+/*	fetch playback info for an upcoming song in the background while the
+ *	current one plays. A failure just means BarMainStartPlayback fetches it
+ *	later.
+ */
+static void BarMainPrefetchPlaybackInfo (BarApp_t *app) {
+	if (app->zone->playlist == NULL || app->zone->curStation == NULL ||
+			app->zone->prefetching) {
+		return;
+	}
+
+	/* skip songs whose prefetch failed already */
+	PianoSong_t *song = PianoListNextP (app->zone->playlist);
+	unsigned int i;
+	for (i = 0; i < prefetchSongs && song != NULL; i++) {
+		if (BarMainNeedPlaybackInfo (app, song) &&
+				!(song->audioUrl == NULL && song->audioUrlTime != 0)) {
+			break;
+		}
+		song = PianoListNextP (song);
+	}
+	if (i == prefetchSongs || song == NULL || song->trackToken == NULL) {
+		return;
+	}
+
+	BarMainPrefetch_t * const prefetch = calloc (1, sizeof (*prefetch));
+	if (prefetch == NULL) {
+		return;
+	}
+	prefetch->zone = app->zone;
+	prefetch->station.id = strdup (app->zone->curStation->id);
+	prefetch->station.stationType = app->zone->curStation->stationType;
+	prefetch->reqData.station = &prefetch->station;
+	prefetch->reqData.quality = app->settings.adaptiveQuality &&
+			app->zone->quality != PIANO_AQ_UNKNOWN ? app->zone->quality :
+			app->settings.audioQuality;
+	prefetch->reqData.retPlaylist = CopySong (song);
+
+	if (prefetch->station.id == NULL || prefetch->reqData.retPlaylist == NULL ||
+			!BarUiPianoCallAsync (app, PIANO_REQUEST_GET_PLAYBACK_INFO,
+			&prefetch->reqData, BarMainPrefetchDone, prefetch)) {
+		PianoDestroyPlaylist (prefetch->reqData.retPlaylist);
+		free (prefetch->station.id);
+		free (prefetch);
+		return;
+	}
+	app->zone->prefetching = true;
+}
+
+/* feedback request of an outbox entry in flight. The entry itself may move
+ * or go away meanwhile, it is looked up again once the answer arrives. */
+typedef struct {
+	PianoRequestType_t type;
+	PianoSongRating_t rating;
+	/* requests only need the song’s station and track token */
+	PianoSong_t song;
+	PianoRequestDataRateSong_t rate;
+} BarMainFeedback_t;
+
+/*	record the outcome of a feedback request
+ */
+static void BarMainFeedbackDone (BarApp_t * const app, void * const data,
+		const PianoReturn_t pRet, const CURLcode wRet, void * const user) {
+	BarMainFeedback_t * const feedback = user;
+
+	app->outboxSending = false;
+	BarOutboxEntry_t * const e = BarOutboxFind (&app->outbox, feedback->type,
+			feedback->song.trackToken);
+	/* a rating changed meanwhile still has to be sent */
+	if (e != NULL && e->rating == feedback->rating) {
+		BarOutboxDone (&app->outbox, e,
+				pRet == PIANO_RET_OK && wRet == CURLE_OK ? BAR_OUTBOX_SENT :
+				(wRet != CURLE_OK ? BAR_OUTBOX_NETWORK_ERROR :
+				BAR_OUTBOX_REJECTED));
+	}
+
+	free (feedback->song.stationId);
+	free (feedback->song.trackToken);
+	free (feedback);
+}
+
+/*	send one queued feedback request in the background, if any is due
+ */
+static void BarMainFlushOutbox (BarApp_t *app) {
+	if (app->outboxSending) {
+		return;
+	}
+	BarOutboxEntry_t * const e = BarOutboxNext (&app->outbox);
+	if (e == NULL) {
+		return;
+	}
+
+	BarMainFeedback_t * const feedback = calloc (1, sizeof (*feedback));
+	if (feedback == NULL) {
+		return;
+	}
+	feedback->type = e->type;
+	feedback->rating = e->rating;
+	feedback->song.trackToken = strdup (e->trackToken);
+	feedback->song.stationId = e->stationId != NULL ?
+			strdup (e->stationId) : NULL;
+
+	void *data = &feedback->song;
+	if (e->type == PIANO_REQUEST_RATE_SONG) {
+		feedback->rate.song = &feedback->song;
+		feedback->rate.rating = e->rating;
+		data = &feedback->rate;
+		if (app->settings.responseCache) {
+			BarCacheInvalidate (&app->cache, e->type, data);
+		}
+	}
+
+	if (feedback->song.trackToken == NULL ||
+			(e->stationId != NULL && feedback->song.stationId == NULL) ||
+			!BarUiPianoCallAsync (app, e->type, data, BarMainFeedbackDone,
+			feedback)) {
+		free (feedback->song.stationId);
+		free (feedback->song.trackToken);
+		free (feedback);
+		return;
+	}
+	app->outboxSending = true;
+}
+
+/*	hand the current song over to the player
+ */
+static void BarMainStartPlayback (BarApp_t *app) {
 	assert (app != NULL);
-	assert (playerThread != NULL);
 
-	const PianoSong_t * const curSong = app->playlist;
+	PianoSong_t * const curSong = app->zone->playlist;
 	assert (curSong != NULL);
+	const PianoAudioQuality_t quality = BarMainSelectQuality (app);
 
-	app->stationStarted = true;
-	BarUiPrintSong (&app->settings, curSong, app->curStation->isQuickMix ?
+	app->zone->stationStarted = true;
+	BarUiPrintSong (&app->settings, curSong, app->zone->curStation->isQuickMix ?
 			PianoFindStationById (app->ph.stations,
 			curSong->stationId) : NULL);
 
-	if(app->curStation->stationType != PIANO_TYPE_STATION && 
-		curSong->audioUrl == NULL) 
-	{
+	if (BarMainNeedPlaybackInfo (app, curSong)) {
+		/* expired */
+		free (curSong->audioUrl);
+		curSong->audioUrl = NULL;
+
 		PianoRequestDataGetPlaylist_t reqData;
 		PianoReturn_t pRet;
 		CURLcode wRet;
 
-		reqData.station = app->curStation;
-		reqData.quality = app->settings.audioQuality;
-		reqData.retPlaylist = app->playlist;
+		reqData.station = app->zone->curStation;
+		reqData.quality = quality;
+		reqData.retPlaylist = app->zone->playlist;
 
 		BarUiMsg (&app->settings, MSG_INFO, "Get playback info ... ");
 		BarUiPianoCall (app, PIANO_REQUEST_GET_PLAYBACK_INFO,
 				&reqData, &pRet, &wRet);
+	} else if (curSong->audioUrl != NULL) {
+		/* urls for all qualities are known already, keep the current one if
+		 * the song lacks the chosen quality */
+		PianoSongSetQuality (curSong, quality);
 	}
 
 	static const char httpPrefix[] = "http://";
@@ -408,59 +896,57 @@ static void BarMainStartPlayback (BarApp_t *app, pthread_t *playerThread) {
 	{
 		BarUiMsg (&app->settings, MSG_ERR, "Invalid song url.\n");
 	} else {
-		player_t * const player = &app->player;
+		player_t * const player = &app->zone->player;
 		BarPlayerReset (player);
 
-		app->player.url = curSong->audioUrl;
-		app->player.gain = curSong->fileGain;
-		app->player.songDuration = curSong->length;
+		app->zone->player.url = curSong->audioUrl;
+		app->zone->player.gain = curSong->fileGain;
+		app->zone->player.songDuration = curSong->length;
 
-		assert (interrupted == &app->doQuit);
-		interrupted = &app->player.interrupted;
+		BarStatusSetSong (player->status, curSong,
+				app->zone->curStation->isQuickMix ? PianoFindStationById (
+				app->ph.stations, curSong->stationId) : app->zone->curStation);
 
 		/* throw event */
 		BarUiStartEventCmd (&app->settings, "songstart",
-				app->curStation, curSong, &app->player, app->ph.stations,
+				app->zone->curStation, curSong, &app->zone->player, app->ph.stations,
 				PIANO_RET_OK, CURLE_OK);
 
-		/* prevent race condition, mode must _not_ be DEAD if
-		 * thread has been started */
-		app->player.mode = PLAYER_WAITING;
 		/* start player */
-		pthread_create (playerThread, NULL, BarPlayerThread,
-				&app->player);
+		BarPlayerStart (&app->zone->player);
+		BarUiControlSong (app);
 	}
 }
 
 /*	player is done, clean up
  */
-static void BarMainPlayerCleanup (BarApp_t *app, pthread_t *playerThread) {
-	void *threadRet;
+static void BarMainPlayerCleanup (BarApp_t *app) {
+	player_t * const player = &app->zone->player;
 
-	BarUiStartEventCmd (&app->settings, "songfinish", app->curStation,
-			app->playlist, &app->player, app->ph.stations, PIANO_RET_OK,
+	BarUiStartEventCmd (&app->settings, "songfinish", app->zone->curStation,
+			app->zone->playlist, &app->zone->player, app->ph.stations, PIANO_RET_OK,
 			CURLE_OK);
 
-	/* FIXME: pthread_join blocks everything if network connection
-	 * is hung up e.g. */
-	pthread_join (*playerThread, &threadRet);
+	/* the decoder thread stays around, just pick up its result */
+	pthread_mutex_lock (&player->lock);
+	const int playerRet = player->ret;
+	pthread_mutex_unlock (&player->lock);
 
-	if (threadRet == (void *) PLAYER_RET_OK) {
-		app->playerErrors = 0;
-	} else if (threadRet == (void *) PLAYER_RET_SOFTFAIL) {
-		++app->playerErrors;
-		if (app->playerErrors >= app->settings.maxRetry) {
+	if (playerRet == PLAYER_RET_OK) {
+		app->zone->playerErrors = 0;
+	} else if (playerRet == PLAYER_RET_SOFTFAIL) {
+		++app->zone->playerErrors;
+		if (app->zone->playerErrors >= app->settings.maxRetry) {
 			/* don't continue playback if thread reports too many error */
-			app->nextStation = NULL;
+			app->zone->nextStation = NULL;
 		}
 	} else {
-		app->nextStation = NULL;
+		app->zone->nextStation = NULL;
 	}
 
-	assert (interrupted == &app->player.interrupted);
-	interrupted = &app->doQuit;
-
-	app->player.mode = PLAYER_DEAD;
+	pthread_mutex_lock (&player->lock);
+	player->mode = PLAYER_DEAD;
+	pthread_mutex_unlock (&player->lock);
 }
 
 /*	print song duration
@@ -468,7 +954,7 @@ static void BarMainPlayerCleanup (BarApp_t *app, pthread_t *playerThread) {
 static void BarMainPrintTime (BarApp_t *app) {
 	unsigned int songRemaining;
 	char sign[2] = {0, 0};
-	player_t * const player = &app->player;
+	player_t * const player = &app->zone->player;
 
 	pthread_mutex_lock (&player->lock);
 	const unsigned int songDuration = player->songDuration;
@@ -499,15 +985,100 @@ static void BarMainPrintTime (BarApp_t *app) {
 	BarUiMsg (&app->settings, MSG_TIME, "%s\r", outstr);
 }
 
+/*	advance playback of app->zone, a zone that is not selected never prompts
+ */
+static void BarMainZoneStep (BarApp_t *app, const bool selected) {
+	player_t * const player = &app->zone->player;
+
+	/* song finished playing, clean up things/scrobble song */
+	if (BarPlayerGetMode (player) == PLAYER_FINISHED) {
+		if (player->interrupted != 0) {
+			app->doQuit = 1;
+		}
+		BarMainPlayerCleanup (app);
+	}
+
+	/* check whether player finished playing and start playing new
+	 * song */
+	if (BarPlayerGetMode (player) == PLAYER_DEAD) {
+		/* what's next? */
+		if (app->zone->playlist != NULL) {
+			PianoSong_t *histsong = app->zone->playlist;
+			app->zone->playlist = PianoListNextP (app->zone->playlist);
+			histsong->head.next = NULL;
+			BarUiHistoryPrepend (app, histsong);
+		}
+		if (app->zone->playlist == NULL && app->zone->nextStation != NULL &&
+				!app->doQuit) {
+			if (app->zone->nextStation != app->zone->curStation) {
+				app->zone->stationStarted = false;
+				BarUiPrintStation (&app->settings, app->zone->nextStation);
+			}
+			switch(app->zone->nextStation->stationType) {
+				case PIANO_TYPE_STATION:
+				case PIANO_TYPE_PLAYLIST:
+				// when these types finish playing just start them over
+					BarMainGetPlaylist (app);
+					break;
+
+				case PIANO_TYPE_ALBUM:
+				case PIANO_TYPE_PODCAST:
+				case PIANO_TYPE_TRACK:
+					if(app->zone->stationStarted) {
+					// when these types finish playing prompt user to select a new "station"
+						app->zone->nextStation = NULL;
+						if (selected) {
+							BarUiActSelectStation( app, NULL,NULL,BAR_DC_UNDEFINED);
+						}
+					}
+					else {
+						BarMainGetPlaylist (app);
+					}
+					break;
+			}
+		}
+		/* song ready to play */
+		if (app->zone->playlist != NULL) {
+			BarMainStartPlayback (app);
+		}
+	}
+
+	/* resolve upcoming songs while this one plays */
+	if (BarPlayerGetMode (player) == PLAYER_PLAYING) {
+		BarMainPrefetchPlaybackInfo (app);
+	}
+}
+
+/* set by SIGUSR1 */
+static volatile sig_atomic_t dumpTrace = 0;
+
+/*	append the trace rings to trace_file or stderr
+ */
+static void BarMainDumpTrace (const BarApp_t * const app) {
+	FILE *fp = stderr;
+	if (app->settings.traceFile != NULL &&
+			(fp = fopen (app->settings.traceFile, "a")) == NULL) {
+		BarUiMsg (&app->settings, MSG_ERR, "Cannot open trace file %s\n",
+				app->settings.traceFile);
+		return;
+	}
+	BarTraceDump (fp);
+	if (fp != stderr) {
+		fclose (fp);
+	}
+}
+
 /*	main loop
  */
 static void BarMainLoop (BarApp_t *app) {
-	pthread_t playerThread;
-
 	if (!BarMainGetLoginCredentials (&app->settings, &app->input)) {
 		return;
 	}
 
+	if (app->settings.responseCache) {
+		BarCacheRead (&app->cache, app->settings.username);
+	}
+
 	if (!BarMainLoginUser (app)) {
 		return;
 	}
@@ -522,70 +1093,39 @@ static void BarMainLoop (BarApp_t *app) {
 
 	BarMainGetInitialStation (app);
 
-	player_t * const player = &app->player;
-
 	while (!app->doQuit) {
-		/* song finished playing, clean up things/scrobble song */
-		if (BarPlayerGetMode (player) == PLAYER_FINISHED) {
-			if (player->interrupted != 0) {
-				app->doQuit = 1;
-			}
-			BarMainPlayerCleanup (app, &playerThread);
-		}
-
-		/* check whether player finished playing and start playing new
-		 * song */
-		if (BarPlayerGetMode (player) == PLAYER_DEAD) {
-			/* what's next? */
-			if (app->playlist != NULL) {
-				PianoSong_t *histsong = app->playlist;
-				app->playlist = PianoListNextP (app->playlist);
-				histsong->head.next = NULL;
-				BarUiHistoryPrepend (app, histsong);
-			}
-			if (app->playlist == NULL && app->nextStation != NULL && !app->doQuit) {
-				if (app->nextStation != app->curStation) {
-					app->stationStarted = false;
-					BarUiPrintStation (&app->settings, app->nextStation);
-				}
-				switch(app->nextStation->stationType) {
-					case PIANO_TYPE_STATION:
-					case PIANO_TYPE_PLAYLIST:
-					// when these types finish playing just start them over
-						BarMainGetPlaylist (app);
-						break;
-
-					case PIANO_TYPE_ALBUM:
-					case PIANO_TYPE_PODCAST:
-					case PIANO_TYPE_TRACK:
-						if(app->stationStarted) {
-						// when these types finish playing prompt user to select a new "station"
-							app->nextStation = NULL;
-							BarUiActSelectStation( app, NULL,NULL,BAR_DC_UNDEFINED);
-						}
-						else {
-							BarMainGetPlaylist (app);
-						}
-						break;
-				}
-			}
-			/* song ready to play */
-			if (app->playlist != NULL) {
-				BarMainStartPlayback (app, &playerThread);
-			}
+		/* all zones keep playing, no matter which one is selected */
+		BarZone_t * const selected = app->zone;
+		for (size_t i = 0; i < app->zoneCount; i++) {
+			app->zone = &app->zones[i];
+			BarMainZoneStep (app, app->zone == selected);
 		}
+		app->zone = selected;
+
+		/* ^C skips the selected zone’s song */
+		player_t * const player = &app->zone->player;
+		interrupted = BarPlayerGetMode (player) != PLAYER_DEAD ?
+				&player->interrupted : &app->doQuit;
+
+		BarUiControlUpdate (app);
+
+		/* collection pages skipped during startup */
+		BarMainLoadMoreItems (app);
+
+		BarMainFlushOutbox (app);
 
 		BarMainHandleUserInput (app);
 
+		if (dumpTrace) {
+			dumpTrace = 0;
+			BarMainDumpTrace (app);
+		}
+
 		/* show time */
-		if (BarPlayerGetMode (player) == PLAYER_PLAYING) {
+		if (BarPlayerGetMode (&app->zone->player) == PLAYER_PLAYING) {
 			BarMainPrintTime (app);
 		}
 	}
-
-	if (BarPlayerGetMode (player) != PLAYER_DEAD) {
-		pthread_join (playerThread, NULL);
-	}
 }
 
 sig_atomic_t *interrupted = NULL;
@@ -597,6 +1137,10 @@ static void intHandler (int signal) {
 	}
 }
 
+static void traceHandler (int signal) {
+	dumpTrace = 1;
+}
+
 static void BarMainSetupSigaction () {
 	struct sigaction act = {
 			.sa_handler = intHandler,
@@ -604,6 +1148,13 @@ static void BarMainSetupSigaction () {
 			};
 	sigemptyset (&act.sa_mask);
 	sigaction (SIGINT, &act, NULL);
+
+	struct sigaction traceAct = {
+			.sa_handler = traceHandler,
+			.sa_flags = SA_RESTART,
+			};
+	sigemptyset (&traceAct.sa_mask);
+	sigaction (SIGUSR1, &traceAct, NULL);
 }
 
 const char *StationType2Str(PianoStationType_t Type)
@@ -665,6 +1216,13 @@ PianoSong_t *CopySong(PianoSong_t *song)
 		Ret->length = song->length;
 		Ret->rating = song->rating;
 		Ret->audioFormat = song->audioFormat;
+		Ret->audioUrlTime = song->audioUrlTime;
+		for (size_t i = 0; i < PIANO_AQ_LAST; i++) {
+			if (song->audioUrls[i] != NULL) {
+				Ret->audioUrls[i] = strdup (song->audioUrls[i]);
+			}
+			Ret->audioFormats[i] = song->audioFormats[i];
+		}
 	}
 	
 	return Ret;
@@ -701,11 +1259,37 @@ int main (int argc, char **argv) {
 	gcry_check_version (NULL);
 	gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
 	gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
-	BarPlayerInit (&app.player, &app.settings);
 
 	BarSettingsInit (&app.settings);
 	BarSettingsRead (&app.settings);
 
+	barTraceMask = app.settings.trace;
+	BarTraceThread ("main");
+
+	/* players read their zone’s output settings */
+	app.zoneCount = app.settings.zones;
+	if (!BarStatusOpen (&app.status, app.settings.statusFile, app.zoneCount,
+			app.settings.volume) && app.settings.statusFile != NULL) {
+		BarUiMsg (&app.settings, MSG_ERR, "Cannot create status file at %s\n",
+				app.settings.statusFile);
+	}
+	if (BarStreamOpen (&app.stream, &app.settings, app.zoneCount)) {
+		BarUiMsg (&app.settings, MSG_INFO, "Streaming audio at %s\n",
+				app.settings.streamListen);
+	} else if (app.settings.streamListen != NULL) {
+		BarUiMsg (&app.settings, MSG_ERR, "Cannot stream audio at %s\n",
+				app.settings.streamListen);
+	}
+	for (size_t i = 0; i < app.zoneCount; i++) {
+		BarPlayerInit (&app.zones[i].player, &app.settings,
+				&app.settings.zone[i]);
+		app.zones[i].player.status = BarStatusGetSlot (&app.status, i);
+		app.zones[i].player.stream = BarStreamGetFeed (&app.stream, i);
+	}
+	app.zone = &app.zones[0];
+	BarAnnotationRead (&app.annotations);
+	BarOutboxRead (&app.outbox);
+
 	PianoReturn_t pret;
 	if ((pret = PianoInit (&app.ph, app.settings.partnerUser,
 			app.settings.partnerPassword, app.settings.device,
@@ -725,9 +1309,22 @@ int main (int argc, char **argv) {
 				app.settings.keys[BAR_KS_HELP]);
 	}
 
+	/* retry jitter */
+	srand (time (NULL) ^ getpid ());
 	curl_global_init (CURL_GLOBAL_DEFAULT);
 	app.http = curl_easy_init ();
 	assert (app.http != NULL);
+	/* pianobar is single-threaded here, so no locking callbacks are needed.
+	 * Hedged requests duplicate app.http and share this as well. */
+	app.httpShare = curl_share_init ();
+	assert (app.httpShare != NULL);
+	curl_share_setopt (app.httpShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt (app.httpShare, CURLSHOPT_SHARE,
+			CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	curl_share_setopt (app.httpShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	curl_easy_setopt (app.http, CURLOPT_SHARE, app.httpShare);
 
 	/* init fds */
 	FD_ZERO(&app.input.set);
@@ -756,22 +1353,60 @@ int main (int argc, char **argv) {
 			app.input.fds[1];
 	++app.input.maxfd;
 
+	if (BarControlOpen (&app.control, app.settings.controlSocket)) {
+		BarUiMsg (&app.settings, MSG_INFO, "Control socket at %s opened\n",
+				app.settings.controlSocket);
+	} else if (app.settings.controlSocket != NULL) {
+		BarUiMsg (&app.settings, MSG_ERR, "Cannot open control socket at %s\n",
+				app.settings.controlSocket);
+	}
+
+	if (BarMetricsOpen (&app.metrics, app.settings.metricsListen)) {
+		BarUiMsg (&app.settings, MSG_INFO, "Serving metrics at %s\n",
+				app.settings.metricsListen);
+	} else if (app.settings.metricsListen != NULL) {
+		BarUiMsg (&app.settings, MSG_ERR, "Cannot serve metrics at %s\n",
+				app.settings.metricsListen);
+	}
+
 	BarMainLoop (&app);
+	BarUiAsyncDestroy (&app);
+	/* stop the players before the songs they may still be using go away */
+	for (size_t i = 0; i < app.zoneCount; i++) {
+		BarPlayerDestroy (&app.zones[i].player);
+	}
+	BarPlayerShutdown ();
+	BarStreamClose (&app.stream);
+	BarStatusClose (&app.status);
+	BarTraceDestroy ();
 
 	if (app.input.fds[1] != -1) {
 		close (app.input.fds[1]);
 	}
+	BarControlClose (&app.control);
+	BarMetricsClose (&app.metrics);
 
 	/* write statefile */
-	BarSettingsWrite (app.curStation, &app.settings);
+	/* autostart_station belongs to the first zone */
+	BarSettingsWrite (app.zones[0].curStation, &app.settings);
+	BarAnnotationWrite (&app.annotations, app.ph.stations);
+	BarAnnotationDestroy (&app.annotations);
+	if (app.settings.responseCache) {
+		BarCacheWrite (&app.cache, app.settings.username);
+	}
+	BarCacheDestroy (&app.cache);
+	BarOutboxDestroy (&app.outbox);
 
 	PianoDestroy (&app.ph);
-	PianoDestroyPlaylist (app.songHistory);
-	PianoDestroyPlaylist (app.playlist);
-	PianoDestroyPlaylist (app.FullPlaylist);
+	for (size_t i = 0; i < app.zoneCount; i++) {
+		PianoDestroyPlaylist (app.zones[i].songHistory);
+		PianoDestroyPlaylist (app.zones[i].playlist);
+		PianoDestroyPlaylist (app.zones[i].FullPlaylist);
+	}
+	free (app.items.cursor);
 	curl_easy_cleanup (app.http);
+	curl_share_cleanup (app.httpShare);
 	curl_global_cleanup ();
-	BarPlayerDestroy (&app.player);
 	BarSettingsDestroy (&app.settings);
 
 	/* restore terminal attributes, zsh doesn't need this, bash does... */
@@ -27,27 +27,75 @@ THE SOFTWARE.
 
 #include <piano.h>
 
+#include "annotation.h"
+#include "cache.h"
+#include "control.h"
+#include "metrics.h"
+#include "outbox.h"
 #include "player.h"
 #include "settings.h"
+#include "status.h"
+#include "stream.h"
+#include "ui_async.h"
 #include "ui_readline.h"
 
+/* one player pipeline and its own playlist, several zones share a session */
 typedef struct {
-	PianoHandle_t ph;
-	CURL *http;
 	player_t player;
-	BarSettings_t settings;
 	/* first item is current song */
 	PianoSong_t *playlist;
 	PianoSong_t *songHistory;
 	/* station of current song and station used to fetch songs from if playlist
 	 * is empty */
 	PianoStation_t *curStation, *nextStation;
-	sig_atomic_t doQuit;
-	BarReadlineFds_t input;
 	unsigned int playerErrors;
-	PianoStationType_t Filter;
 	char stationStarted;
 	PianoSong_t *FullPlaylist;
+	/* quality picked for the last song if adaptive_quality is enabled */
+	PianoAudioQuality_t quality;
+	/* playback info of an upcoming song is being fetched */
+	bool prefetching;
+} BarZone_t;
+
+typedef struct BarApp {
+	PianoHandle_t ph;
+	CURL *http;
+	/* dns cache, tls sessions and connections shared by all rpc handles */
+	CURLSH *httpShare;
+	BarZone_t zones[BAR_MAX_ZONES];
+	size_t zoneCount;
+	/* zone user input applies to */
+	BarZone_t *zone;
+	BarSettings_t settings;
+	sig_atomic_t doQuit;
+	BarReadlineFds_t input;
+	PianoStationType_t Filter;
+	/* collection paging state, remaining pages are loaded in the background */
+	PianoRequestDataGetItems_t items;
+	/* the next page is on its way or being annotated */
+	bool itemsLoading;
+	/* annotateObjects batches in flight and the first failure among them */
+	struct {
+		unsigned int pending;
+		PianoReturn_t pRet;
+		CURLcode wRet;
+	} annotate;
+	/* annotations of collection items from the last run */
+	BarAnnotationStore_t annotations;
+	/* responses of read-only requests */
+	BarCache_t cache;
+	/* feedback not sent yet */
+	BarOutbox_t outbox;
+	/* one of its requests is in flight */
+	bool outboxSending;
+	/* json control socket clients */
+	BarControl_t control;
+	/* shared memory copy of the zones’ state */
+	BarStatus_t status;
+	/* prometheus scrapers */
+	BarMetrics_t metrics;
+	BarStream_t stream;
+	BarUiAsync_t async;
 } BarApp_t;
 
 #include <signal.h>
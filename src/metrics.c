@@ -0,0 +1,362 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* metrics endpoint. A minimal HTTP/1.0 server on a tcp or unix domain socket
+ * that answers every GET /metrics with counters and histograms in the
+ * Prometheus text format. The body is produced by a callback, this file only
+ * knows about the transport and the format.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "metrics.h"
+#include "listen.h"
+#include "debug.h"
+
+/*	add value to histogram, bucket bounds are base << i
+ */
+void BarHistogramObserve (BarHistogram_t * const h, const uint64_t base,
+		const uint64_t value) {
+	assert (h != NULL);
+	assert (base > 0);
+
+	size_t i = 0;
+	while (i < BAR_HISTOGRAM_BUCKETS-1 && value > base << i) {
+		++i;
+	}
+	__atomic_add_fetch (&h->count[i], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&h->total, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&h->sum, value, __ATOMIC_RELAXED);
+}
+
+/*	append formatted text to buf, output is dropped if memory runs out
+ */
+void BarMetricsPrintf (BarMetricsBuf_t * const buf, const char * const fmt,
+		...) {
+	assert (buf != NULL);
+	assert (fmt != NULL);
+
+	va_list ap;
+	va_start (ap, fmt);
+	const int len = vsnprintf (NULL, 0, fmt, ap);
+	va_end (ap);
+	if (len < 0) {
+		return;
+	}
+
+	if (buf->len + len + 1 > buf->size) {
+		size_t size = buf->size > 0 ? buf->size : 4096;
+		while (buf->len + len + 1 > size) {
+			size *= 2;
+		}
+		char * const data = realloc (buf->data, size);
+		if (data == NULL) {
+			return;
+		}
+		buf->data = data;
+		buf->size = size;
+	}
+
+	va_start (ap, fmt);
+	vsnprintf (buf->data + buf->len, buf->size - buf->len, fmt, ap);
+	va_end (ap);
+	buf->len += len;
+}
+
+/*	start metric family name of type (counter, gauge or histogram)
+ */
+void BarMetricsFamily (BarMetricsBuf_t * const buf, const char * const name,
+		const char * const type, const char * const help) {
+	BarMetricsPrintf (buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name,
+			type);
+}
+
+/*	single sample, labels are a preformatted list like zone="1" or NULL
+ */
+void BarMetricsValue (BarMetricsBuf_t * const buf, const char * const name,
+		const char * const labels, const double value) {
+	if (labels != NULL) {
+		BarMetricsPrintf (buf, "%s{%s} %.17g\n", name, labels, value);
+	} else {
+		BarMetricsPrintf (buf, "%s %.17g\n", name, value);
+	}
+}
+
+/*	histogram samples. Bucket bounds and the sum are divided by scale, so one
+ *	recorded in microseconds is exported in seconds with scale 1e6.
+ */
+void BarMetricsHistogram (BarMetricsBuf_t * const buf, const char * const name,
+		const char * const labels, const BarHistogram_t * const h,
+		const uint64_t base, const double scale) {
+	assert (h != NULL);
+
+	const char * const sep = labels != NULL ? "," : "";
+	const char * const l = labels != NULL ? labels : "";
+	/* exported buckets are cumulative */
+	unsigned long seen = 0;
+	for (size_t i = 0; i < BAR_HISTOGRAM_BUCKETS-1; i++) {
+		seen += __atomic_load_n (&h->count[i], __ATOMIC_RELAXED);
+		BarMetricsPrintf (buf, "%s_bucket{%s%sle=\"%g\"} %lu\n", name, l, sep,
+				(double) (base << i) / scale, seen);
+	}
+	const unsigned long total = __atomic_load_n (&h->total, __ATOMIC_RELAXED);
+	BarMetricsPrintf (buf, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, l, sep,
+			total);
+	const uint64_t sum = __atomic_load_n (&h->sum, __ATOMIC_RELAXED);
+	if (labels != NULL) {
+		BarMetricsPrintf (buf, "%s_sum{%s} %.17g\n%s_count{%s} %lu\n", name,
+				labels, (double) sum / scale, name, labels, total);
+	} else {
+		BarMetricsPrintf (buf, "%s_sum %.17g\n%s_count %lu\n", name,
+				(double) sum / scale, name, total);
+	}
+}
+
+static void BarMetricsInitClient (BarMetricsClient_t * const c) {
+	c->fd = -1;
+	c->inLen = 0;
+	c->out.data = NULL;
+	c->out.len = 0;
+	c->out.size = 0;
+	c->outPos = 0;
+}
+
+static void BarMetricsDrop (BarMetricsClient_t * const c) {
+	if (c->fd != -1) {
+		close (c->fd);
+	}
+	free (c->out.data);
+	BarMetricsInitClient (c);
+}
+
+/*	start listening at addr, a path if it starts with / and host:port
+ *	otherwise
+ */
+bool BarMetricsOpen (BarMetrics_t * const m, const char * const addr) {
+	assert (m != NULL);
+
+	m->fd = -1;
+	m->path = NULL;
+	for (size_t i = 0; i < BAR_METRICS_MAX_CLIENTS; i++) {
+		BarMetricsInitClient (&m->clients[i]);
+	}
+
+	if (addr == NULL) {
+		return false;
+	}
+
+	const int fd = BarListenOpen (addr);
+	if (fd == -1) {
+		return false;
+	}
+
+	m->fd = fd;
+	if (addr[0] == '/') {
+		m->path = strdup (addr);
+	}
+	return true;
+}
+
+void BarMetricsClose (BarMetrics_t * const m) {
+	assert (m != NULL);
+
+	for (size_t i = 0; i < BAR_METRICS_MAX_CLIENTS; i++) {
+		BarMetricsDrop (&m->clients[i]);
+	}
+	if (m->fd != -1) {
+		close (m->fd);
+		m->fd = -1;
+	}
+	if (m->path != NULL) {
+		unlink (m->path);
+		free (m->path);
+		m->path = NULL;
+	}
+}
+
+/*	add the sockets to select()’s sets
+ *	@return new highest fd + 1
+ */
+int BarMetricsFdSet (const BarMetrics_t * const m, fd_set * const rd,
+		fd_set * const wr, int maxfd) {
+	assert (m != NULL);
+
+	if (m->fd == -1) {
+		return maxfd;
+	}
+	FD_SET (m->fd, rd);
+	if (m->fd >= maxfd) {
+		maxfd = m->fd + 1;
+	}
+	for (size_t i = 0; i < BAR_METRICS_MAX_CLIENTS; i++) {
+		const BarMetricsClient_t * const c = &m->clients[i];
+		if (c->fd == -1) {
+			continue;
+		}
+		if (c->out.data != NULL) {
+			FD_SET (c->fd, wr);
+		} else {
+			FD_SET (c->fd, rd);
+		}
+		if (c->fd >= maxfd) {
+			maxfd = c->fd + 1;
+		}
+	}
+	return maxfd;
+}
+
+static void BarMetricsAccept (BarMetrics_t * const m) {
+	const int fd = accept (m->fd, NULL, NULL);
+	if (fd == -1) {
+		return;
+	}
+	for (size_t i = 0; i < BAR_METRICS_MAX_CLIENTS; i++) {
+		BarMetricsClient_t * const c = &m->clients[i];
+		if (c->fd == -1) {
+			if (!BarListenSetFlags (fd)) {
+				break;
+			}
+			c->fd = fd;
+			return;
+		}
+	}
+	/* scrapers retry, no need to queue them */
+	close (fd);
+}
+
+/*	write as much of the response as the socket takes, the connection is
+ *	closed once it is complete
+ */
+static void BarMetricsFlush (BarMetricsClient_t * const c) {
+	while (c->outPos < c->out.len) {
+		const ssize_t ret = write (c->fd, c->out.data + c->outPos,
+				c->out.len - c->outPos);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				BarMetricsDrop (c);
+			}
+			return;
+		}
+		c->outPos += ret;
+	}
+	BarMetricsDrop (c);
+}
+
+/*	queue response with status line status and body
+ */
+static void BarMetricsRespond (BarMetricsClient_t * const c,
+		const char * const status, const BarMetricsBuf_t * const body) {
+	const size_t len = body->data != NULL ? body->len : 0;
+	BarMetricsPrintf (&c->out, "HTTP/1.0 %s\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: %zu\r\n"
+			"Connection: close\r\n\r\n", status, len);
+	if (len > 0) {
+		BarMetricsPrintf (&c->out, "%.*s", (int) len, body->data);
+	}
+	if (c->out.data == NULL) {
+		/* out of memory */
+		BarMetricsDrop (c);
+		return;
+	}
+	c->outPos = 0;
+	BarMetricsFlush (c);
+}
+
+/*	read the request head and answer it
+ */
+static void BarMetricsRead (BarMetricsClient_t * const c,
+		BarMetricsScrapeFunc_t scrape, void * const data) {
+	const ssize_t ret = read (c->fd, c->in + c->inLen,
+			sizeof (c->in) - c->inLen - 1);
+	if (ret <= 0) {
+		if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)) {
+			BarMetricsDrop (c);
+		}
+		return;
+	}
+	c->inLen += ret;
+	c->in[c->inLen] = '\0';
+
+	if (strstr (c->in, "\r\n\r\n") == NULL && strstr (c->in, "\n\n") == NULL) {
+		if (c->inLen >= sizeof (c->in) - 1) {
+			debugPrint (DEBUG_UI, "metrics request too long\n");
+			BarMetricsDrop (c);
+		}
+		return;
+	}
+
+	BarMetricsBuf_t body = { .data = NULL, .len = 0, .size = 0 };
+	if (strncmp (c->in, "GET ", 4) != 0) {
+		BarMetricsPrintf (&body, "method not allowed\n");
+		BarMetricsRespond (c, "405 Method Not Allowed", &body);
+	} else if (strncmp (c->in + 4, "/metrics ", 9) != 0 &&
+			strncmp (c->in + 4, "/ ", 2) != 0) {
+		BarMetricsPrintf (&body, "not found\n");
+		BarMetricsRespond (c, "404 Not Found", &body);
+	} else {
+		scrape (data, &body);
+		BarMetricsRespond (c, "200 OK", &body);
+	}
+	free (body.data);
+}
+
+/*	handle sockets select() reported ready
+ */
+void BarMetricsHandle (BarMetrics_t * const m, const fd_set * const rd,
+		const fd_set * const wr, BarMetricsScrapeFunc_t scrape,
+		void * const data) {
+	assert (m != NULL);
+	assert (scrape != NULL);
+
+	if (m->fd == -1) {
+		return;
+	}
+	for (size_t i = 0; i < BAR_METRICS_MAX_CLIENTS; i++) {
+		BarMetricsClient_t * const c = &m->clients[i];
+		if (c->fd == -1) {
+			continue;
+		}
+		if (c->out.data != NULL) {
+			if (FD_ISSET (c->fd, wr)) {
+				BarMetricsFlush (c);
+			}
+		} else if (FD_ISSET (c->fd, rd)) {
+			BarMetricsRead (c, scrape, data);
+		}
+	}
+	/* after the clients, so a new fd is not looked up in stale sets */
+	if (FD_ISSET (m->fd, rd)) {
+		BarMetricsAccept (m);
+	}
+}
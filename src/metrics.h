@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/select.h>
+
+#define BAR_HISTOGRAM_BUCKETS 12
+#define BAR_METRICS_MAX_CLIENTS 4
+
+/* bucket i counts observations up to base << i, the last one everything
+ * above. Observations are added atomically, so any thread may record. */
+typedef struct {
+	unsigned long count[BAR_HISTOGRAM_BUCKETS];
+	unsigned long total;
+	/* of all observations */
+	uint64_t sum;
+} BarHistogram_t;
+
+/* scrape response, grown as needed */
+typedef struct {
+	char *data;
+	size_t len, size;
+} BarMetricsBuf_t;
+
+typedef struct {
+	/* -1 if the slot is free */
+	int fd;
+	/* request head, the body (if any) is ignored */
+	char in[2048];
+	size_t inLen;
+	/* response the socket did not take yet, NULL while reading */
+	BarMetricsBuf_t out;
+	size_t outPos;
+} BarMetricsClient_t;
+
+typedef struct {
+	/* listening socket, -1 if disabled */
+	int fd;
+	/* of a unix socket, NULL for tcp */
+	char *path;
+	BarMetricsClient_t clients[BAR_METRICS_MAX_CLIENTS];
+} BarMetrics_t;
+
+typedef void (*BarMetricsScrapeFunc_t) (void *, BarMetricsBuf_t *);
+
+void BarHistogramObserve (BarHistogram_t * const, const uint64_t,
+		const uint64_t);
+
+bool BarMetricsOpen (BarMetrics_t * const, const char * const);
+void BarMetricsClose (BarMetrics_t * const);
+int BarMetricsFdSet (const BarMetrics_t * const, fd_set * const,
+		fd_set * const, int);
+void BarMetricsHandle (BarMetrics_t * const, const fd_set * const,
+		const fd_set * const, BarMetricsScrapeFunc_t, void *);
+
+void BarMetricsPrintf (BarMetricsBuf_t * const, const char * const, ...)
+		__attribute__((format(printf, 2, 3)));
+void BarMetricsFamily (BarMetricsBuf_t * const, const char * const,
+		const char * const, const char * const);
+void BarMetricsValue (BarMetricsBuf_t * const, const char * const,
+		const char * const, const double);
+void BarMetricsHistogram (BarMetricsBuf_t * const, const char * const,
+		const char * const, const BarHistogram_t * const, const uint64_t,
+		const double);
+
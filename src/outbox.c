@@ -0,0 +1,300 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* queue for song feedback (ratings, tired songs, bookmarks). The local effect
+ * is applied right away, requests are sent from the main loop and retried
+ * until they succeed. The queue is saved after every change, so nothing is
+ * lost if pianobar quits or crashes before it is empty.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "outbox.h"
+#include "settings.h"
+#include "debug.h"
+
+/* bump whenever the line format changes, old outboxes are discarded */
+static const char outboxHeader[] = "# pianobar outbox v1\n";
+/* upper bound for the number of entries */
+static const size_t outboxMax = 256;
+/* give up after Pandora rejected an entry this many times */
+static const unsigned int maxAttempts = 5;
+/* retry delay in seconds, doubled for every failure */
+static const time_t retryDelay = 5, retryDelayMax = 10*60;
+/* type, rating, stationId, trackToken, attempts */
+#define OUTBOX_FIELDS 5
+
+static char *BarOutboxPath (void) {
+	return BarGetXdgConfigDir (PACKAGE "/outbox");
+}
+
+/*	save the outbox, atomically replacing the old file
+ */
+static void BarOutboxWrite (const BarOutbox_t * const outbox) {
+	char * const path = BarOutboxPath ();
+	if (path == NULL) {
+		return;
+	}
+	const size_t tmpLen = strlen (path) + 5;
+	char * const tmpPath = malloc (tmpLen);
+	if (tmpPath == NULL) {
+		free (path);
+		return;
+	}
+	snprintf (tmpPath, tmpLen, "%s.new", path);
+
+	/* track tokens belong to the account */
+	const int tmpFd = open (tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	FILE * const fd = tmpFd != -1 ? fdopen (tmpFd, "w") : NULL;
+	if (fd == NULL && tmpFd != -1) {
+		close (tmpFd);
+		unlink (tmpPath);
+	}
+	if (fd != NULL) {
+		fputs (outboxHeader, fd);
+		for (size_t i = 0; i < outbox->count; i++) {
+			const BarOutboxEntry_t * const e = &outbox->entries[i];
+			fprintf (fd, "%i\t%i\t%s\t%s\t%u\n", e->type, e->rating,
+					e->stationId != NULL ? e->stationId : "", e->trackToken,
+					e->attempts);
+		}
+		if (fclose (fd) != 0 || rename (tmpPath, path) != 0) {
+			/* the old outbox is still there, its entries are resent */
+			debugPrint (DEBUG_NETWORK, "cannot write outbox %s\n", path);
+			unlink (tmpPath);
+		}
+	}
+	free (tmpPath);
+	free (path);
+}
+
+static void BarOutboxFree (BarOutboxEntry_t * const e) {
+	free (e->stationId);
+	free (e->trackToken);
+}
+
+/*	append entry, taking ownership of its strings
+ */
+static bool BarOutboxAppend (BarOutbox_t * const outbox,
+		const BarOutboxEntry_t * const e) {
+	if (outbox->entries == NULL && (outbox->entries = calloc (outboxMax,
+			sizeof (*outbox->entries))) == NULL) {
+		return false;
+	}
+	if (outbox->count >= outboxMax) {
+		return false;
+	}
+	outbox->entries[outbox->count++] = *e;
+	return true;
+}
+
+/*	load entries left over from the last run
+ */
+void BarOutboxRead (BarOutbox_t * const outbox) {
+	assert (outbox != NULL);
+
+	outbox->entries = NULL;
+	outbox->count = 0;
+
+	char * const path = BarOutboxPath ();
+	if (path == NULL) {
+		return;
+	}
+	FILE * const fd = fopen (path, "r");
+	free (path);
+	if (fd == NULL) {
+		return;
+	}
+
+	char line[1024];
+	if (fgets (line, sizeof (line), fd) == NULL ||
+			strcmp (line, outboxHeader) != 0) {
+		fclose (fd);
+		return;
+	}
+
+	const time_t now = time (NULL);
+	while (fgets (line, sizeof (line), fd) != NULL) {
+		char *field[OUTBOX_FIELDS];
+		char *pos = line;
+		size_t n;
+		line[strcspn (line, "\n")] = '\0';
+		for (n = 0; n < OUTBOX_FIELDS && pos != NULL; n++) {
+			field[n] = pos;
+			if ((pos = strchr (pos, '\t')) != NULL) {
+				*pos = '\0';
+				++pos;
+			}
+		}
+		if (n != OUTBOX_FIELDS || field[3][0] == '\0') {
+			continue;
+		}
+
+		BarOutboxEntry_t e;
+		memset (&e, 0, sizeof (e));
+		e.type = atoi (field[0]);
+		e.rating = atoi (field[1]);
+		e.stationId = field[2][0] != '\0' ? strdup (field[2]) : NULL;
+		e.trackToken = strdup (field[3]);
+		e.attempts = strtoul (field[4], NULL, 10);
+		e.due = now;
+		if (!BarOutboxAppend (outbox, &e)) {
+			BarOutboxFree (&e);
+		}
+	}
+	fclose (fd);
+
+	debugPrint (DEBUG_NETWORK, "%zu feedback requests pending\n",
+			outbox->count);
+}
+
+/*	@return entry of request type for the song with trackToken, or NULL
+ */
+BarOutboxEntry_t *BarOutboxFind (BarOutbox_t * const outbox,
+		const PianoRequestType_t type, const char * const trackToken) {
+	assert (outbox != NULL);
+	assert (trackToken != NULL);
+
+	for (size_t i = 0; i < outbox->count; i++) {
+		BarOutboxEntry_t * const e = &outbox->entries[i];
+		if (e->type == type && strcmp (e->trackToken, trackToken) == 0) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*	queue feedback for song. Repeated ratings of the same song replace each
+ *	other, other duplicates are dropped.
+ *	@return false if the outbox is full
+ */
+bool BarOutboxAdd (BarOutbox_t * const outbox, const PianoRequestType_t type,
+		const PianoSong_t * const song, const PianoSongRating_t rating) {
+	assert (outbox != NULL);
+	assert (song != NULL);
+	assert (song->trackToken != NULL);
+	assert (type == PIANO_REQUEST_RATE_SONG ||
+			type == PIANO_REQUEST_ADD_TIRED_SONG ||
+			type == PIANO_REQUEST_BOOKMARK_SONG ||
+			type == PIANO_REQUEST_BOOKMARK_ARTIST);
+
+	BarOutboxEntry_t * const found = BarOutboxFind (outbox, type,
+			song->trackToken);
+	if (found != NULL) {
+		if (found->rating != rating) {
+			found->rating = rating;
+			found->attempts = 0;
+			BarOutboxWrite (outbox);
+		}
+		return true;
+	}
+
+	BarOutboxEntry_t e;
+	memset (&e, 0, sizeof (e));
+	e.type = type;
+	e.rating = rating;
+	e.stationId = song->stationId != NULL ? strdup (song->stationId) : NULL;
+	e.trackToken = strdup (song->trackToken);
+	e.due = time (NULL);
+	if (e.trackToken == NULL || !BarOutboxAppend (outbox, &e)) {
+		BarOutboxFree (&e);
+		return false;
+	}
+	BarOutboxWrite (outbox);
+	return true;
+}
+
+/*	@return oldest entry that is due, or NULL
+ */
+BarOutboxEntry_t *BarOutboxNext (BarOutbox_t * const outbox) {
+	assert (outbox != NULL);
+
+	const time_t now = time (NULL);
+	for (size_t i = 0; i < outbox->count; i++) {
+		if (outbox->entries[i].due <= now) {
+			return &outbox->entries[i];
+		}
+	}
+	return NULL;
+}
+
+/*	record the outcome of sending e, which is removed if it was sent or
+ *	rejected too often
+ */
+void BarOutboxDone (BarOutbox_t * const outbox, BarOutboxEntry_t * const e,
+		const BarOutboxResult_t result) {
+	assert (outbox != NULL);
+	assert (e >= outbox->entries && e < outbox->entries + outbox->count);
+
+	switch (result) {
+		case BAR_OUTBOX_REJECTED:
+			if (++e->attempts < maxAttempts) {
+				break;
+			}
+			debugPrint (DEBUG_NETWORK, "giving up on feedback %i for %s\n",
+					e->type, e->trackToken);
+			/* fall through */
+
+		case BAR_OUTBOX_SENT: {
+			BarOutboxFree (e);
+			/* keep the order */
+			const size_t i = e - outbox->entries;
+			memmove (e, e+1, (outbox->count - i - 1) * sizeof (*e));
+			--outbox->count;
+			BarOutboxWrite (outbox);
+			return;
+		}
+
+		case BAR_OUTBOX_NETWORK_ERROR:
+			break;
+	}
+
+	/* back off, network errors are retried forever */
+	time_t delay = retryDelay;
+	for (unsigned int i = 0; i < e->failures && delay < retryDelayMax; i++) {
+		delay *= 2;
+	}
+	++e->failures;
+	e->due = time (NULL) + (delay < retryDelayMax ? delay : retryDelayMax);
+	if (result == BAR_OUTBOX_REJECTED) {
+		BarOutboxWrite (outbox);
+	}
+}
+
+void BarOutboxDestroy (BarOutbox_t * const outbox) {
+	assert (outbox != NULL);
+
+	for (size_t i = 0; i < outbox->count; i++) {
+		BarOutboxFree (&outbox->entries[i]);
+	}
+	free (outbox->entries);
+	outbox->entries = NULL;
+	outbox->count = 0;
+}
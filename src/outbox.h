@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <piano.h>
+
+/* feedback waiting to be sent */
+typedef struct {
+	/* RATE_SONG, ADD_TIRED_SONG, BOOKMARK_SONG or BOOKMARK_ARTIST */
+	PianoRequestType_t type;
+	PianoSongRating_t rating;
+	char *stationId, *trackToken;
+	/* rejected attempts so far */
+	unsigned int attempts;
+	/* network failures, only delay the next attempt */
+	unsigned int failures;
+	time_t due;
+} BarOutboxEntry_t;
+
+typedef struct {
+	/* oldest first */
+	BarOutboxEntry_t *entries;
+	size_t count;
+} BarOutbox_t;
+
+typedef enum {
+	BAR_OUTBOX_SENT,
+	BAR_OUTBOX_NETWORK_ERROR,
+	BAR_OUTBOX_REJECTED,
+} BarOutboxResult_t;
+
+void BarOutboxRead (BarOutbox_t * const);
+bool BarOutboxAdd (BarOutbox_t * const, const PianoRequestType_t,
+		const PianoSong_t * const, const PianoSongRating_t);
+BarOutboxEntry_t *BarOutboxNext (BarOutbox_t * const);
+BarOutboxEntry_t *BarOutboxFind (BarOutbox_t * const,
+		const PianoRequestType_t, const char * const);
+void BarOutboxDone (BarOutbox_t * const, BarOutboxEntry_t * const,
+		const BarOutboxResult_t);
+void BarOutboxDestroy (BarOutbox_t * const);
+
@@ -23,18 +23,27 @@ THE SOFTWARE.
 
 /* receive/play audio stream.
  *
- * There are two threads involved here:
+ * There are two threads involved here. Both are started by BarPlayerInit and
+ * live until BarPlayerDestroy, waiting for the next song in between:
  * BarPlayerThread
- * 		Sets up the stream and fetches the data into a ffmpeg buffersrc
+ * 		Waits for a command from BarPlayerStart, sets up the stream and fetches
+ * 		the data into a ffmpeg buffersrc
  * BarAoPlayThread
- * 		Reads data from the filter chain’s sink and hands it over to libao for
- * 		playback.
+ * 		Reads data from the filter chain’s sink and hands it over to the
+ * 		zone’s audio sinks (sink.c), which have writer threads of their own.
  * 
  */
 
+#ifdef __linux__
+/* pthread_setaffinity_np, must come before any system header */
+#define _GNU_SOURCE
+#endif
 #include "config.h"
 
 #include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <math.h>
 #include <stdint.h>
@@ -43,7 +52,10 @@ THE SOFTWARE.
 #include <assert.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
-#include <sys/stat.h>
+#include <time.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
@@ -57,14 +69,59 @@ THE SOFTWARE.
 #include <libavutil/channel_layout.h>
 #include <libavutil/opt.h>
 #include <libavutil/frame.h>
+#include <ao/ao.h>
 
 #include "player.h"
+#include "realtime.h"
 #include "debug.h"
+#include "trace.h"
 #include "ui.h"
 #include "ui_types.h"
 
-/* default sample format */
-const enum AVSampleFormat avformat = AV_SAMPLE_FMT_S16;
+/* sample format used if the decoder’s cannot be played directly */
+static const enum AVSampleFormat defaultFormat = AV_SAMPLE_FMT_S16;
+
+/* largest piece of audio handed to the sinks at once, bounds the time until
+ * pause/skip take effect, in milliseconds */
+static const unsigned int controlChunkMs = 10;
+
+/* minimum amount of audio data a throughput sample is based on, in bytes */
+static const int64_t minThroughputBytes = 64*1024;
+
+/*	Current time of the monotonic clock in microseconds
+ */
+static int64_t monotonicUs (void) {
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/* bucket bounds of the lock wait and song open histograms, microseconds and
+ * milliseconds */
+static const unsigned int lockWaitBucketUs = 4;
+static const unsigned int openBucketMs = 16;
+/* pause and skip should be heard within controlBudgetUs, which is one of the
+ * control latency histogram’s bucket bounds */
+static const int64_t controlBudgetUs = 50000;
+static const unsigned int controlBucketUs = 3125;
+
+/*	lock mutex, recording how long we had to wait if someone else held it
+ */
+static void lockTimed (pthread_mutex_t * const lock, BarHistogram_t * const h,
+		const bool output) {
+	if (pthread_mutex_trylock (lock) == 0) {
+		return;
+	}
+	const int64_t start = monotonicUs ();
+	pthread_mutex_lock (lock);
+	const int64_t waited = monotonicUs () - start;
+	BarHistogramObserve (h, lockWaitBucketUs, waited);
+	BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_LOCK_WAIT, waited, output);
+}
+
+#define lockPlayer(p) lockTimed (&(p)->lock, &(p)->stats.lockWait, false)
+#define lockAoplay(p) lockTimed (&(p)->aoplayLock, \
+		&(p)->stats.aoplayLockWait, true)
 
 static void printError (const BarSettings_t * const settings,
 		const char * const msg, int ret) {
@@ -73,9 +130,7 @@ static void printError (const BarSettings_t * const settings,
 	BarUiMsg (settings, MSG_ERR, "%s (%s)\n", msg, avmsg);
 }
 
-/*	global initialization
- */
-void BarPlayerInit (player_t * const p, const BarSettings_t * const settings) {
+static void BarPlayerGlobalInit (void) {
 	ao_initialize ();
 	av_log_set_level (AV_LOG_FATAL);
 #ifdef HAVE_AV_REGISTER_ALL
@@ -87,80 +142,306 @@ void BarPlayerInit (player_t * const p, const BarSettings_t * const settings) {
 #ifdef HAVE_AVFORMAT_NETWORK_INIT
 	avformat_network_init ();
 #endif
+}
 
-	pthread_mutex_init (&p->lock, NULL);
+/*	pin thread to core cpu, or to the zone’s core if that is -1
+ */
+static void BarPlayerPin (const player_t * const p, const pthread_t thread,
+		int cpu) {
+#ifdef __linux__
+	if (cpu < 0) {
+		cpu = p->zone->cpu;
+	}
+	if (cpu < 0) {
+		return;
+	}
+	cpu_set_t set;
+	CPU_ZERO (&set);
+	CPU_SET (cpu, &set);
+	const int ret = pthread_setaffinity_np (thread, sizeof (set), &set);
+	if (ret != 0) {
+		debugPrint (DEBUG_AUDIO, "cannot pin player to cpu %i: %s\n",
+				cpu, strerror (ret));
+	}
+#endif
+}
+
+/*	name the calling worker’s trace ring after its zone
+ */
+static void BarPlayerTraceThread (const player_t * const p,
+		const char * const role) {
+	char name[16];
+	snprintf (name, sizeof (name), "%s%zu", role,
+			(size_t) (p->zone - p->settings->zone) + 1);
+	BarTraceThread (name);
+}
+
+/*	initialize player of zone, library setup is done once for all of them
+ */
+void BarPlayerInit (player_t * const p, const BarSettings_t * const settings,
+		const BarZoneSettings_t * const zone) {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once (&once, BarPlayerGlobalInit);
+
+	BarRealtimeMutexInit (&p->lock, settings);
 	pthread_cond_init (&p->cond, NULL);
-	pthread_mutex_init (&p->aoplayLock, NULL);
+	BarRealtimeMutexInit (&p->aoplayLock, settings);
 	pthread_cond_init (&p->aoplayCond, NULL);
 	BarPlayerReset (p);
 	p->settings = settings;
+	p->zone = zone;
+	p->status = NULL;
+	p->stream = NULL;
+	memset (&p->stats, 0, sizeof (p->stats));
+	p->cmd = PLAYER_CMD_NONE;
+	p->ret = PLAYER_RET_OK;
+	p->aoplaySong = false;
+	p->aoplayExit = false;
+	p->aoplayEof = false;
+	p->aoplayFailed = false;
+	p->volume = 1.0f;
+	p->throughput = 0;
+	p->outputFormat = defaultFormat;
+	p->fgraph = NULL;
+	p->fbufsink = NULL;
+	p->fabuf = NULL;
+	p->filterFormat[0] = '\0';
+	BarSinksInit (&p->sinks, settings, zone, zone - settings->zone);
+	p->pkt = NULL;
+	p->frame = NULL;
+	p->filteredFrame = NULL;
+	p->outputBuf = NULL;
+	p->outputBufSize = 0;
+
+	/* the workers idle until BarPlayerStart hands them a song */
+	pthread_create (&p->decoderThread, NULL, BarPlayerThread, p);
+	pthread_create (&p->aoplayThread, NULL, BarAoPlayThread, p);
+	BarPlayerPin (p, p->decoderThread, zone->decoderCpu);
+	BarPlayerPin (p, p->aoplayThread, zone->outputCpu);
+	for (size_t i = 0; i < p->sinks.count; i++) {
+		BarPlayerPin (p, p->sinks.sink[i].thread, zone->outputCpu);
+	}
 }
 
+/*	Stop worker threads and wait for them, network I/O is aborted by intCb
+ */
 void BarPlayerDestroy (player_t * const p) {
+	lockPlayer (p);
+	p->cmd = PLAYER_CMD_EXIT;
+	p->doQuit = true;
+	p->doPause = false;
+	pthread_cond_broadcast (&p->cond);
+	pthread_mutex_unlock (&p->lock);
+
+	lockAoplay (p);
+	p->aoplayExit = true;
+	pthread_cond_broadcast (&p->aoplayCond);
+	pthread_mutex_unlock (&p->aoplayLock);
+	/* neither worker waits for a stalled device after this, and a sink
+	 * writer stuck in its driver is given up on after a while by
+	 * BarSinksDestroy, so joining them is bounded */
+	BarSinksAbort (&p->sinks);
+
+	/* the song, filter graph and piano handle are freed once this returns,
+	 * a thread must not outlive them */
+	pthread_join (p->decoderThread, NULL);
+	pthread_join (p->aoplayThread, NULL);
+
 	pthread_cond_destroy (&p->cond);
 	pthread_mutex_destroy (&p->lock);
 	pthread_cond_destroy (&p->aoplayCond);
 	pthread_mutex_destroy (&p->aoplayLock);
+}
 
+/*	undo library setup, after all players are destroyed
+ */
+void BarPlayerShutdown (void) {
 #ifdef HAVE_AVFORMAT_NETWORK_INIT
 	avformat_network_deinit ();
 #endif
 	ao_shutdown ();
 }
 
+/*	Hand the song set up in url/gain over to the decoder thread
+ */
+void BarPlayerStart (player_t * const p) {
+	lockPlayer (p);
+	assert (p->cmd == PLAYER_CMD_NONE);
+	/* prevent race condition, mode must _not_ be DEAD once the command has
+	 * been posted */
+	p->mode = PLAYER_WAITING;
+	p->cmd = PLAYER_CMD_PLAY;
+	pthread_cond_broadcast (&p->cond);
+	pthread_mutex_unlock (&p->lock);
+	BarStatusSetState (p->status, BAR_STATUS_LOADING);
+}
+
 void BarPlayerReset (player_t * const p) {
 	p->doQuit = false;
 	p->doPause = false;
+	p->commandPending = false;
+	p->underruns = 0;
+	p->bufferLows = 0;
 	p->songDuration = 0;
 	p->songPlayed = 0;
 	p->mode = PLAYER_DEAD;
-	p->fvolume = NULL;
-	p->fgraph = NULL;
 	p->fctx = NULL;
 	p->st = NULL;
 	p->cctx = NULL;
-	p->fbufsink = NULL;
-	p->fabuf = NULL;
 	p->streamIdx = -1;
 	p->lastTimestamp = 0;
 	p->interrupted = 0;
-	p->aoDev = NULL;
 }
 
-/*	Update volume filter
+/*	Update output gain. Takes effect with the next buffer handed to libao.
  */
 void BarPlayerSetVolume (player_t * const player) {
 	assert (player != NULL);
 
-	if (player->mode != PLAYER_PLAYING) {
-		return;
+	/* convert from decibel */
+	const float volume = pow (10, (player->settings->volume +
+			(player->gain * player->settings->gainMul)) / 20);
+
+	lockAoplay (player);
+	player->volume = volume;
+	pthread_mutex_unlock (&player->aoplayLock);
+}
+
+/*	Scale interleaved samples, ramping linearly from gain from to gain to over
+ *	the whole buffer to avoid clicks. Plain loops, so the compiler can
+ *	vectorize them.
+ */
+static void applyGainS16 (int16_t * const restrict samples,
+		const size_t frames, const int channels, const float from,
+		const float to) {
+	const size_t n = frames * channels;
+	const float step = (to - from) / (float) n;
+	if (from == to) {
+		if (from == 1.0f) {
+			return;
+		}
+		for (size_t i = 0; i < n; i++) {
+			float v = (float) samples[i] * from;
+			v = v > INT16_MAX ? INT16_MAX : v;
+			v = v < INT16_MIN ? INT16_MIN : v;
+			samples[i] = v;
+		}
+	} else {
+		for (size_t i = 0; i < n; i++) {
+			float v = (float) samples[i] * (from + step * (float) i);
+			v = v > INT16_MAX ? INT16_MAX : v;
+			v = v < INT16_MIN ? INT16_MIN : v;
+			samples[i] = v;
+		}
 	}
+}
 
-	int ret;
-#ifdef HAVE_AVFILTER_GRAPH_SEND_COMMAND
-	/* ffmpeg and libav disagree on the type of this option (string vs. double)
-	 * -> print to string and let them parse it again */
-	char strbuf[16];
-	snprintf (strbuf, sizeof (strbuf), "%fdB",
-			player->settings->volume + (player->gain * player->settings->gainMul));
-	assert (player->fgraph != NULL);
-	if ((ret = avfilter_graph_send_command (player->fgraph, "volume", "volume",
-					strbuf, NULL, 0, 0)) < 0) {
-#else
-	/* convert from decibel */
-	const double volume = pow (10, (player->settings->volume + (player->gain * player->settings->gainMul)) / 20);
-	/* libav does not provide other means to set this right now. it might not
-	 * even work everywhere. */
-	assert (player->fvolume != NULL);
-	if ((ret = av_opt_set_double (player->fvolume->priv, "volume", volume,
-			0)) != 0) {
-#endif
-		printError (player->settings, "Cannot set volume", ret);
+static void applyGainS32 (int32_t * const restrict samples,
+		const size_t frames, const int channels, const float from,
+		const float to) {
+	const size_t n = frames * channels;
+	const double step = (to - from) / (double) n;
+	if (from == to) {
+		if (from == 1.0f) {
+			return;
+		}
+		for (size_t i = 0; i < n; i++) {
+			double v = (double) samples[i] * from;
+			v = v > INT32_MAX ? INT32_MAX : v;
+			v = v < INT32_MIN ? INT32_MIN : v;
+			samples[i] = v;
+		}
+	} else {
+		for (size_t i = 0; i < n; i++) {
+			double v = (double) samples[i] * (from + step * (double) i);
+			v = v > INT32_MAX ? INT32_MAX : v;
+			v = v < INT32_MIN ? INT32_MIN : v;
+			samples[i] = v;
+		}
+	}
+}
+
+/*	Convert float samples starting at frame off of a decoded frame to
+ *	interleaved S16 and scale them in the same pass, instead of converting in
+ *	the filter graph and scaling the result again. The gain at frame k is
+ *	from + step * k.
+ */
+static void convertGainFlt (int16_t * const restrict out,
+		const AVFrame * const frame, const size_t off, const size_t frames,
+		const float from, const float step) {
+	const int channels = frame->ch_layout.nb_channels;
+	if (frame->format == AV_SAMPLE_FMT_FLTP) {
+		const float * const * const in =
+				(const float * const *) frame->extended_data;
+		for (size_t k = 0; k < frames; k++) {
+			const float g = (from + step * (float) (off + k)) * 32768.0f;
+			for (int c = 0; c < channels; c++) {
+				float v = in[c][off + k] * g;
+				v = v > INT16_MAX ? INT16_MAX : v;
+				v = v < INT16_MIN ? INT16_MIN : v;
+				out[k * channels + c] = v;
+			}
+		}
+	} else {
+		const float * const restrict in = (const float *) frame->data[0] +
+				off * channels;
+		for (size_t k = 0; k < frames; k++) {
+			const float g = (from + step * (float) (off + k)) * 32768.0f;
+			for (int c = 0; c < channels; c++) {
+				float v = in[k * channels + c] * g;
+				v = v > INT16_MAX ? INT16_MAX : v;
+				v = v < INT16_MIN ? INT16_MIN : v;
+				out[k * channels + c] = v;
+			}
+		}
 	}
 }
 
+static void applyGain (AVFrame * const frame, const float from,
+		const float to) {
+	const int channels = frame->ch_layout.nb_channels;
+	switch (frame->format) {
+		case AV_SAMPLE_FMT_S16:
+			applyGainS16 ((int16_t *) frame->data[0], frame->nb_samples,
+					channels, from, to);
+			break;
+
+		case AV_SAMPLE_FMT_S32:
+			applyGainS32 ((int32_t *) frame->data[0], frame->nb_samples,
+					channels, from, to);
+			break;
+
+		default:
+			/* getOutputFormat only picks the formats above */
+			assert (0);
+			break;
+	}
+}
+
+/*	Operating on shared variables and must be protected by mutex
+ */
+
+static bool shouldQuit (player_t * const player) {
+	lockPlayer (player);
+	const bool ret = player->doQuit;
+	pthread_mutex_unlock (&player->lock);
+	return ret;
+}
+
+/*	the output thread gave up on the current song, its clock sink is gone
+ */
+static bool outputFailed (player_t * const player) {
+	lockAoplay (player);
+	const bool ret = player->aoplayFailed;
+	pthread_mutex_unlock (&player->aoplayLock);
+	return ret;
+}
+
+/* errors caused by skipping the song are not worth a message */
 #define softfail(msg) \
-	printError (player->settings, msg, ret); \
+	if (!shouldQuit (player)) { \
+		printError (player->settings, msg, ret); \
+	} \
 	return false;
 
 /*	ffmpeg callback for blocking functions, returns 1 to abort function
@@ -168,9 +449,12 @@ void BarPlayerSetVolume (player_t * const player) {
 static int intCb (void * const data) {
 	player_t * const player = data;
 	assert (player != NULL);
-	if (player->interrupted > 1) {
+	if (shouldQuit (player)) {
+		/* song was skipped, abort pending network I/O right away */
+		return 1;
+	} else if (player->interrupted > 1) {
 		/* got a sigint multiple times, quit pianobar (handled by main.c). */
-		pthread_mutex_lock (&player->lock);
+		lockPlayer (player);
 		player->doQuit = true;
 		pthread_mutex_unlock (&player->lock);
 		return 1;
@@ -240,6 +524,9 @@ static bool openStream (player_t * const player) {
 		softfail ("find_decoder");
 	}
 
+	/* decoders supporting it can produce the output format directly */
+	player->cctx->request_sample_fmt = defaultFormat;
+
 	if ((ret = avcodec_open2 (player->cctx, decoder, NULL)) < 0) {
 		softfail ("codec_open2");
 	}
@@ -250,7 +537,7 @@ static bool openStream (player_t * const player) {
 
 	const unsigned int songDuration = av_q2d (player->st->time_base) *
 			(double) player->st->duration;
-	pthread_mutex_lock (&player->lock);
+	lockPlayer (player);
 	player->songPlayed = 0;
 	player->songDuration = songDuration;
 	pthread_mutex_unlock (&player->lock);
@@ -267,7 +554,50 @@ static int getSampleRate (const player_t * const player) {
 			player->settings->sampleRate;
 }
 
-/*	setup filter chain
+static void closeFilter (player_t * const player) {
+	if (player->fgraph != NULL) {
+		avfilter_graph_free (&player->fgraph);
+		player->fgraph = NULL;
+	}
+	player->fabuf = NULL;
+	player->fbufsink = NULL;
+	player->filterFormat[0] = '\0';
+}
+
+/*	Drop whatever is left of the previous song in the filter graph
+ */
+static void flushFilter (player_t * const player) {
+	AVFrame * const frame = player->frame;
+	while (av_buffersink_get_frame (player->fbufsink, frame) >= 0) {
+		av_frame_unref (frame);
+	}
+}
+
+/*	Pick the output sample format. libao takes interleaved integer samples
+ *	only, so the decoder’s format is kept if it is one of those and converted
+ *	to defaultFormat otherwise.
+ */
+static enum AVSampleFormat getOutputFormat (const player_t * const player) {
+	const enum AVSampleFormat fmt = player->cctx->sample_fmt;
+	switch (fmt) {
+		case AV_SAMPLE_FMT_S16:
+		case AV_SAMPLE_FMT_S32:
+			return fmt;
+
+		default:
+			return defaultFormat;
+	}
+}
+
+/*	Float samples are converted to S16 by the output thread while it applies
+ *	the gain, unless the graph resamples anyway
+ */
+static bool convertsOnOutput (const enum AVSampleFormat fmt) {
+	return fmt == AV_SAMPLE_FMT_FLT || fmt == AV_SAMPLE_FMT_FLTP;
+}
+
+/*	setup filter chain, reusing the existing one if the input format did not
+ *	change
  */
 static bool openFilter (player_t * const player) {
 	/* filter setup */
@@ -275,10 +605,6 @@ static bool openFilter (player_t * const player) {
 	int ret = 0;
 	AVCodecParameters * const cp = player->st->codecpar;
 
-	if ((player->fgraph = avfilter_graph_alloc ()) == NULL) {
-		softfail ("graph_alloc");
-	}
-
 	/* abuffer */
 	AVRational time_base = player->st->time_base;
 
@@ -289,28 +615,54 @@ static bool openFilter (player_t * const player) {
 			time_base.num, time_base.den, cp->sample_rate,
 			av_get_sample_fmt_name (player->cctx->sample_fmt),
 			channelLayout);
+
+	if (player->fgraph != NULL && strcmp (player->filterFormat, strbuf) == 0) {
+		debugPrint (DEBUG_AUDIO, "reusing filter graph for %s\n", strbuf);
+		flushFilter (player);
+		return true;
+	}
+	closeFilter (player);
+
+	if ((player->fgraph = avfilter_graph_alloc ()) == NULL) {
+		softfail ("graph_alloc");
+	}
+
 	if ((ret = avfilter_graph_create_filter (&player->fabuf,
 			avfilter_get_by_name ("abuffer"), "source", strbuf, NULL,
 			player->fgraph)) < 0) {
 		softfail ("create_filter abuffer");
 	}
-
-	/* volume */
-	if ((ret = avfilter_graph_create_filter (&player->fvolume,
-			avfilter_get_by_name ("volume"), "volume", "0dB", NULL,
-			player->fgraph)) < 0) {
-		softfail ("create_filter volume");
-	}
-
-	/* aformat: convert float samples into something more usable */
+	/* only remember the format once the graph is complete */
+	char format[sizeof (player->filterFormat)];
+	strcpy (format, strbuf);
+
+	player->outputFormat = getOutputFormat (player);
+	player->filterResamples = getSampleRate (player) != cp->sample_rate;
+	const bool fused = !player->filterResamples &&
+			convertsOnOutput (player->cctx->sample_fmt);
+	const bool convert = !fused &&
+			(player->outputFormat != player->cctx->sample_fmt ||
+			player->filterResamples);
+
+	/* aformat: convert float samples into something more usable, not needed
+	 * if the decoder already produces what the device takes or the output
+	 * thread converts */
 	AVFilterContext *fafmt = NULL;
-	snprintf (strbuf, sizeof (strbuf), "sample_fmts=%s:sample_rates=%d",
-			av_get_sample_fmt_name (avformat), getSampleRate (player));
-	if ((ret = avfilter_graph_create_filter (&fafmt,
-					avfilter_get_by_name ("aformat"), "format", strbuf, NULL,
-					player->fgraph)) < 0) {
-		softfail ("create_filter aformat");
+	if (convert) {
+		snprintf (strbuf, sizeof (strbuf), "sample_fmts=%s:sample_rates=%d",
+				av_get_sample_fmt_name (player->outputFormat),
+				getSampleRate (player));
+		if ((ret = avfilter_graph_create_filter (&fafmt,
+						avfilter_get_by_name ("aformat"), "format", strbuf, NULL,
+						player->fgraph)) < 0) {
+			softfail ("create_filter aformat");
+		}
 	}
+	debugPrint (DEBUG_AUDIO, "decoder produces %s, playing %s%s\n",
+			av_get_sample_fmt_name (player->cctx->sample_fmt),
+			av_get_sample_fmt_name (player->outputFormat),
+			fused ? ", converted with the gain" :
+			(convert ? "" : " without conversion"));
 
 	/* abuffersink */
 	if ((ret = avfilter_graph_create_filter (&player->fbufsink,
@@ -319,10 +671,14 @@ static bool openFilter (player_t * const player) {
 		softfail ("create_filter abuffersink");
 	}
 
-	/* connect filter: abuffer -> volume -> aformat -> abuffersink */
-	if (avfilter_link (player->fabuf, 0, player->fvolume, 0) != 0 ||
-			avfilter_link (player->fvolume, 0, fafmt, 0) != 0 ||
-			avfilter_link (fafmt, 0, player->fbufsink, 0) != 0) {
+	/* connect filter: abuffer -> [aformat ->] abuffersink, volume is applied
+	 * by the output thread */
+	if (convert) {
+		if (avfilter_link (player->fabuf, 0, fafmt, 0) != 0 ||
+				avfilter_link (fafmt, 0, player->fbufsink, 0) != 0) {
+			softfail ("filter_link");
+		}
+	} else if (avfilter_link (player->fabuf, 0, player->fbufsink, 0) != 0) {
 		softfail ("filter_link");
 	}
 
@@ -330,74 +686,69 @@ static bool openFilter (player_t * const player) {
 		softfail ("graph_config");
 	}
 
+	strcpy (player->filterFormat, format);
+
 	return true;
 }
 
-/*	setup libao
+/*	(re)open the zone’s sinks in the filter graph’s output format
  */
 static bool openDevice (player_t * const player) {
 	const AVCodecParameters * const cp = player->st->codecpar;
 
-	ao_sample_format aoFmt;
-	memset (&aoFmt, 0, sizeof (aoFmt));
-	aoFmt.bits = av_get_bytes_per_sample (avformat) * 8;
-	assert (aoFmt.bits > 0);
-	aoFmt.channels = cp->ch_layout.nb_channels;
-	aoFmt.rate = getSampleRate (player);
-	aoFmt.byte_format = AO_FMT_NATIVE;
-
-	int driver = -1;
-	if (player->settings->audioPipe) {
-		// using audio pipe
-		struct stat st;
-		if (stat (player->settings->audioPipe, &st)) {
-			BarUiMsg (player->settings, MSG_ERR, "Cannot stat audio pipe file.\n");
-			return false;
-		}
-		if (!S_ISFIFO (st.st_mode)) {
-			BarUiMsg (player->settings, MSG_ERR, "File is not a pipe, error.\n");
-			return false;
-		}
-		driver = ao_driver_id ("raw");
-		if ((player->aoDev = ao_open_file(driver, player->settings->audioPipe, 1, &aoFmt, NULL)) == NULL) {
-			BarUiMsg (player->settings, MSG_ERR, "Cannot open audio pipe file.\n");
-			return false;
-		}
-	} else {
-		// use driver from libao configuration
-		driver = ao_default_driver_id ();
-		if ((player->aoDev = ao_open_live (driver, &aoFmt, NULL)) == NULL) {
-			BarUiMsg (player->settings, MSG_ERR, "Cannot open audio device.\n");
-			return false;
-		}
+	BarSinkFormat_t format;
+	format.bits = av_get_bytes_per_sample (player->outputFormat) * 8;
+	assert (format.bits > 0);
+	format.channels = cp->ch_layout.nb_channels;
+	format.rate = getSampleRate (player);
+
+	if (!BarSinksOpen (&player->sinks, &format)) {
+		return false;
 	}
+	BarStreamSetFormat (player->stream, format.bits, format.channels,
+			format.rate);
 
 	return true;
 }
 
-/*	Operating on shared variables and must be protected by mutex
- */
-
-static bool shouldQuit (player_t * const player) {
-	pthread_mutex_lock (&player->lock);
-	const bool ret = player->doQuit;
-	pthread_mutex_unlock (&player->lock);
-	return ret;
-}
-
 static void changeMode (player_t * const player, unsigned int mode) {
-	pthread_mutex_lock (&player->lock);
+	lockPlayer (player);
 	player->mode = mode;
 	pthread_mutex_unlock (&player->lock);
+	BarStatusSetState (player->status, mode == PLAYER_PLAYING ?
+			BAR_STATUS_PLAYING : BAR_STATUS_LOADING);
 }
 
 BarPlayerMode BarPlayerGetMode (player_t * const player) {
-	pthread_mutex_lock (&player->lock);
+	lockPlayer (player);
 	const BarPlayerMode ret = player->mode;
 	pthread_mutex_unlock (&player->lock);
 	return ret;
 }
 
+/*	Feed the download throughput estimate with the bytes read during the
+ *	last song and the time spent waiting for them. Waiting for the output
+ *	thread does not count, so a paced download still measures the link.
+ */
+static void updateThroughput (player_t * const player, const int64_t bytes,
+		const int64_t us) {
+	/* too little data to say anything about the link */
+	if (bytes < minThroughputBytes || us <= 0) {
+		return;
+	}
+	const double sample = (double) bytes * 8 * 1000000 / (double) us;
+
+	lockPlayer (player);
+	player->throughput = player->throughput == 0 ? sample :
+			0.7 * player->throughput + 0.3 * sample;
+	debugPrint (DEBUG_AUDIO, "download throughput %.0f bit/s, estimate %u "
+			"bit/s\n", sample, player->throughput);
+	const unsigned int throughput = player->throughput;
+	const unsigned int underruns = player->underruns;
+	pthread_mutex_unlock (&player->lock);
+	BarStatusSetStats (player->status, throughput, underruns);
+}
+
 /*	decode and play stream. returns 0 or av error code.
  */
 static int play (player_t * const player) {
@@ -405,43 +756,51 @@ static int play (player_t * const player) {
 	const int64_t minBufferHealth = player->settings->bufferSecs;
 	AVCodecContext * const cctx = player->cctx;
 
-	AVPacket *pkt = av_packet_alloc ();
-	assert (pkt != NULL);
-	pkt->data = NULL;
-	pkt->size = 0;
+	AVPacket * const pkt = player->pkt;
+	AVFrame * const frame = player->frame;
+
+	/* hand the song over to the output thread */
+	lockAoplay (player);
+	player->aoplaySong = true;
+	player->aoplayEof = false;
+	player->aoplayFailed = false;
+	pthread_cond_broadcast (&player->aoplayCond);
+	pthread_mutex_unlock (&player->aoplayLock);
 
-	AVFrame *frame = NULL;
-	frame = av_frame_alloc ();
-	assert (frame != NULL);
-	pthread_t aoplaythread;
-	pthread_create (&aoplaythread, NULL, BarAoPlayThread, player);
 	enum { FILL, DRAIN, DONE } drainMode = FILL;
 	int ret = 0;
 	const double timeBase = av_q2d (player->st->time_base);
-	while (!shouldQuit (player) && drainMode != DONE) {
+	int64_t readBytes = 0, readUs = 0;
+	/* buffer reached buffer_seconds once and is below half of it now, the
+	 * download does not keep up long before the output runs dry */
+	bool filled = false, low = false;
+	unsigned int bufferLows = 0;
+	bool failed = false;
+	while (!shouldQuit (player) && !failed && drainMode != DONE) {
 		if (drainMode == FILL) {
+			const int64_t readStart = monotonicUs ();
 			ret = av_read_frame (player->fctx, pkt);
+			readUs += monotonicUs () - readStart;
+			if (ret >= 0) {
+				readBytes += pkt->size;
+				__atomic_add_fetch (&player->stats.bytes, pkt->size,
+						__ATOMIC_RELAXED);
+			}
 			if (ret == AVERROR_EOF) {
 				/* enter drain mode */
 				drainMode = DRAIN;
 				avcodec_send_packet (cctx, NULL);
-				debugPrint (DEBUG_AUDIO, "decoder entering drain mode after EOF\n");
+				BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_DECODER_DRAIN, 0, 0);
 			} else if (pkt->stream_index != player->streamIdx) {
 				/* unused packet */
 				av_packet_unref (pkt);
 				continue;
 			} else if (ret < 0) {
 				/* error, abort */
-				/* mark the EOF, so that BarAoPlayThread can quit*/
-				char error[AV_ERROR_MAX_STRING_SIZE];
-				if (av_strerror(ret, error, sizeof(error)) < 0) {
-					strncpy (error, "(unknown)", sizeof(error)-1);
-				}
-				debugPrint (DEBUG_AUDIO, "av_read_frame failed with code %i (%s), "
-						"sending NULL frame\n", ret, error);
-				pthread_mutex_lock (&player->aoplayLock);
-				const int rt = av_buffersrc_add_frame (player->fabuf, NULL);
-				assert (rt == 0);
+				/* mark the end, so that BarAoPlayThread can quit*/
+				BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_DECODER_ERROR, ret, 0);
+				lockAoplay (player);
+				player->aoplayEof = true;
 				pthread_cond_broadcast (&player->aoplayCond);
 				pthread_mutex_unlock (&player->aoplayLock);
 				break;
@@ -451,16 +810,22 @@ static int play (player_t * const player) {
 			}
 		}
 
-		while (!shouldQuit (player)) {
+		while (!shouldQuit (player) && !failed) {
 			ret = avcodec_receive_frame (cctx, frame);
 			if (ret == AVERROR_EOF) {
 				/* done draining */
 				drainMode = DONE;
-				/* mark the EOF*/
-				debugPrint (DEBUG_AUDIO, "receive_frame got EOF, sending NULL frame\n");
-				pthread_mutex_lock (&player->aoplayLock);
-				const int rt = av_buffersrc_add_frame (player->fabuf, NULL);
-				assert (rt == 0);
+				/* mark the end of the song. The buffer source is only closed
+				 * if the resampler still holds the song’s tail, otherwise the
+				 * graph is reused for the next one. */
+				BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_DECODER_EOF, 0, 0);
+				lockAoplay (player);
+				if (player->filterResamples) {
+					av_buffersrc_add_frame (player->fabuf, NULL);
+					/* a closed source takes no more frames */
+					player->filterFormat[0] = '\0';
+				}
+				player->aoplayEof = true;
 				pthread_cond_broadcast (&player->aoplayCond);
 				pthread_mutex_unlock (&player->aoplayLock);
 				break;
@@ -469,50 +834,76 @@ static int play (player_t * const player) {
 				break;
 			}
 
+			__atomic_add_fetch (&player->stats.frames, 1, __ATOMIC_RELAXED);
+
 			/* XXX: suppresses warning from resample filter */
 			if (frame->pts == (int64_t) AV_NOPTS_VALUE) {
 				frame->pts = 0;
 			}
-			pthread_mutex_lock (&player->aoplayLock);
+			lockAoplay (player);
 			ret = av_buffersrc_write_frame (player->fabuf, frame);
 			assert (ret >= 0);
+			const double buffered = timeBase *
+					(double) (frame->pts - player->lastTimestamp);
 			pthread_mutex_unlock (&player->aoplayLock);
+			BarStatusSetBuffer (player->status,
+					buffered > 0 ? buffered * 1000 : 0);
+			if (buffered >= minBufferHealth) {
+				filled = true;
+				low = false;
+			} else if (filled && !low && buffered < minBufferHealth / 2.0) {
+				low = true;
+				++bufferLows;
+			}
 			
 			int64_t bufferHealth = 0;
 			do {
-				pthread_mutex_lock (&player->aoplayLock);
+				lockAoplay (player);
 				bufferHealth = timeBase * (double) (frame->pts - player->lastTimestamp);
-				if (bufferHealth > minBufferHealth) {
-					debugPrint (DEBUG_AUDIO, "decoding buffer filled health %"PRIi64" minHealth %"PRIi64"\n",
+				/* nobody consumes what a failed output left behind */
+				failed = player->aoplayFailed;
+				if (bufferHealth > minBufferHealth && !failed) {
+					BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_BUFFER_FULL,
 							bufferHealth, minBufferHealth);
 					/* Buffer get healthy, resume */
 					pthread_cond_broadcast (&player->aoplayCond);
 					/* Buffer is healthy enough, wait */
 					pthread_cond_wait (&player->aoplayCond, &player->aoplayLock);
-					debugPrint (DEBUG_AUDIO, "ao play signalled it needs more data health %"PRIi64" minHealth %"PRIi64"\n",
-							bufferHealth, minBufferHealth);
+					BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_BUFFER_WAKE,
+							timeBase * (double) (frame->pts -
+							player->lastTimestamp), 0);
 				}
 				pthread_mutex_unlock (&player->aoplayLock);
-			} while (bufferHealth > minBufferHealth);
+				/* the output thread stops consuming once the song is skipped */
+			} while (bufferHealth > minBufferHealth && !failed &&
+					!shouldQuit (player));
 		}
 
 		av_packet_unref (pkt);
 	}
-	av_frame_free (&frame);
-	av_packet_free (&pkt);
-	debugPrint (DEBUG_AUDIO, "decoder is done, waiting for ao player\n");
-	pthread_join (aoplaythread, NULL);
+	av_packet_unref (pkt);
+	av_frame_unref (frame);
+	lockPlayer (player);
+	player->bufferLows += bufferLows;
+	pthread_mutex_unlock (&player->lock);
+	updateThroughput (player, readBytes, readUs);
+	BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_DECODER_DONE, readBytes, readUs);
+
+	/* wait until the output thread is done with this song, it must not touch
+	 * the filter graph once we free it */
+	lockAoplay (player);
+	pthread_cond_broadcast (&player->aoplayCond);
+	while (player->aoplaySong) {
+		pthread_cond_wait (&player->aoplayCond, &player->aoplayLock);
+	}
+	pthread_mutex_unlock (&player->aoplayLock);
 
 	return ret;
 }
 
+/*	Release per-song resources. Filter graph and device stay around.
+ */
 static void finish (player_t * const player) {
-	ao_close (player->aoDev);
-	player->aoDev = NULL;
-	if (player->fgraph != NULL) {
-		avfilter_graph_free (&player->fgraph);
-		player->fgraph = NULL;
-	}
 	if (player->cctx != NULL) {
 		avcodec_free_context (&player->cctx);
 		player->cctx = NULL;
@@ -522,32 +913,55 @@ static void finish (player_t * const player) {
 	}
 }
 
-/*	player thread; for every song a new thread is started
- *	@param audioPlayer structure
- *	@return PLAYER_RET_*
+/*	Block until the next command arrives
  */
-void *BarPlayerThread (void *data) {
-	assert (data != NULL);
+static BarPlayerCmd waitCmd (player_t * const player) {
+	lockPlayer (player);
+	while (player->cmd == PLAYER_CMD_NONE) {
+		pthread_cond_wait (&player->cond, &player->lock);
+	}
+	const BarPlayerCmd cmd = player->cmd;
+	pthread_mutex_unlock (&player->lock);
+	return cmd;
+}
 
-	player_t * const player = data;
-	uintptr_t pret = PLAYER_RET_OK;
+/*	Play a single song, the former body of BarPlayerThread
+ *	@return PLAYER_RET_*
+ */
+static int playSong (player_t * const player) {
+	int pret = PLAYER_RET_OK;
 
 	bool retry;
 	do {
 		retry = false;
+		const int64_t openStart = monotonicUs ();
 		if (openStream (player)) {
+			const int64_t openMs = (monotonicUs () - openStart) / 1000;
+			BarHistogramObserve (&player->stats.openLatency, openBucketMs,
+					openMs);
+			BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_SONG_OPEN, openMs,
+					player->songDuration);
 			if (openFilter (player) && openDevice (player)) {
 				changeMode (player, PLAYER_PLAYING);
 				BarPlayerSetVolume (player);
 				const int ret = play (player);
-				retry = (ret == AVERROR_INVALIDDATA ||
-						 ret == -ECONNRESET) &&
-						!player->interrupted;
+				if (outputFailed (player)) {
+					/* audio device went away mid-song */
+					pret = PLAYER_RET_HARDFAIL;
+				} else {
+					retry = (ret == AVERROR_INVALIDDATA ||
+							 ret == -ECONNRESET) &&
+							!player->interrupted && !shouldQuit (player);
+				}
 			} else {
-				/* filter missing or audio device busy */
-				pret = PLAYER_RET_HARDFAIL;
+				/* a half-built graph must not be reused */
+				closeFilter (player);
+				if (!shouldQuit (player)) {
+					/* filter missing or audio device busy */
+					pret = PLAYER_RET_HARDFAIL;
+				}
 			}
-		} else {
+		} else if (!shouldQuit (player)) {
 			/* stream not found */
 			pret = PLAYER_RET_SOFTFAIL;
 		}
@@ -555,75 +969,377 @@ void *BarPlayerThread (void *data) {
 		finish (player);
 	} while (retry);
 
-	changeMode (player, PLAYER_FINISHED);
-
-	return (void *) pret;
+	return pret;
 }
 
-void *BarAoPlayThread (void *data) {
+/*	decoder thread; lives as long as the player and plays one song per
+ *	PLAYER_CMD_PLAY
+ *	@param audioPlayer structure
+ */
+void *BarPlayerThread (void *data) {
 	assert (data != NULL);
 
 	player_t * const player = data;
+	BarPlayerTraceThread (player, "decoder");
+
+	player->pkt = av_packet_alloc ();
+	assert (player->pkt != NULL);
+	player->frame = av_frame_alloc ();
+	assert (player->frame != NULL);
+
+	while (waitCmd (player) == PLAYER_CMD_PLAY) {
+		const int pret = playSong (player);
+
+		lockPlayer (player);
+		if (player->cmd == PLAYER_CMD_PLAY) {
+			player->cmd = PLAYER_CMD_NONE;
+		}
+		player->ret = pret;
+		player->mode = PLAYER_FINISHED;
+		pthread_mutex_unlock (&player->lock);
+		BarStatusSetState (player->status, BAR_STATUS_STOPPED);
+	}
+
+	/* the output thread is idle by now. A song opened after
+	 * BarPlayerDestroy aborted the sinks cleared that, quit must not wait
+	 * for queued audio either way. */
+	closeFilter (player);
+	BarSinksAbort (&player->sinks);
+	BarSinksClose (&player->sinks);
+	BarSinksDestroy (&player->sinks);
+	av_frame_free (&player->frame);
+	av_packet_free (&player->pkt);
+	debugPrint (DEBUG_AUDIO, "decoder thread is done\n");
+
+	return (void *) 0;
+}
+
+/*	Take the time since the pending pause/skip command, the output thread is
+ *	acting on it now. Must be called with player->lock held.
+ *	@return microseconds or -1 if there is none
+ */
+static int64_t takeControlLatency (player_t * const player) {
+	if (!player->commandPending ||
+			(!player->doPause && !player->doQuit)) {
+		return -1;
+	}
+	player->commandPending = false;
+	const int64_t us = monotonicUs () - player->commandTime;
+	return us > 0 ? us : 0;
+}
+
+/*	Record a command-to-silence latency, needs no lock
+ */
+static void recordControlLatency (player_t * const player, const int64_t us) {
+	BarHistogramObserve (&player->stats.controlLatency, controlBucketUs, us);
+	BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_CONTROL_LATENCY, us, 0);
+	if (us > controlBudgetUs) {
+		debugPrint (DEBUG_AUDIO, "control latency %"PRIi64" us exceeds the "
+				"budget of %"PRIi64" us\n", us, controlBudgetUs);
+	}
+}
 
-	AVFrame *filteredFrame = NULL;
-	filteredFrame = av_frame_alloc ();
-	assert (filteredFrame != NULL);
+/*	Block while paused
+ *	@return false if the song was skipped
+ */
+static bool waitPaused (player_t * const player) {
+	lockPlayer (player);
+	const int64_t latency = takeControlLatency (player);
+	if (latency >= 0) {
+		pthread_mutex_unlock (&player->lock);
+		recordControlLatency (player, latency);
+		lockPlayer (player);
+	}
+	if (player->doPause && !player->doQuit) {
+		BarStatusSetPaused (player->status, true);
+		BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_PAUSED, 0, 0);
+		do {
+			pthread_cond_wait (&player->cond, &player->lock);
+		} while (player->doPause && !player->doQuit);
+		BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_RESUMED, 0, 0);
+		BarStatusSetPaused (player->status, false);
+	}
+	const bool ret = !player->doQuit;
+	pthread_mutex_unlock (&player->lock);
+	return ret;
+}
+
+/*	Note the time a pause or skip command was issued. Must be called with
+ *	player->lock held.
+ */
+void BarPlayerNoteCommand (player_t * const player) {
+	player->commandTime = monotonicUs ();
+	player->commandPending = true;
+}
+
+/*	Play back the current song’s filter graph output
+ */
+static void aoPlaySong (player_t * const player) {
+	AVFrame * const filteredFrame = player->filteredFrame;
 
 	int ret;
 	const double timeBase = av_q2d (av_buffersink_get_time_base (player->fbufsink)),
 			timeBaseSt = av_q2d (player->st->time_base);
+
+	/* the song starts at its target gain, no ramp needed */
+	lockAoplay (player);
+	float volume = player->volume;
+	pthread_mutex_unlock (&player->aoplayLock);
+
+	/* chunks of float frames are converted into outputBuf, grown here so it
+	 * is not reallocated while playing */
+	const int chunkSamples = player->sinks.format.rate * controlChunkMs /
+			1000 + 1;
+	const size_t chunkBytes = chunkSamples * player->sinks.format.channels *
+			sizeof (*player->outputBuf);
+	if (chunkBytes > player->outputBufSize) {
+		BarRealtimeUnlock (player->outputBuf, player->outputBufSize,
+				player->settings);
+		free (player->outputBuf);
+		player->outputBuf = malloc (chunkBytes);
+		assert (player->outputBuf != NULL);
+		player->outputBufSize = chunkBytes;
+		BarRealtimeLock (player->outputBuf, chunkBytes, player->settings);
+	}
+
+	/* running dry after playback started is an underrun */
+	bool started = false;
+	unsigned int underruns = 0;
+	/* last position written to the status page */
+	unsigned int reported = 0;
+
 	while (!shouldQuit(player)) {
-		pthread_mutex_lock (&player->aoplayLock);
+		lockAoplay (player);
 		ret = av_buffersink_get_frame (player->fbufsink, filteredFrame);
-		if (ret == AVERROR_EOF || shouldQuit (player)) {
+		if (ret == AVERROR_EOF || (ret < 0 && player->aoplayEof) ||
+				shouldQuit (player)) {
 			/* we are done here */
 			pthread_mutex_unlock (&player->aoplayLock);
-			debugPrint (DEBUG_AUDIO, "ao player got EOF, exiting\n");
+			BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_OUTPUT_EOF, 0, 0);
 			break;
 		} else if (ret < 0) {
 			/* wait for more frames */
-			debugPrint (DEBUG_AUDIO, "ao player is waiting for more frames after code %i (%s)\n",
-					ret, av_err2str (ret));
+			if (started) {
+				++underruns;
+			}
+			/* waking up without data again is the same underrun */
+			BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_OUTPUT_STARVED, ret,
+					started ? underruns : 0);
+			started = false;
 			pthread_cond_broadcast (&player->aoplayCond);
 			pthread_cond_wait (&player->aoplayCond, &player->aoplayLock);
 			pthread_mutex_unlock (&player->aoplayLock);
 			continue;
 		}
+		const float targetVolume = player->volume;
 		pthread_mutex_unlock (&player->aoplayLock);
+		started = true;
+
+		/* float frames are converted chunk by chunk below */
+		const bool fused = filteredFrame->format != player->outputFormat;
+		const float step = (targetVolume - volume) /
+				(float) filteredFrame->nb_samples;
+		if (!fused && (volume != 1.0f || targetVolume != 1.0f)) {
+			/* the frame may share its buffers with the decoder or filter
+			 * graph, scale a copy then */
+			if (av_frame_make_writable (filteredFrame) < 0) {
+				/* better skip it than play it too loud */
+				debugPrint (DEBUG_AUDIO, "cannot apply gain, dropping "
+						"frame\n");
+				av_frame_unref (filteredFrame);
+				continue;
+			}
+			applyGain (filteredFrame, volume, targetVolume);
+		}
 
-		const int numChannels = filteredFrame->ch_layout.nb_channels;
-		const int bps = av_get_bytes_per_sample (filteredFrame->format);
-		ao_play (player->aoDev, (char *) filteredFrame->data[0],
-				filteredFrame->nb_samples * numChannels * bps);
+		/* hand the frame to the sinks in small chunks, so pause and skip are
+		 * noticed quickly */
+		const size_t frameBytes = player->sinks.format.channels *
+				player->sinks.format.bits / 8;
+		bool quit = false;
+		for (int off = 0; off < filteredFrame->nb_samples && !quit;
+				off += chunkSamples) {
+			const int remaining = filteredFrame->nb_samples - off;
+			const int n = remaining < chunkSamples ? remaining : chunkSamples;
+			const char *chunk = (char *) filteredFrame->data[0] +
+					off * frameBytes;
+			if (fused) {
+				convertGainFlt (player->outputBuf, filteredFrame, off, n, volume,
+						step);
+				chunk = (const char *) player->outputBuf;
+			}
+			if (!BarSinksWrite (&player->sinks, chunk, n * frameBytes)) {
+				/* the clock is gone, nothing paces the song anymore */
+				lockAoplay (player);
+				player->aoplayFailed = true;
+				pthread_cond_broadcast (&player->aoplayCond);
+				pthread_mutex_unlock (&player->aoplayLock);
+				quit = true;
+				break;
+			}
+			BarStreamWrite (player->stream, chunk, n * frameBytes);
+			quit = !waitPaused (player);
+		}
+		volume = targetVolume;
+		if (quit) {
+			BarTrace (BAR_TRACE_AUDIO, BAR_TRACE_OUTPUT_ABORT, 0, 0);
+			break;
+		}
 
 		const double timestamp = (double) filteredFrame->pts * timeBase;
 		const unsigned int songPlayed = timestamp;
 
-		pthread_mutex_lock (&player->lock);
+		lockPlayer (player);
 		player->songPlayed = songPlayed;
-		/* pausing */
-		if (player->doPause) {
-			do {
-				debugPrint (DEBUG_AUDIO, "ao player is paused\n");
-				pthread_cond_wait (&player->cond, &player->lock);
-			} while (player->doPause);
-			debugPrint (DEBUG_AUDIO, "ao player continues\n");
-		}
 		pthread_mutex_unlock (&player->lock);
+		if (songPlayed != reported) {
+			BarStatusSetPosition (player->status, songPlayed);
+			reported = songPlayed;
+		}
 
 		/* lastTimestamp must be the last pts, but expressed in terms of
 		 * st->time_base, not the sink’s time_base. */
 		const int64_t lastTimestamp = timestamp/timeBaseSt;
 		/* notify download thread, we might need more data */
-		pthread_mutex_lock (&player->aoplayLock);
+		lockAoplay (player);
 		player->lastTimestamp = lastTimestamp;
 		pthread_cond_broadcast (&player->aoplayCond);
 		pthread_mutex_unlock (&player->aoplayLock);
 
 		av_frame_unref (filteredFrame);
 	}
-	av_frame_free (&filteredFrame);
+	av_frame_unref (filteredFrame);
+	if (shouldQuit (player)) {
+		/* what is still queued must not be heard after a skip */
+		BarSinksFlush (&player->sinks);
+	}
+
+	lockPlayer (player);
+	player->underruns += underruns;
+	__atomic_add_fetch (&player->stats.underruns, underruns, __ATOMIC_RELAXED);
+	const unsigned int totalUnderruns = player->underruns;
+	const unsigned int throughput = player->throughput;
+	pthread_mutex_unlock (&player->lock);
+	BarStatusSetStats (player->status, throughput, totalUnderruns);
+}
+
+/*	output thread; lives as long as the player and plays whatever the decoder
+ *	thread hands over
+ */
+void *BarAoPlayThread (void *data) {
+	assert (data != NULL);
+
+	player_t * const player = data;
+	BarPlayerTraceThread (player, "output");
+	__atomic_store_n (&player->stats.scheduling,
+			BarRealtimeThread (player->settings), __ATOMIC_RELAXED);
+
+	player->filteredFrame = av_frame_alloc ();
+	assert (player->filteredFrame != NULL);
+
+	lockAoplay (player);
+	while (true) {
+		while (!player->aoplaySong && !player->aoplayExit) {
+			pthread_cond_wait (&player->aoplayCond, &player->aoplayLock);
+		}
+		if (!player->aoplaySong) {
+			break;
+		}
+		pthread_mutex_unlock (&player->aoplayLock);
+
+		aoPlaySong (player);
+
+		lockAoplay (player);
+		player->aoplaySong = false;
+		pthread_cond_broadcast (&player->aoplayCond);
+	}
+	pthread_mutex_unlock (&player->aoplayLock);
+
+	av_frame_free (&player->filteredFrame);
+	BarRealtimeUnlock (player->outputBuf, player->outputBufSize,
+			player->settings);
+	free (player->outputBuf);
+	player->outputBuf = NULL;
+	player->outputBufSize = 0;
 	debugPrint (DEBUG_AUDIO, "ao player is done\n");
 
 	return (void *) 0;
 }
+
+/*	append audio metrics of players to buf, labelled with their zone
+ */
+void BarPlayerMetrics (BarMetricsBuf_t * const buf, player_t * const players[],
+		const size_t count) {
+	const struct {
+		const char *name, *help;
+		size_t offset;
+	} counters[] = {
+		{"pianobar_audio_bytes_total", "Audio data downloaded.",
+				offsetof (player_t, stats.bytes)},
+		{"pianobar_audio_frames_total", "Audio frames decoded.",
+				offsetof (player_t, stats.frames)},
+		{"pianobar_audio_underruns_total", "Times the output ran dry.",
+				offsetof (player_t, stats.underruns)},
+	};
+	for (size_t i = 0; i < sizeof (counters) / sizeof (*counters); i++) {
+		BarMetricsFamily (buf, counters[i].name, "counter", counters[i].help);
+		for (size_t j = 0; j < count; j++) {
+			unsigned long * const v = (unsigned long *) ((char *) players[j] +
+					counters[i].offset);
+			char labels[32];
+			snprintf (labels, sizeof (labels), "zone=\"%zu\"", j + 1);
+			BarMetricsValue (buf, counters[i].name, labels,
+					__atomic_load_n (v, __ATOMIC_RELAXED));
+		}
+	}
+
+	const struct {
+		const char *name, *help;
+		size_t offset;
+		unsigned int base;
+		double scale;
+	} histograms[] = {
+		{"pianobar_track_open_seconds", "Time until a song is ready to "
+				"decode.", offsetof (player_t, stats.openLatency),
+				openBucketMs, 1000},
+		{"pianobar_player_lock_wait_seconds", "Time spent waiting for the "
+				"contended player lock.", offsetof (player_t, stats.lockWait),
+				lockWaitBucketUs, 1e6},
+		{"pianobar_aoplay_lock_wait_seconds", "Time spent waiting for the "
+				"contended output lock.",
+				offsetof (player_t, stats.aoplayLockWait), lockWaitBucketUs,
+				1e6},
+		{"pianobar_control_latency_seconds", "Time from pause or skip until "
+				"the output stops.", offsetof (player_t, stats.controlLatency),
+				controlBucketUs, 1e6},
+	};
+	for (size_t i = 0; i < sizeof (histograms) / sizeof (*histograms); i++) {
+		BarMetricsFamily (buf, histograms[i].name, "histogram",
+				histograms[i].help);
+		for (size_t j = 0; j < count; j++) {
+			const BarHistogram_t * const h = (const BarHistogram_t *)
+					((const char *) players[j] + histograms[i].offset);
+			char labels[32];
+			snprintf (labels, sizeof (labels), "zone=\"%zu\"", j + 1);
+			BarMetricsHistogram (buf, histograms[i].name, labels, h,
+					histograms[i].base, histograms[i].scale);
+		}
+	}
+
+	/* tells underruns with and without real-time output apart */
+	BarMetricsFamily (buf, "pianobar_audio_scheduling_info", "gauge",
+			"Scheduling the output thread got.");
+	for (size_t j = 0; j < count; j++) {
+		char labels[64];
+		snprintf (labels, sizeof (labels), "zone=\"%zu\",policy=\"%s\"",
+				j + 1, BarRealtimeName (__atomic_load_n (
+				&players[j]->stats.scheduling, __ATOMIC_RELAXED)));
+		BarMetricsValue (buf, "pianobar_audio_scheduling_info", labels, 1);
+	}
+
+	BarSinkSet_t *sinks[BAR_MAX_ZONES];
+	for (size_t j = 0; j < count; j++) {
+		sinks[j] = &players[j]->sinks;
+	}
+	BarSinksMetrics (buf, sinks, count);
+}
@@ -30,14 +30,18 @@ THE SOFTWARE.
 #include <pthread.h>
 #include <stdint.h>
 #include <signal.h>
+#include <time.h>
 
-#include <ao/ao.h>
 #include <libavformat/avformat.h>
 #include <libavfilter/avfilter.h>
 #include <libavcodec/avcodec.h>
 #include <piano.h>
 
 #include "settings.h"
+#include "status.h"
+#include "metrics.h"
+#include "stream.h"
+#include "sink.h"
 
 typedef enum {
 	/* not running */
@@ -50,12 +54,36 @@ typedef enum {
 	PLAYER_FINISHED,
 } BarPlayerMode;
 
+typedef enum {
+	PLAYER_CMD_NONE = 0,
+	/* play the song set up in url/gain */
+	PLAYER_CMD_PLAY,
+	/* shut down worker threads */
+	PLAYER_CMD_EXIT,
+} BarPlayerCmd;
+
 typedef struct {
 	/* public attributes protected by mutex */
 	pthread_mutex_t lock, aoplayLock;
 	pthread_cond_t cond, aoplayCond; /* broadcast changes to doPause */
 	bool doQuit, doPause;
 
+	/* command for the decoder thread and result of the last song, protected
+	 * by lock */
+	BarPlayerCmd cmd;
+	int ret;
+
+	/* time of the last pause/skip command the output thread has not acted
+	 * on yet, protected by lock */
+	int64_t commandTime;
+	bool commandPending;
+
+	/* estimated download rate in bit/s (0 if unknown), number of times
+	 * the output ran dry and the buffer fell below half of buffer_seconds
+	 * after it was filled during the current song, protected by lock */
+	unsigned int throughput;
+	unsigned int underruns, bufferLows;
+
 	/* measured in seconds */
 	unsigned int songDuration;
 	unsigned int songPlayed;
@@ -65,7 +93,6 @@ typedef struct {
 	/* private attributes _not_ protected by mutex */
 
 	/* libav */
-	AVFilterContext *fvolume;
 	AVFilterGraph *fgraph;
 	AVFormatContext *fctx;
 	AVStream *st;
@@ -75,12 +102,53 @@ typedef struct {
 	int64_t lastTimestamp;
 	sig_atomic_t interrupted;
 
-	ao_device *aoDev;
+	/* output thread owns the current song/is asked to exit, decoder is done
+	 * with the current song, the clock sink failed during it, protected by
+	 * aoplayLock */
+	bool aoplaySong, aoplayExit, aoplayEof, aoplayFailed;
+	/* linear gain applied by the output thread, protected by aoplayLock */
+	float volume;
+
+	/* worker threads and their buffers, kept across songs */
+	pthread_t decoderThread, aoplayThread;
+	AVPacket *pkt;
+	AVFrame *frame, *filteredFrame;
+	/* float samples converted by the output thread, owned by it */
+	int16_t *outputBuf;
+	size_t outputBufSize;
+
+	/* filter graph and sinks are kept across songs and only rebuilt if
+	 * their format changes, or the graph had to be flushed */
+	char filterFormat[256];
+	enum AVSampleFormat outputFormat;
+	/* the graph resamples and holds back the end of a song until its
+	 * source is closed */
+	bool filterResamples;
+	BarSinkSet_t sinks;
 
 	/* settings (must be set before starting the thread) */
 	double gain;
 	char *url;
 	const BarSettings_t *settings;
+	/* output device and cpu of this player’s zone */
+	const BarZoneSettings_t *zone;
+	/* zone’s part of the status page, may be NULL */
+	BarStatusSlot_t *status;
+	/* zone’s audio stream, may be NULL */
+	BarStreamFeed_t *stream;
+
+	/* lifetime counters for the metrics endpoint, updated atomically */
+	struct {
+		unsigned long bytes, frames, underruns;
+		/* milliseconds until a song is ready to decode */
+		BarHistogram_t openLatency;
+		/* microseconds spent waiting for a contended lock */
+		BarHistogram_t lockWait, aoplayLockWait;
+		/* microseconds from pause/skip until the output stops */
+		BarHistogram_t controlLatency;
+		/* what the output thread got, see realtime.c */
+		BarSchedPolicy_t scheduling;
+	} stats;
 } player_t;
 
 enum {PLAYER_RET_OK = 0, PLAYER_RET_HARDFAIL = 1, PLAYER_RET_SOFTFAIL = 2};
@@ -88,8 +156,14 @@ enum {PLAYER_RET_OK = 0, PLAYER_RET_HARDFAIL = 1, PLAYER_RET_SOFTFAIL = 2};
 void *BarPlayerThread (void *data);
 void *BarAoPlayThread (void *data);
 void BarPlayerSetVolume (player_t * const player);
-void BarPlayerInit (player_t * const p, const BarSettings_t * const settings);
+void BarPlayerInit (player_t * const p, const BarSettings_t * const settings,
+		const BarZoneSettings_t * const zone);
 void BarPlayerReset (player_t * const p);
+void BarPlayerStart (player_t * const p);
+void BarPlayerNoteCommand (player_t * const player);
 void BarPlayerDestroy (player_t * const p);
+void BarPlayerShutdown (void);
 BarPlayerMode BarPlayerGetMode (player_t * const player);
+void BarPlayerMetrics (BarMetricsBuf_t * const, player_t * const [],
+		const size_t);
 
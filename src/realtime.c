@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* scheduling of the audio output path. Everything here is opt-in and falls
+ * back quietly: a thread that may not use a real-time policy is reniced
+ * instead, memory that cannot be locked is at least faulted in up front, and
+ * mutexes only inherit priorities if some thread runs at a raised one.
+ */
+
+#ifdef __linux__
+/* syscall, must come before any system header */
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "realtime.h"
+#include "debug.h"
+
+/* nice value of output threads that may not run real-time */
+static const int fallbackNice = -10;
+/* stack faulted in and locked by output threads, so a deeper call does not
+ * page fault in the middle of a write */
+#define STACK_PREFAULT (64*1024)
+
+/*	init mutex handed between the output threads and others. With real-time
+ *	output threads it inherits the priority of its waiters, so a low priority
+ *	holder cannot keep a real-time thread waiting behind unrelated work.
+ */
+void BarRealtimeMutexInit (pthread_mutex_t * const m,
+		const BarSettings_t * const settings) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init (&attr);
+#if defined(_POSIX_THREAD_PRIO_INHERIT) && _POSIX_THREAD_PRIO_INHERIT > 0
+	if (settings->audioScheduler != BAR_SCHED_OTHER) {
+		pthread_mutexattr_setprotocol (&attr, PTHREAD_PRIO_INHERIT);
+	}
+#endif
+	pthread_mutex_init (m, &attr);
+	pthread_mutexattr_destroy (&attr);
+}
+
+/*	lower the calling thread’s nice value
+ */
+static BarSchedPolicy_t BarRealtimeNice (void) {
+#ifdef __linux__
+	/* linux threads have a nice value of their own */
+	if (setpriority (PRIO_PROCESS, syscall (SYS_gettid), fallbackNice) == 0) {
+		return BAR_SCHED_NICE;
+	}
+	debugPrint (DEBUG_AUDIO, "cannot renice output thread: %s\n",
+			strerror (errno));
+#endif
+	return BAR_SCHED_OTHER;
+}
+
+/*	raise the calling output thread to the configured policy and fault in its
+ *	stack
+ *	@return policy the thread actually got
+ */
+BarSchedPolicy_t BarRealtimeThread (const BarSettings_t * const settings) {
+	volatile char stack[STACK_PREFAULT];
+	memset ((char *) stack, 0, sizeof (stack));
+	if (settings->audioMlock && mlock ((char *) stack, sizeof (stack)) != 0) {
+		debugPrint (DEBUG_AUDIO, "cannot lock output thread stack: %s\n",
+				strerror (errno));
+	}
+
+	if (settings->audioScheduler == BAR_SCHED_OTHER) {
+		return BAR_SCHED_OTHER;
+	} else if (settings->audioScheduler == BAR_SCHED_NICE) {
+		return BarRealtimeNice ();
+	}
+
+	const int policy = settings->audioScheduler == BAR_SCHED_FIFO ?
+			SCHED_FIFO : SCHED_RR;
+	int priority = settings->audioPriority;
+	const int min = sched_get_priority_min (policy),
+			max = sched_get_priority_max (policy);
+	if (priority < min) {
+		priority = min;
+	} else if (priority > max) {
+		priority = max;
+	}
+#ifdef RLIMIT_RTPRIO
+	/* unprivileged users may be granted real-time up to a limit */
+	struct rlimit limit;
+	if (getrlimit (RLIMIT_RTPRIO, &limit) == 0 &&
+			limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 0 &&
+			(rlim_t) priority > limit.rlim_cur) {
+		priority = limit.rlim_cur;
+	}
+#endif
+	struct sched_param param;
+	memset (&param, 0, sizeof (param));
+	param.sched_priority = priority;
+	const int ret = pthread_setschedparam (pthread_self (), policy, &param);
+	if (ret != 0) {
+		debugPrint (DEBUG_AUDIO, "cannot use real-time priority %i: %s\n",
+				priority, strerror (ret));
+		return BarRealtimeNice ();
+	}
+	debugPrint (DEBUG_AUDIO, "output thread runs %s at priority %i\n",
+			BarRealtimeName (settings->audioScheduler), priority);
+	return settings->audioScheduler;
+}
+
+/*	fault in buffer mem of len bytes used by the output path, and keep it in
+ *	memory if audio_mlock is set
+ */
+void BarRealtimeLock (void * const mem, const size_t len,
+		const BarSettings_t * const settings) {
+	if (!settings->audioMlock) {
+		return;
+	}
+	memset (mem, 0, len);
+	if (mlock (mem, len) != 0) {
+		debugPrint (DEBUG_AUDIO, "cannot lock %zu bytes: %s\n", len,
+				strerror (errno));
+	}
+}
+
+/*	release buffer before it is freed
+ */
+void BarRealtimeUnlock (void * const mem, const size_t len,
+		const BarSettings_t * const settings) {
+	if (settings->audioMlock && mem != NULL) {
+		munlock (mem, len);
+	}
+}
+
+const char *BarRealtimeName (const BarSchedPolicy_t policy) {
+	static const char * const names[] = {"other", "nice", "fifo", "rr"};
+	return names[policy];
+}
+
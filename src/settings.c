@@ -65,7 +65,7 @@ static char *BarSettingsGetHome () {
 
 /*	Get XDG config directory, which is set by BarSettingsRead (if not set)
  */
-static char *BarGetXdgConfigDir (const char * const filename) {
+char *BarGetXdgConfigDir (const char * const filename) {
 	assert (filename != NULL);
 
 	char *xdgConfigDir;
@@ -126,7 +126,19 @@ void BarSettingsDestroy (BarSettings_t *settings) {
 	free (settings->listSongFormat);
 	free (settings->timeFormat);
 	free (settings->fifo);
+	free (settings->controlSocket);
+	free (settings->statusFile);
+	free (settings->metricsListen);
+	free (settings->traceFile);
+	free (settings->streamListen);
+	free (settings->streamEncoder);
 	free (settings->audioPipe);
+	free (settings->outputs);
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		free (settings->zone[i].audioPipe);
+		free (settings->zone[i].audioDevice);
+		free (settings->zone[i].outputs);
+	}
 	free (settings->rpcHost);
 	free (settings->rpcTlsPort);
 	free (settings->partnerUser);
@@ -141,6 +153,42 @@ void BarSettingsDestroy (BarSettings_t *settings) {
 	memset (settings, 0, sizeof (*settings));
 }
 
+/*	parse per-zone key zone<n>_<setting>, zones are numbered from 1
+ *	@return false if key is unknown
+ */
+static bool BarSettingsReadZone (BarSettings_t * const settings,
+		const char * const key, const char * const val,
+		const char * const userhome) {
+	unsigned int n;
+	int pos = 0;
+	if (sscanf (key, "zone%u_%n", &n, &pos) != 1 || pos == 0 || n < 1 ||
+			n > BAR_MAX_ZONES) {
+		return false;
+	}
+	BarZoneSettings_t * const zone = &settings->zone[n-1];
+	const char * const name = key + pos;
+
+	if (streq ("audio_pipe", name)) {
+		free (zone->audioPipe);
+		zone->audioPipe = BarSettingsExpandTilde (val, userhome);
+	} else if (streq ("audio_device", name)) {
+		free (zone->audioDevice);
+		zone->audioDevice = strdup (val);
+	} else if (streq ("outputs", name)) {
+		free (zone->outputs);
+		zone->outputs = strdup (val);
+	} else if (streq ("cpu", name)) {
+		zone->cpu = atoi (val);
+	} else if (streq ("decoder_cpu", name)) {
+		zone->decoderCpu = atoi (val);
+	} else if (streq ("output_cpu", name)) {
+		zone->outputCpu = atoi (val);
+	} else {
+		return false;
+	}
+	return true;
+}
+
 /*	read app settings from file; format is: key = value\n
  *	@param where to save these settings
  *	@return nothing yet
@@ -160,6 +208,9 @@ void BarSettingsRead (BarSettings_t *settings) {
 
 	/* apply defaults */
 	settings->audioQuality = PIANO_AQ_HIGH;
+	settings->adaptiveQuality = false;
+	settings->responseCache = true;
+	settings->hedgeRequests = false;
 	settings->autoselect = true;
 	settings->history = 5;
 	settings->volume = 0;
@@ -168,6 +219,12 @@ void BarSettingsRead (BarSettings_t *settings) {
 	/* should be > 4, otherwise expired audio urls (403) can stop playback */
 	settings->maxRetry = 5;
 	settings->bufferSecs = 5;
+	settings->streamBitrate = 128;
+	settings->streamBacklog = 2;
+	settings->pipeBacklog = 2;
+	settings->pipeOverflow = BAR_SINK_BLOCK;
+	settings->audioScheduler = BAR_SCHED_OTHER;
+	settings->audioPriority = 10;
 	settings->sortOrder = BAR_SORT_NAME_AZ;
 	settings->loveIcon = strdup (" <3");
 	settings->banIcon = strdup (" </3");
@@ -186,6 +243,12 @@ void BarSettingsRead (BarSettings_t *settings) {
 	settings->outkey = strdup ("6#26FRL$ZWD");
 	settings->fifo = BarGetXdgConfigDir (PACKAGE "/ctl");
 	settings->audioPipe = NULL;
+	settings->zones = 1;
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		settings->zone[i].cpu = -1;
+		settings->zone[i].decoderCpu = -1;
+		settings->zone[i].outputCpu = -1;
+	}
 	assert (settings->fifo != NULL);
 	settings->sampleRate = 0; /* default to stream sample rate */
 
@@ -338,6 +401,12 @@ void BarSettingsRead (BarSettings_t *settings) {
 				} else if (streq (val, "high")) {
 					settings->audioQuality = PIANO_AQ_HIGH;
 				}
+			} else if (streq ("adaptive_quality", key)) {
+				settings->adaptiveQuality = atoi (val);
+			} else if (streq ("hedge_requests", key)) {
+				settings->hedgeRequests = atoi (val);
+			} else if (streq ("response_cache", key)) {
+				settings->responseCache = atoi (val);
 			} else if (streq ("autostart_station", key)) {
 				free (settings->autostartStation);
 				settings->autostartStation = strdup (val);
@@ -347,6 +416,11 @@ void BarSettingsRead (BarSettings_t *settings) {
 				settings->history = atoi (val);
 			} else if (streq ("max_retry", key)) {
 				settings->maxRetry = atoi (val);
+			} else if (streq ("trace", key)) {
+				settings->trace = strtoul (val, NULL, 0);
+			} else if (streq ("trace_file", key)) {
+				free (settings->traceFile);
+				settings->traceFile = BarSettingsExpandTilde (val, userhome);
 			} else if (streq ("timeout", key)) {
 				settings->timeout = atoi (val);
 			} else if (streq ("buffer_seconds", key)) {
@@ -397,9 +471,65 @@ void BarSettingsRead (BarSettings_t *settings) {
 			} else if (streq ("fifo", key)) {
 				free (settings->fifo);
 				settings->fifo = BarSettingsExpandTilde (val, userhome);
+			} else if (streq ("control_socket", key)) {
+				free (settings->controlSocket);
+				settings->controlSocket = BarSettingsExpandTilde (val, userhome);
+			} else if (streq ("status_file", key)) {
+				free (settings->statusFile);
+				settings->statusFile = BarSettingsExpandTilde (val, userhome);
+			} else if (streq ("metrics_listen", key)) {
+				free (settings->metricsListen);
+				settings->metricsListen = BarSettingsExpandTilde (val, userhome);
+			} else if (streq ("stream_listen", key)) {
+				free (settings->streamListen);
+				settings->streamListen = BarSettingsExpandTilde (val, userhome);
+			} else if (streq ("stream_encoder", key)) {
+				free (settings->streamEncoder);
+				settings->streamEncoder = strdup (val);
+			} else if (streq ("stream_bitrate", key)) {
+				settings->streamBitrate = atoi (val);
+			} else if (streq ("stream_backlog", key)) {
+				settings->streamBacklog = atoi (val);
 			} else if (streq ("audio_pipe", key)) {
 				free (settings->audioPipe);
 				settings->audioPipe = BarSettingsExpandTilde (val, userhome);
+			} else if (streq ("audio_pipe_backlog", key)) {
+				settings->pipeBacklog = atoi (val);
+			} else if (streq ("audio_pipe_overflow", key)) {
+				static const char *mapping[] = {"block", "drop_newest",
+						"drop_oldest"};
+				for (size_t i = 0; i < sizeof (mapping) / sizeof (*mapping); i++) {
+					if (streq (mapping[i], val)) {
+						settings->pipeOverflow = i;
+						break;
+					}
+				}
+			} else if (streq ("audio_pipe_splice", key)) {
+				settings->pipeSplice = atoi (val);
+			} else if (streq ("audio_scheduler", key)) {
+				static const char *mapping[] = {"other", "nice", "fifo", "rr"};
+				for (size_t i = 0; i < sizeof (mapping) / sizeof (*mapping); i++) {
+					if (streq (mapping[i], val)) {
+						settings->audioScheduler = i;
+						break;
+					}
+				}
+			} else if (streq ("audio_priority", key)) {
+				settings->audioPriority = atoi (val);
+			} else if (streq ("audio_mlock", key)) {
+				settings->audioMlock = atoi (val);
+			} else if (streq ("outputs", key)) {
+				free (settings->outputs);
+				settings->outputs = strdup (val);
+			} else if (streq ("zones", key)) {
+				const int zones = atoi (val);
+				settings->zones = zones < 1 ? 1 :
+						(zones > BAR_MAX_ZONES ? BAR_MAX_ZONES : zones);
+			} else if (strncmp ("zone", key, 4) == 0) {
+				if (!BarSettingsReadZone (settings, key, val, userhome)) {
+					BarUiMsg (settings, MSG_INFO,
+							"Unrecognized key %s at %s:%zu\n", key, path, lineNum);
+				}
 			} else if (streq ("autoselect", key)) {
 				settings->autoselect = atoi (val);
 			} else if (streq ("sample_rate", key)) {
@@ -444,6 +574,14 @@ void BarSettingsRead (BarSettings_t *settings) {
 		free (path);
 	}
 
+	/* audio_pipe and outputs are the first zone’s */
+	if (settings->zone[0].audioPipe == NULL && settings->audioPipe != NULL) {
+		settings->zone[0].audioPipe = strdup (settings->audioPipe);
+	}
+	if (settings->zone[0].outputs == NULL && settings->outputs != NULL) {
+		settings->zone[0].outputs = strdup (settings->outputs);
+	}
+
 	/* check environment variable if proxy is not set explicitly */
 	if (settings->proxy == NULL) {
 		char *tmpProxy = getenv ("http_proxy");
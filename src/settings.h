@@ -61,9 +61,10 @@ typedef enum {
 	BAR_KS_SETTINGS = 29,
 	BAR_KS_MODE = 30,
 	BAR_KS_GOTO = 31,
+	BAR_KS_ZONE = 32,
 
    /* insert new shortcuts _before_ this element and increase its value */
-	BAR_KS_COUNT = 32,
+	BAR_KS_COUNT = 33,
 } BarKeyShortcutId_t;
 
 #define BAR_KS_DISABLED '\x00'
@@ -85,9 +86,50 @@ typedef struct {
 
 #include "ui_types.h"
 
+#define BAR_MAX_ZONES 8
+
+/* what an output does with audio that does not fit into its queue */
+typedef enum {
+	BAR_SINK_BLOCK = 0,
+	BAR_SINK_DROP_NEWEST,
+	BAR_SINK_DROP_OLDEST,
+} BarSinkPolicy_t;
+
+/* scheduling of the audio output threads, see realtime.c */
+typedef enum {
+	BAR_SCHED_OTHER = 0,
+	BAR_SCHED_NICE,
+	BAR_SCHED_FIFO,
+	BAR_SCHED_RR,
+} BarSchedPolicy_t;
+
+/* output of one zone */
 typedef struct {
-	bool autoselect;
+	char *audioPipe;
+	/* libao "dev" option, NULL for the driver's default */
+	char *audioDevice;
+	/* sinks, see sink.c, NULL for audioPipe or the sound device */
+	char *outputs;
+	/* core the zone's player threads are pinned to, -1 for none, and cores
+	 * overriding it for the decoder and the output threads */
+	int cpu, decoderCpu, outputCpu;
+} BarZoneSettings_t;
+
+typedef struct {
+	bool autoselect, adaptiveQuality, responseCache, hedgeRequests;
 	unsigned int history, maxRetry, timeout, bufferSecs;
+	/* trace categories recorded, see trace.h */
+	unsigned int trace;
+	/* kbit/s of encoded streams, seconds a stream listener may lag */
+	unsigned int streamBitrate, streamBacklog;
+	/* fifo outputs: queue in seconds, what to do if it is full, vmsplice */
+	unsigned int pipeBacklog;
+	BarSinkPolicy_t pipeOverflow;
+	bool pipeSplice;
+	/* output threads: scheduling, its real-time priority, lock buffers */
+	BarSchedPolicy_t audioScheduler;
+	unsigned int audioPriority;
+	bool audioMlock;
 	int volume;
 	float gainMul;
 	BarStationSorting_t sortOrder;
@@ -105,8 +147,15 @@ typedef struct {
 	char *npStationFormat;
 	char *listSongFormat, *timeFormat;
 	char *fifo;
+	char *controlSocket;
+	char *statusFile;
+	char *metricsListen;
+	char *traceFile;
+	char *streamListen, *streamEncoder;
 	char *rpcHost, *rpcTlsPort, *partnerUser, *partnerPassword, *device, *inkey, *outkey, *caBundle;
-	char *audioPipe;
+	char *audioPipe, *outputs;
+	unsigned int zones;
+	BarZoneSettings_t zone[BAR_MAX_ZONES];
 	char keys[BAR_KS_COUNT];
 	int sampleRate;
 	BarMsgFormatStr_t msgFormat[MSG_COUNT];
@@ -118,4 +167,5 @@ void BarSettingsInit (BarSettings_t *);
 void BarSettingsDestroy (BarSettings_t *);
 void BarSettingsRead (BarSettings_t *);
 void BarSettingsWrite (PianoStation_t *, BarSettings_t *);
+char *BarGetXdgConfigDir (const char * const);
 
@@ -0,0 +1,983 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* audio outputs. A zone plays to one or more sinks, a sound device, a fifo,
+ * a file or nowhere at all. Every sink has a queue and a writer thread of its
+ * own, so a stalled fifo reader cannot hold up the speakers. The first sink
+ * of a zone is its clock: the output thread waits for it, while the others
+ * drop audio if they cannot keep up. A fifo never blocks its writer, if the
+ * reader stalls its queue grows up to the backlog and then applies the
+ * overflow policy.
+ */
+
+#ifdef __linux__
+/* vmsplice, must come before any system header */
+#define _GNU_SOURCE
+#endif
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <ao/ao.h>
+
+#include "sink.h"
+#include "realtime.h"
+#include "debug.h"
+#include "trace.h"
+#include "ui.h"
+
+/* queue of the clock sink, bounds the time until pause and skip are heard,
+ * and of the others, in milliseconds */
+static const unsigned int clockQueueMs = 40;
+static const unsigned int defaultQueueMs = 2000;
+/* queue space for pages a fifo refers to, the default maximum pipe size */
+static const size_t spliceReserve = 1024*1024;
+/* how long to wait for a stalled reader to take the rest of a frame */
+static const int64_t frameTimeoutUs = 1000000;
+/* how long to wait for a writer once the set was aborted, it may be stuck
+ * in the driver */
+static const int64_t abortTimeoutUs = 1000000;
+
+static int64_t BarSinkNowUs (void) {
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static size_t BarSinkBytesPerSec (const BarSinkFormat_t * const f) {
+	return (size_t) f->rate * f->channels * f->bits / 8;
+}
+
+static size_t BarSinkFrameBytes (const BarSinkFormat_t * const f) {
+	return (size_t) f->channels * f->bits / 8;
+}
+
+static size_t BarSinkPageSize (void) {
+	const long page = sysconf (_SC_PAGESIZE);
+	return page > 0 ? (size_t) page : 4096;
+}
+
+/*	queue memory of size bytes, page aligned. It is mapped rather than
+ *	allocated: pages a fifo still refers to after vmsplice stay with the
+ *	pipe once they are unmapped, while freed memory could be handed out
+ *	again and overwritten before the reader got to it.
+ */
+static char *BarSinkQueueAlloc (const size_t size) {
+	void * const queue = mmap (NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return queue != MAP_FAILED ? queue : NULL;
+}
+
+static void BarSinkQueueFree (BarSink_t * const s) {
+	if (s->queue != NULL) {
+		BarRealtimeUnlock (s->queue, s->size, s->settings);
+		munmap (s->queue, s->size);
+		s->queue = NULL;
+	}
+}
+
+/*	libao, the sound device
+ */
+static bool BarSinkAoOpen (BarSink_t * const s) {
+	ao_sample_format fmt;
+	memset (&fmt, 0, sizeof (fmt));
+	fmt.bits = s->format.bits;
+	fmt.channels = s->format.channels;
+	fmt.rate = s->format.rate;
+	fmt.byte_format = AO_FMT_NATIVE;
+
+	ao_option *options = NULL;
+	if (s->arg != NULL) {
+		ao_append_option (&options, "dev", s->arg);
+	}
+	s->handle = ao_open_live (ao_default_driver_id (), &fmt, options);
+	ao_free_options (options);
+	if (s->handle == NULL) {
+		s->error = "Cannot open audio device.";
+		return false;
+	}
+	return true;
+}
+
+static ssize_t BarSinkAoWrite (BarSink_t * const s, const char * const data,
+		const size_t len) {
+	return ao_play (s->handle, (char *) data, len) != 0 ? (ssize_t) len : -1;
+}
+
+static void BarSinkAoClose (BarSink_t * const s) {
+	ao_close (s->handle);
+	s->handle = NULL;
+}
+
+/*	complete the frame a non-blocking write stopped in, *done bytes into
+ *	data, so the reader does not get out of step
+ *	@return false if the fd took nothing for too long
+ */
+static bool BarSinkFinishFrame (BarSink_t * const s, const char * const data,
+		size_t * const done) {
+	const size_t frameBytes = BarSinkFrameBytes (&s->format);
+	const int64_t deadline = BarSinkNowUs () + frameTimeoutUs;
+	while (*done % frameBytes != 0) {
+		struct pollfd pfd = { .fd = s->fd, .events = POLLOUT };
+		poll (&pfd, 1, 100);
+		const ssize_t r = write (s->fd, data + *done,
+				frameBytes - *done % frameBytes);
+		if (r > 0) {
+			*done += r;
+		} else if ((r < 0 && errno != EAGAIN && errno != EINTR) ||
+				BarSinkNowUs () > deadline) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void BarSinkCloseFd (BarSink_t * const s) {
+	if (s->fd != -1) {
+		close (s->fd);
+		s->fd = -1;
+	}
+}
+
+/*	connect to the fifo’s reader, fails with ENXIO if there is none
+ */
+static bool BarSinkPipeConnect (BarSink_t * const s) {
+	s->zeroCopy = false;
+	if ((s->fd = open (s->arg, O_WRONLY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		return false;
+	}
+#ifdef SPLICE_F_NONBLOCK
+	/* the queue must not be overwritten while the pipe still refers to it,
+	 * which the reserve only guarantees for pipes no larger than itself */
+	if (s->reserve > 0) {
+		const int capacity = fcntl (s->fd, F_GETPIPE_SZ);
+		s->zeroCopy = capacity > 0 && (size_t) capacity <= s->reserve;
+		if (!s->zeroCopy) {
+			debugPrint (DEBUG_AUDIO, "pipe of %i bytes too large for "
+					"vmsplice\n", capacity);
+		}
+	}
+#endif
+	return true;
+}
+
+/*	fifo read by another program, raw samples. It is written without
+ *	blocking, the reader may come and go.
+ */
+static bool BarSinkPipeOpen (BarSink_t * const s) {
+	struct stat st;
+	if (s->arg == NULL || stat (s->arg, &st) != 0) {
+		s->error = "Cannot stat audio pipe file.";
+		return false;
+	}
+	if (!S_ISFIFO (st.st_mode)) {
+		s->error = "File is not a pipe, error.";
+		return false;
+	}
+	/* without a reader write tries again later */
+	if (!BarSinkPipeConnect (s) && errno != ENXIO) {
+		s->error = "Cannot open audio pipe file.";
+		return false;
+	}
+	return true;
+}
+
+static ssize_t BarSinkPipeWrite (BarSink_t * const s, const char * const data,
+		const size_t len) {
+	if (s->fd == -1 && !BarSinkPipeConnect (s)) {
+		return errno == ENXIO || errno == EINTR ? 0 : -1;
+	}
+
+	ssize_t ret;
+#ifdef SPLICE_F_NONBLOCK
+	if (s->zeroCopy) {
+		struct iovec iov = { .iov_base = (void *) data, .iov_len = len };
+		ret = vmsplice (s->fd, &iov, 1, SPLICE_F_NONBLOCK);
+	} else
+#endif
+	{
+		ret = write (s->fd, data, len);
+	}
+	if (ret < 0) {
+		if (errno == EPIPE) {
+			debugPrint (DEBUG_AUDIO, "audio pipe reader went away\n");
+			BarSinkCloseFd (s);
+			return 0;
+		}
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	}
+
+	/* if completing the last frame takes too long the connection is dropped
+	 * and the next reader starts on a frame boundary */
+	size_t done = ret;
+	if (!BarSinkFinishFrame (s, data, &done)) {
+		debugPrint (DEBUG_AUDIO, "audio pipe reader stalled mid-frame\n");
+		BarSinkCloseFd (s);
+		const size_t frameBytes = BarSinkFrameBytes (&s->format);
+		done += frameBytes - done % frameBytes;
+	}
+	return done;
+}
+
+/*	drop what a fifo holds by reading it through a read end of our own,
+ *	racing the reader. The pipe lets go of spliced queue pages that way, too.
+ *	Regular files and devices keep what was written.
+ */
+static void BarSinkFdFlush (BarSink_t * const s) {
+	struct stat st;
+	if (s->fd == -1 || s->arg == NULL || fstat (s->fd, &st) != 0 ||
+			!S_ISFIFO (st.st_mode)) {
+		return;
+	}
+	const int fd = open (s->arg, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1) {
+		return;
+	}
+	/* all writes end on a frame boundary, so does emptying the fifo */
+	char buf[4096];
+	size_t dropped = 0;
+	ssize_t ret;
+	while ((ret = read (fd, buf, sizeof (buf))) > 0 ||
+			(ret < 0 && errno == EINTR)) {
+		dropped += ret > 0 ? ret : 0;
+	}
+	close (fd);
+	debugPrint (DEBUG_AUDIO, "flushed %zu bytes from %s\n", dropped, s->arg);
+}
+
+static void BarSinkFdWait (BarSink_t * const s, const int ms) {
+	/* poll ignores the fd while there is no reader and just sleeps */
+	struct pollfd pfd = { .fd = s->fd, .events = POLLOUT };
+	poll (&pfd, 1, ms);
+}
+
+/*	audio in the fifo the reader has not picked up yet
+ */
+static size_t BarSinkPipePending (BarSink_t * const s) {
+	int queued = 0;
+	if (s->fd == -1 || ioctl (s->fd, FIONREAD, &queued) != 0 || queued < 0) {
+		return 0;
+	}
+	return queued;
+}
+
+/*	raw samples appended to a file. The file may as well be a device or a
+ *	fifo, which are written without blocking, so the writer thread still
+ *	notices when it is asked to close.
+ */
+static bool BarSinkFileOpen (BarSink_t * const s) {
+	if (s->arg == NULL || (s->fd = open (s->arg,
+			O_WRONLY | O_CREAT | O_APPEND | O_NONBLOCK | O_CLOEXEC,
+			0644)) == -1) {
+		s->error = "Cannot open audio file.";
+		return false;
+	}
+	return true;
+}
+
+static ssize_t BarSinkFileWrite (BarSink_t * const s,
+		const char * const data, const size_t len) {
+	const ssize_t ret = write (s->fd, data, len);
+	if (ret < 0) {
+		return errno == EAGAIN || errno == EINTR ? 0 : -1;
+	}
+	size_t done = ret;
+	return BarSinkFinishFrame (s, data, &done) ? (ssize_t) done : -1;
+}
+
+/*	discards everything as fast as it arrives. Used as the clock it lets the
+ *	decoder run at full speed, which makes it a benchmark.
+ */
+static bool BarSinkNullOpen (BarSink_t * const s) {
+	s->openedAt = BarSinkNowUs ();
+	s->openedWritten = __atomic_load_n (&s->written, __ATOMIC_RELAXED);
+	return true;
+}
+
+static ssize_t BarSinkNullWrite (BarSink_t * const s,
+		const char * const data, const size_t len) {
+	return len;
+}
+
+static void BarSinkNullClose (BarSink_t * const s) {
+	const double secs = (double) (__atomic_load_n (&s->written,
+			__ATOMIC_RELAXED) - s->openedWritten) /
+			BarSinkBytesPerSec (&s->format);
+	const double wall = (double) (BarSinkNowUs () - s->openedAt) / 1e6;
+	debugPrint (DEBUG_AUDIO, "null sink took %.1f s of audio in %.1f s "
+			"(%.1fx realtime)\n", secs, wall, wall > 0 ? secs / wall : 0);
+}
+
+/* libao can neither drain nor flush, ao_close plays what the device holds
+ * and a skip is heard once the device buffer ran out. A fifo keeps what
+ * was written after the writer closed it, so there is nothing to drain,
+ * and files keep everything anyway.
+ */
+static const BarSinkDriver_t drivers[] = {
+	{"ao", BarSinkAoOpen, BarSinkAoWrite, NULL, NULL, NULL, BarSinkAoClose,
+			NULL},
+	{"pipe", BarSinkPipeOpen, BarSinkPipeWrite, BarSinkFdWait, NULL,
+			BarSinkFdFlush, BarSinkCloseFd, BarSinkPipePending},
+	{"file", BarSinkFileOpen, BarSinkFileWrite, BarSinkFdWait, NULL,
+			BarSinkFdFlush, BarSinkCloseFd, NULL},
+	{"null", BarSinkNullOpen, BarSinkNullWrite, NULL, NULL, NULL,
+			BarSinkNullClose, NULL},
+};
+
+/*	close the device, called without lock
+ */
+static void BarSinkShut (BarSink_t * const s) {
+	pthread_mutex_lock (&s->lock);
+	const bool abort = s->abort;
+	pthread_mutex_unlock (&s->lock);
+	if (s->driver->drain != NULL && !abort) {
+		s->driver->drain (s);
+	}
+	s->driver->close (s);
+	__atomic_store_n (&s->latency, 0, __ATOMIC_RELAXED);
+}
+
+/*	drop n bytes at the head of the queue without writing them, called with
+ *	lock held
+ */
+static void BarSinkSkip (BarSink_t * const s, const size_t n) {
+	s->head = (s->head + n) % s->size;
+	s->fill -= n;
+	s->discard -= s->discard < n ? s->discard : n;
+	if (s->held > 0) {
+		/* the skipped bytes sit between head and what the output refers to */
+		s->held += n;
+		s->heldGap = true;
+	}
+}
+
+/*	drop the part of a flushed queue that has not been written yet
+ */
+static void BarSinkDiscard (BarSink_t * const s) {
+	BarSinkSkip (s, s->discard < s->fill ? s->discard : s->fill);
+	s->discard = 0;
+}
+
+/*	the queue is no longer referenced by the output
+ */
+static void BarSinkRelease (BarSink_t * const s) {
+	s->head = s->fill = s->discard = s->held = 0;
+	s->heldGap = false;
+}
+
+/*	next piece of the queue to write: large and page aligned, so the pipe
+ *	can take whole pages, but small enough for the output thread to find room
+ *	early
+ */
+static size_t BarSinkChunk (const BarSink_t * const s) {
+	const size_t page = BarSinkPageSize ();
+	const size_t frameBytes = BarSinkFrameBytes (&s->format);
+	const size_t contiguous = s->size - s->head;
+	size_t n = s->fill < contiguous ? s->fill : contiguous;
+	size_t limit = s->size / 4;
+	limit -= limit % page;
+	if (limit < page) {
+		limit = page;
+	}
+	if (n > limit) {
+		n = limit;
+	}
+	const size_t misaligned = s->head % page;
+	if (misaligned != 0 && n > page - misaligned) {
+		n = page - misaligned;
+	} else if (misaligned == 0 && n >= page) {
+		n -= n % page;
+	}
+	n -= n % frameBytes;
+	/* the page boundary may not be a frame boundary */
+	return n > 0 ? n : frameBytes;
+}
+
+/*	(re)open the device in s->format, called with lock held
+ */
+static void BarSinkReopen (BarSink_t * const s) {
+	const bool wasOpen = s->opened;
+	s->opened = false;
+	/* the clock was drained before, the others lose the old format’s rest */
+	__atomic_add_fetch (&s->dropped, s->fill - s->discard, __ATOMIC_RELAXED);
+	BarSinkRelease (s);
+	pthread_mutex_unlock (&s->lock);
+
+	if (wasOpen) {
+		BarSinkShut (s);
+	}
+	/* whole pages and whole frames, so wrapping around keeps both aligned */
+	const size_t page = BarSinkPageSize ();
+	const size_t frameBytes = BarSinkFrameBytes (&s->format);
+	size_t a = page, b = frameBytes;
+	while (b != 0) {
+		const size_t t = a % b;
+		a = b;
+		b = t;
+	}
+	const size_t unit = page / a * frameBytes;
+	const unsigned int ms = s->queueMs > clockQueueMs ? s->queueMs :
+			clockQueueMs;
+	const size_t want = BarSinkBytesPerSec (&s->format) * ms / 1000 +
+			s->reserve;
+	const size_t size = (want + unit - 1) / unit * unit;
+	BarSinkQueueFree (s);
+	char * const queue = BarSinkQueueAlloc (size);
+	bool ok = false;
+	if (queue == NULL) {
+		s->error = "Out of memory.";
+	} else {
+		BarRealtimeLock (queue, size, s->settings);
+		s->queue = queue;
+		s->error = NULL;
+		ok = s->driver->open (s);
+	}
+	if (!ok) {
+		BarUiMsg (s->settings, MSG_ERR, "%s (%s output of zone %zu)\n",
+				s->error, s->driver->name, s->zone + 1);
+	}
+
+	pthread_mutex_lock (&s->lock);
+	s->size = size;
+	s->opened = ok;
+}
+
+/*	writer thread, lives as long as the sink
+ */
+static void *BarSinkThread (void * const data) {
+	BarSink_t * const s = data;
+
+	char name[16];
+	snprintf (name, sizeof (name), "%s%zu", s->driver->name, s->zone + 1);
+	BarTraceThread (name);
+	/* the clock’s writer feeds the device and is part of the output path */
+	if (s->clock) {
+		BarRealtimeThread (s->settings);
+	}
+
+	pthread_mutex_lock (&s->lock);
+	while (true) {
+		while (!s->quit && !s->reopen && !s->close && s->discard == 0 &&
+				!s->flush && (s->fill == 0 || !s->opened)) {
+			pthread_cond_wait (&s->cond, &s->lock);
+		}
+
+		if (s->discard > 0 || s->flush) {
+			BarSinkDiscard (s);
+			if (s->flush && s->opened && s->driver->flush != NULL) {
+				pthread_mutex_unlock (&s->lock);
+				s->driver->flush (s);
+				const size_t pending = s->driver->pending != NULL ?
+						s->driver->pending (s) : 0;
+				pthread_mutex_lock (&s->lock);
+				if (pending == 0) {
+					/* the output refers to no queue pages anymore */
+					s->held = 0;
+					s->heldGap = false;
+				}
+			}
+			s->flush = false;
+			pthread_cond_broadcast (&s->cond);
+		} else if (s->reopen) {
+			BarSinkReopen (s);
+			s->reopen = false;
+			pthread_cond_broadcast (&s->cond);
+		} else if (s->close) {
+			if (s->opened) {
+				s->opened = false;
+				pthread_mutex_unlock (&s->lock);
+				BarSinkShut (s);
+				pthread_mutex_lock (&s->lock);
+			}
+			BarSinkRelease (s);
+			s->close = false;
+			pthread_cond_broadcast (&s->cond);
+		} else if (s->quit) {
+			break;
+		} else {
+			const size_t n = BarSinkChunk (s);
+			const char * const p = s->queue + s->head;
+			/* the output thread must not drop what is being written */
+			s->writing = true;
+			pthread_mutex_unlock (&s->lock);
+
+			const ssize_t ret = s->driver->write (s, p, n);
+			const size_t pending = s->driver->pending != NULL ?
+					s->driver->pending (s) : 0;
+			__atomic_store_n (&s->latency, (uint64_t) pending * 1000 /
+					BarSinkBytesPerSec (&s->format), __ATOMIC_RELAXED);
+
+			pthread_mutex_lock (&s->lock);
+			s->writing = false;
+			if (ret < 0) {
+				/* dead device, the output thread must not wait for it */
+				debugPrint (DEBUG_AUDIO, "%s sink of zone %zu failed\n",
+						s->driver->name, s->zone + 1);
+				s->opened = false;
+				BarSinkRelease (s);
+				pthread_mutex_unlock (&s->lock);
+				BarSinkShut (s);
+				pthread_mutex_lock (&s->lock);
+			} else {
+				__atomic_add_fetch (&s->written, ret, __ATOMIC_RELAXED);
+				s->discard -= s->discard < (size_t) ret ? s->discard :
+						(size_t) ret;
+				s->head = (s->head + ret) % s->size;
+				s->fill -= ret;
+				if (pending == 0) {
+					s->held = 0;
+					s->heldGap = false;
+				} else if (s->zeroCopy) {
+					/* the pipe refers to the newest bytes written, unless
+					 * some were skipped in between */
+					s->held += ret;
+					if (!s->heldGap && s->held > pending) {
+						s->held = pending;
+					}
+				}
+			}
+			pthread_cond_broadcast (&s->cond);
+
+			if (ret == 0 && s->driver->wait != NULL) {
+				pthread_mutex_unlock (&s->lock);
+				s->driver->wait (s, 100);
+				pthread_mutex_lock (&s->lock);
+			}
+		}
+	}
+	const bool opened = s->opened;
+	s->opened = false;
+	pthread_mutex_unlock (&s->lock);
+
+	if (opened) {
+		BarSinkShut (s);
+	}
+	pthread_mutex_lock (&s->lock);
+	s->exited = true;
+	pthread_cond_broadcast (&s->cond);
+	pthread_mutex_unlock (&s->lock);
+	return NULL;
+}
+
+/*	wait for the writer, called with lock held. Once the set was aborted for
+ *	no longer than abortTimeoutUs without hearing from it.
+ *	@return false if the writer did not respond in time
+ */
+static bool BarSinkWait (BarSink_t * const s) {
+	if (!s->abort) {
+		pthread_cond_wait (&s->cond, &s->lock);
+		return true;
+	}
+	struct timespec deadline;
+	clock_gettime (CLOCK_REALTIME, &deadline);
+	const uint64_t ns = deadline.tv_nsec + (uint64_t) abortTimeoutUs * 1000;
+	deadline.tv_sec += ns / 1000000000;
+	deadline.tv_nsec = ns % 1000000000;
+	return pthread_cond_timedwait (&s->cond, &s->lock, &deadline) == 0;
+}
+
+/*	add sink driver:arg to set
+ */
+static bool BarSinkAdd (BarSinkSet_t * const set, const char * const spec,
+		const BarZoneSettings_t * const zone) {
+	const char * const colon = strchr (spec, ':');
+	const size_t nameLen = colon != NULL ? (size_t) (colon - spec) :
+			strlen (spec);
+	const BarSinkDriver_t *driver = NULL;
+	for (size_t i = 0; i < sizeof (drivers) / sizeof (*drivers); i++) {
+		if (strlen (drivers[i].name) == nameLen &&
+				strncmp (drivers[i].name, spec, nameLen) == 0) {
+			driver = &drivers[i];
+			break;
+		}
+	}
+	if (driver == NULL || set->count >= BAR_MAX_SINKS) {
+		return false;
+	}
+
+	BarSink_t * const s = &set->sink[set->count];
+	memset (s, 0, sizeof (*s));
+	s->driver = driver;
+	s->settings = set->settings;
+	s->zone = set->zone;
+	s->fd = -1;
+	s->clock = set->count == 0;
+	/* only the clock may hold up the output thread */
+	s->policy = s->clock ? BAR_SINK_BLOCK : BAR_SINK_DROP_NEWEST;
+	s->queueMs = s->clock ? clockQueueMs : defaultQueueMs;
+	if (driver->open == BarSinkPipeOpen) {
+		const BarSinkPolicy_t policy = set->settings->pipeOverflow;
+		if (policy != BAR_SINK_BLOCK) {
+			s->policy = policy;
+			s->queueMs = set->settings->pipeBacklog * 1000;
+		} else if (!s->clock) {
+			s->queueMs = set->settings->pipeBacklog * 1000;
+		}
+		if (set->settings->pipeSplice) {
+			s->reserve = spliceReserve;
+		}
+	}
+	if (colon != NULL && colon[1] != '\0') {
+		s->arg = strdup (colon + 1);
+	} else if (driver->open == BarSinkAoOpen && zone->audioDevice != NULL) {
+		s->arg = strdup (zone->audioDevice);
+	} else if (driver->open == BarSinkPipeOpen && zone->audioPipe != NULL) {
+		s->arg = strdup (zone->audioPipe);
+	}
+	BarRealtimeMutexInit (&s->lock, s->settings);
+	pthread_cond_init (&s->cond, NULL);
+	if (pthread_create (&s->thread, NULL, BarSinkThread, s) != 0) {
+		free (s->arg);
+		pthread_cond_destroy (&s->cond);
+		pthread_mutex_destroy (&s->lock);
+		return false;
+	}
+	++set->count;
+	return true;
+}
+
+/*	start the zone’s sinks, from its outputs setting or audio_pipe/the sound
+ *	device if there is none
+ */
+void BarSinksInit (BarSinkSet_t * const set,
+		const BarSettings_t * const settings,
+		const BarZoneSettings_t * const zone, const size_t zoneIndex) {
+	assert (set != NULL);
+
+	memset (set, 0, sizeof (*set));
+	set->settings = settings;
+	set->zone = zoneIndex;
+
+	const char * const outputs = zone->outputs != NULL ? zone->outputs :
+			(zone->audioPipe != NULL ? "pipe" : "ao");
+	char * const list = strdup (outputs);
+	char *save = NULL;
+	for (char *spec = strtok_r (list, ", ", &save); spec != NULL;
+			spec = strtok_r (NULL, ", ", &save)) {
+		if (!BarSinkAdd (set, spec, zone)) {
+			BarUiMsg (settings, MSG_ERR, "Cannot add output %s to zone %zu\n",
+					spec, zoneIndex + 1);
+		}
+	}
+	free (list);
+}
+
+/*	(re)open all sinks in format, unless they already use it. Sinks that
+ *	failed since are opened again. The clock plays what is queued in the old
+ *	format first and is waited for, the others may take their time, a fifo
+ *	for instance waits for its reader.
+ *	@return false if the clock cannot be used
+ */
+bool BarSinksOpen (BarSinkSet_t * const set,
+		const BarSinkFormat_t * const format) {
+	assert (set != NULL);
+	assert (format != NULL);
+
+	const bool same = set->opened && set->format.bits == format->bits &&
+			set->format.channels == format->channels &&
+			set->format.rate == format->rate;
+	if (set->opened && !same) {
+		debugPrint (DEBUG_AUDIO, "output format changed, reopening sinks\n");
+	}
+
+	bool ok = set->count > 0;
+	for (size_t i = 0; i < set->count; i++) {
+		BarSink_t * const s = &set->sink[i];
+		pthread_mutex_lock (&s->lock);
+		/* a new song, the previous one’s abort is over */
+		s->abort = false;
+		if (same && (s->opened || s->reopen)) {
+			pthread_mutex_unlock (&s->lock);
+			continue;
+		}
+		if (same) {
+			debugPrint (DEBUG_AUDIO, "reopening failed %s sink of zone %zu\n",
+					s->driver->name, s->zone + 1);
+		}
+		while (s->clock && s->fill > 0 && s->opened && !s->abort) {
+			pthread_cond_wait (&s->cond, &s->lock);
+		}
+		s->format = *format;
+		s->reopen = true;
+		pthread_cond_broadcast (&s->cond);
+		while (s->clock && s->reopen && !s->abort) {
+			pthread_cond_wait (&s->cond, &s->lock);
+		}
+		if (s->clock) {
+			ok = s->opened;
+		}
+		pthread_mutex_unlock (&s->lock);
+	}
+	set->format = *format;
+	set->opened = ok;
+	return ok;
+}
+
+/*	queue audio for one sink. The clock paces the output thread, for as long
+ *	as it takes if it blocks, otherwise for no longer than the audio lasts.
+ *	If the queue is full the sink’s policy decides what is lost.
+ *	@return false if the sink failed
+ */
+static bool BarSinkPut (BarSink_t * const s, const char *data, size_t len) {
+	pthread_mutex_lock (&s->lock);
+	const size_t bytesPerSec = BarSinkBytesPerSec (&s->format);
+	const size_t frameBytes = BarSinkFrameBytes (&s->format);
+	if (s->clock && s->opened && !s->reopen) {
+		const size_t pace = bytesPerSec * clockQueueMs / 1000;
+		struct timespec deadline;
+		clock_gettime (CLOCK_REALTIME, &deadline);
+		const uint64_t ns = deadline.tv_nsec +
+				(uint64_t) len * 1000000000 / bytesPerSec;
+		deadline.tv_sec += ns / 1000000000;
+		deadline.tv_nsec = ns % 1000000000;
+		while (s->opened && !s->reopen && !s->abort && s->fill > 0 &&
+				s->fill + len > pace) {
+			if (s->policy == BAR_SINK_BLOCK) {
+				pthread_cond_wait (&s->cond, &s->lock);
+			} else if (pthread_cond_timedwait (&s->cond, &s->lock,
+					&deadline) != 0) {
+				/* stalled, the backlog takes it */
+				break;
+			}
+		}
+	}
+
+	bool overflow = false;
+	while (len > 0 && s->opened && !s->reopen && !s->abort) {
+		size_t room = s->size - s->fill - s->held;
+		room -= room % frameBytes;
+		if (room == 0) {
+			overflow = true;
+			if (s->policy == BAR_SINK_BLOCK) {
+				pthread_cond_wait (&s->cond, &s->lock);
+				continue;
+			} else if (s->policy == BAR_SINK_DROP_OLDEST && s->fill > 0 &&
+					s->held == 0 && !s->writing) {
+				/* skipping frees no room while the output still refers to
+				 * the bytes before head, and the oldest cannot be skipped
+				 * while they are being written, which may take as long as
+				 * the reader stalls. The newest are dropped then. */
+				const size_t n = len < s->fill ? len : s->fill;
+				BarSinkSkip (s, n);
+				__atomic_add_fetch (&s->dropped, n, __ATOMIC_RELAXED);
+				continue;
+			}
+			/* drop the newest */
+			break;
+		}
+		const size_t n = len < room ? len : room;
+		const size_t tail = (s->head + s->fill) % s->size;
+		const size_t first = n < s->size - tail ? n : s->size - tail;
+		memcpy (s->queue + tail, data, first);
+		memcpy (s->queue, data + first, n - first);
+		s->fill += n;
+		data += n;
+		len -= n;
+		pthread_cond_broadcast (&s->cond);
+	}
+	const bool ok = s->opened || s->reopen;
+	if (s->abort) {
+		/* skipped, not lost */
+		len = 0;
+	}
+	pthread_mutex_unlock (&s->lock);
+	if (len > 0) {
+		__atomic_add_fetch (&s->dropped, len, __ATOMIC_RELAXED);
+	}
+	if (overflow) {
+		__atomic_add_fetch (&s->overflows, 1, __ATOMIC_RELAXED);
+	}
+	return ok;
+}
+
+/*	hand audio to all sinks
+ *	@return false if the clock failed, it is reopened by the next
+ *		BarSinksOpen
+ */
+bool BarSinksWrite (BarSinkSet_t * const set, const char * const data,
+		const size_t len) {
+	assert (set != NULL);
+
+	/* the clock may block, the others should have their copy by then */
+	bool ok = true;
+	for (size_t i = set->count; i > 0; i--) {
+		ok = BarSinkPut (&set->sink[i-1], data, len);
+	}
+	return ok;
+}
+
+/*	drop audio that was queued but not written yet and what the devices
+ *	hold, after a skip
+ */
+void BarSinksFlush (BarSinkSet_t * const set) {
+	assert (set != NULL);
+
+	for (size_t i = 0; i < set->count; i++) {
+		BarSink_t * const s = &set->sink[i];
+		pthread_mutex_lock (&s->lock);
+		s->discard = s->fill;
+		s->flush = true;
+		pthread_cond_broadcast (&s->cond);
+		pthread_mutex_unlock (&s->lock);
+	}
+}
+
+/*	stop waiting for the sinks, after a skip or on quit. A clock without a
+ *	reader or a hung device no longer holds up the output thread, and waits
+ *	for the writers are bounded until the next BarSinksOpen. May be called
+ *	from any thread.
+ */
+void BarSinksAbort (BarSinkSet_t * const set) {
+	assert (set != NULL);
+
+	for (size_t i = 0; i < set->count; i++) {
+		BarSink_t * const s = &set->sink[i];
+		pthread_mutex_lock (&s->lock);
+		s->abort = true;
+		pthread_cond_broadcast (&s->cond);
+		pthread_mutex_unlock (&s->lock);
+	}
+}
+
+/*	close all devices, the clock plays what is queued first unless the set
+ *	was aborted, which discards it
+ */
+void BarSinksClose (BarSinkSet_t * const set) {
+	assert (set != NULL);
+
+	for (size_t i = 0; i < set->count; i++) {
+		BarSink_t * const s = &set->sink[i];
+		pthread_mutex_lock (&s->lock);
+		while (s->clock && s->fill > 0 && s->opened && !s->abort) {
+			pthread_cond_wait (&s->cond, &s->lock);
+		}
+		if (s->abort) {
+			s->discard = s->fill;
+			s->flush = true;
+		}
+		s->close = true;
+		pthread_cond_broadcast (&s->cond);
+		while (s->close) {
+			if (!BarSinkWait (s)) {
+				debugPrint (DEBUG_AUDIO, "%s sink of zone %zu does not "
+						"close\n", s->driver->name, s->zone + 1);
+				break;
+			}
+		}
+		pthread_mutex_unlock (&s->lock);
+	}
+	set->opened = false;
+}
+
+/*	stop the writer threads. One stuck in its driver is left behind once the
+ *	set was aborted, along with its queue and lock.
+ */
+void BarSinksDestroy (BarSinkSet_t * const set) {
+	assert (set != NULL);
+
+	for (size_t i = 0; i < set->count; i++) {
+		BarSink_t * const s = &set->sink[i];
+		pthread_mutex_lock (&s->lock);
+		s->quit = true;
+		pthread_cond_broadcast (&s->cond);
+		bool responding = true;
+		while (!s->exited && responding) {
+			responding = BarSinkWait (s);
+		}
+		const bool exited = s->exited;
+		pthread_mutex_unlock (&s->lock);
+		if (!exited) {
+			BarUiMsg (s->settings, MSG_ERR, "%s output of zone %zu does not "
+					"respond, giving up on it.\n", s->driver->name,
+					s->zone + 1);
+			pthread_detach (s->thread);
+			continue;
+		}
+		pthread_join (s->thread, NULL);
+		pthread_cond_destroy (&s->cond);
+		pthread_mutex_destroy (&s->lock);
+		BarSinkQueueFree (s);
+		free (s->arg);
+	}
+	set->count = 0;
+}
+
+/*	append metrics of the sinks of all zones to buf
+ */
+void BarSinksMetrics (BarMetricsBuf_t * const buf, BarSinkSet_t * const sets[],
+		const size_t count) {
+	const struct {
+		const char *name, *type, *help;
+	} families[] = {
+		{"pianobar_sink_written_bytes_total", "counter",
+				"Audio written to the output."},
+		{"pianobar_sink_dropped_bytes_total", "counter",
+				"Audio dropped because the output was too slow."},
+		{"pianobar_sink_overflows_total", "counter",
+				"Writes that found the output’s queue full."},
+		{"pianobar_sink_latency_seconds", "gauge",
+				"Audio queued for the output but not played yet."},
+	};
+	for (size_t i = 0; i < sizeof (families) / sizeof (*families); i++) {
+		BarMetricsFamily (buf, families[i].name, families[i].type,
+				families[i].help);
+		for (size_t j = 0; j < count; j++) {
+			for (size_t k = 0; k < sets[j]->count; k++) {
+				BarSink_t * const s = &sets[j]->sink[k];
+				char labels[64];
+				snprintf (labels, sizeof (labels), "zone=\"%zu\",sink=\"%s\"",
+						j + 1, s->driver->name);
+				double value;
+				if (i == 0) {
+					value = __atomic_load_n (&s->written, __ATOMIC_RELAXED);
+				} else if (i == 1) {
+					value = __atomic_load_n (&s->dropped, __ATOMIC_RELAXED);
+				} else if (i == 2) {
+					value = __atomic_load_n (&s->overflows, __ATOMIC_RELAXED);
+				} else {
+					pthread_mutex_lock (&s->lock);
+					const size_t bytesPerSec = s->opened ?
+							BarSinkBytesPerSec (&s->format) : 0;
+					const size_t fill = s->fill;
+					pthread_mutex_unlock (&s->lock);
+					value = bytesPerSec > 0 ? (double) fill / bytesPerSec +
+							__atomic_load_n (&s->latency, __ATOMIC_RELAXED) /
+							1000.0 : 0;
+				}
+				BarMetricsValue (buf, families[i].name, labels, value);
+			}
+		}
+	}
+}
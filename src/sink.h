@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "settings.h"
+#include "metrics.h"
+
+/* outputs per zone */
+#define BAR_MAX_SINKS 4
+
+typedef struct {
+	unsigned int bits, channels, rate;
+} BarSinkFormat_t;
+
+struct BarSink;
+
+/* a kind of output. Everything is called by the sink’s writer thread only,
+ * optional functions may be NULL. */
+typedef struct {
+	const char *name;
+	/* start output in the sink’s format, set error and return false if that
+	 * is impossible */
+	bool (*open) (struct BarSink * const);
+	/* @return bytes taken, whole frames only, 0 if the output is not ready
+	 * and -1 on error */
+	ssize_t (*write) (struct BarSink * const, const char * const,
+			const size_t);
+	/* optional: wait at most ms milliseconds for the output to get ready
+	 * after write returned 0 */
+	void (*wait) (struct BarSink * const, const int);
+	/* optional: wait until everything written was played, skipped if the
+	 * set was aborted */
+	void (*drain) (struct BarSink * const);
+	/* optional: discard what was written but not played yet */
+	void (*flush) (struct BarSink * const);
+	void (*close) (struct BarSink * const);
+	/* optional: bytes written but not played yet */
+	size_t (*pending) (struct BarSink * const);
+} BarSinkDriver_t;
+
+typedef struct BarSink {
+	const BarSinkDriver_t *driver;
+	/* device name or path, may be NULL */
+	char *arg;
+	const BarSettings_t *settings;
+	size_t zone;
+	/* driver state */
+	void *handle;
+	int fd;
+	int64_t openedAt;
+	unsigned long openedWritten;
+	/* the driver keeps references to the queue instead of copying it, reserve
+	 * is the queue space set aside for them */
+	bool zeroCopy;
+	size_t reserve;
+	BarSinkFormat_t format;
+	/* why open failed */
+	const char *error;
+	/* the output thread waits for this sink instead of running ahead, so it
+	 * sets the pace */
+	bool clock;
+	BarSinkPolicy_t policy;
+	/* queue length in milliseconds */
+	unsigned int queueMs;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* ring buffer between the output thread and the writer, protected by
+	 * lock except for the bytes being written, which only the writer touches.
+	 * The held bytes before head were written, but the output may still
+	 * refer to them. After skipping audio they are no longer the newest
+	 * written ones, heldGap is set until the output let go of all of them. */
+	char *queue;
+	size_t size, head, fill, held;
+	bool heldGap;
+	/* queued bytes to drop instead of writing them */
+	size_t discard;
+	/* state of the device and requests to the writer, protected by lock.
+	 * Nothing is queued while a reopen is pending. */
+	bool opened, reopen, close, quit, writing, flush;
+	/* waiting for the writer was given up on, no one waits for the device
+	 * until the next BarSinksOpen. The writer is done once exited is set. */
+	bool abort, exited;
+
+	/* lifetime counters and the device latency in ms, updated atomically */
+	unsigned long written, dropped, overflows;
+	unsigned int latency;
+} BarSink_t;
+
+/* outputs of one zone, used by its output thread */
+typedef struct {
+	BarSink_t sink[BAR_MAX_SINKS];
+	size_t count;
+	/* format all sinks were opened with */
+	BarSinkFormat_t format;
+	bool opened;
+	const BarSettings_t *settings;
+	size_t zone;
+} BarSinkSet_t;
+
+void BarSinksInit (BarSinkSet_t * const, const BarSettings_t * const,
+		const BarZoneSettings_t * const, const size_t);
+bool BarSinksOpen (BarSinkSet_t * const, const BarSinkFormat_t * const);
+bool BarSinksWrite (BarSinkSet_t * const, const char * const, const size_t);
+void BarSinksFlush (BarSinkSet_t * const);
+void BarSinksAbort (BarSinkSet_t * const);
+void BarSinksClose (BarSinkSet_t * const);
+void BarSinksDestroy (BarSinkSet_t * const);
+void BarSinksMetrics (BarMetricsBuf_t * const, BarSinkSet_t * const [],
+		const size_t);
+
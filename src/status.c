@@ -0,0 +1,265 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* status page. The state of every zone is mirrored to a small file that
+ * other programs can map and poll without talking to pianobar. Writers
+ * update a zone inside a seqlock, readers retry until they get a copy the
+ * writers did not touch in between. See status.h for the layout.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "status.h"
+
+/*	create status file at path, replacing the old one atomically, so
+ *	readers never see a truncated page
+ */
+bool BarStatusOpen (BarStatus_t * const status, const char * const path,
+		const size_t zoneCount, const int volume) {
+	assert (status != NULL);
+	assert (zoneCount <= BAR_MAX_ZONES);
+
+	status->page = NULL;
+	status->path = NULL;
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		status->slots[i].zone = NULL;
+		pthread_mutex_init (&status->slots[i].lock, NULL);
+	}
+
+	if (path == NULL) {
+		return false;
+	}
+
+	const size_t tmpLen = strlen (path) + 5;
+	char * const tmpPath = malloc (tmpLen);
+	if (tmpPath == NULL) {
+		return false;
+	}
+	snprintf (tmpPath, tmpLen, "%s.new", path);
+
+	BarStatusPage_t *page = MAP_FAILED;
+	const int fd = open (tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd != -1) {
+		if (ftruncate (fd, sizeof (*page)) == 0) {
+			page = mmap (NULL, sizeof (*page), PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, 0);
+		}
+		close (fd);
+	}
+	if (page == MAP_FAILED) {
+		unlink (tmpPath);
+		free (tmpPath);
+		return false;
+	}
+
+	/* the file is all zeros, i.e. every zone stopped */
+	page->version = BAR_STATUS_VERSION;
+	page->size = sizeof (*page);
+	page->zoneCount = zoneCount;
+	for (size_t i = 0; i < zoneCount; i++) {
+		page->zones[i].volume = volume;
+		status->slots[i].zone = &page->zones[i];
+	}
+	__atomic_store_n (&page->magic, BAR_STATUS_MAGIC, __ATOMIC_RELEASE);
+
+	if (rename (tmpPath, path) != 0) {
+		munmap (page, sizeof (*page));
+		unlink (tmpPath);
+		free (tmpPath);
+		for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+			status->slots[i].zone = NULL;
+		}
+		return false;
+	}
+	free (tmpPath);
+
+	status->page = page;
+	status->path = strdup (path);
+	return true;
+}
+
+void BarStatusClose (BarStatus_t * const status) {
+	assert (status != NULL);
+
+	if (status->page != NULL) {
+		munmap (status->page, sizeof (*status->page));
+		status->page = NULL;
+	}
+	if (status->path != NULL) {
+		unlink (status->path);
+		free (status->path);
+		status->path = NULL;
+	}
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		status->slots[i].zone = NULL;
+		pthread_mutex_destroy (&status->slots[i].lock);
+	}
+}
+
+/*	@return writer for zone i, NULL if there is no status page
+ */
+BarStatusSlot_t *BarStatusGetSlot (BarStatus_t * const status,
+		const size_t i) {
+	assert (status != NULL);
+	assert (i < BAR_MAX_ZONES);
+
+	return status->slots[i].zone != NULL ? &status->slots[i] : NULL;
+}
+
+/*	start an update, readers retry until BarStatusEnd
+ *	@return false if there is nothing to update
+ */
+static bool BarStatusBegin (BarStatusSlot_t * const slot) {
+	if (slot == NULL) {
+		return false;
+	}
+	pthread_mutex_lock (&slot->lock);
+	BarStatusZone_t * const z = slot->zone;
+	__atomic_store_n (&z->seq, z->seq + 1, __ATOMIC_RELAXED);
+	/* the odd sequence number must be visible before any data changes */
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	return true;
+}
+
+static void BarStatusEnd (BarStatusSlot_t * const slot) {
+	BarStatusZone_t * const z = slot->zone;
+	__atomic_store_n (&z->seq, z->seq + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock (&slot->lock);
+}
+
+void BarStatusSetState (BarStatusSlot_t * const slot,
+		const BarStatusState_t state) {
+	if (!BarStatusBegin (slot)) {
+		return;
+	}
+	slot->zone->state = state;
+	if (state == BAR_STATUS_STOPPED) {
+		slot->zone->paused = 0;
+		slot->zone->bufferMs = 0;
+	}
+	BarStatusEnd (slot);
+}
+
+void BarStatusSetPaused (BarStatusSlot_t * const slot, const bool paused) {
+	if (!BarStatusBegin (slot)) {
+		return;
+	}
+	slot->zone->paused = paused;
+	BarStatusEnd (slot);
+}
+
+void BarStatusSetPosition (BarStatusSlot_t * const slot,
+		const unsigned int songPlayed) {
+	if (!BarStatusBegin (slot)) {
+		return;
+	}
+	slot->zone->songPlayed = songPlayed;
+	BarStatusEnd (slot);
+}
+
+void BarStatusSetBuffer (BarStatusSlot_t * const slot,
+		const unsigned int bufferMs) {
+	if (!BarStatusBegin (slot)) {
+		return;
+	}
+	slot->zone->bufferMs = bufferMs;
+	BarStatusEnd (slot);
+}
+
+void BarStatusSetStats (BarStatusSlot_t * const slot,
+		const unsigned int throughput, const unsigned int underruns) {
+	if (!BarStatusBegin (slot)) {
+		return;
+	}
+	slot->zone->throughput = throughput;
+	slot->zone->underruns = underruns;
+	BarStatusEnd (slot);
+}
+
+/*	append s to the zone’s strings, truncating it if necessary
+ *	@return offset of s
+ */
+static uint32_t BarStatusPutString (BarStatusZone_t * const z,
+		size_t * const used, const char * const s) {
+	const size_t avail = sizeof (z->strings) - *used;
+	if (s == NULL || *s == '\0' || avail < 2) {
+		return 0;
+	}
+	const size_t len = strlen (s) < avail - 1 ? strlen (s) : avail - 1;
+	const uint32_t off = *used;
+	memcpy (&z->strings[off], s, len);
+	z->strings[off + len] = '\0';
+	*used += len + 1;
+	return off;
+}
+
+/*	song started playing
+ */
+void BarStatusSetSong (BarStatusSlot_t * const slot,
+		const PianoSong_t * const song, const PianoStation_t * const station) {
+	assert (song != NULL);
+
+	if (!BarStatusBegin (slot)) {
+		return;
+	}
+	BarStatusZone_t * const z = slot->zone;
+	/* offset 0 is the empty string */
+	size_t used = 1;
+	z->strings[0] = '\0';
+	z->title = BarStatusPutString (z, &used, song->title);
+	z->artist = BarStatusPutString (z, &used, song->artist);
+	z->album = BarStatusPutString (z, &used, song->album);
+	z->station = BarStatusPutString (z, &used,
+			station != NULL ? station->name : NULL);
+	z->stationId = BarStatusPutString (z, &used, song->stationId);
+	z->trackToken = BarStatusPutString (z, &used, song->trackToken);
+	z->coverArt = BarStatusPutString (z, &used, song->coverArt);
+	z->detailUrl = BarStatusPutString (z, &used, song->detailUrl);
+	z->songPlayed = 0;
+	z->songDuration = song->length;
+	z->paused = 0;
+	BarStatusEnd (slot);
+}
+
+/*	volume is the same for all zones
+ */
+void BarStatusSetVolume (BarStatus_t * const status, const int volume) {
+	assert (status != NULL);
+
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		BarStatusSlot_t * const slot = BarStatusGetSlot (status, i);
+		if (BarStatusBegin (slot)) {
+			slot->zone->volume = volume;
+			BarStatusEnd (slot);
+		}
+	}
+}
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+/* Layout of the status file. Other programs may map it read-only and copy a
+ * zone like this:
+ *
+ *   do {
+ *     while ((seq = atomic_load (&zone->seq)) & 1);
+ *     memcpy (&copy, zone, sizeof (copy));
+ *     atomic_thread_fence (acquire);
+ *   } while (atomic_load (&zone->seq) != seq);
+ *
+ * The copy is consistent if seq did not change in between. Strings are
+ * offsets into strings, offset 0 is the empty string.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <piano.h>
+
+#include "settings.h"
+
+#define BAR_STATUS_MAGIC 0x72616270 /* "pbar" in little endian */
+#define BAR_STATUS_VERSION 1
+#define BAR_STATUS_STRINGS 2048
+
+typedef enum {
+	BAR_STATUS_STOPPED = 0,
+	BAR_STATUS_LOADING = 1,
+	BAR_STATUS_PLAYING = 2,
+} BarStatusState_t;
+
+typedef struct {
+	/* odd while the zone is being updated */
+	uint32_t seq;
+	/* BarStatusState_t */
+	uint32_t state;
+	uint32_t paused;
+	/* seconds */
+	uint32_t songPlayed, songDuration;
+	/* decoded audio waiting for the output, milliseconds */
+	uint32_t bufferMs;
+	/* bit/s */
+	uint32_t throughput;
+	uint32_t underruns;
+	/* dB */
+	int32_t volume;
+	uint32_t title, artist, album, station, stationId, trackToken, coverArt,
+			detailUrl;
+	char strings[BAR_STATUS_STRINGS];
+} BarStatusZone_t;
+
+typedef struct {
+	uint32_t magic, version;
+	/* of the whole page, readers must check it */
+	uint32_t size;
+	uint32_t zoneCount;
+	BarStatusZone_t zones[BAR_MAX_ZONES];
+} BarStatusPage_t;
+
+/* writer side of a zone, updates are serialized by lock */
+typedef struct {
+	BarStatusZone_t *zone;
+	pthread_mutex_t lock;
+} BarStatusSlot_t;
+
+typedef struct {
+	/* NULL if disabled */
+	BarStatusPage_t *page;
+	char *path;
+	BarStatusSlot_t slots[BAR_MAX_ZONES];
+} BarStatus_t;
+
+bool BarStatusOpen (BarStatus_t * const, const char * const, const size_t,
+		const int);
+void BarStatusClose (BarStatus_t * const);
+BarStatusSlot_t *BarStatusGetSlot (BarStatus_t * const, const size_t);
+void BarStatusSetState (BarStatusSlot_t * const, const BarStatusState_t);
+void BarStatusSetPaused (BarStatusSlot_t * const, const bool);
+void BarStatusSetPosition (BarStatusSlot_t * const, const unsigned int);
+void BarStatusSetBuffer (BarStatusSlot_t * const, const unsigned int);
+void BarStatusSetStats (BarStatusSlot_t * const, const unsigned int,
+		const unsigned int);
+void BarStatusSetSong (BarStatusSlot_t * const, const PianoSong_t * const,
+		const PianoStation_t * const);
+void BarStatusSetVolume (BarStatus_t * const, const int);
+
@@ -0,0 +1,1088 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* audio streaming server. The output thread of every zone appends the pcm it
+ * plays to its feed, a thread of our own serves it over HTTP to any number of
+ * listeners, as wav, raw pcm or, if stream_encoder is set, encoded once for
+ * all of them. Listeners share the pages of a feed, so no matter how many
+ * there are, every byte is copied only once. Nobody ever waits for a
+ * listener: one that falls behind skips ahead (pcm) or is disconnected
+ * (encoded streams, which cannot be cut at arbitrary points).
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/channel_layout.h>
+
+#include "stream.h"
+#include "listen.h"
+#include "realtime.h"
+#include "debug.h"
+#include "trace.h"
+
+/* samples handed to the encoder’s filter graph at once */
+static const int encoderChunk = 1024;
+/* size of the muxer’s output buffer */
+static const int muxerBufferSize = 4096;
+
+typedef struct BarStreamEncoder {
+	BarStreamFeed_t *feed;
+	unsigned int generation;
+	AVCodecContext *cctx;
+	AVFormatContext *fctx;
+	AVFilterGraph *graph;
+	AVFilterContext *src, *sink;
+	AVFrame *in, *out;
+	AVPacket *pkt;
+	/* bytes collected in in, pts of the next frame */
+	size_t fill;
+	int64_t pts;
+	/* read position in the feed’s pcm */
+	BarStreamPage_t *page;
+	size_t off;
+	/* written by the muxer before the first packet, every listener gets it
+	 * first */
+	char *header;
+	size_t headerLen;
+	bool inHeader;
+} BarStreamEncoder_t;
+
+/*	drop a reference to page, freeing it and possibly its successors
+ *	must be called with the feed’s lock held
+ */
+static void BarStreamRelease (BarStreamPage_t *page) {
+	while (page != NULL && --page->refs == 0) {
+		BarStreamPage_t * const next = page->next;
+		free (page);
+		page = next;
+	}
+}
+
+/*	forget the chain’s pages, readers keep theirs until they let go
+ */
+static void BarStreamChainReset (BarStreamChain_t * const chain) {
+	BarStreamRelease (chain->tail);
+	chain->tail = NULL;
+}
+
+static bool BarStreamAddPage (BarStreamChain_t * const chain) {
+	BarStreamPage_t * const page = malloc (sizeof (*page));
+	if (page == NULL) {
+		return false;
+	}
+	page->next = NULL;
+	page->refs = 1;
+	page->start = chain->written;
+	page->len = 0;
+	if (chain->tail != NULL) {
+		/* the old tail now refers to the new one, the chain does not need the
+		 * old one any more */
+		chain->tail->next = page;
+		++page->refs;
+		BarStreamRelease (chain->tail);
+	}
+	chain->tail = page;
+	return true;
+}
+
+static void BarStreamAppend (BarStreamChain_t * const chain,
+		const char *data, size_t len) {
+	while (len > 0) {
+		if ((chain->tail == NULL || chain->tail->len == BAR_STREAM_PAGE) &&
+				!BarStreamAddPage (chain)) {
+			return;
+		}
+		BarStreamPage_t * const tail = chain->tail;
+		const size_t n = len < BAR_STREAM_PAGE - tail->len ? len :
+				BAR_STREAM_PAGE - tail->len;
+		memcpy (tail->data + tail->len, data, n);
+		tail->len += n;
+		chain->written += n;
+		data += n;
+		len -= n;
+	}
+}
+
+/*	start reading at the chain’s current end
+ *	@return false if out of memory
+ */
+static bool BarStreamAttach (BarStreamChain_t * const chain,
+		BarStreamPage_t ** const page, size_t * const off) {
+	if (chain->tail == NULL && !BarStreamAddPage (chain)) {
+		return false;
+	}
+	*page = chain->tail;
+	++(*page)->refs;
+	*off = (*page)->len;
+	return true;
+}
+
+/*	@return bytes readable at the position, moving on to the next page if
+ *	the current one is done
+ */
+static size_t BarStreamAvail (BarStreamPage_t ** const page,
+		size_t * const off) {
+	while (*off == (*page)->len && (*page)->next != NULL) {
+		BarStreamPage_t * const next = (*page)->next;
+		++next->refs;
+		BarStreamRelease (*page);
+		*page = next;
+		*off = 0;
+	}
+	return (*page)->len - *off;
+}
+
+/*	@return bytes between the position and the chain’s end
+ */
+static uint64_t BarStreamLag (const BarStreamChain_t * const chain,
+		const BarStreamPage_t * const page, const size_t off) {
+	return chain->written - (page->start + off);
+}
+
+/*	move position towards the chain’s end, by a multiple of unit bytes. A
+ *	listener that stopped in the middle of a frame stays just as far into
+ *	one, so it does not get out of step.
+ *	@return bytes skipped
+ */
+static uint64_t BarStreamSkip (BarStreamChain_t * const chain,
+		BarStreamPage_t ** const page, size_t * const off,
+		const size_t unit) {
+	const uint64_t lag = BarStreamLag (chain, *page, *off);
+	const uint64_t skip = lag - lag % unit;
+	const uint64_t target = (*page)->start + *off + skip;
+	while (target > (*page)->start + (*page)->len) {
+		BarStreamPage_t * const next = (*page)->next;
+		assert (next != NULL);
+		++next->refs;
+		BarStreamRelease (*page);
+		*page = next;
+	}
+	*off = target - (*page)->start;
+	return skip;
+}
+
+static void BarStreamWake (BarStream_t * const s) {
+	if (__atomic_exchange_n (&s->wakePending, 1, __ATOMIC_ACQ_REL) == 0) {
+		const char c = 0;
+		if (write (s->wake[1], &c, 1) == -1) {
+			/* full pipe wakes the server up as well */
+		}
+	}
+}
+
+/*	@return bytes a listener may fall behind before it loses data
+ */
+static uint64_t BarStreamBacklog (const BarStream_t * const s,
+		const BarStreamFeed_t * const feed, const bool encoded) {
+	const uint64_t secs = s->settings->streamBacklog;
+	const uint64_t bytes = encoded ?
+			secs * s->settings->streamBitrate * 1000 / 8 :
+			secs * feed->rate * feed->channels * feed->bits / 8;
+	return bytes > BAR_STREAM_PAGE ? bytes : BAR_STREAM_PAGE;
+}
+
+static enum AVSampleFormat BarStreamSampleFormat (const unsigned int bits) {
+	return bits == 32 ? AV_SAMPLE_FMT_S32 : AV_SAMPLE_FMT_S16;
+}
+
+/*	muxer output, goes to the header until it is complete and to the
+ *	listeners afterwards
+ */
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+static int BarStreamMuxerWrite (void * const data, const uint8_t *buf,
+		int size) {
+#else
+static int BarStreamMuxerWrite (void * const data, uint8_t *buf, int size) {
+#endif
+	BarStreamEncoder_t * const enc = data;
+
+	if (enc->inHeader) {
+		char * const header = realloc (enc->header, enc->headerLen + size);
+		if (header == NULL) {
+			return AVERROR (ENOMEM);
+		}
+		memcpy (header + enc->headerLen, buf, size);
+		enc->header = header;
+		enc->headerLen += size;
+	} else {
+		BarStreamFeed_t * const feed = enc->feed;
+		pthread_mutex_lock (&feed->lock);
+		if (feed->encoded.tail != NULL) {
+			BarStreamAppend (&feed->encoded, (const char *) buf, size);
+		}
+		pthread_mutex_unlock (&feed->lock);
+	}
+	return size;
+}
+
+static void BarStreamEncoderFree (BarStreamEncoder_t * const enc) {
+	if (enc->fctx != NULL) {
+		if (enc->fctx->pb != NULL) {
+			av_freep (&enc->fctx->pb->buffer);
+			avio_context_free (&enc->fctx->pb);
+		}
+		avformat_free_context (enc->fctx);
+	}
+	avcodec_free_context (&enc->cctx);
+	avfilter_graph_free (&enc->graph);
+	av_frame_free (&enc->in);
+	av_frame_free (&enc->out);
+	av_packet_free (&enc->pkt);
+	free (enc->header);
+	free (enc);
+}
+
+/*	keep the input rate if the encoder supports it, prefer 48 kHz otherwise
+ */
+static int BarStreamEncoderRate (const AVCodec * const codec, const int rate) {
+	const int *r = codec->supported_samplerates;
+	if (r == NULL) {
+		return rate;
+	}
+	int best = r[0];
+	for (; *r != 0; r++) {
+		if (*r == rate) {
+			return rate;
+		} else if (*r == 48000) {
+			best = *r;
+		}
+	}
+	return best;
+}
+
+/*	input format -> encoder format, resampling as needed
+ */
+static bool BarStreamEncoderFilter (BarStreamEncoder_t * const enc,
+		const AVCodec * const codec, const unsigned int bits,
+		const AVChannelLayout * const layout, const unsigned int rate) {
+	char args[256], layoutStr[64];
+	av_channel_layout_describe (layout, layoutStr, sizeof (layoutStr));
+
+	if ((enc->graph = avfilter_graph_alloc ()) == NULL) {
+		return false;
+	}
+	snprintf (args, sizeof (args), "time_base=1/%u:sample_rate=%u:"
+			"sample_fmt=%s:channel_layout=%s", rate, rate,
+			av_get_sample_fmt_name (BarStreamSampleFormat (bits)), layoutStr);
+	AVFilterContext *fmt = NULL;
+	if (avfilter_graph_create_filter (&enc->src,
+			avfilter_get_by_name ("abuffer"), "source", args, NULL,
+			enc->graph) < 0) {
+		return false;
+	}
+	snprintf (args, sizeof (args), "sample_fmts=%s:sample_rates=%d:"
+			"channel_layouts=%s", av_get_sample_fmt_name (enc->cctx->sample_fmt),
+			enc->cctx->sample_rate, layoutStr);
+	if (avfilter_graph_create_filter (&fmt, avfilter_get_by_name ("aformat"),
+			"format", args, NULL, enc->graph) < 0 ||
+			avfilter_graph_create_filter (&enc->sink,
+			avfilter_get_by_name ("abuffersink"), "sink", NULL, NULL,
+			enc->graph) < 0) {
+		return false;
+	}
+	if (avfilter_link (enc->src, 0, fmt, 0) != 0 ||
+			avfilter_link (fmt, 0, enc->sink, 0) != 0 ||
+			avfilter_graph_config (enc->graph, NULL) < 0) {
+		return false;
+	}
+	/* most encoders take fixed-size frames only */
+	if (!(codec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE) &&
+			enc->cctx->frame_size > 0) {
+		av_buffersink_set_frame_size (enc->sink, enc->cctx->frame_size);
+	}
+	return true;
+}
+
+/*	set up the encoder of feed, it starts with the pcm arriving next
+ */
+static bool BarStreamEncoderOpen (BarStream_t * const s,
+		BarStreamFeed_t * const feed) {
+	const AVCodec * const codec =
+			avcodec_find_encoder_by_name (s->settings->streamEncoder);
+	if (codec == NULL) {
+		debugPrint (DEBUG_AUDIO, "stream encoder %s not found\n",
+				s->settings->streamEncoder);
+		return false;
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	const unsigned int generation = feed->generation, bits = feed->bits,
+			channels = feed->channels, rate = feed->rate;
+	pthread_mutex_unlock (&feed->lock);
+
+	BarStreamEncoder_t * const enc = calloc (1, sizeof (*enc));
+	if (enc == NULL) {
+		return false;
+	}
+	enc->feed = feed;
+	enc->generation = generation;
+
+	AVChannelLayout layout;
+	av_channel_layout_default (&layout, channels);
+
+	if ((enc->cctx = avcodec_alloc_context3 (codec)) == NULL) {
+		goto error;
+	}
+	enc->cctx->sample_fmt = codec->sample_fmts != NULL ?
+			codec->sample_fmts[0] : BarStreamSampleFormat (bits);
+	enc->cctx->sample_rate = BarStreamEncoderRate (codec, rate);
+	av_channel_layout_copy (&enc->cctx->ch_layout, &layout);
+	enc->cctx->bit_rate = s->settings->streamBitrate * 1000;
+	enc->cctx->time_base = (AVRational) {1, enc->cctx->sample_rate};
+
+	/* mp3 is streamed as is, everything else in ogg */
+	const char * const muxer = codec->id == AV_CODEC_ID_MP3 ? "mp3" : "ogg";
+	if (avformat_alloc_output_context2 (&enc->fctx, NULL, muxer, NULL) < 0) {
+		goto error;
+	}
+	if (enc->fctx->oformat->flags & AVFMT_GLOBALHEADER) {
+		enc->cctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+	}
+	if (avcodec_open2 (enc->cctx, codec, NULL) < 0) {
+		goto error;
+	}
+	AVStream * const st = avformat_new_stream (enc->fctx, NULL);
+	if (st == NULL ||
+			avcodec_parameters_from_context (st->codecpar, enc->cctx) < 0) {
+		goto error;
+	}
+	st->time_base = enc->cctx->time_base;
+	unsigned char * const ioBuffer = av_malloc (muxerBufferSize);
+	if (ioBuffer == NULL) {
+		goto error;
+	}
+	if ((enc->fctx->pb = avio_alloc_context (ioBuffer, muxerBufferSize, 1,
+			enc, NULL, BarStreamMuxerWrite, NULL)) == NULL) {
+		av_free (ioBuffer);
+		goto error;
+	}
+
+	if (!BarStreamEncoderFilter (enc, codec, bits, &layout, rate)) {
+		goto error;
+	}
+
+	if ((enc->in = av_frame_alloc ()) == NULL ||
+			(enc->out = av_frame_alloc ()) == NULL ||
+			(enc->pkt = av_packet_alloc ()) == NULL) {
+		goto error;
+	}
+	enc->in->format = BarStreamSampleFormat (bits);
+	av_channel_layout_copy (&enc->in->ch_layout, &layout);
+	enc->in->sample_rate = rate;
+	enc->in->nb_samples = encoderChunk;
+	if (av_frame_get_buffer (enc->in, 0) < 0) {
+		goto error;
+	}
+
+	/* listeners joining later need the stream header, so keep it */
+	AVDictionary *options = NULL;
+	av_dict_set (&options, "id3v2_version", "0", 0);
+	enc->inHeader = true;
+	const int ret = avformat_write_header (enc->fctx, &options);
+	avio_flush (enc->fctx->pb);
+	enc->inHeader = false;
+	av_dict_free (&options);
+	if (ret < 0) {
+		goto error;
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	if (feed->generation != generation ||
+			!BarStreamAttach (&feed->pcm, &enc->page, &enc->off)) {
+		pthread_mutex_unlock (&feed->lock);
+		goto error;
+	}
+	feed->encoder = enc;
+	pthread_mutex_unlock (&feed->lock);
+
+	av_channel_layout_uninit (&layout);
+	debugPrint (DEBUG_AUDIO, "stream encoder %s at %d Hz started\n",
+			codec->name, enc->cctx->sample_rate);
+	return true;
+
+error:
+	av_channel_layout_uninit (&layout);
+	BarStreamEncoderFree (enc);
+	return false;
+}
+
+static void BarStreamEncoderClose (BarStreamFeed_t * const feed) {
+	BarStreamEncoder_t * const enc = feed->encoder;
+	if (enc == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	feed->encoder = NULL;
+	BarStreamRelease (enc->page);
+	if (feed->pcmListeners == 0) {
+		BarStreamChainReset (&feed->pcm);
+	}
+	BarStreamChainReset (&feed->encoded);
+	pthread_mutex_unlock (&feed->lock);
+
+	BarStreamEncoderFree (enc);
+}
+
+/*	encode whatever the filter graph has ready and hand it to the muxer
+ */
+static bool BarStreamEncoderDrain (BarStreamEncoder_t * const enc) {
+	const AVRational sinkBase = av_buffersink_get_time_base (enc->sink);
+	AVStream * const st = enc->fctx->streams[0];
+	while (av_buffersink_get_frame (enc->sink, enc->out) >= 0) {
+		enc->out->pts = av_rescale_q (enc->out->pts, sinkBase,
+				enc->cctx->time_base);
+		const int ret = avcodec_send_frame (enc->cctx, enc->out);
+		av_frame_unref (enc->out);
+		if (ret < 0) {
+			return false;
+		}
+		while (avcodec_receive_packet (enc->cctx, enc->pkt) == 0) {
+			enc->pkt->stream_index = 0;
+			av_packet_rescale_ts (enc->pkt, enc->cctx->time_base,
+					st->time_base);
+			const int wret = av_write_frame (enc->fctx, enc->pkt);
+			av_packet_unref (enc->pkt);
+			if (wret < 0) {
+				return false;
+			}
+		}
+	}
+	avio_flush (enc->fctx->pb);
+	return true;
+}
+
+/*	encode the pcm that arrived since the last call
+ */
+static void BarStreamEncoderStep (BarStream_t * const s,
+		BarStreamFeed_t * const feed) {
+	BarStreamEncoder_t * const enc = feed->encoder;
+
+	while (true) {
+		if (enc->fill == 0 && av_frame_make_writable (enc->in) < 0) {
+			BarStreamEncoderClose (feed);
+			return;
+		}
+
+		pthread_mutex_lock (&feed->lock);
+		if (enc->generation != feed->generation) {
+			pthread_mutex_unlock (&feed->lock);
+			BarStreamEncoderClose (feed);
+			return;
+		}
+		const size_t frameBytes = feed->channels * feed->bits / 8;
+		if (BarStreamLag (&feed->pcm, enc->page, enc->off) >
+				BarStreamBacklog (s, feed, false)) {
+			/* too slow, drop audio rather than memory */
+			feed->skipped += BarStreamSkip (&feed->pcm, &enc->page, &enc->off,
+					1);
+			enc->fill -= enc->fill % frameBytes;
+		}
+		const size_t full = enc->in->nb_samples * frameBytes;
+		const size_t avail = BarStreamAvail (&enc->page, &enc->off);
+		const size_t n = avail < full - enc->fill ? avail : full - enc->fill;
+		memcpy (enc->in->data[0] + enc->fill, enc->page->data + enc->off, n);
+		enc->off += n;
+		enc->fill += n;
+		pthread_mutex_unlock (&feed->lock);
+
+		if (enc->fill < full) {
+			return;
+		}
+		enc->fill = 0;
+		enc->in->pts = enc->pts;
+		enc->pts += enc->in->nb_samples;
+		if (av_buffersrc_write_frame (enc->src, enc->in) < 0 ||
+				!BarStreamEncoderDrain (enc)) {
+			debugPrint (DEBUG_AUDIO, "stream encoder failed\n");
+			BarStreamEncoderClose (feed);
+			return;
+		}
+	}
+}
+
+static void BarStreamInitClient (BarStreamClient_t * const c) {
+	c->fd = -1;
+	c->inLen = 0;
+	c->head = NULL;
+	c->headLen = 0;
+	c->headPos = 0;
+	c->feed = NULL;
+	c->encoded = false;
+	c->generation = 0;
+	c->page = NULL;
+	c->off = 0;
+	c->blocked = false;
+}
+
+static void BarStreamDrop (BarStreamClient_t * const c) {
+	if (c->fd != -1) {
+		close (c->fd);
+	}
+	free (c->head);
+	BarStreamFeed_t * const feed = c->feed;
+	if (feed != NULL) {
+		bool closeEncoder = false;
+		pthread_mutex_lock (&feed->lock);
+		BarStreamRelease (c->page);
+		if (c->encoded) {
+			closeEncoder = --feed->encodedListeners == 0;
+		} else if (--feed->pcmListeners == 0 && feed->encoder == NULL) {
+			BarStreamChainReset (&feed->pcm);
+		}
+		pthread_mutex_unlock (&feed->lock);
+		if (closeEncoder) {
+			BarStreamEncoderClose (feed);
+		}
+	}
+	BarStreamInitClient (c);
+}
+
+static void BarStreamPut16 (char * const p, const unsigned int v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void BarStreamPut32 (char * const p, const unsigned int v) {
+	BarStreamPut16 (p, v & 0xffff);
+	BarStreamPut16 (p + 2, v >> 16);
+}
+
+/*	header of a wav file of unknown length
+ */
+static void BarStreamWavHeader (char * const h, const unsigned int bits,
+		const unsigned int channels, const unsigned int rate) {
+	memcpy (h, "RIFF", 4);
+	/* players accept the largest size for streams */
+	BarStreamPut32 (h + 4, 0xffffffff);
+	memcpy (h + 8, "WAVEfmt ", 8);
+	BarStreamPut32 (h + 16, 16);
+	/* integer pcm */
+	BarStreamPut16 (h + 20, 1);
+	BarStreamPut16 (h + 22, channels);
+	BarStreamPut32 (h + 24, rate);
+	BarStreamPut32 (h + 28, rate * channels * bits / 8);
+	BarStreamPut16 (h + 32, channels * bits / 8);
+	BarStreamPut16 (h + 34, bits);
+	memcpy (h + 36, "data", 4);
+	BarStreamPut32 (h + 40, 0xffffffff);
+}
+
+/*	queue response head, followed by body, which may contain nul bytes
+ */
+static bool BarStreamRespond (BarStreamClient_t * const c,
+		const char * const status, const char * const type,
+		const char * const body, const size_t bodyLen) {
+	char head[512];
+	const int len = snprintf (head, sizeof (head), "HTTP/1.0 %s\r\n"
+			"Content-Type: %s\r\n"
+			"Cache-Control: no-cache\r\n"
+			"Connection: close\r\n\r\n", status, type);
+	assert (len > 0 && (size_t) len < sizeof (head));
+	if ((c->head = malloc (len + bodyLen)) == NULL) {
+		return false;
+	}
+	memcpy (c->head, head, len);
+	if (bodyLen > 0) {
+		memcpy (c->head + len, body, bodyLen);
+	}
+	c->headLen = len + bodyLen;
+	c->headPos = 0;
+	return true;
+}
+
+static void BarStreamError (BarStreamClient_t * const c,
+		const char * const status) {
+	if (!BarStreamRespond (c, status, "text/plain", status, strlen (status))) {
+		BarStreamDrop (c);
+	}
+}
+
+/*	answer GET /<zone>.<format>, zones are numbered from 1 like everywhere
+ *	else
+ */
+static void BarStreamRequest (BarStream_t * const s,
+		BarStreamClient_t * const c) {
+	unsigned int zone;
+	char ext[8];
+	if (sscanf (c->in, "GET /%u.%7[a-z] ", &zone, ext) != 2) {
+		BarStreamError (c, strncmp (c->in, "GET ", 4) == 0 ? "404 Not Found" :
+				"405 Method Not Allowed");
+		return;
+	}
+	if (zone < 1 || zone > s->zoneCount) {
+		BarStreamError (c, "404 Not Found");
+		return;
+	}
+	BarStreamFeed_t * const feed = &s->feeds[zone - 1];
+
+	const bool wav = strcmp (ext, "wav") == 0, pcm = strcmp (ext, "pcm") == 0;
+	const bool encoded = s->settings->streamEncoder != NULL &&
+			(strcmp (ext, "mp3") == 0 || strcmp (ext, "ogg") == 0);
+	if (!wav && !pcm && !encoded) {
+		BarStreamError (c, "404 Not Found");
+		return;
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	const unsigned int bits = feed->bits, channels = feed->channels,
+			rate = feed->rate;
+	pthread_mutex_unlock (&feed->lock);
+	if (bits == 0) {
+		BarStreamError (c, "503 Nothing Played Yet");
+		return;
+	}
+
+	if (encoded && feed->encoder == NULL && !BarStreamEncoderOpen (s, feed)) {
+		BarStreamError (c, "500 Encoder Failed");
+		return;
+	}
+	if (encoded) {
+		const char * const muxer = feed->encoder->fctx->oformat->name;
+		if (strcmp (muxer, ext) != 0) {
+			BarStreamError (c, "404 Not Found");
+			return;
+		}
+	}
+
+	/* respond first, so a client without a position is never attached */
+	bool ok;
+	if (encoded) {
+		ok = BarStreamRespond (c, "200 OK", strcmp (ext, "mp3") == 0 ?
+				"audio/mpeg" : "audio/ogg", feed->encoder->header,
+				feed->encoder->headerLen);
+	} else if (wav) {
+		char header[44];
+		BarStreamWavHeader (header, bits, channels, rate);
+		ok = BarStreamRespond (c, "200 OK", "audio/wav", header,
+				sizeof (header));
+	} else {
+		ok = BarStreamRespond (c, "200 OK", "application/octet-stream", NULL,
+				0);
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	/* the format may have changed in the meantime, the header is wrong then */
+	if (ok && feed->bits == bits && feed->channels == channels &&
+			feed->rate == rate) {
+		ok = BarStreamAttach (encoded ? &feed->encoded : &feed->pcm,
+				&c->page, &c->off);
+	} else {
+		ok = false;
+	}
+	if (ok) {
+		c->feed = feed;
+		c->encoded = encoded;
+		c->generation = feed->generation;
+		if (encoded) {
+			++feed->encodedListeners;
+		} else {
+			++feed->pcmListeners;
+		}
+	}
+	pthread_mutex_unlock (&feed->lock);
+
+	if (!ok) {
+		/* an encoder nobody listens to is not needed */
+		if (encoded && feed->encodedListeners == 0) {
+			BarStreamEncoderClose (feed);
+		}
+		BarStreamDrop (c);
+		return;
+	}
+	debugPrint (DEBUG_AUDIO, "stream client %i listens to zone %u (%s)\n",
+			c->fd, zone, ext);
+}
+
+/*	read the request, after that only detect the client hanging up
+ */
+static void BarStreamRead (BarStream_t * const s, BarStreamClient_t * const c) {
+	if (c->head != NULL) {
+		char buf[256];
+		const ssize_t ret = read (c->fd, buf, sizeof (buf));
+		if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)) {
+			BarStreamDrop (c);
+		}
+		return;
+	}
+
+	const ssize_t ret = read (c->fd, c->in + c->inLen,
+			sizeof (c->in) - c->inLen - 1);
+	if (ret <= 0) {
+		if (ret == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+				errno != EINTR)) {
+			BarStreamDrop (c);
+		}
+		return;
+	}
+	c->inLen += ret;
+	c->in[c->inLen] = '\0';
+
+	if (strstr (c->in, "\r\n\r\n") != NULL || strstr (c->in, "\n\n") != NULL) {
+		BarStreamRequest (s, c);
+	} else if (c->inLen >= sizeof (c->in) - 1) {
+		BarStreamError (c, "431 Request Header Fields Too Large");
+	}
+}
+
+/*	send the response head and as much audio as the socket takes
+ */
+static void BarStreamWriteClient (BarStream_t * const s,
+		BarStreamClient_t * const c) {
+	while (c->headPos < c->headLen) {
+		const ssize_t ret = write (c->fd, c->head + c->headPos,
+				c->headLen - c->headPos);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				c->blocked = true;
+			} else if (errno != EINTR) {
+				BarStreamDrop (c);
+			}
+			return;
+		}
+		c->headPos += ret;
+	}
+
+	BarStreamFeed_t * const feed = c->feed;
+	if (feed == NULL) {
+		/* error response is complete */
+		BarStreamDrop (c);
+		return;
+	}
+
+	while (true) {
+		pthread_mutex_lock (&feed->lock);
+		if (c->generation != feed->generation ||
+				(c->encoded && feed->encoder == NULL)) {
+			/* the header we sent does not match the audio any more or the
+			 * encoder failed */
+			pthread_mutex_unlock (&feed->lock);
+			BarStreamDrop (c);
+			return;
+		}
+		BarStreamChain_t * const chain = c->encoded ? &feed->encoded :
+				&feed->pcm;
+		if (BarStreamLag (chain, c->page, c->off) >
+				BarStreamBacklog (s, feed, c->encoded)) {
+			if (c->encoded) {
+				++feed->dropped;
+				pthread_mutex_unlock (&feed->lock);
+				debugPrint (DEBUG_AUDIO, "stream client %i is too slow\n",
+						c->fd);
+				BarStreamDrop (c);
+				return;
+			}
+			/* pcm listeners may have stopped mid-frame */
+			feed->skipped += BarStreamSkip (chain, &c->page, &c->off,
+					feed->channels * feed->bits / 8);
+		}
+		const size_t avail = BarStreamAvail (&c->page, &c->off);
+		pthread_mutex_unlock (&feed->lock);
+
+		if (avail == 0) {
+			return;
+		}
+		/* only this thread moves the position, the data below len is fixed */
+		const ssize_t ret = write (c->fd, c->page->data + c->off, avail);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				c->blocked = true;
+			} else if (errno != EINTR) {
+				BarStreamDrop (c);
+			}
+			return;
+		}
+		c->off += ret;
+		if ((size_t) ret < avail) {
+			c->blocked = true;
+			return;
+		}
+	}
+}
+
+static void BarStreamAccept (BarStream_t * const s) {
+	const int fd = accept (s->fd, NULL, NULL);
+	if (fd == -1) {
+		return;
+	}
+	for (size_t i = 0; i < BAR_STREAM_MAX_CLIENTS; i++) {
+		BarStreamClient_t * const c = &s->clients[i];
+		if (c->fd == -1) {
+			if (!BarListenSetFlags (fd)) {
+				break;
+			}
+			c->fd = fd;
+			return;
+		}
+	}
+	close (fd);
+}
+
+/*	server thread, lives as long as the stream
+ */
+static void *BarStreamThread (void * const data) {
+	BarStream_t * const s = data;
+	BarTraceThread ("stream");
+
+	while (!__atomic_load_n (&s->quit, __ATOMIC_ACQUIRE)) {
+		struct pollfd fds[2 + BAR_STREAM_MAX_CLIENTS];
+		BarStreamClient_t *polled[BAR_STREAM_MAX_CLIENTS];
+		fds[0].fd = s->wake[0];
+		fds[0].events = POLLIN;
+		fds[1].fd = s->fd;
+		fds[1].events = POLLIN;
+		size_t n = 0;
+		for (size_t i = 0; i < BAR_STREAM_MAX_CLIENTS; i++) {
+			BarStreamClient_t * const c = &s->clients[i];
+			if (c->fd == -1) {
+				continue;
+			}
+			fds[2 + n].fd = c->fd;
+			fds[2 + n].events = POLLIN | (c->blocked ? POLLOUT : 0);
+			polled[n] = c;
+			++n;
+		}
+
+		if (poll (fds, 2 + n, 1000) < 0) {
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			__atomic_store_n (&s->wakePending, 0, __ATOMIC_RELEASE);
+			char buf[64];
+			while (read (s->wake[0], buf, sizeof (buf)) > 0);
+		}
+		for (size_t i = 0; i < n; i++) {
+			BarStreamClient_t * const c = polled[i];
+			const short revents = fds[2 + i].revents;
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				BarStreamRead (s, c);
+			}
+			if (c->fd != -1 && (revents & POLLOUT)) {
+				c->blocked = false;
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			BarStreamAccept (s);
+		}
+
+		for (size_t i = 0; i < s->zoneCount; i++) {
+			if (s->feeds[i].encoder != NULL) {
+				BarStreamEncoderStep (s, &s->feeds[i]);
+			}
+		}
+		for (size_t i = 0; i < BAR_STREAM_MAX_CLIENTS; i++) {
+			BarStreamClient_t * const c = &s->clients[i];
+			if (c->fd != -1 && c->head != NULL && !c->blocked) {
+				BarStreamWriteClient (s, c);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*	start serving the zones’ audio at settings->streamListen
+ */
+bool BarStreamOpen (BarStream_t * const s, const BarSettings_t * const settings,
+		const size_t zoneCount) {
+	assert (s != NULL);
+	assert (zoneCount <= BAR_MAX_ZONES);
+
+	memset (s, 0, sizeof (*s));
+	s->fd = -1;
+	s->wake[0] = s->wake[1] = -1;
+	s->settings = settings;
+	s->zoneCount = zoneCount;
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		BarRealtimeMutexInit (&s->feeds[i].lock, settings);
+		s->feeds[i].stream = s;
+	}
+	for (size_t i = 0; i < BAR_STREAM_MAX_CLIENTS; i++) {
+		BarStreamInitClient (&s->clients[i]);
+	}
+
+	if (settings->streamListen == NULL) {
+		return false;
+	}
+	if ((s->fd = BarListenOpen (settings->streamListen)) == -1) {
+		return false;
+	}
+	if (pipe (s->wake) != 0 || !BarListenSetFlags (s->wake[0]) ||
+			!BarListenSetFlags (s->wake[1]) ||
+			pthread_create (&s->thread, NULL, BarStreamThread, s) != 0) {
+		close (s->fd);
+		s->fd = -1;
+		for (size_t i = 0; i < 2; i++) {
+			if (s->wake[i] != -1) {
+				close (s->wake[i]);
+				s->wake[i] = -1;
+			}
+		}
+		return false;
+	}
+	return true;
+}
+
+void BarStreamClose (BarStream_t * const s) {
+	assert (s != NULL);
+
+	if (s->fd != -1) {
+		__atomic_store_n (&s->quit, true, __ATOMIC_RELEASE);
+		BarStreamWake (s);
+		pthread_join (s->thread, NULL);
+		for (size_t i = 0; i < BAR_STREAM_MAX_CLIENTS; i++) {
+			BarStreamDrop (&s->clients[i]);
+		}
+		for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+			BarStreamEncoderClose (&s->feeds[i]);
+		}
+		close (s->fd);
+		s->fd = -1;
+		if (s->settings->streamListen[0] == '/') {
+			unlink (s->settings->streamListen);
+		}
+	}
+	for (size_t i = 0; i < 2; i++) {
+		if (s->wake[i] != -1) {
+			close (s->wake[i]);
+			s->wake[i] = -1;
+		}
+	}
+	for (size_t i = 0; i < BAR_MAX_ZONES; i++) {
+		BarStreamChainReset (&s->feeds[i].pcm);
+		BarStreamChainReset (&s->feeds[i].encoded);
+		pthread_mutex_destroy (&s->feeds[i].lock);
+	}
+}
+
+/*	@return feed of zone i, NULL if streaming is disabled
+ */
+BarStreamFeed_t *BarStreamGetFeed (BarStream_t * const s, const size_t i) {
+	assert (s != NULL);
+	assert (i < BAR_MAX_ZONES);
+
+	return s->fd != -1 ? &s->feeds[i] : NULL;
+}
+
+/*	format of the pcm written from now on, listeners of another one are
+ *	disconnected
+ */
+void BarStreamSetFormat (BarStreamFeed_t * const feed, const unsigned int bits,
+		const unsigned int channels, const unsigned int rate) {
+	if (feed == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	const bool changed = feed->bits != bits || feed->channels != channels ||
+			feed->rate != rate;
+	if (changed) {
+		feed->bits = bits;
+		feed->channels = channels;
+		feed->rate = rate;
+		++feed->generation;
+		BarStreamChainReset (&feed->pcm);
+		BarStreamChainReset (&feed->encoded);
+	}
+	pthread_mutex_unlock (&feed->lock);
+	if (changed) {
+		BarStreamWake (feed->stream);
+	}
+}
+
+/*	hand pcm to the listeners, never blocks for long
+ */
+void BarStreamWrite (BarStreamFeed_t * const feed, const void * const data,
+		const size_t len) {
+	if (feed == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock (&feed->lock);
+	/* the chain only exists while somebody reads it */
+	const bool wanted = feed->pcm.tail != NULL;
+	if (wanted) {
+		BarStreamAppend (&feed->pcm, data, len);
+	}
+	pthread_mutex_unlock (&feed->lock);
+	if (wanted) {
+		BarStreamWake (feed->stream);
+	}
+}
+
+/*	append listener metrics to buf
+ */
+void BarStreamMetrics (BarMetricsBuf_t * const buf, BarStream_t * const s) {
+	if (s->fd == -1) {
+		return;
+	}
+
+	unsigned long listeners[BAR_MAX_ZONES], skipped[BAR_MAX_ZONES],
+			dropped[BAR_MAX_ZONES];
+	for (size_t i = 0; i < s->zoneCount; i++) {
+		BarStreamFeed_t * const feed = &s->feeds[i];
+		pthread_mutex_lock (&feed->lock);
+		listeners[i] = feed->pcmListeners + feed->encodedListeners;
+		skipped[i] = feed->skipped;
+		dropped[i] = feed->dropped;
+		pthread_mutex_unlock (&feed->lock);
+	}
+
+	const struct {
+		const char *name, *type, *help;
+		const unsigned long *values;
+	} families[] = {
+		{"pianobar_stream_listeners", "gauge", "Connected stream listeners.",
+				listeners},
+		{"pianobar_stream_skipped_bytes_total", "counter",
+				"Audio slow listeners skipped.", skipped},
+		{"pianobar_stream_dropped_total", "counter",
+				"Listeners disconnected for being too slow.", dropped},
+	};
+	for (size_t i = 0; i < sizeof (families) / sizeof (*families); i++) {
+		BarMetricsFamily (buf, families[i].name, families[i].type,
+				families[i].help);
+		for (size_t j = 0; j < s->zoneCount; j++) {
+			char labels[32];
+			snprintf (labels, sizeof (labels), "zone=\"%zu\"", j + 1);
+			BarMetricsValue (buf, families[i].name, labels,
+					families[i].values[j]);
+		}
+	}
+}
@@ -0,0 +1,119 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "settings.h"
+#include "metrics.h"
+
+/* capacity of a stream page */
+#define BAR_STREAM_PAGE (64*1024)
+#define BAR_STREAM_MAX_CLIENTS 32
+
+/* A piece of a stream shared by all listeners. Pages form a list from the
+ * oldest one still in use to the newest, every page holds a reference to its
+ * successor, so a listener only needs a reference to the page it is reading.
+ * refs and len are protected by the feed’s lock, data below len never
+ * changes and may be read without it. */
+typedef struct BarStreamPage {
+	struct BarStreamPage *next;
+	unsigned int refs;
+	/* offset of data[0] in the stream */
+	uint64_t start;
+	size_t len;
+	char data[BAR_STREAM_PAGE];
+} BarStreamPage_t;
+
+typedef struct {
+	/* newest page, NULL while nobody listens */
+	BarStreamPage_t *tail;
+	/* bytes appended so far */
+	uint64_t written;
+} BarStreamChain_t;
+
+struct BarStreamEncoder;
+struct BarStream;
+
+/* audio of one zone, written by its output thread */
+typedef struct {
+	pthread_mutex_t lock;
+	struct BarStream *stream;
+	/* pcm format, generation changes with it and ends all connections */
+	unsigned int generation;
+	unsigned int bits, channels, rate;
+	BarStreamChain_t pcm, encoded;
+	unsigned int pcmListeners, encodedListeners;
+	/* owned by the server thread, NULL unless someone listens to it */
+	struct BarStreamEncoder *encoder;
+	/* bytes slow listeners skipped and listeners dropped for being slow */
+	unsigned long skipped, dropped;
+} BarStreamFeed_t;
+
+typedef struct {
+	/* -1 if the slot is free */
+	int fd;
+	char in[1024];
+	size_t inLen;
+	/* response head, sent before the audio, NULL while reading the request */
+	char *head;
+	size_t headLen, headPos;
+	BarStreamFeed_t *feed;
+	bool encoded;
+	unsigned int generation;
+	/* current read position */
+	BarStreamPage_t *page;
+	size_t off;
+	/* socket buffer was full, wait for POLLOUT */
+	bool blocked;
+} BarStreamClient_t;
+
+typedef struct BarStream {
+	/* listening socket, -1 if disabled */
+	int fd;
+	/* wakes the server thread up, set pending to avoid redundant writes */
+	int wake[2];
+	int wakePending;
+	bool quit;
+	pthread_t thread;
+	const BarSettings_t *settings;
+	size_t zoneCount;
+	BarStreamFeed_t feeds[BAR_MAX_ZONES];
+	/* server thread only */
+	BarStreamClient_t clients[BAR_STREAM_MAX_CLIENTS];
+} BarStream_t;
+
+bool BarStreamOpen (BarStream_t * const, const BarSettings_t * const,
+		const size_t);
+void BarStreamClose (BarStream_t * const);
+BarStreamFeed_t *BarStreamGetFeed (BarStream_t * const, const size_t);
+void BarStreamSetFormat (BarStreamFeed_t * const, const unsigned int,
+		const unsigned int, const unsigned int);
+void BarStreamWrite (BarStreamFeed_t * const, const void * const,
+		const size_t);
+void BarStreamMetrics (BarMetricsBuf_t * const, BarStream_t * const);
+
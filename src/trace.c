@@ -0,0 +1,274 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* trace log. Every thread appends fixed-size binary records to a ring of its
+ * own, so recording takes neither locks nor system calls besides reading the
+ * clock. Nothing is formatted until the rings are dumped, which pianobar does
+ * when it receives SIGUSR1. Old records are overwritten, the dump shows the
+ * most recent BAR_TRACE_RING of each thread.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+unsigned int barTraceMask = 0;
+
+/* rings of all threads that ever recorded something. It only grows to the
+ * largest number of threads alive at once, an exited thread’s ring stays in
+ * the dump until the next new thread takes it over. */
+static BarTraceRing_t *rings = NULL;
+static __thread BarTraceRing_t *ring = NULL;
+static unsigned int threadCount = 0;
+/* releases the ring on thread exit */
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+static const struct {
+	const char *category, *format;
+} events[BAR_TRACE_EVENTS] = {
+	[BAR_TRACE_HTTP_DONE] = {"network",
+			"request type %" PRId64 " done in %" PRId64 " ms"},
+	[BAR_TRACE_HTTP_FAILED] = {"network",
+			"request type %" PRId64 " failed with curl code %" PRId64},
+	[BAR_TRACE_HTTP_RETRY] = {"network",
+			"attempt %" PRId64 " failed with curl code %" PRId64 ", retrying"},
+	[BAR_TRACE_SONG_OPEN] = {"audio",
+			"song opened in %" PRId64 " ms, %" PRId64 " s long"},
+	[BAR_TRACE_DECODER_DRAIN] = {"audio", "decoder draining after EOF"},
+	[BAR_TRACE_DECODER_ERROR] = {"audio",
+			"av_read_frame failed with code %" PRId64 ", song ends"},
+	[BAR_TRACE_DECODER_EOF] = {"audio", "decoder drained, song ends"},
+	[BAR_TRACE_BUFFER_FULL] = {"audio",
+			"decoder buffer full, %" PRId64 " s buffered, minimum %" PRId64
+			" s"},
+	[BAR_TRACE_BUFFER_WAKE] = {"audio",
+			"output wants more data, %" PRId64 " s buffered"},
+	[BAR_TRACE_DECODER_DONE] = {"audio",
+			"decoder done, %" PRId64 " bytes in %" PRId64 " us"},
+	[BAR_TRACE_OUTPUT_EOF] = {"audio", "output reached end of song"},
+	[BAR_TRACE_OUTPUT_STARVED] = {"audio",
+			"output waiting for data, code %" PRId64 ", underrun #%" PRId64
+			" (0 before playback started or while still waiting)"},
+	[BAR_TRACE_OUTPUT_ABORT] = {"audio", "output stopped mid-frame"},
+	[BAR_TRACE_PAUSED] = {"audio", "output paused"},
+	[BAR_TRACE_RESUMED] = {"audio", "output resumed"},
+	[BAR_TRACE_CONTROL_LATENCY] = {"audio",
+			"command took effect after %" PRId64 " us"},
+	[BAR_TRACE_LOCK_WAIT] = {"audio",
+			"waited %" PRId64 " us for %s lock"},
+	[BAR_TRACE_KEY] = {"ui", "key %c"},
+};
+
+static int64_t BarTraceNow (void) {
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void BarTraceRelease (void * const data) {
+	BarTraceRing_t * const r = data;
+	__atomic_store_n (&r->used, false, __ATOMIC_RELEASE);
+}
+
+static void BarTraceKeyInit (void) {
+	pthread_key_create (&ringKey, BarTraceRelease);
+}
+
+/*	take over the ring of an exited thread
+ *	@return ring or NULL
+ */
+static BarTraceRing_t *BarTraceReuse (void) {
+	for (BarTraceRing_t *r = __atomic_load_n (&rings, __ATOMIC_ACQUIRE);
+			r != NULL; r = r->next) {
+		bool used = false;
+		if (__atomic_compare_exchange_n (&r->used, &used, true, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			/* old records are overwritten from the start, a dump skips
+			 * them as soon as their slot is reused */
+			__atomic_store_n (&r->head, 0, __ATOMIC_RELEASE);
+			return r;
+		}
+	}
+	return NULL;
+}
+
+/*	give the calling thread a ring named name, call once at thread start
+ */
+void BarTraceThread (const char * const name) {
+	if (ring == NULL) {
+		pthread_once (&ringKeyOnce, BarTraceKeyInit);
+		BarTraceRing_t *r = BarTraceReuse ();
+		if (r == NULL) {
+			if ((r = calloc (1, sizeof (*r))) == NULL) {
+				return;
+			}
+			r->used = true;
+			/* push to the list, which may be walked concurrently */
+			r->next = __atomic_load_n (&rings, __ATOMIC_RELAXED);
+			while (!__atomic_compare_exchange_n (&rings, &r->next, r, true,
+					__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+		}
+		ring = r;
+		pthread_setspecific (ringKey, r);
+	}
+	if (name != NULL) {
+		snprintf (ring->name, sizeof (ring->name), "%s", name);
+	} else {
+		snprintf (ring->name, sizeof (ring->name), "thread%u",
+				__atomic_add_fetch (&threadCount, 1, __ATOMIC_RELAXED));
+	}
+}
+
+/*	append event to the calling thread’s ring, use BarTrace instead
+ */
+void BarTraceRecord (const BarTraceEvent_t event, const int64_t a,
+		const int64_t b) {
+	if (ring == NULL) {
+		BarTraceThread (NULL);
+		if (ring == NULL) {
+			return;
+		}
+	}
+	const uint64_t head = ring->head;
+	BarTraceRecord_t * const r = &ring->records[head & (BAR_TRACE_RING-1)];
+	/* readers skip the record until it is complete */
+	__atomic_store_n (&r->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_RELEASE);
+	r->time = BarTraceNow ();
+	r->event = event;
+	r->args[0] = a;
+	r->args[1] = b;
+	__atomic_store_n (&r->seq, head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+	BarTraceRecord_t record;
+	const char *thread;
+} BarTraceDumpRecord_t;
+
+static int BarTraceCmp (const void * const va, const void * const vb) {
+	const BarTraceDumpRecord_t * const a = va, * const b = vb;
+	return a->record.time < b->record.time ? -1 :
+			(a->record.time > b->record.time ? 1 : 0);
+}
+
+/*	copy the records of one ring that are not being overwritten right now
+ *	@return number of records copied
+ */
+static size_t BarTraceCopy (const BarTraceRing_t * const r,
+		BarTraceDumpRecord_t * const out) {
+	const uint64_t head = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE);
+	const uint64_t first = head > BAR_TRACE_RING ? head - BAR_TRACE_RING : 0;
+	size_t n = 0;
+	for (uint64_t i = first; i < head; i++) {
+		const BarTraceRecord_t * const src = &r->records[i & (BAR_TRACE_RING-1)];
+		if (__atomic_load_n (&src->seq, __ATOMIC_ACQUIRE) != i + 1) {
+			continue;
+		}
+		BarTraceDumpRecord_t * const dst = &out[n];
+		dst->record.time = src->time;
+		dst->record.event = src->event;
+		dst->record.args[0] = src->args[0];
+		dst->record.args[1] = src->args[1];
+		__atomic_thread_fence (__ATOMIC_ACQUIRE);
+		/* overwritten while copying */
+		if (__atomic_load_n (&src->seq, __ATOMIC_RELAXED) != i + 1 ||
+				dst->record.event >= BAR_TRACE_EVENTS) {
+			continue;
+		}
+		dst->thread = r->name;
+		++n;
+	}
+	return n;
+}
+
+/*	format the recorded events of all threads in the order they happened
+ */
+void BarTraceDump (FILE * const fp) {
+	size_t count = 0;
+	for (const BarTraceRing_t *r = __atomic_load_n (&rings, __ATOMIC_ACQUIRE);
+			r != NULL; r = r->next) {
+		++count;
+	}
+	BarTraceDumpRecord_t * const all = malloc (count * BAR_TRACE_RING *
+			sizeof (*all));
+	if (all == NULL) {
+		return;
+	}
+
+	/* rings pushed in the meantime are not counted and not dumped */
+	size_t n = 0;
+	const BarTraceRing_t *r = __atomic_load_n (&rings, __ATOMIC_ACQUIRE);
+	for (size_t i = 0; i < count && r != NULL; i++, r = r->next) {
+		n += BarTraceCopy (r, &all[n]);
+	}
+	qsort (all, n, sizeof (*all), BarTraceCmp);
+
+	const int64_t now = BarTraceNow ();
+	fprintf (fp, "--- trace, %zu events, times relative to now\n", n);
+	for (size_t i = 0; i < n; i++) {
+		const BarTraceRecord_t * const rec = &all[i].record;
+		const int64_t age = now - rec->time;
+		fprintf (fp, "-%" PRId64 ".%06" PRId64 " %-10s %-7s ",
+				age / 1000000000, age % 1000000000 / 1000, all[i].thread,
+				events[rec->event].category);
+		if (rec->event == BAR_TRACE_LOCK_WAIT) {
+			fprintf (fp, events[rec->event].format, rec->args[0],
+					rec->args[1] ? "output" : "player");
+		} else if (rec->event == BAR_TRACE_KEY) {
+			fprintf (fp, events[rec->event].format, (int) rec->args[0]);
+		} else {
+			fprintf (fp, events[rec->event].format, rec->args[0],
+					rec->args[1]);
+		}
+		fputc ('\n', fp);
+	}
+	fprintf (fp, "--- end of trace\n");
+	fflush (fp);
+	free (all);
+}
+
+/*	free all rings, every other thread that recorded something must have
+ *	exited and no thread must record anything afterwards
+ */
+void BarTraceDestroy (void) {
+	if (ring != NULL) {
+		pthread_setspecific (ringKey, NULL);
+	}
+	BarTraceRing_t *r = __atomic_exchange_n (&rings, NULL, __ATOMIC_ACQUIRE);
+	while (r != NULL) {
+		BarTraceRing_t * const next = r->next;
+		free (r);
+		r = next;
+	}
+	ring = NULL;
+}
@@ -0,0 +1,105 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/* categories, same bits as PIANOBAR_DEBUG */
+typedef enum {
+	BAR_TRACE_NETWORK = 1,
+	BAR_TRACE_AUDIO = 2,
+	BAR_TRACE_UI = 4,
+} BarTraceCategory_t;
+
+/* categories compiled in, BarTrace calls for the others disappear */
+#ifndef BAR_TRACE_CATEGORIES
+#define BAR_TRACE_CATEGORIES (BAR_TRACE_NETWORK | BAR_TRACE_AUDIO | BAR_TRACE_UI)
+#endif
+
+/* see events in trace.c for their arguments */
+typedef enum {
+	BAR_TRACE_HTTP_DONE = 0,
+	BAR_TRACE_HTTP_FAILED,
+	BAR_TRACE_HTTP_RETRY,
+	BAR_TRACE_SONG_OPEN,
+	BAR_TRACE_DECODER_DRAIN,
+	BAR_TRACE_DECODER_ERROR,
+	BAR_TRACE_DECODER_EOF,
+	BAR_TRACE_BUFFER_FULL,
+	BAR_TRACE_BUFFER_WAKE,
+	BAR_TRACE_DECODER_DONE,
+	BAR_TRACE_OUTPUT_EOF,
+	BAR_TRACE_OUTPUT_STARVED,
+	BAR_TRACE_OUTPUT_ABORT,
+	BAR_TRACE_PAUSED,
+	BAR_TRACE_RESUMED,
+	BAR_TRACE_CONTROL_LATENCY,
+	BAR_TRACE_LOCK_WAIT,
+	BAR_TRACE_KEY,
+	BAR_TRACE_EVENTS,
+} BarTraceEvent_t;
+
+/* records kept per thread, must be a power of two */
+#define BAR_TRACE_RING 4096
+
+/* one record, formatted only when the ring is dumped */
+typedef struct {
+	/* index + 1 of the record in its ring, 0 while it is being written */
+	uint64_t seq;
+	/* monotonic clock, nanoseconds */
+	int64_t time;
+	uint16_t event;
+	int64_t args[2];
+} BarTraceRecord_t;
+
+/* written by its thread only, read by BarTraceDump */
+typedef struct BarTraceRing {
+	struct BarTraceRing *next;
+	/* owned by a running thread, the ring of an exited one is reused */
+	bool used;
+	char name[16];
+	uint64_t head;
+	BarTraceRecord_t records[BAR_TRACE_RING];
+} BarTraceRing_t;
+
+/* categories enabled at runtime */
+extern unsigned int barTraceMask;
+
+void BarTraceThread (const char * const);
+void BarTraceRecord (const BarTraceEvent_t, const int64_t, const int64_t);
+void BarTraceDump (FILE * const);
+void BarTraceDestroy (void);
+
+/* record event if category is enabled. Costs nothing if it is not compiled
+ * in and a single load if it is disabled at runtime. */
+#define BarTrace(category, event, a, b) \
+	do { \
+		if ((BAR_TRACE_CATEGORIES & (category)) && \
+				(barTraceMask & (category))) { \
+			BarTraceRecord ((event), (a), (b)); \
+		} \
+	} while (0)
+
@@ -34,6 +34,9 @@ THE SOFTWARE.
 #include <strings.h>
 #include <assert.h>
 #include <ctype.h> /* tolower() */
+#include <time.h>
+#include <stdint.h>
+#include <inttypes.h>
 
 /* waitpid () */
 #include <sys/types.h>
@@ -41,6 +44,7 @@ THE SOFTWARE.
 
 #include "ui.h"
 #include "debug.h"
+#include "trace.h"
 #include "ui_readline.h"
 
 typedef int (*BarSortFunc_t) (const void *, const void *);
@@ -159,16 +163,42 @@ static size_t httpFetchCb (char *ptr, size_t size, size_t nmemb,
 	return recvSize;
 }
 
+/*	monotonic clock in microseconds
+ */
+static int64_t BarUiNowUs (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*	monotonic clock in milliseconds
+ */
+static int64_t BarUiNowMs (void) {
+	return BarUiNowUs () / 1000;
+}
+
+typedef struct {
+	const sig_atomic_t *lint;
+	/* abort if nothing was received by then, 0 disables the deadline */
+	int64_t firstByteDeadline;
+	bool stalled;
+} progressData;
+
 /*	libcurl progress callback. aborts the current request if user pressed ^C
+ *	or the server did not answer in time
  */
 int progressCb (void * const data, curl_off_t dltotal, curl_off_t dlnow,
 		curl_off_t ultotal, curl_off_t ulnow) {
-	const sig_atomic_t lint = *((sig_atomic_t *) data);
-	if (lint) {
+	progressData * const progress = data;
+	if (*progress->lint) {
+		return 1;
+	}
+	if (progress->firstByteDeadline != 0 && dlnow == 0 &&
+			BarUiNowMs () > progress->firstByteDeadline) {
+		progress->stalled = true;
 		return 1;
-	} else {
-		return 0;
 	}
+	return 0;
 }
 
 /*	Error codes from libcurl, which may be temporary and should be retried.
@@ -192,43 +222,370 @@ static bool temporaryCurlError (const CURLcode code) {
 	}
 }
 
+/* latency histograms, bucket i counts requests that took up to
+ * latencyBucketMs << i milliseconds, the last one everything above */
+static const unsigned int latencyBucketMs = 16;
+static BarHttpLatency_t httpLatency[BAR_HTTP_TYPES];
+
+/* metric label of request types */
+static const char * const requestNames[] = {
+	[PIANO_REQUEST_LOGIN] = "login",
+	[PIANO_REQUEST_GET_STATIONS] = "get_stations",
+	[PIANO_REQUEST_GET_PLAYLIST] = "get_playlist",
+	[PIANO_REQUEST_RATE_SONG] = "rate_song",
+	[PIANO_REQUEST_ADD_FEEDBACK] = "add_feedback",
+	[PIANO_REQUEST_RENAME_STATION] = "rename_station",
+	[PIANO_REQUEST_DELETE_STATION] = "delete_station",
+	[PIANO_REQUEST_SEARCH] = "search",
+	[PIANO_REQUEST_CREATE_STATION] = "create_station",
+	[PIANO_REQUEST_ADD_SEED] = "add_seed",
+	[PIANO_REQUEST_ADD_TIRED_SONG] = "add_tired_song",
+	[PIANO_REQUEST_SET_QUICKMIX] = "set_quickmix",
+	[PIANO_REQUEST_GET_GENRE_STATIONS] = "get_genre_stations",
+	[PIANO_REQUEST_TRANSFORM_STATION] = "transform_station",
+	[PIANO_REQUEST_EXPLAIN] = "explain",
+	[PIANO_REQUEST_BOOKMARK_SONG] = "bookmark_song",
+	[PIANO_REQUEST_BOOKMARK_ARTIST] = "bookmark_artist",
+	[PIANO_REQUEST_GET_STATION_INFO] = "get_station_info",
+	[PIANO_REQUEST_DELETE_FEEDBACK] = "delete_feedback",
+	[PIANO_REQUEST_DELETE_SEED] = "delete_seed",
+	[PIANO_REQUEST_GET_SETTINGS] = "get_settings",
+	[PIANO_REQUEST_CHANGE_SETTINGS] = "change_settings",
+	[PIANO_REQUEST_GET_STATION_MODES] = "get_station_modes",
+	[PIANO_REQUEST_SET_STATION_MODE] = "set_station_mode",
+	[PIANO_REQUEST_GET_PLAYLISTS] = "get_playlists",
+	[PIANO_REQUEST_GET_TRACKS] = "get_tracks",
+	[PIANO_REQUEST_GET_PLAYBACK_INFO] = "get_playback_info",
+	[PIANO_REQUEST_GET_ITEMS] = "get_items",
+	[PIANO_REQUEST_GET_USER_PROFILE] = "get_user_profile",
+	[PIANO_REQUEST_ANNOTATE_OBJECTS] = "annotate_objects",
+	[PIANO_REQUEST_REMOVE_ITEM] = "remove_item",
+	[PIANO_REQUEST_GET_EPISODES] = "get_episodes",
+};
+
+/*	@return latency histogram of request type
+ */
+const BarHttpLatency_t *BarUiHttpLatency (const PianoRequestType_t type) {
+	assert ((size_t) type < BAR_HTTP_TYPES);
+	return &httpLatency[type];
+}
+
+/*	estimate a latency percentile from the histogram
+ *	@param percentile, 0 to 100
+ *	@return upper bound in milliseconds, 0 if there are too few samples
+ */
+unsigned int BarUiHttpPercentile (const BarHttpLatency_t * const h,
+		const unsigned int percentile) {
+	/* fewer samples tell us nothing */
+	const unsigned long minSamples = 20;
+
+	if (h->total < minSamples) {
+		return 0;
+	}
+	const unsigned long want = (h->total * percentile + 99) / 100;
+	unsigned long seen = 0;
+	for (size_t i = 0; i < BAR_HTTP_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen >= want) {
+			return latencyBucketMs << i;
+		}
+	}
+	return latencyBucketMs << (BAR_HTTP_BUCKETS-1);
+}
+
+static void BarUiHttpRecord (const PianoRequestType_t type,
+		const int64_t ms) {
+	if ((size_t) type >= BAR_HTTP_TYPES) {
+		return;
+	}
+	BarHttpLatency_t * const h = &httpLatency[type];
+	BarHistogramObserve (h, latencyBucketMs, ms > 0 ? ms : 0);
+	BarTrace (BAR_TRACE_NETWORK, BAR_TRACE_HTTP_DONE, type, ms);
+	debugPrint (DEBUG_NETWORK, "request %i took %" PRId64 " ms, p95 %u ms\n",
+			type, ms, BarUiHttpPercentile (h, 95));
+}
+
+static BarHttpStats_t httpStats;
+
+/* time it takes to fork eventcmd, bucket i counts spawns up to
+ * spawnBucketUs << i microseconds */
+static const unsigned int spawnBucketUs = 64;
+static BarHistogram_t eventcmdSpawn;
+
+/*	@return connection statistics of all requests so far
+ */
+const BarHttpStats_t *BarUiHttpStats (void) {
+	return &httpStats;
+}
+
+/*	count whether a finished transfer needed a new connection
+ */
+static void BarUiHttpCount (CURL * const http) {
+	long connects = 0;
+	if (curl_easy_getinfo (http, CURLINFO_NUM_CONNECTS, &connects) != CURLE_OK) {
+		return;
+	}
+	++httpStats.requests;
+	if (connects > 0) {
+		httpStats.connects += connects;
+	} else {
+		++httpStats.reused;
+	}
+#if LIBCURL_VERSION_NUM >= 0x073200
+	long version = 0;
+	if (curl_easy_getinfo (http, CURLINFO_HTTP_VERSION, &version) == CURLE_OK &&
+			version == CURL_HTTP_VERSION_2_0) {
+		++httpStats.http2;
+	}
+#endif
+	debugPrint (DEBUG_NETWORK, "%lu of %lu requests reused a connection, "
+			"%lu used HTTP/2\n", httpStats.reused, httpStats.requests,
+			httpStats.http2);
+}
+
+/*	append request and eventcmd metrics to buf
+ */
+void BarUiMetrics (BarMetricsBuf_t * const buf) {
+	BarMetricsFamily (buf, "pianobar_rpc_duration_seconds", "histogram",
+			"Duration of successful API requests by request type.");
+	for (size_t i = 0; i < BAR_HTTP_TYPES; i++) {
+		if (httpLatency[i].total == 0) {
+			continue;
+		}
+		const char * const name = i < sizeof (requestNames) /
+				sizeof (*requestNames) ? requestNames[i] : NULL;
+		char labels[64];
+		if (name != NULL) {
+			snprintf (labels, sizeof (labels), "type=\"%s\"", name);
+		} else {
+			snprintf (labels, sizeof (labels), "type=\"%zu\"", i);
+		}
+		BarMetricsHistogram (buf, "pianobar_rpc_duration_seconds", labels,
+				&httpLatency[i], latencyBucketMs, 1000);
+	}
+
+	const struct {
+		const char *name, *help;
+		unsigned long value;
+	} counters[] = {
+		{"pianobar_http_requests_total", "Completed HTTP transfers.",
+				httpStats.requests},
+		{"pianobar_http_connects_total", "Connections opened.",
+				httpStats.connects},
+		{"pianobar_http_reused_total", "Transfers that reused a connection.",
+				httpStats.reused},
+		{"pianobar_rpc_retries_total",
+				"Requests repeated after a temporary network error.",
+				httpStats.retries},
+		{"pianobar_rpc_reauths_total", "Logins repeated after the session "
+				"expired.", httpStats.reauths},
+		{"pianobar_rpc_failures_total", "API calls that failed.",
+				httpStats.failures},
+	};
+	for (size_t i = 0; i < sizeof (counters) / sizeof (*counters); i++) {
+		BarMetricsFamily (buf, counters[i].name, "counter", counters[i].help);
+		BarMetricsValue (buf, counters[i].name, NULL, counters[i].value);
+	}
+
+	BarMetricsFamily (buf, "pianobar_eventcmd_spawn_seconds", "histogram",
+			"Time it takes to fork eventcmd.");
+	BarMetricsHistogram (buf, "pianobar_eventcmd_spawn_seconds", NULL,
+			&eventcmdSpawn, spawnBucketUs, 1e6);
+}
+
+/*	requests that can be sent twice without changing anything
+ */
+static bool BarUiHttpIdempotent (const PianoRequestType_t type) {
+	switch (type) {
+		case PIANO_REQUEST_GET_STATIONS:
+		case PIANO_REQUEST_SEARCH:
+		case PIANO_REQUEST_GET_GENRE_STATIONS:
+		case PIANO_REQUEST_EXPLAIN:
+		case PIANO_REQUEST_GET_STATION_INFO:
+		case PIANO_REQUEST_GET_SETTINGS:
+		case PIANO_REQUEST_GET_STATION_MODES:
+		case PIANO_REQUEST_GET_PLAYLISTS:
+		case PIANO_REQUEST_GET_TRACKS:
+		case PIANO_REQUEST_GET_PLAYBACK_INFO:
+		case PIANO_REQUEST_GET_ITEMS:
+		case PIANO_REQUEST_GET_USER_PROFILE:
+		case PIANO_REQUEST_ANNOTATE_OBJECTS:
+		case PIANO_REQUEST_GET_EPISODES:
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+/*	exponential backoff with full jitter
+ *	@return milliseconds to wait before attempt retry+1
+ */
+static unsigned int BarUiHttpBackoffMs (const unsigned int retry) {
+	const unsigned int base = 250, max = 4000;
+
+	unsigned int delay = base;
+	for (unsigned int i = 1; i < retry && delay < max; i++) {
+		delay *= 2;
+	}
+	if (delay > max) {
+		delay = max;
+	}
+	delay = (unsigned int) rand () % (delay + 1);
+	debugPrint (DEBUG_NETWORK, "retrying in %u ms\n", delay);
+	return delay;
+}
+
+/*	sleep before the next attempt
+ *	@return false if interrupted
+ */
+static bool BarUiHttpBackoff (const unsigned int retry,
+		const sig_atomic_t * const lint) {
+	const unsigned int delay = BarUiHttpBackoffMs (retry);
+	const int64_t until = BarUiNowMs () + delay;
+	while (!*lint && BarUiNowMs () < until) {
+		const struct timespec ts = {0, 10*1000*1000};
+		nanosleep (&ts, NULL);
+	}
+	return !*lint;
+}
+
+/*	perform a single attempt, optionally racing a second copy of the request
+ *	against the first one
+ *	@param first byte deadline in milliseconds, 0 to disable
+ *	@param hedge after this many milliseconds, 0 to disable
+ */
+static CURLcode BarUiHttpPerform (CURL * const http,
+		const PianoRequestType_t type, buffer * const response,
+		const sig_atomic_t * const lint, const unsigned int firstByteMs,
+		const unsigned int hedgeMs) {
+	const int64_t start = BarUiNowMs ();
+	progressData progress = { .lint = lint,
+			.firstByteDeadline = firstByteMs > 0 ? start + firstByteMs : 0 };
+	CURLcode ret;
+
+	curl_easy_setopt (http, CURLOPT_XFERINFODATA, &progress);
+
+	if (hedgeMs == 0) {
+		ret = curl_easy_perform (http);
+		BarUiHttpCount (http);
+	} else {
+		CURLM * const multi = curl_multi_init ();
+		CURL *hedge = NULL;
+		buffer hedgeBuffer = {NULL, 0};
+		progressData hedgeProgress = { .lint = lint };
+		CURL *winner = NULL;
+		unsigned int running = 1;
+
+		curl_multi_add_handle (multi, http);
+		ret = CURLE_OK;
+		while (winner == NULL && running > 0) {
+			int stillRunning;
+			curl_multi_perform (multi, &stillRunning);
+
+			CURLMsg *msg;
+			int queued;
+			while ((msg = curl_multi_info_read (multi, &queued)) != NULL) {
+				if (msg->msg != CURLMSG_DONE) {
+					continue;
+				}
+				--running;
+				ret = msg->data.result;
+				/* a failed copy waits for the other one */
+				if (ret == CURLE_OK || running == 0 ||
+						(!temporaryCurlError (ret) &&
+						ret != CURLE_ABORTED_BY_CALLBACK)) {
+					winner = msg->easy_handle;
+					break;
+				}
+			}
+
+			if (winner == NULL && hedge == NULL && running > 0 &&
+					BarUiNowMs () - start >= hedgeMs &&
+					(hedge = curl_easy_duphandle (http)) != NULL) {
+				debugPrint (DEBUG_NETWORK, "hedging request %i after %u ms\n",
+						type, hedgeMs);
+				curl_easy_setopt (hedge, CURLOPT_WRITEDATA, &hedgeBuffer);
+				curl_easy_setopt (hedge, CURLOPT_XFERINFODATA, &hedgeProgress);
+				curl_multi_add_handle (multi, hedge);
+				++running;
+			}
+
+			if (winner == NULL && running > 0) {
+				curl_multi_wait (multi, NULL, 0, 10, NULL);
+			}
+		}
+
+		if (winner != NULL) {
+			BarUiHttpCount (winner);
+		}
+		curl_multi_remove_handle (multi, http);
+		if (hedge != NULL) {
+			curl_multi_remove_handle (multi, hedge);
+			if (winner == hedge) {
+				free (response->data);
+				*response = hedgeBuffer;
+			} else {
+				free (hedgeBuffer.data);
+			}
+			curl_easy_cleanup (hedge);
+		}
+		curl_multi_cleanup (multi);
+	}
+
+	if (ret == CURLE_ABORTED_BY_CALLBACK && progress.stalled && !*lint) {
+		debugPrint (DEBUG_NETWORK, "no answer within %u ms\n", firstByteMs);
+		ret = CURLE_OPERATION_TIMEDOUT;
+	} else if (ret == CURLE_OK) {
+		BarUiHttpRecord (type, BarUiNowMs () - start);
+	}
+	return ret;
+}
+
 #define setAndCheck(k,v) \
 	httpret = curl_easy_setopt (http, k, v); \
 	assert (httpret == CURLE_OK);
 
-static CURLcode BarPianoHttpRequest (CURL * const http,
-		const BarSettings_t * const settings, PianoRequest_t * const req) {
-	buffer buffer = {NULL, 0};
-	sig_atomic_t lint = 0, *prevint;
+/*	set every option of an rpc transfer, there is no curl_easy_reset (), it
+ *	would drop the share handle
+ *	@return request headers, to be freed once the transfer is done
+ */
+static struct curl_slist *BarUiHttpSetup (CURL * const http,
+		const BarSettings_t * const settings, const PianoRequest_t * const req,
+		buffer * const response) {
+	/* seconds */
+	const unsigned int connectTimeout = 5;
 
 	char url[2048];
 	assert (settings->rpcHost != NULL);
 	assert (settings->rpcTlsPort != NULL);
 	assert (req->urlPath != NULL);
-	int ret = snprintf (url, sizeof (url), "%s://%s:%s%s",
-		req->secure ? "https" : "http",
-		settings->rpcHost,
-		req->secure ? settings->rpcTlsPort : "80",
-		req->urlPath);
+	/* every method is available over TLS, using it for all of them lets
+	 * requests share one connection */
+	int ret = snprintf (url, sizeof (url), "https://%s:%s%s",
+		settings->rpcHost, settings->rpcTlsPort, req->urlPath);
 	assert (ret >= 0 && ret <= (int) sizeof (url));
 	debugPrint (DEBUG_NETWORK, "← %s\n", url);
 
-	/* save the previous interrupt destination */
-	prevint = interrupted;
-	interrupted = &lint;
-
-	curl_easy_reset (http);
 	CURLcode httpret;
 	setAndCheck (CURLOPT_URL, url);
 	setAndCheck (CURLOPT_USERAGENT, PACKAGE "-" VERSION);
 	setAndCheck (CURLOPT_POSTFIELDS, req->postData);
 	setAndCheck (CURLOPT_WRITEFUNCTION, httpFetchCb);
-	setAndCheck (CURLOPT_WRITEDATA, &buffer);
+	setAndCheck (CURLOPT_WRITEDATA, response);
 	setAndCheck (CURLOPT_XFERINFOFUNCTION, progressCb);
-	setAndCheck (CURLOPT_XFERINFODATA, &lint);
 	setAndCheck (CURLOPT_NOPROGRESS, 0);
 	setAndCheck (CURLOPT_POST, 1);
 	setAndCheck (CURLOPT_TIMEOUT, settings->timeout);
+	setAndCheck (CURLOPT_CONNECTTIMEOUT, settings->timeout < connectTimeout ?
+			settings->timeout : connectTimeout);
+	/* responses are plain JSON and compress well */
+	setAndCheck (CURLOPT_ACCEPT_ENCODING, "");
+	setAndCheck (CURLOPT_TCP_KEEPALIVE, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	/* falls back to HTTP/1.1 if the server does not offer HTTP/2 */
+	setAndCheck (CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+#endif
 	if (settings->caBundle != NULL) {
 		setAndCheck (CURLOPT_CAINFO, settings->caBundle);
 	}
@@ -264,10 +621,53 @@ static CURLcode BarPianoHttpRequest (CURL * const http,
 	struct curl_slist *list = NULL;
 	list = curl_slist_append (list, "Content-Type: text/plain");
 	setAndCheck (CURLOPT_HTTPHEADER, list);
+	return list;
+}
+
+/*	a server that has not answered within a multiple of the usual time is
+ *	unlikely to answer at all
+ *	@return first byte deadline in milliseconds
+ */
+static unsigned int BarUiHttpFirstByteMs (const PianoRequestType_t type) {
+	/* milliseconds, until enough latencies have been seen */
+	const unsigned int defaultFirstByteMs = 10000, minFirstByteMs = 2000;
+
+	const unsigned int p95 = (size_t) type < BAR_HTTP_TYPES ?
+			BarUiHttpPercentile (&httpLatency[type], 95) : 0;
+	const unsigned int firstByteMs = p95 > 0 ? 4 * p95 : defaultFirstByteMs;
+	return firstByteMs < minFirstByteMs ? minFirstByteMs : firstByteMs;
+}
+
+CURLcode BarPianoHttpRequest (CURL * const http,
+		const BarSettings_t * const settings, PianoRequest_t * const req) {
+	buffer buffer = {NULL, 0};
+	sig_atomic_t lint = 0, *prevint;
+
+	/* save the previous interrupt destination */
+	prevint = interrupted;
+	interrupted = &lint;
+
+	CURLcode httpret;
+	struct curl_slist * const list = BarUiHttpSetup (http, settings, req,
+			&buffer);
+
+	/* give up early unless it is the last try */
+	const unsigned int firstByteMs = BarUiHttpFirstByteMs (req->type);
+	const unsigned int p95 = (size_t) req->type < BAR_HTTP_TYPES ?
+			BarUiHttpPercentile (&httpLatency[req->type], 95) : 0;
+	const unsigned int hedgeMs = settings->hedgeRequests &&
+			BarUiHttpIdempotent (req->type) ? p95 : 0;
 
 	unsigned int retry = 0;
 	do {
-		httpret = curl_easy_perform (http);
+		if (retry > 0 && !BarUiHttpBackoff (retry, &lint)) {
+			httpret = CURLE_ABORTED_BY_CALLBACK;
+			break;
+		}
+		const bool last = retry + 1 >= settings->maxRetry ||
+				firstByteMs >= settings->timeout * 1000;
+		httpret = BarUiHttpPerform (http, req->type, &buffer, &lint,
+				last ? 0 : firstByteMs, hedgeMs);
 		++retry;
 		if (temporaryCurlError (httpret)) {
 			free (buffer.data);
@@ -276,12 +676,17 @@ static CURLcode BarPianoHttpRequest (CURL * const http,
 			if (retry >= settings->maxRetry) {
 				break;
 			}
+			++httpStats.retries;
+			BarTrace (BAR_TRACE_NETWORK, BAR_TRACE_HTTP_RETRY, retry, httpret);
 		} else {
 			break;
 		}
 	} while (true);
 
 	curl_slist_free_all (list);
+	if (httpret != CURLE_OK) {
+		BarTrace (BAR_TRACE_NETWORK, BAR_TRACE_HTTP_FAILED, req->type, httpret);
+	}
 
 	req->responseData = buffer.data;
 	debugPrint (DEBUG_NETWORK, "→ %s\n", req->responseData);
@@ -311,14 +716,23 @@ bool BarUiPianoCall (BarApp_t * const app, const PianoRequestType_t type,
 			goto cleanup;
 		}
 
-		wRetLocal = BarPianoHttpRequest (app->http, &app->settings, &req);
-		if (wRetLocal == CURLE_ABORTED_BY_CALLBACK) {
-			BarUiMsg (&app->settings, MSG_NONE, "Interrupted.\n");
-			goto cleanup;
-		} else if (wRetLocal != CURLE_OK) {
-			BarUiMsg (&app->settings, MSG_NONE, "Network error: %s\n",
-					curl_easy_strerror (wRetLocal));
-			goto cleanup;
+		/* read-only requests may be answered from the cache, others may
+		 * change what it holds */
+		const bool cached = app->settings.responseCache &&
+				(req.responseData = BarCacheGet (&app->cache, type, data)) != NULL;
+		if (!cached) {
+			if (app->settings.responseCache) {
+				BarCacheInvalidate (&app->cache, type, data);
+			}
+			wRetLocal = BarPianoHttpRequest (app->http, &app->settings, &req);
+			if (wRetLocal == CURLE_ABORTED_BY_CALLBACK) {
+				BarUiMsg (&app->settings, MSG_NONE, "Interrupted.\n");
+				goto cleanup;
+			} else if (wRetLocal != CURLE_OK) {
+				BarUiMsg (&app->settings, MSG_NONE, "Network error: %s\n",
+						curl_easy_strerror (wRetLocal));
+				goto cleanup;
+			}
 		}
 
 		pRetLocal = PianoResponse (&app->ph, &req);
@@ -334,6 +748,7 @@ bool BarUiPianoCall (BarApp_t * const app, const PianoRequestType_t type,
 
 				BarUiMsg (&app->settings, MSG_NONE,
 						"Reauthentication required... ");
+				++httpStats.reauths;
 				if (!BarUiPianoCall (app, PIANO_REQUEST_LOGIN, &reqData,
 						&pRetLocal, &wRetLocal)) {
 					goto cleanup;
@@ -349,6 +764,9 @@ bool BarUiPianoCall (BarApp_t * const app, const PianoRequestType_t type,
 			} else {
 				BarUiMsg (&app->settings, MSG_NONE, "Ok.\n");
 				ret = true;
+				if (app->settings.responseCache && !cached) {
+					BarCachePut (&app->cache, type, data, req.responseData);
+				}
 			}
 		}
 
@@ -358,12 +776,408 @@ cleanup:
 		PianoDestroyRequest (&req);
 	} while (pRetLocal == PIANO_RET_CONTINUE_REQUEST);
 
+	if (!ret) {
+		++httpStats.failures;
+	}
 	*pRet = pRetLocal;
 	*wRet = wRetLocal;
 
 	return ret;
 }
 
+typedef enum {
+	/* transfer added to the multi handle */
+	BAR_CALL_RUNNING,
+	/* waiting for retryAt before the next attempt */
+	BAR_CALL_BACKOFF,
+	/* response is known already, from the cache */
+	BAR_CALL_CACHED,
+	/* waiting for the login repeating the expired session */
+	BAR_CALL_REAUTH,
+	BAR_CALL_DONE,
+} BarUiCallState_t;
+
+struct BarUiCall {
+	PianoRequestType_t type;
+	void *data;
+	BarUiCallDone_t done;
+	void *user;
+	BarUiCallState_t state;
+	PianoRequest_t req;
+	CURL *http;
+	struct curl_slist *headers;
+	buffer response;
+	/* never set, background calls cannot be interrupted with ^C */
+	sig_atomic_t lint;
+	progressData progress;
+	unsigned int attempt;
+	int64_t start, retryAt;
+	PianoReturn_t pRet;
+	CURLcode wRet;
+	/* request data of the login call */
+	PianoRequestDataLogin_t login;
+	BarUiCall_t *next;
+};
+
+static void BarUiCallFinish (BarUiCall_t * const call, const PianoReturn_t pRet,
+		const CURLcode wRet) {
+	call->state = BAR_CALL_DONE;
+	call->pRet = pRet;
+	call->wRet = wRet;
+}
+
+/*	transfer the current request
+ */
+static void BarUiCallSend (BarApp_t * const app, BarUiCall_t * const call) {
+	if (call->http == NULL) {
+		if ((call->http = curl_easy_init ()) == NULL) {
+			BarUiCallFinish (call, PIANO_RET_OK, CURLE_OUT_OF_MEMORY);
+			return;
+		}
+		curl_easy_setopt (call->http, CURLOPT_SHARE, app->httpShare);
+		curl_easy_setopt (call->http, CURLOPT_PRIVATE, call);
+	}
+
+	curl_slist_free_all (call->headers);
+	call->headers = BarUiHttpSetup (call->http, &app->settings, &call->req,
+			&call->response);
+	call->start = BarUiNowMs ();
+	const bool last = call->attempt + 1 >= app->settings.maxRetry;
+	const unsigned int firstByteMs = BarUiHttpFirstByteMs (call->type);
+	memset (&call->progress, 0, sizeof (call->progress));
+	call->progress.lint = &call->lint;
+	if (!last && firstByteMs < app->settings.timeout * 1000) {
+		call->progress.firstByteDeadline = call->start + firstByteMs;
+	}
+	curl_easy_setopt (call->http, CURLOPT_XFERINFODATA, &call->progress);
+	curl_multi_add_handle (app->async.multi, call->http);
+	call->state = BAR_CALL_RUNNING;
+}
+
+/*	build the call’s (next) request and send it, unless the cache knows the
+ *	answer
+ */
+static void BarUiCallStart (BarApp_t * const app, BarUiCall_t * const call) {
+	free (call->req.responseData);
+	PianoDestroyRequest (&call->req);
+	memset (&call->req, 0, sizeof (call->req));
+	call->req.data = call->data;
+	call->attempt = 0;
+
+	const PianoReturn_t pRet = PianoRequest (&app->ph, &call->req, call->type);
+	if (pRet != PIANO_RET_OK) {
+		BarUiCallFinish (call, pRet, CURLE_OK);
+		return;
+	}
+
+	if (app->settings.responseCache) {
+		call->req.responseData = BarCacheGet (&app->cache, call->type,
+				call->data);
+		if (call->req.responseData != NULL) {
+			call->state = BAR_CALL_CACHED;
+			return;
+		}
+		BarCacheInvalidate (&app->cache, call->type, call->data);
+	}
+	BarUiCallSend (app, call);
+}
+
+static BarUiCall_t *BarUiCallNew (BarApp_t * const app,
+		const PianoRequestType_t type, void * const data,
+		const BarUiCallDone_t done, void * const user) {
+	if (app->async.multi == NULL &&
+			(app->async.multi = curl_multi_init ()) == NULL) {
+		return NULL;
+	}
+	BarUiCall_t * const call = calloc (1, sizeof (*call));
+	if (call == NULL) {
+		return NULL;
+	}
+	call->type = type;
+	call->data = data;
+	call->done = done;
+	call->user = user;
+	call->next = app->async.calls;
+	app->async.calls = call;
+	BarUiCallStart (app, call);
+	return call;
+}
+
+/*	start a piano call in the background. It gets the same retries and
+ *	reauthentication as BarUiPianoCall, but prints nothing. done is called
+ *	from BarUiAsyncHandle, data must stay around until then.
+ *	@return false if the call could not be started, done is not called then
+ */
+bool BarUiPianoCallAsync (BarApp_t * const app, const PianoRequestType_t type,
+		void * const data, const BarUiCallDone_t done, void * const user) {
+	return BarUiCallNew (app, type, data, done, user) != NULL;
+}
+
+/*	repeat the login for calls whose session expired
+ */
+static void BarUiCallReauth (BarApp_t * const app, BarUiCall_t * const call) {
+	call->state = BAR_CALL_REAUTH;
+	if (app->async.login != NULL) {
+		return;
+	}
+	debugPrint (DEBUG_NETWORK, "session expired, logging in again\n");
+	++httpStats.reauths;
+	/* the login’s request data lives in the call itself, it is set up
+	 * before the first request is built */
+	BarUiCall_t * const login = calloc (1, sizeof (*login));
+	if (login == NULL) {
+		BarUiCallFinish (call, PIANO_RET_OUT_OF_MEMORY, CURLE_OK);
+		return;
+	}
+	login->type = PIANO_REQUEST_LOGIN;
+	login->login.user = app->settings.username;
+	login->login.password = app->settings.password;
+	login->login.step = 0;
+	login->data = &login->login;
+	login->next = app->async.calls;
+	app->async.calls = login;
+	app->async.login = login;
+	BarUiCallStart (app, login);
+}
+
+/*	hand the call’s response to libpiano
+ */
+static void BarUiCallResponse (BarApp_t * const app, BarUiCall_t * const call,
+		const bool cached) {
+	const PianoReturn_t pRet = PianoResponse (&app->ph, &call->req);
+	if (pRet == PIANO_RET_CONTINUE_REQUEST) {
+		BarUiCallStart (app, call);
+	} else if (pRet == PIANO_RET_P_INVALID_AUTH_TOKEN &&
+			call->type != PIANO_REQUEST_LOGIN) {
+		BarUiCallReauth (app, call);
+	} else {
+		if (pRet == PIANO_RET_OK && app->settings.responseCache && !cached) {
+			BarCachePut (&app->cache, call->type, call->data,
+					call->req.responseData);
+		}
+		BarUiCallFinish (call, pRet, CURLE_OK);
+	}
+}
+
+/*	a transfer of call finished
+ */
+static void BarUiCallTransferred (BarApp_t * const app,
+		BarUiCall_t * const call, CURLcode wRet) {
+	curl_multi_remove_handle (app->async.multi, call->http);
+	BarUiHttpCount (call->http);
+	++call->attempt;
+
+	if (wRet == CURLE_ABORTED_BY_CALLBACK && call->progress.stalled) {
+		debugPrint (DEBUG_NETWORK, "no answer to request %i in time\n",
+				call->type);
+		wRet = CURLE_OPERATION_TIMEDOUT;
+	}
+	if (wRet != CURLE_OK) {
+		free (call->response.data);
+		call->response.data = NULL;
+		call->response.pos = 0;
+		if (temporaryCurlError (wRet) &&
+				call->attempt < app->settings.maxRetry) {
+			++httpStats.retries;
+			BarTrace (BAR_TRACE_NETWORK, BAR_TRACE_HTTP_RETRY, call->attempt,
+					wRet);
+			call->retryAt = BarUiNowMs () + BarUiHttpBackoffMs (call->attempt);
+			call->state = BAR_CALL_BACKOFF;
+		} else {
+			BarTrace (BAR_TRACE_NETWORK, BAR_TRACE_HTTP_FAILED, call->type,
+					wRet);
+			BarUiCallFinish (call, PIANO_RET_OK, wRet);
+		}
+		return;
+	}
+
+	BarUiHttpRecord (call->type, BarUiNowMs () - call->start);
+	call->req.responseData = call->response.data;
+	call->response.data = NULL;
+	call->response.pos = 0;
+	debugPrint (DEBUG_NETWORK, "→ %s\n", call->req.responseData);
+	BarUiCallResponse (app, call, false);
+}
+
+static void BarUiCallFree (BarUiCall_t * const call) {
+	if (call->http != NULL) {
+		curl_easy_cleanup (call->http);
+	}
+	curl_slist_free_all (call->headers);
+	free (call->response.data);
+	free (call->req.responseData);
+	PianoDestroyRequest (&call->req);
+	free (call);
+}
+
+/*	remove finished calls from the list and tell their owners
+ */
+static void BarUiAsyncReap (BarApp_t * const app) {
+	BarUiCall_t *done = NULL;
+	BarUiCall_t **prev = &app->async.calls;
+	while (*prev != NULL) {
+		BarUiCall_t * const call = *prev;
+		if (call->state == BAR_CALL_DONE) {
+			*prev = call->next;
+			call->next = done;
+			done = call;
+		} else {
+			prev = &call->next;
+		}
+	}
+
+	/* owners may start new calls */
+	while (done != NULL) {
+		BarUiCall_t * const call = done;
+		done = call->next;
+		if (call->pRet != PIANO_RET_OK || call->wRet != CURLE_OK) {
+			debugPrint (DEBUG_NETWORK, "background request %i: %s/%s\n",
+					call->type, PianoErrorToStr (call->pRet),
+					curl_easy_strerror (call->wRet));
+			++httpStats.failures;
+		}
+		if (call->done != NULL) {
+			call->done (app, call->data, call->pRet, call->wRet, call->user);
+		}
+		BarUiCallFree (call);
+	}
+}
+
+/*	add the background transfers to select’s sets and shorten its timeout
+ *	@return new maxfd
+ */
+int BarUiAsyncFdSet (BarApp_t * const app, fd_set * const rd,
+		fd_set * const wr, int maxfd, struct timeval * const timeout) {
+	if (app->async.calls == NULL) {
+		return maxfd;
+	}
+
+	long waitMs = -1;
+	bool running = false;
+	const int64_t now = BarUiNowMs ();
+	for (BarUiCall_t *call = app->async.calls; call != NULL;
+			call = call->next) {
+		long ms = -1;
+		switch (call->state) {
+			case BAR_CALL_RUNNING:
+				running = true;
+				break;
+
+			case BAR_CALL_BACKOFF:
+				ms = call->retryAt > now ? call->retryAt - now : 0;
+				break;
+
+			case BAR_CALL_CACHED:
+			case BAR_CALL_DONE:
+				ms = 0;
+				break;
+
+			case BAR_CALL_REAUTH:
+				break;
+		}
+		if (ms >= 0 && (waitMs < 0 || ms < waitMs)) {
+			waitMs = ms;
+		}
+	}
+
+	if (running) {
+		fd_set ex;
+		FD_ZERO (&ex);
+		int curlMax = -1;
+		long curlMs = -1;
+		curl_multi_fdset (app->async.multi, rd, wr, &ex, &curlMax);
+		curl_multi_timeout (app->async.multi, &curlMs);
+		if (curlMax == -1 && (curlMs < 0 || curlMs > 100)) {
+			/* libcurl has nothing to wait on right now, poll */
+			curlMs = 100;
+		}
+		if (curlMax >= maxfd) {
+			maxfd = curlMax + 1;
+		}
+		if (curlMs >= 0 && (waitMs < 0 || curlMs < waitMs)) {
+			waitMs = curlMs;
+		}
+	}
+
+	const long timeoutMs = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+	if (waitMs >= 0 && waitMs < timeoutMs) {
+		timeout->tv_sec = waitMs / 1000;
+		timeout->tv_usec = (waitMs % 1000) * 1000;
+	}
+	return maxfd;
+}
+
+/*	make progress on background calls, after select returned
+ */
+void BarUiAsyncHandle (BarApp_t * const app) {
+	if (app->async.calls == NULL) {
+		return;
+	}
+
+	int running;
+	curl_multi_perform (app->async.multi, &running);
+	CURLMsg *msg;
+	int queued;
+	while ((msg = curl_multi_info_read (app->async.multi, &queued)) != NULL) {
+		if (msg->msg != CURLMSG_DONE) {
+			continue;
+		}
+		BarUiCall_t *call = NULL;
+		curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, (char **) &call);
+		assert (call != NULL);
+		BarUiCallTransferred (app, call, msg->data.result);
+	}
+
+	const int64_t now = BarUiNowMs ();
+	for (BarUiCall_t *call = app->async.calls; call != NULL;
+			call = call->next) {
+		if (call->state == BAR_CALL_BACKOFF && call->retryAt <= now) {
+			BarUiCallSend (app, call);
+		} else if (call->state == BAR_CALL_CACHED) {
+			BarUiCallResponse (app, call, true);
+		}
+	}
+
+	/* calls waiting for the login go on with the new session or fail */
+	BarUiCall_t * const login = app->async.login;
+	if (login != NULL && login->state == BAR_CALL_DONE) {
+		app->async.login = NULL;
+		for (BarUiCall_t *call = app->async.calls; call != NULL;
+				call = call->next) {
+			if (call->state != BAR_CALL_REAUTH) {
+				continue;
+			}
+			if (login->pRet == PIANO_RET_OK && login->wRet == CURLE_OK) {
+				BarUiCallStart (app, call);
+			} else {
+				BarUiCallFinish (call, login->pRet, login->wRet);
+			}
+		}
+	}
+
+	BarUiAsyncReap (app);
+}
+
+/*	abort all background calls, their owners are told before this returns
+ */
+void BarUiAsyncDestroy (BarApp_t * const app) {
+	for (BarUiCall_t *call = app->async.calls; call != NULL;
+			call = call->next) {
+		if (call->state != BAR_CALL_DONE) {
+			BarUiCallFinish (call, PIANO_RET_OK, CURLE_ABORTED_BY_CALLBACK);
+			if (call->http != NULL) {
+				curl_multi_remove_handle (app->async.multi, call->http);
+			}
+		}
+	}
+	app->async.login = NULL;
+	BarUiAsyncReap (app);
+	if (app->async.multi != NULL) {
+		curl_multi_cleanup (app->async.multi);
+		app->async.multi = NULL;
+	}
+}
+
 /*	Station sorting functions */
 
 static inline int BarStationQuickmix01Cmp (const void *a, const void *b) {
@@ -866,7 +1680,7 @@ size_t BarUiListSongs (const BarApp_t * const app,
 
 			const PianoStation_t * const station =
 					PianoFindStationById (app->ph.stations, song->stationId);
-			if (station != NULL && station != app->curStation) {
+			if (station != NULL && station != app->zone->curStation) {
 				stationName = station->name;
 			} else if (station == NULL && song->stationId != NULL) {
 				stationName = deleted;
@@ -997,6 +1811,7 @@ void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 		return;
 	}
 
+	const int64_t spawnStart = BarUiNowUs ();
 	chld = fork ();
 	if (chld == 0) {
 		/* child */
@@ -1014,6 +1829,9 @@ void BarUiStartEventCmd (const BarSettings_t *settings, const char *type,
 		PianoStation_t *songStation = NULL;
 		FILE *pipeWriteFd;
 
+		BarHistogramObserve (&eventcmdSpawn, spawnBucketUs,
+				BarUiNowUs () - spawnStart);
+
 		close (pipeFd[0]);
 
 		pipeWriteFd = fdopen (pipeFd[1], "w");
@@ -1097,12 +1915,12 @@ void BarUiHistoryPrepend (BarApp_t *app, PianoSong_t *song) {
 	assert (PianoListNextP (song) == NULL);
 
 	if (app->settings.history != 0) {
-		app->songHistory = PianoListPrependP (app->songHistory, song);
+		app->zone->songHistory = PianoListPrependP (app->zone->songHistory, song);
 		PianoSong_t *del;
 		do {
-			del = PianoListGetP (app->songHistory, app->settings.history);
+			del = PianoListGetP (app->zone->songHistory, app->settings.history);
 			if (del != NULL) {
-				app->songHistory = PianoListDeleteP (app->songHistory, del);
+				app->zone->songHistory = PianoListDeleteP (app->zone->songHistory, del);
 				PianoDestroyPlaylist (del);
 			} else {
 				break;
@@ -24,6 +24,7 @@ THE SOFTWARE.
 #pragma once
 
 #include <stdbool.h>
+#include <sys/select.h>
 
 #include <piano.h>
 
@@ -32,9 +33,25 @@ THE SOFTWARE.
 #include "main.h"
 #include "ui_readline.h"
 #include "ui_types.h"
+#include "metrics.h"
 
 typedef void (*BarUiSelectStationCallback_t) (BarApp_t *app, char *buf);
 
+/* request types with latency statistics */
+#define BAR_HTTP_TYPES 64
+#define BAR_HTTP_BUCKETS BAR_HISTOGRAM_BUCKETS
+
+typedef BarHistogram_t BarHttpLatency_t;
+
+typedef struct {
+	/* successful transfers, new connections they opened, transfers that
+	 * reused a connection and transfers that used HTTP/2 */
+	unsigned long requests, connects, reused, http2;
+	/* attempts repeated after a temporary error, logins repeated because
+	 * the session expired and calls that failed for good */
+	unsigned long retries, reauths, failures;
+} BarHttpStats_t;
+
 void BarUiMsg (const BarSettings_t *, const BarUiMsg_t, const char *, ...) __attribute__((format(printf, 3, 4)));
 PianoStation_t *BarUiSelectStation (BarApp_t *, PianoStation_t *, const char *,
 		BarUiSelectStationCallback_t, bool);
@@ -52,6 +69,19 @@ void BarUiStartEventCmd (const BarSettings_t *, const char *,
 		PianoStation_t *, PianoReturn_t, CURLcode);
 bool BarUiPianoCall (BarApp_t * const, const PianoRequestType_t,
 		void *, PianoReturn_t *, CURLcode *);
+CURLcode BarPianoHttpRequest (CURL * const, const BarSettings_t * const,
+		PianoRequest_t * const);
+bool BarUiPianoCallAsync (BarApp_t * const, const PianoRequestType_t,
+		void * const, const BarUiCallDone_t, void * const);
+int BarUiAsyncFdSet (BarApp_t * const, fd_set * const, fd_set * const, int,
+		struct timeval * const);
+void BarUiAsyncHandle (BarApp_t * const);
+void BarUiAsyncDestroy (BarApp_t * const);
+const BarHttpLatency_t *BarUiHttpLatency (const PianoRequestType_t);
+unsigned int BarUiHttpPercentile (const BarHttpLatency_t * const,
+		const unsigned int);
+const BarHttpStats_t *BarUiHttpStats (void);
+void BarUiMetrics (BarMetricsBuf_t * const);
 void BarUiHistoryPrepend (BarApp_t *app, PianoSong_t *song);
 void BarUiCustomFormat (char *dest, size_t destSize, const char *format,
 		const char *formatChars, const char **formatVals);
@@ -35,11 +35,12 @@ THE SOFTWARE.
 #include "ui_readline.h"
 #include "ui_dispatch.h"
 #include "debug_log.h"
+#include "episodes.h"
 
 /*	standard eventcmd call
  */
 #define BarUiActDefaultEventcmd(name) BarUiStartEventCmd (&app->settings, \
-		name, selStation, selSong, &app->player, app->ph.stations, \
+		name, selStation, selSong, &app->zone->player, app->ph.stations, \
 		pRet, wRet)
 
 /*	standard piano call
@@ -56,11 +57,14 @@ static inline void BarUiDoSkipSong (player_t * const player) {
 	pthread_mutex_lock (&player->lock);
 	player->doQuit = true;
 	player->doPause = false;
+	BarPlayerNoteCommand (player);
 	pthread_cond_broadcast (&player->cond);
 	pthread_mutex_unlock (&player->lock);
 	pthread_mutex_lock (&player->aoplayLock);
 	pthread_cond_broadcast (&player->aoplayCond);
 	pthread_mutex_unlock (&player->aoplayLock);
+	/* the output thread may be waiting for a stalled device */
+	BarSinksAbort (&player->sinks);
 }
 
 /*	transform station if necessary to allow changes like rename, rate, ...
@@ -85,6 +89,30 @@ static int BarTransformIfShared (BarApp_t *app, PianoStation_t *station) {
 	return 1;
 }
 
+/*	queue song feedback and apply its local effect, the request itself is sent
+ *	later from the main loop
+ *	@param rating, also recorded for tired songs
+ *	@return false if it could not be queued
+ */
+static bool BarUiActQueueFeedback (BarApp_t *app, const PianoRequestType_t type,
+		PianoSong_t * const song, const PianoSongRating_t rating,
+		PianoReturn_t * const pRet, CURLcode * const wRet) {
+	*pRet = PIANO_RET_OK;
+	*wRet = CURLE_OK;
+
+	if (!BarOutboxAdd (&app->outbox, type, song, rating)) {
+		*pRet = PIANO_RET_OUT_OF_MEMORY;
+		BarUiMsg (&app->settings, MSG_NONE, "Error: %s\n",
+				PianoErrorToStr (*pRet));
+		return false;
+	}
+	if (rating != PIANO_RATE_NONE) {
+		song->rating = rating;
+	}
+	BarUiMsg (&app->settings, MSG_NONE, "Ok.\n");
+	return true;
+}
+
 /*	print current shortcut configuration
  */
 BarUiActCallback(BarUiActHelp) {
@@ -145,14 +173,10 @@ BarUiActCallback(BarUiActBanSong) {
 		return;
 	}
 
-	PianoRequestDataRateSong_t reqData;
-	reqData.song = selSong;
-	reqData.rating = PIANO_RATE_BAN;
-
 	BarUiMsg (&app->settings, MSG_INFO, "Banning song... ");
-	if (BarUiActDefaultPianoCall (PIANO_REQUEST_RATE_SONG, &reqData) &&
-			selSong == app->playlist) {
-		BarUiDoSkipSong (&app->player);
+	if (BarUiActQueueFeedback (app, PIANO_REQUEST_RATE_SONG, selSong,
+			PIANO_RATE_BAN, &pRet, &wRet) && selSong == app->zone->playlist) {
+		BarUiDoSkipSong (&app->zone->player);
 	}
 	BarUiActDefaultEventcmd ("songban");
 }
@@ -226,16 +250,16 @@ BarUiActCallback(BarUiActAddSharedStation) {
 }
 
 static void drainPlaylist (BarApp_t * const app) {
-	app->stationStarted = false;
-	BarUiDoSkipSong (&app->player);
-	if (app->playlist != NULL) {
+	app->zone->stationStarted = false;
+	BarUiDoSkipSong (&app->zone->player);
+	if (app->zone->playlist != NULL) {
 		/* drain playlist */
-		PianoDestroyPlaylist (PianoListNextP (app->playlist));
-		app->playlist->head.next = NULL;
+		PianoDestroyPlaylist (PianoListNextP (app->zone->playlist));
+		app->zone->playlist->head.next = NULL;
 	}
-	if(app->FullPlaylist != NULL) {
-		PianoDestroyPlaylist (app->FullPlaylist);
-		app->FullPlaylist = NULL;
+	if(app->zone->FullPlaylist != NULL) {
+		PianoDestroyPlaylist (app->zone->FullPlaylist);
+		app->zone->FullPlaylist = NULL;
 	}
 }
 
@@ -274,17 +298,17 @@ BarUiActCallback(BarUiActDeleteStation) {
 		if (BarReadlineYesNo (false, &app->input)) {
 			BarUiMsg (&app->settings, MSG_INFO, "Deleting %s... ",StationTypeStr);
 			if (BarUiActDefaultPianoCall (requestType,selStation) 
-				 && selStation == app->curStation) 
+				 && selStation == app->zone->curStation) 
 			{
 				drainPlaylist (app);
-				if(app->FullPlaylist != NULL) {
-					PianoDestroyPlaylist (app->FullPlaylist);
-					app->FullPlaylist = NULL;
+				if(app->zone->FullPlaylist != NULL) {
+					PianoDestroyPlaylist (app->zone->FullPlaylist);
+					app->zone->FullPlaylist = NULL;
 				}
-				app->nextStation = NULL;
+				app->zone->nextStation = NULL;
 				/* XXX: usually we shoudn’t touch cur*, but DELETE_STATION destroys
 				 * station struct */
-				app->curStation = NULL;
+				app->zone->curStation = NULL;
 				selStation = NULL;
 			}
 			snprintf(Temp,sizeof(Temp),"%sdelete",StationTypeStr);
@@ -391,6 +415,10 @@ BarUiActCallback(BarUiActSongInfo) {
 			selStation->isQuickMix ?
 			PianoFindStationById (app->ph.stations, selSong->stationId) :
 			NULL);
+	if (app->outbox.count > 0) {
+		BarUiMsg (&app->settings, MSG_INFO, "%zu feedback request%s not sent "
+				"yet.\n", app->outbox.count, app->outbox.count == 1 ? "" : "s");
+	}
 }
 
 /*	print some debugging information
@@ -424,6 +452,17 @@ BarUiActCallback(BarUiActDebug) {
 			selSong->stationId,
 			selSong->title,
 			selSong->trackToken);
+
+	const BarHttpStats_t * const stats = BarUiHttpStats ();
+	BarUiMsg (&app->settings, MSG_NONE,
+			"requests:\t%lu\n"
+			"connections:\t%lu\n"
+			"reused:\t%lu\n"
+			"http2:\t%lu\n",
+			stats->requests,
+			stats->connects,
+			stats->reused,
+			stats->http2);
 }
 
 /*	rate current song
@@ -446,46 +485,47 @@ BarUiActCallback(BarUiActLoveSong) {
 		return;
 	}
 
-	PianoRequestDataRateSong_t reqData;
-	reqData.song = selSong;
-	reqData.rating = PIANO_RATE_LOVE;
-
 	BarUiMsg (&app->settings, MSG_INFO, "Loving song... ");
-	BarUiActDefaultPianoCall (PIANO_REQUEST_RATE_SONG, &reqData);
+	BarUiActQueueFeedback (app, PIANO_REQUEST_RATE_SONG, selSong,
+			PIANO_RATE_LOVE, &pRet, &wRet);
 	BarUiActDefaultEventcmd ("songlove");
 }
 
 /*	skip song
  */
 BarUiActCallback(BarUiActSkipSong) {
-	BarUiDoSkipSong (&app->player);
+	BarUiDoSkipSong (&app->zone->player);
 }
 
 /*	play
  */
 BarUiActCallback(BarUiActPlay) {
-	pthread_mutex_lock (&app->player.lock);
-	app->player.doPause = false;
-	pthread_cond_broadcast (&app->player.cond);
-	pthread_mutex_unlock (&app->player.lock);
+	pthread_mutex_lock (&app->zone->player.lock);
+	app->zone->player.doPause = false;
+	pthread_cond_broadcast (&app->zone->player.cond);
+	pthread_mutex_unlock (&app->zone->player.lock);
 }
 
 /*	pause
  */
 BarUiActCallback(BarUiActPause) {
-	pthread_mutex_lock (&app->player.lock);
-	app->player.doPause = true;
-	pthread_cond_broadcast (&app->player.cond);
-	pthread_mutex_unlock (&app->player.lock);
+	pthread_mutex_lock (&app->zone->player.lock);
+	app->zone->player.doPause = true;
+	BarPlayerNoteCommand (&app->zone->player);
+	pthread_cond_broadcast (&app->zone->player.cond);
+	pthread_mutex_unlock (&app->zone->player.lock);
 }
 
 /*	toggle pause
  */
 BarUiActCallback(BarUiActTogglePause) {
-	pthread_mutex_lock (&app->player.lock);
-	app->player.doPause = !app->player.doPause;
-	pthread_cond_broadcast (&app->player.cond);
-	pthread_mutex_unlock (&app->player.lock);
+	pthread_mutex_lock (&app->zone->player.lock);
+	app->zone->player.doPause = !app->zone->player.doPause;
+	if (app->zone->player.doPause) {
+		BarPlayerNoteCommand (&app->zone->player);
+	}
+	pthread_cond_broadcast (&app->zone->player.cond);
+	pthread_mutex_unlock (&app->zone->player.lock);
 }
 
 /*	rename current station
@@ -520,13 +560,20 @@ BarUiActCallback(BarUiActSelectStation) {
 	snprintf(prompt,sizeof(prompt),"Select %s: ",StationType2Str(app->Filter));
 	PianoStation_t *newStation = BarUiSelectStation (app, app->ph.stations,
 			prompt, NULL, app->settings.autoselect);
-	if (newStation != NULL) {
-		app->nextStation = newStation;
+	BarUiActSwitchStation (app, newStation);
+}
+
+/*	stop the current song and continue with station, if it is not NULL
+ */
+void BarUiActSwitchStation (BarApp_t * const app,
+		PianoStation_t * const station) {
+	if (station != NULL) {
+		app->zone->nextStation = station;
 		drainPlaylist (app);
 	}
-	if(app->FullPlaylist != NULL) {
-		PianoDestroyPlaylist (app->FullPlaylist);
-		app->FullPlaylist = NULL;
+	if(app->zone->FullPlaylist != NULL) {
+		PianoDestroyPlaylist (app->zone->FullPlaylist);
+		app->zone->FullPlaylist = NULL;
 	}
 }
 
@@ -539,9 +586,9 @@ BarUiActCallback(BarUiActTempBanSong) {
 	assert (selSong != NULL);
 
 	BarUiMsg (&app->settings, MSG_INFO, "Putting song on shelf... ");
-	if (BarUiActDefaultPianoCall (PIANO_REQUEST_ADD_TIRED_SONG, selSong) &&
-			selSong == app->playlist) {
-		BarUiDoSkipSong (&app->player);
+	if (BarUiActQueueFeedback (app, PIANO_REQUEST_ADD_TIRED_SONG, selSong,
+			PIANO_RATE_TIRED, &pRet, &wRet) && selSong == app->zone->playlist) {
+		BarUiDoSkipSong (&app->zone->player);
 	}
 	BarUiActDefaultEventcmd ("songshelf");
 }
@@ -623,7 +670,7 @@ BarUiActCallback(BarUiActSelectQuickMix) {
  */
 BarUiActCallback(BarUiActQuit) {
 	app->doQuit = true;
-	BarUiDoSkipSong (&app->player);
+	BarUiDoSkipSong (&app->zone->player);
 }
 
 /*	song history
@@ -632,8 +679,8 @@ BarUiActCallback(BarUiActHistory) {
 	char buf[2];
 	PianoSong_t *histSong;
 
-	if (app->songHistory != NULL) {
-		histSong = BarUiSelectSong (app, app->songHistory,
+	if (app->zone->songHistory != NULL) {
+		histSong = BarUiSelectSong (app, app->zone->songHistory,
 				&app->input);
 		if (histSong != NULL) {
 			BarKeyShortcutId_t action;
@@ -679,34 +726,45 @@ BarUiActCallback(BarUiActBookmark) {
 			BAR_RL_FULLRETURN, -1);
 	if (selectBuf[0] == 's') {
 		BarUiMsg (&app->settings, MSG_INFO, "Bookmarking song... ");
-		BarUiActDefaultPianoCall (PIANO_REQUEST_BOOKMARK_SONG, selSong);
+		BarUiActQueueFeedback (app, PIANO_REQUEST_BOOKMARK_SONG, selSong,
+				PIANO_RATE_NONE, &pRet, &wRet);
 		BarUiActDefaultEventcmd ("songbookmark");
 	} else if (selectBuf[0] == 'a') {
 		BarUiMsg (&app->settings, MSG_INFO, "Bookmarking artist... ");
-		BarUiActDefaultPianoCall (PIANO_REQUEST_BOOKMARK_ARTIST, selSong);
+		BarUiActQueueFeedback (app, PIANO_REQUEST_BOOKMARK_ARTIST, selSong,
+				PIANO_RATE_NONE, &pRet, &wRet);
 		BarUiActDefaultEventcmd ("artistbookmark");
 	}
 }
 
+/*	volume is shared by all zones
+ */
+static void BarUiActApplyVolume (BarApp_t * const app) {
+	for (size_t i = 0; i < app->zoneCount; i++) {
+		BarPlayerSetVolume (&app->zones[i].player);
+	}
+	BarStatusSetVolume (&app->status, app->settings.volume);
+}
+
 /*	decrease volume
  */
 BarUiActCallback(BarUiActVolDown) {
 	--app->settings.volume;
-	BarPlayerSetVolume (&app->player);
+	BarUiActApplyVolume (app);
 }
 
 /*	increase volume
  */
 BarUiActCallback(BarUiActVolUp) {
 	++app->settings.volume;
-	BarPlayerSetVolume (&app->player);
+	BarUiActApplyVolume (app);
 }
 
 /*	reset volume
  */
 BarUiActCallback(BarUiActVolReset) {
 	app->settings.volume = 0;
-	BarPlayerSetVolume (&app->player);
+	BarUiActApplyVolume (app);
 }
 
 static const char *boolToYesNo (const bool value) {
@@ -968,9 +1026,9 @@ BarUiActCallback(BarUiActManageStation) {
 							PIANO_REQUEST_SET_STATION_MODE, &subReqDataSet)) {
 						drainPlaylist (app);
 					}
-					if(app->FullPlaylist != NULL) {
-						PianoDestroyPlaylist (app->FullPlaylist);
-						app->FullPlaylist = NULL;
+					if(app->zone->FullPlaylist != NULL) {
+						PianoDestroyPlaylist (app->zone->FullPlaylist);
+						app->zone->FullPlaylist = NULL;
 					}
 					BarUiActDefaultEventcmd ("stationsetmode");
 					break;
@@ -998,7 +1056,7 @@ BarUiActCallback(BarUiActGotoSong) {
 
 	switch(selStation->stationType) {
 		case PIANO_TYPE_ALBUM: {
-			song = app->FullPlaylist;
+			song = app->zone->FullPlaylist;
 			int i;
 			while(song != NULL) {
 				BarUiMsg (&app->settings, MSG_LIST, "%s\n", song->title);
@@ -1008,7 +1066,7 @@ BarUiActCallback(BarUiActGotoSong) {
 			if (BarReadlineInt (&i, &app->input) == 0) {
 				return;
 			}
-			song = app->FullPlaylist;
+			song = app->zone->FullPlaylist;
 			while(song != NULL) {
 				int TrackNumber;
 				sscanf(song->title,"%d",&TrackNumber);
@@ -1022,7 +1080,7 @@ BarUiActCallback(BarUiActGotoSong) {
 		}
 
 		case PIANO_TYPE_PLAYLIST: {
-			song = app->FullPlaylist;
+			song = app->zone->FullPlaylist;
 			int i = 1;
 			while(song != NULL) {
 				BarUiMsg (&app->settings, MSG_LIST, "%d) %s\n", i ,song->title);
@@ -1034,7 +1092,7 @@ BarUiActCallback(BarUiActGotoSong) {
 				return;
 			}
 
-			song = app->FullPlaylist;
+			song = app->zone->FullPlaylist;
 			int j = 1;
 			while(song != NULL) {
 				if(i == j++) {
@@ -1048,46 +1106,77 @@ BarUiActCallback(BarUiActGotoSong) {
 		case PIANO_TYPE_PODCAST: {
 			PianoReturn_t pRet;
 			CURLcode wRet;
-			PianoRequestDataGetEpisodes_t reqData;
-			int i = 1;
+			/* episodes fetched per page */
+			const unsigned int pageSize = 20;
+			PianoSong_t *episodes = BarEpisodesGet (selStation);
+			size_t count = 0;
+			bool more = true;
 
-			reqData.station = selStation;
-			reqData.playList = NULL;
-			reqData.bGetAll = true;
+			while (true) {
+				if (episodes == NULL) {
+					PianoRequestDataGetEpisodes_t reqData;
+					reqData.station = selStation;
+					reqData.playList = NULL;
+					reqData.bGetAll = true;
+					reqData.limit = count + pageSize;
+					if (!BarUiActDefaultPianoCall (PIANO_REQUEST_GET_EPISODES,
+							&reqData)) {
+						break;
+					}
+					episodes = reqData.playList;
+					BarEpisodesPut (selStation, episodes);
+				}
+
+				size_t n = 0;
+				song = episodes;
+				PianoListForeachP (song) {
+					BarUiMsg (&app->settings, MSG_LIST, "%2zu) %s\n", ++n,
+							song->title);
+				}
+				if (n <= count) {
+					/* no older episodes */
+					more = false;
+				}
+				count = n;
 
-			if (BarUiActDefaultPianoCall(PIANO_REQUEST_GET_EPISODES,&reqData) ) {
-				song = reqData.playList;
+				int i = 0;
+				BarUiMsg (&app->settings, MSG_QUESTION, more ?
+						"Select episode (0 for older ones): " :
+						"Select episode: ");
+				if (BarReadlineInt (&i, &app->input) == 0) {
+					break;
+				}
+				if (i == 0 && more) {
+					/* next page, older episodes are prepended */
+					PianoDestroyPlaylist (episodes);
+					episodes = NULL;
+					continue;
+				}
+
+				song = episodes;
+				int j = 1;
 				while(song != NULL) {
-					BarUiMsg (&app->settings, MSG_LIST, "%2d) %s\n", i ,song->title);
+					if(i == j++) {
+						break;
+					}
 					song = (PianoSong_t *) song->head.next;
-					i++;
 				}
-				BarUiMsg (&app->settings, MSG_QUESTION, "Select episode: ");
-				if (BarReadlineInt (&i, &app->input) != 0) {
-					song = reqData.playList;
-					int j = 1;
-					while(song != NULL) {
-						if(i == j++) {
-							break;
-						}
-						song = (PianoSong_t *) song->head.next;
-					}
-					if(song != NULL) {
-						PianoSong_t *NewSong = CopySong(app->playlist);
-						LOG("Selected '%s'\n",song->title);
-
-						assert(NewSong->trackToken != NULL);
-						assert(NewSong->title != NULL);
-						free(NewSong->trackToken);
-						NewSong->trackToken = strdup(song->trackToken);
-						free(NewSong->title);
-						NewSong->title = strdup(song->title);
-						NewSong->fileGain = 0.0;
-						song = NewSong;
-					}
+				if(song != NULL) {
+					PianoSong_t *NewSong = CopySong(app->zone->playlist);
+					LOG("Selected '%s'\n",song->title);
+
+					assert(NewSong->trackToken != NULL);
+					assert(NewSong->title != NULL);
+					free(NewSong->trackToken);
+					NewSong->trackToken = strdup(song->trackToken);
+					free(NewSong->title);
+					NewSong->title = strdup(song->title);
+					NewSong->fileGain = 0.0;
+					song = NewSong;
 				}
+				break;
 			}
-			PianoDestroyPlaylist(reqData.playList);
+			PianoDestroyPlaylist(episodes);
 			break;
 		}
 
@@ -1100,13 +1189,38 @@ BarUiActCallback(BarUiActGotoSong) {
 	}
 
 	if(song != NULL) {
-		BarUiDoSkipSong (&app->player);
-		assert(app->playlist != NULL);
-		PianoSong_t *PlayTail = (PianoSong_t *) app->playlist->head.next;
+		BarUiDoSkipSong (&app->zone->player);
+		assert(app->zone->playlist != NULL);
+		PianoSong_t *PlayTail = (PianoSong_t *) app->zone->playlist->head.next;
 
 		if (PlayTail != NULL) {
 			PianoDestroyPlaylist (PianoListNextP (PlayTail));
 		}
-		app->playlist->head.next = (PianoListHead_t *) CopyPlaylist(song);
+		app->zone->playlist->head.next = (PianoListHead_t *) CopyPlaylist(song);
+	}
+}
+
+/*	select the zone following commands apply to
+ */
+BarUiActCallback(BarUiActSelectZone) {
+	for (size_t i = 0; i < app->zoneCount; i++) {
+		const BarZone_t * const zone = &app->zones[i];
+		const PianoSong_t * const song = zone->playlist;
+		BarUiMsg (&app->settings, MSG_LIST, "%c%zu) %s%s%s\n",
+				zone == app->zone ? '*' : ' ', i+1,
+				zone->curStation != NULL ? zone->curStation->name : "(idle)",
+				song != NULL ? ": " : "", song != NULL ? song->title : "");
+	}
+
+	int i;
+	BarUiMsg (&app->settings, MSG_QUESTION, "Select zone: ");
+	if (BarReadlineInt (&i, &app->input) == 0) {
+		return;
+	}
+	if (i < 1 || (size_t) i > app->zoneCount) {
+		BarUiMsg (&app->settings, MSG_ERR, "No such zone.\n");
+		return;
 	}
+	app->zone = &app->zones[i-1];
+	BarUiMsg (&app->settings, MSG_INFO, "Zone %i selected.\n", i);
 }
@@ -63,4 +63,7 @@ BarUiActCallback(BarUiActVolReset);
 BarUiActCallback(BarUiActSettings);
 BarUiActCallback(BarUiActFilter);
 BarUiActCallback(BarUiActGotoSong);
+BarUiActCallback(BarUiActSelectZone);
+
+void BarUiActSwitchStation (BarApp_t * const, PianoStation_t * const);
 
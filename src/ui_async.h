@@ -0,0 +1,48 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#pragma once
+
+#include <curl/curl.h>
+
+#include <piano.h>
+
+struct BarApp;
+
+typedef struct BarUiCall BarUiCall_t;
+
+/*	called once a background call finished, with the data it was started
+ *	with. Calls that were still running on shutdown end with
+ *	CURLE_ABORTED_BY_CALLBACK.
+ */
+typedef void (*BarUiCallDone_t) (struct BarApp * const, void * const,
+		const PianoReturn_t, const CURLcode, void * const);
+
+/* piano calls running in the background, driven by the main loop */
+typedef struct {
+	CURLM *multi;
+	BarUiCall_t *calls;
+	/* login repeating an expired session, NULL if none is running */
+	BarUiCall_t *login;
+} BarUiAsync_t;
+
@@ -0,0 +1,445 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* json requests and notifications for the control socket. Every request is
+ * a json object on a line of its own, like
+ *   {"id": 1, "cmd": "key", "key": "n", "zone": 2}
+ * and answered with a single line carrying the same id:
+ *   {"id": 1, "ok": true} or {"id": 1, "ok": false, "error": "..."}
+ * Subscribed clients also receive lines like {"event": "song", ...}.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include <json.h>
+
+#include "ui_control.h"
+#include "ui.h"
+#include "ui_dispatch.h"
+
+/* actions the "key" command may run, the others prompt on the terminal and
+ * would block the main loop until someone answers there */
+static const BarKeyShortcutId_t remoteActions[] = {
+		BAR_KS_LOVE, BAR_KS_BAN, BAR_KS_TIRED, BAR_KS_EXPLAIN, BAR_KS_INFO,
+		BAR_KS_SKIP, BAR_KS_PLAYPAUSE, BAR_KS_PLAYPAUSE2, BAR_KS_PLAY,
+		BAR_KS_PAUSE, BAR_KS_UPCOMING, BAR_KS_VOLDOWN, BAR_KS_VOLUP,
+		BAR_KS_VOLRESET, BAR_KS_QUIT,
+		};
+
+static const struct {
+	const char *name;
+	BarControlTopic_t topic;
+} topics[] = {
+		{"song", BAR_CONTROL_SONG},
+		{"position", BAR_CONTROL_POSITION},
+		{"buffer", BAR_CONTROL_BUFFER},
+		};
+
+static void BarUiControlAddString (json_object * const o,
+		const char * const key, const char * const val) {
+	json_object_object_add (o, key, val != NULL ?
+			json_object_new_string (val) : NULL);
+}
+
+static json_object *BarUiControlStation (const PianoStation_t * const station) {
+	if (station == NULL) {
+		return NULL;
+	}
+	json_object * const o = json_object_new_object ();
+	BarUiControlAddString (o, "id", station->id);
+	BarUiControlAddString (o, "name", station->name);
+	BarUiControlAddString (o, "type", StationType2Str (station->stationType));
+	return o;
+}
+
+static json_object *BarUiControlSongObject (const PianoSong_t * const song) {
+	static const char * const ratings[] = {"none", "love", "ban", "tired"};
+
+	if (song == NULL) {
+		return NULL;
+	}
+	json_object * const o = json_object_new_object ();
+	BarUiControlAddString (o, "title", song->title);
+	BarUiControlAddString (o, "artist", song->artist);
+	BarUiControlAddString (o, "album", song->album);
+	BarUiControlAddString (o, "coverArt", song->coverArt);
+	BarUiControlAddString (o, "detailUrl", song->detailUrl);
+	BarUiControlAddString (o, "trackToken", song->trackToken);
+	BarUiControlAddString (o, "stationId", song->stationId);
+	json_object_object_add (o, "duration", json_object_new_int (song->length));
+	BarUiControlAddString (o, "rating", song->rating <= PIANO_RATE_TIRED ?
+			ratings[song->rating] : "none");
+	return o;
+}
+
+/*	@return 1-based zone number used by the protocol
+ */
+static int BarUiControlZoneNumber (const BarApp_t * const app,
+		const BarZone_t * const zone) {
+	return zone - app->zones + 1;
+}
+
+static json_object *BarUiControlZone (BarApp_t * const app,
+		BarZone_t * const zone) {
+	player_t * const player = &zone->player;
+
+	pthread_mutex_lock (&player->lock);
+	const BarPlayerMode mode = player->mode;
+	const bool paused = player->doPause;
+	const unsigned int played = player->songPlayed;
+	const unsigned int duration = player->songDuration;
+	const unsigned int throughput = player->throughput;
+	const unsigned int underruns = player->underruns;
+	pthread_mutex_unlock (&player->lock);
+
+	const char *state = "stopped";
+	if (mode == PLAYER_WAITING) {
+		state = "loading";
+	} else if (mode == PLAYER_PLAYING) {
+		state = paused ? "paused" : "playing";
+	}
+
+	json_object * const o = json_object_new_object ();
+	json_object_object_add (o, "zone",
+			json_object_new_int (BarUiControlZoneNumber (app, zone)));
+	json_object_object_add (o, "selected",
+			json_object_new_boolean (zone == app->zone));
+	json_object_object_add (o, "state", json_object_new_string (state));
+	json_object_object_add (o, "station",
+			BarUiControlStation (zone->curStation));
+	const bool hasSong = mode != PLAYER_DEAD && mode != PLAYER_FINISHED;
+	json_object_object_add (o, "song",
+			BarUiControlSongObject (hasSong ? zone->playlist : NULL));
+	json_object_object_add (o, "played", json_object_new_int (played));
+	json_object_object_add (o, "duration", json_object_new_int (duration));
+	json_object_object_add (o, "throughput", json_object_new_int64 (throughput));
+	json_object_object_add (o, "underruns", json_object_new_int (underruns));
+	return o;
+}
+
+static json_object *BarUiControlStatus (BarApp_t * const app) {
+	json_object * const o = json_object_new_object ();
+	json_object_object_add (o, "volume",
+			json_object_new_int (app->settings.volume));
+	json_object_object_add (o, "zone",
+			json_object_new_int (BarUiControlZoneNumber (app, app->zone)));
+	json_object * const zones = json_object_new_array ();
+	for (size_t i = 0; i < app->zoneCount; i++) {
+		json_object_array_add (zones, BarUiControlZone (app, &app->zones[i]));
+	}
+	json_object_object_add (o, "zones", zones);
+	return o;
+}
+
+/*	send o to client and free it
+ */
+static void BarUiControlReply (BarApp_t * const app,
+		BarControlClient_t * const c, json_object * const o) {
+	BarControlSend (&app->control, c,
+			json_object_to_json_string_ext (o, JSON_C_TO_STRING_PLAIN));
+	json_object_put (o);
+}
+
+/*	send o to all subscribers of topic and free it
+ */
+static void BarUiControlNotify (BarApp_t * const app,
+		const BarControlTopic_t topic, json_object * const o) {
+	BarControlPublish (&app->control, topic,
+			json_object_to_json_string_ext (o, JSON_C_TO_STRING_PLAIN));
+	json_object_put (o);
+}
+
+static json_object *BarUiControlSongEvent (BarApp_t * const app,
+		BarZone_t * const zone) {
+	json_object * const o = json_object_new_object ();
+	json_object_object_add (o, "event", json_object_new_string ("song"));
+	json_object_object_add (o, "zone",
+			json_object_new_int (BarUiControlZoneNumber (app, zone)));
+	json_object_object_add (o, "station",
+			BarUiControlStation (zone->curStation));
+	json_object_object_add (o, "song", BarUiControlSongObject (zone->playlist));
+	return o;
+}
+
+/*	change subscriptions
+ *	@return error message or NULL
+ */
+static const char *BarUiControlSubscribe (BarApp_t * const app,
+		BarControlClient_t * const c, json_object * const req,
+		const bool subscribe) {
+	json_object *list;
+	if (!json_object_object_get_ex (req, "topics", &list) ||
+			!json_object_is_type (list, json_type_array)) {
+		return "missing topics";
+	}
+
+	unsigned int mask = 0;
+	for (size_t i = 0; i < json_object_array_length (list); i++) {
+		const char * const name = json_object_get_string (
+				json_object_array_get_idx (list, i));
+		size_t j;
+		for (j = 0; j < sizeof (topics) / sizeof (*topics); j++) {
+			if (name != NULL && strcmp (name, topics[j].name) == 0) {
+				mask |= topics[j].topic;
+				break;
+			}
+		}
+		if (j == sizeof (topics) / sizeof (*topics)) {
+			return "unknown topic";
+		}
+	}
+
+	if (!subscribe) {
+		c->topics &= ~mask;
+		return NULL;
+	}
+	/* new song subscribers learn what is playing right now */
+	if ((mask & BAR_CONTROL_SONG) && !(c->topics & BAR_CONTROL_SONG)) {
+		for (size_t i = 0; i < app->zoneCount; i++) {
+			BarZone_t * const zone = &app->zones[i];
+			if (BarPlayerGetMode (&zone->player) == PLAYER_PLAYING) {
+				BarUiControlReply (app, c, BarUiControlSongEvent (app, zone));
+			}
+		}
+	}
+	c->topics |= mask;
+	return NULL;
+}
+
+/*	@return true if key is bound to an action that does not prompt
+ */
+static bool BarUiControlRemoteKey (const BarApp_t * const app,
+		const char key) {
+	/* the first action bound to key is the one BarUiDispatch runs */
+	for (size_t i = 0; i < BAR_KS_COUNT; i++) {
+		if (app->settings.keys[i] == BAR_KS_DISABLED ||
+				app->settings.keys[i] != key) {
+			continue;
+		}
+		for (size_t j = 0; j < sizeof (remoteActions) /
+				sizeof (*remoteActions); j++) {
+			if (remoteActions[j] == (BarKeyShortcutId_t) i) {
+				return true;
+			}
+		}
+		return false;
+	}
+	return false;
+}
+
+/*	run command in app->zone
+ *	@return error message or NULL
+ */
+static const char *BarUiControlExecute (BarApp_t * const app,
+		BarControlClient_t * const c, const char * const cmd,
+		json_object * const req, json_object ** const result) {
+	json_object *arg;
+
+	if (strcmp (cmd, "status") == 0) {
+		*result = BarUiControlStatus (app);
+	} else if (strcmp (cmd, "zone") == 0) {
+		/* selected by BarUiControlRequest already */
+		if (!json_object_object_get_ex (req, "zone", &arg)) {
+			return "missing zone";
+		}
+	} else if (strcmp (cmd, "key") == 0) {
+		const char *key;
+		if (!json_object_object_get_ex (req, "key", &arg) ||
+				(key = json_object_get_string (arg)) == NULL ||
+				strlen (key) != 1) {
+			return "missing key";
+		}
+		if (!BarUiControlRemoteKey (app, key[0])) {
+			return "action not available remotely";
+		}
+		if (BarUiDispatch (app, key[0], app->zone->curStation,
+				app->zone->playlist, false, BAR_DC_GLOBAL) == BAR_KS_COUNT) {
+			return "action not available";
+		}
+	} else if (strcmp (cmd, "station") == 0) {
+		const char *id;
+		if (!json_object_object_get_ex (req, "station", &arg) ||
+				(id = json_object_get_string (arg)) == NULL) {
+			return "missing station";
+		}
+		PianoStation_t * const station = PianoFindStationById (
+				app->ph.stations, id);
+		if (station == NULL) {
+			return "no such station";
+		}
+		BarUiActSwitchStation (app, station);
+	} else if (strcmp (cmd, "volume") == 0) {
+		if (!json_object_object_get_ex (req, "volume", &arg)) {
+			return "missing volume";
+		}
+		app->settings.volume = json_object_get_int (arg);
+		for (size_t i = 0; i < app->zoneCount; i++) {
+			BarPlayerSetVolume (&app->zones[i].player);
+		}
+		BarStatusSetVolume (&app->status, app->settings.volume);
+	} else if (strcmp (cmd, "subscribe") == 0) {
+		return BarUiControlSubscribe (app, c, req, true);
+	} else if (strcmp (cmd, "unsubscribe") == 0) {
+		return BarUiControlSubscribe (app, c, req, false);
+	} else {
+		return "unknown command";
+	}
+	return NULL;
+}
+
+/*	answer a single request line
+ */
+static void BarUiControlRequest (void * const data, BarControl_t * const ctl,
+		BarControlClient_t * const c, const char * const line) {
+	BarApp_t * const app = data;
+	json_object * const req = json_tokener_parse (line);
+	json_object * const reply = json_object_new_object ();
+	json_object *result = NULL, *arg;
+	const char *error = NULL, *cmd = NULL;
+
+	if (req == NULL || !json_object_is_type (req, json_type_object)) {
+		error = "invalid request";
+	} else {
+		if (json_object_object_get_ex (req, "id", &arg)) {
+			json_object_object_add (reply, "id", json_object_get (arg));
+		}
+		if (!json_object_object_get_ex (req, "cmd", &arg) ||
+				(cmd = json_object_get_string (arg)) == NULL) {
+			error = "missing cmd";
+		}
+	}
+
+	if (error == NULL) {
+		BarZone_t * const selected = app->zone;
+		const bool hasZone = json_object_object_get_ex (req, "zone", &arg);
+		if (hasZone) {
+			const int zone = json_object_get_int (arg);
+			if (zone < 1 || (size_t) zone > app->zoneCount) {
+				error = "no such zone";
+			} else {
+				app->zone = &app->zones[zone-1];
+			}
+		}
+		if (error == NULL) {
+			error = BarUiControlExecute (app, c, cmd, req, &result);
+		}
+		/* zone applies to this request only, unless it selected one */
+		if (hasZone && strcmp (cmd, "zone") != 0) {
+			app->zone = selected;
+		}
+	}
+
+	json_object_object_add (reply, "ok", json_object_new_boolean (error == NULL));
+	if (error != NULL) {
+		json_object_object_add (reply, "error", json_object_new_string (error));
+	} else if (result != NULL) {
+		json_object_object_add (reply, "result", result);
+	}
+	BarUiControlReply (app, c, reply);
+	if (req != NULL) {
+		json_object_put (req);
+	}
+}
+
+/*	serve clients select() reported ready
+ */
+void BarUiControlHandle (BarApp_t * const app, const fd_set * const rd,
+		const fd_set * const wr) {
+	assert (app != NULL);
+	BarControlHandle (&app->control, rd, wr, BarUiControlRequest, app);
+}
+
+/*	announce the song app->zone just started playing
+ */
+void BarUiControlSong (BarApp_t * const app) {
+	assert (app != NULL);
+	if (!BarControlSubscribed (&app->control, BAR_CONTROL_SONG)) {
+		return;
+	}
+	BarUiControlNotify (app, BAR_CONTROL_SONG,
+			BarUiControlSongEvent (app, app->zone));
+}
+
+/*	push playback position and buffer state of all zones, if changed
+ */
+void BarUiControlUpdate (BarApp_t * const app) {
+	assert (app != NULL);
+
+	const bool position = BarControlSubscribed (&app->control,
+			BAR_CONTROL_POSITION);
+	const bool buffer = BarControlSubscribed (&app->control,
+			BAR_CONTROL_BUFFER);
+	if (!position && !buffer) {
+		return;
+	}
+
+	for (size_t i = 0; i < app->zoneCount; i++) {
+		player_t * const player = &app->zones[i].player;
+
+		pthread_mutex_lock (&player->lock);
+		const bool playing = player->mode == PLAYER_PLAYING;
+		const bool paused = player->doPause;
+		const unsigned int played = player->songPlayed;
+		const unsigned int duration = player->songDuration;
+		const unsigned int throughput = player->throughput;
+		const unsigned int underruns = player->underruns;
+		pthread_mutex_unlock (&player->lock);
+
+		if (!playing) {
+			continue;
+		}
+
+		BarControlZoneState_t * const last = &app->control.published[i];
+		if (position && played != last->played) {
+			json_object * const o = json_object_new_object ();
+			json_object_object_add (o, "event",
+					json_object_new_string ("position"));
+			json_object_object_add (o, "zone", json_object_new_int (i+1));
+			json_object_object_add (o, "played", json_object_new_int (played));
+			json_object_object_add (o, "duration",
+					json_object_new_int (duration));
+			json_object_object_add (o, "paused",
+					json_object_new_boolean (paused));
+			BarUiControlNotify (app, BAR_CONTROL_POSITION, o);
+		}
+		if (buffer && (throughput != last->throughput ||
+				underruns != last->underruns)) {
+			json_object * const o = json_object_new_object ();
+			json_object_object_add (o, "event",
+					json_object_new_string ("buffer"));
+			json_object_object_add (o, "zone", json_object_new_int (i+1));
+			json_object_object_add (o, "throughput",
+					json_object_new_int64 (throughput));
+			json_object_object_add (o, "underruns",
+					json_object_new_int (underruns));
+			BarUiControlNotify (app, BAR_CONTROL_BUFFER, o);
+		}
+		last->played = played;
+		last->throughput = throughput;
+		last->underruns = underruns;
+	}
+}
@@ -27,6 +27,7 @@ THE SOFTWARE.
 #include "settings.h"
 #include "ui.h"
 #include "debug_log.h"
+#include "trace.h"
 
 /*	handle global keyboard shortcuts
  *	@return BAR_KS_* if action was performed or BAR_KS_COUNT on error/if no
@@ -57,7 +58,7 @@ BarKeyShortcutId_t BarUiDispatch (BarApp_t *app, const char key, PianoStation_t
 			context |= StationTypes[stationType];
 	}
 		else {
-			ELOG("Internal error: stationType 0x%x\n",stationType);
+			ELOG(&app->ph, "Internal error: stationType 0x%x\n",stationType);
 		}
 	}
 	if (selSong != NULL) {
@@ -76,6 +77,7 @@ BarKeyShortcutId_t BarUiDispatch (BarApp_t *app, const char key, PianoStation_t
 				break;
 			}
 			assert (dispatchActions[i].function != NULL);
+			BarTrace (BAR_TRACE_UI, BAR_TRACE_KEY, key, 0);
 			dispatchActions[i].function (app, selStation, selSong,context);
 			Ret = i;
 			break;
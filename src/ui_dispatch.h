@@ -121,6 +121,8 @@ static const BarUiDispatchAction_t dispatchActions[BAR_KS_COUNT] = {
 				"act_filter"},
 		{'G', BAR_DC_STATION_TYPE_ALBUM | BAR_DC_STATION_TYPE_PLAYLIST | BAR_DC_STATION_TYPE_PODCAST | BAR_DC_SONG, 
 				BarUiActGotoSong, "goto song", "act_gotosong"},
+		{'z', BAR_DC_GLOBAL, BarUiActSelectZone, "select zone",
+				"act_zoneselect"},
 		};
 
 #include <piano.h>
@@ -0,0 +1,301 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* microbenchmark of building requests and parsing responses: cpu time and
+ * heap allocations per call, for a few request types and for the parts of
+ * a playlist request. The numbers quoted in request.c come from here.
+ *
+ * usage: piano_bench [iterations]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include "../src/config.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <time.h>
+
+#include <gcrypt.h>
+#include <json.h>
+#include <piano.h>
+
+#include "../src/libpiano/crypt.h"
+
+/* allocations are counted by interposing glibc’s malloc, which sanitizers
+ * do themselves */
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__) && \
+		!defined(__SANITIZE_THREAD__)
+#define COUNT_ALLOCS
+static unsigned long allocs;
+
+extern void *__libc_malloc (size_t);
+extern void *__libc_calloc (size_t, size_t);
+extern void *__libc_realloc (void *, size_t);
+extern void __libc_free (void *);
+
+void *malloc (size_t size) {
+	++allocs;
+	return __libc_malloc (size);
+}
+
+void *calloc (size_t n, size_t size) {
+	++allocs;
+	return __libc_calloc (n, size);
+}
+
+void *realloc (void *p, size_t size) {
+	++allocs;
+	return __libc_realloc (p, size);
+}
+
+void free (void *p) {
+	__libc_free (p);
+}
+#else
+static const unsigned long allocs = 0;
+#endif
+
+static const char * const inkey = "bench-in-key";
+static const char * const outkey = "bench-out-key";
+/* as long as the ones pandora hands out */
+static const char * const userToken =
+		"XR3zOtMrzEdJlmEbW4HtILiGyB3Gz1tBnyxWcbKDOwDkN9ld7a/Aj2Rw==";
+
+static PianoHandle_t ph;
+static PianoStation_t station;
+static PianoSong_t song;
+static char *playlistResponse;
+
+static int64_t cpuNs (void) {
+	struct timespec t;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &t);
+	return (int64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/*	run f iterations times and print cpu time and allocations per call
+ */
+static void bench (const char * const name, void (*f) (void),
+		const unsigned int iterations) {
+	/* warm up caches and lazily initialized state */
+	for (unsigned int i = 0; i < iterations / 10 + 1; i++) {
+		f ();
+	}
+	const unsigned long allocsStart = allocs;
+	const int64_t start = cpuNs ();
+	for (unsigned int i = 0; i < iterations; i++) {
+		f ();
+	}
+	const int64_t ns = cpuNs () - start;
+	printf ("%-28s %9.2f us %8.1f allocs\n", name,
+			(double) ns / iterations / 1000,
+			(double) (allocs - allocsStart) / iterations);
+}
+
+static void request (const PianoRequestType_t type, void * const data) {
+	PianoRequest_t req;
+	memset (&req, 0, sizeof (req));
+	req.data = data;
+	const PianoReturn_t ret = PianoRequest (&ph, &req, type);
+	assert (ret == PIANO_RET_OK);
+	(void) ret;
+	PianoDestroyRequest (&req);
+}
+
+static void benchPartnerLogin (void) {
+	PianoRequestDataLogin_t login = {"user", "password", 0};
+	request (PIANO_REQUEST_LOGIN, &login);
+}
+
+static void benchUserLogin (void) {
+	PianoRequestDataLogin_t login = {"user", "password", 1};
+	request (PIANO_REQUEST_LOGIN, &login);
+}
+
+static void benchStations (void) {
+	request (PIANO_REQUEST_GET_STATIONS, NULL);
+}
+
+static void benchPlaylist (void) {
+	PianoRequestDataGetPlaylist_t reqData;
+	memset (&reqData, 0, sizeof (reqData));
+	reqData.station = &station;
+	reqData.quality = PIANO_AQ_HIGH;
+	request (PIANO_REQUEST_GET_PLAYLIST, &reqData);
+}
+
+static void benchRate (void) {
+	PianoRequestDataRateSong_t reqData = {&song, PIANO_RATE_LOVE};
+	request (PIANO_REQUEST_RATE_SONG, &reqData);
+}
+
+static void benchExplain (void) {
+	PianoRequestDataExplain_t reqData;
+	memset (&reqData, 0, sizeof (reqData));
+	reqData.song = &song;
+	request (PIANO_REQUEST_EXPLAIN, &reqData);
+}
+
+static void benchSearch (void) {
+	PianoRequestDataSearch_t reqData;
+	memset (&reqData, 0, sizeof (reqData));
+	reqData.searchStr = "some artist";
+	request (PIANO_REQUEST_SEARCH, &reqData);
+}
+
+/*	the body of a playlist request, the way PianoRequest builds it
+ */
+static void benchPlaylistJson (void) {
+	json_object * const j = json_object_new_object ();
+	json_object_object_add (j, "stationToken",
+			json_object_new_string (station.id));
+	json_object_object_add (j, "includeTrackLength",
+			json_object_new_boolean (true));
+	json_object_object_add (j, "userAuthToken",
+			json_object_new_string (ph.user.authToken));
+	json_object_object_add (j, "syncTime",
+			json_object_new_int (time (NULL)));
+	char * const body = strdup (json_object_to_json_string_ext (j,
+			JSON_C_TO_STRING_PLAIN));
+	json_object_put (j);
+	free (body);
+}
+
+/*	the same body written by hand into a reused buffer, what a dedicated
+ *	writer would cost. Tokens need no escaping here.
+ */
+static void benchPlaylistWriter (void) {
+	static char body[1024];
+	const int len = snprintf (body, sizeof (body), "{\"stationToken\":\"%s\","
+			"\"includeTrackLength\":true,\"userAuthToken\":\"%s\","
+			"\"syncTime\":%ld}", station.id, ph.user.authToken,
+			(long) time (NULL));
+	assert (len > 0 && (size_t) len < sizeof (body));
+	(void) len;
+}
+
+static void benchPlaylistEncrypt (void) {
+	static const char body[] = "{\"stationToken\":\"4242424242424242424\","
+			"\"includeTrackLength\":true,\"userAuthToken\":"
+			"\"XR3zOtMrzEdJlmEbW4HtILiGyB3Gz1tBnyxWcbKDOwDkN9ld7a/Aj2Rw==\","
+			"\"syncTime\":1700000000}";
+	free (PianoEncryptString (ph.partner.out, body));
+}
+
+static void benchPlaylistResponse (void) {
+	PianoRequestDataGetPlaylist_t reqData;
+	memset (&reqData, 0, sizeof (reqData));
+	reqData.station = &station;
+	reqData.quality = PIANO_AQ_HIGH;
+	PianoRequest_t req;
+	memset (&req, 0, sizeof (req));
+	req.type = PIANO_REQUEST_GET_PLAYLIST;
+	req.data = &reqData;
+	req.responseData = playlistResponse;
+	const PianoReturn_t ret = PianoResponse (&ph, &req);
+	assert (ret == PIANO_RET_OK && reqData.retPlaylist != NULL);
+	(void) ret;
+	PianoDestroyPlaylist (reqData.retPlaylist);
+}
+
+/*	a playlist response of four songs like the api sends
+ */
+static char *makePlaylistResponse (void) {
+	const char * const qualities[] = {"lowQuality", "mediumQuality",
+			"highQuality"};
+	char *resp = NULL;
+	size_t len = 0;
+	FILE * const fp = open_memstream (&resp, &len);
+	assert (fp != NULL);
+	fputs ("{\"stat\":\"ok\",\"result\":{\"items\":[", fp);
+	for (unsigned int i = 0; i < 4; i++) {
+		fprintf (fp, "%s{\"artistName\":\"Some Artist\",\"albumName\":"
+				"\"Some Album\",\"songName\":\"Song %u\",\"trackToken\":"
+				"\"%s-track-%u-e2f8c9a1b3d4\",\"stationId\":\"%s\","
+				"\"trackLength\":240,\"trackGain\":\"-3.5\",\"songRating\":0,"
+				"\"albumArtUrl\":\"http://example.com/art/%u.jpg\","
+				"\"audioUrlMap\":{", i > 0 ? "," : "", i, station.id, i,
+				station.id, i);
+		for (size_t q = 0; q < sizeof (qualities) / sizeof (*qualities);
+				q++) {
+			fprintf (fp, "%s\"%s\":{\"bitrate\":\"64\",\"encoding\":\"aacplus\","
+					"\"audioUrl\":\"http://audio.example.com/access/%u-%zu?"
+					"version=5&lid=1234567&token=abcdefabcdefabcdef\","
+					"\"protocol\":\"http\"}", q > 0 ? "," : "", qualities[q], i,
+					q);
+		}
+		fputs ("}}", fp);
+	}
+	fputs ("]}}", fp);
+	fclose (fp);
+	return resp;
+}
+
+int main (int argc, char **argv) {
+	const unsigned int iterations = argc > 1 ? strtoul (argv[1], NULL, 10) :
+			200000;
+
+	gcry_check_version (NULL);
+	if (PianoInit (&ph, "android", "password", "android-generic", inkey,
+			outkey) != PIANO_RET_OK) {
+		fprintf (stderr, "cannot init handle\n");
+		return EXIT_FAILURE;
+	}
+	/* a logged in session */
+	ph.partner.authToken = strdup ("VAzrFmkRKYqGbzJjGc8DoxKQ==");
+	ph.partner.id = 42;
+	ph.user.authToken = strdup (userToken);
+	ph.user.listenerId = strdup ("123456789");
+
+	station.id = "4242424242424242424";
+	station.name = "Some Station";
+	song.trackToken = "4242424242424242424-track-0-e2f8c9a1b3d4";
+	song.stationId = station.id;
+	playlistResponse = makePlaylistResponse ();
+
+#ifndef COUNT_ALLOCS
+	printf ("allocations are not counted in this build\n");
+#endif
+	printf ("%u iterations, %zu byte playlist response\n", iterations,
+			strlen (playlistResponse));
+	bench ("auth.partnerLogin", benchPartnerLogin, iterations);
+	bench ("auth.userLogin", benchUserLogin, iterations);
+	bench ("user.getStationList", benchStations, iterations);
+	bench ("station.getPlaylist", benchPlaylist, iterations);
+	bench ("station.addFeedback", benchRate, iterations);
+	bench ("track.explainTrack", benchExplain, iterations);
+	bench ("music.search", benchSearch, iterations);
+	printf ("station.getPlaylist in parts:\n");
+	bench ("  json-c body", benchPlaylistJson, iterations);
+	bench ("  hand-written body", benchPlaylistWriter, iterations);
+	bench ("  encrypt body", benchPlaylistEncrypt, iterations);
+	bench ("  parse response", benchPlaylistResponse, iterations / 10);
+
+	/* PianoDestroy frees the tokens, the station and song are ours */
+	free (playlistResponse);
+	PianoDestroy (&ph);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,541 @@
+/*
+Copyright (c) 2008-2018
+	Lars-Dominik Braun <lars@6xq.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/* stress test of libpiano’s threading contract: many handles, one per
+ * thread, log in, fetch their stations and playlists and log in again,
+ * all at the same time, against a mock of the json api on the loopback
+ * interface. The mock checks every request belongs to the session it
+ * claims to, the clients check every response ended up in their own
+ * handle. Run it under ThreadSanitizer to find unsynchronized state, see
+ * the test target in the Makefile.
+ *
+ * usage: piano_stress [handles] [iterations]
+ */
+
+/* memmem, strcasestr */
+#define _GNU_SOURCE
+#include "../src/config.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <curl/curl.h>
+#include <gcrypt.h>
+#include <json.h>
+#include <piano.h>
+
+#include "../src/libpiano/crypt.h"
+#include "../src/libpiano/debug_log.h"
+
+/* not pandora’s, any pair of keys does */
+static const char * const inkey = "mock-in-key";
+static const char * const outkey = "mock-out-key";
+static const unsigned int stationCount = 12;
+static const unsigned int songCount = 4;
+/* a client logs in again every reloginEvery iterations */
+static const unsigned int reloginEvery = 10;
+
+/* logins handed out so far, part of every user token */
+static unsigned long logins;
+static unsigned long failures;
+
+#define fail(...) do { \
+		fprintf (stderr, __VA_ARGS__); \
+		__atomic_add_fetch (&failures, 1, __ATOMIC_RELAXED); \
+	} while (0)
+
+/*	response, grown as needed
+ */
+typedef struct {
+	char *data;
+	size_t len;
+} Buffer_t;
+
+static void BufferPrintf (Buffer_t * const b, const char * const fmt, ...)
+		__attribute__((format(printf, 2, 3)));
+
+static void BufferPrintf (Buffer_t * const b, const char * const fmt, ...) {
+	va_list ap;
+	va_start (ap, fmt);
+	const int len = vsnprintf (NULL, 0, fmt, ap);
+	va_end (ap);
+	assert (len >= 0);
+	b->data = realloc (b->data, b->len + len + 1);
+	assert (b->data != NULL);
+	va_start (ap, fmt);
+	vsnprintf (b->data + b->len, len + 1, fmt, ap);
+	va_end (ap);
+	b->len += len;
+}
+
+/*	value of query parameter key in the request line, copied to dest
+ */
+static bool MockParam (const char * const line, const char * const key,
+		char * const dest, const size_t size) {
+	const size_t keyLen = strlen (key);
+	const char *p = strchr (line, '?');
+	while (p != NULL) {
+		++p;
+		if (strncmp (p, key, keyLen) == 0 && p[keyLen] == '=') {
+			p += keyLen + 1;
+			const size_t n = strcspn (p, "& ");
+			if (n >= size) {
+				return false;
+			}
+			memcpy (dest, p, n);
+			dest[n] = '\0';
+			return true;
+		}
+		p = strchr (p, '&');
+	}
+	return false;
+}
+
+/*	decrypt a request body the way the api does
+ */
+static json_object *MockDecrypt (gcry_cipher_hd_t h, const char * const body) {
+	size_t len;
+	char * const plain = PianoDecryptString (h, body, &len);
+	if (plain == NULL) {
+		return NULL;
+	}
+	json_object * const j = json_tokener_parse (plain);
+	free (plain);
+	return j;
+}
+
+static const char *MockGetStr (json_object * const j, const char * const key) {
+	json_object *v;
+	return j != NULL && json_object_object_get_ex (j, key, &v) ?
+			json_object_get_string (v) : NULL;
+}
+
+/*	answer one api call, bodies of authenticated calls must carry the token
+ *	of the user named in the url
+ */
+static void MockAnswer (gcry_cipher_hd_t in, gcry_cipher_hd_t out,
+		const char * const line, const char * const body,
+		Buffer_t * const resp) {
+	char method[64], token[128], user[64];
+	if (!MockParam (line, "method", method, sizeof (method))) {
+		fail ("mock: no method in %s\n", line);
+		BufferPrintf (resp, "{\"stat\":\"fail\",\"code\":0}");
+		return;
+	}
+
+	if (strcmp (method, "auth.partnerLogin") == 0) {
+		char plain[32];
+		const int len = snprintf (plain, sizeof (plain), "abcd%ld",
+				(long) time (NULL));
+		char * const sync = PianoEncryptString (in, plain);
+		assert (len > 0 && sync != NULL);
+		BufferPrintf (resp, "{\"stat\":\"ok\",\"result\":{\"syncTime\":\"%s\","
+				"\"partnerAuthToken\":\"partner-token\",\"partnerId\":\"42\"}}",
+				sync);
+		free (sync);
+		return;
+	}
+
+	json_object * const j = MockDecrypt (out, body);
+	if (strcmp (method, "auth.userLogin") == 0) {
+		const char * const name = MockGetStr (j, "username");
+		if (name == NULL || !MockParam (line, "auth_token", token,
+				sizeof (token)) || strcmp (token, "partner-token") != 0) {
+			fail ("mock: bad user login %s\n", line);
+			BufferPrintf (resp, "{\"stat\":\"fail\",\"code\":1002}");
+		} else {
+			BufferPrintf (resp, "{\"stat\":\"ok\",\"result\":{\"userId\":\"%s\","
+					"\"userAuthToken\":\"%s-%lu\"}}", name, name,
+					__atomic_add_fetch (&logins, 1, __ATOMIC_RELAXED));
+		}
+		json_object_put (j);
+		return;
+	}
+
+	/* tokens are name-login, names and tokens need no url encoding */
+	const char * const bodyToken = MockGetStr (j, "userAuthToken");
+	if (!MockParam (line, "auth_token", token, sizeof (token)) ||
+			!MockParam (line, "user_id", user, sizeof (user)) ||
+			bodyToken == NULL || strcmp (bodyToken, token) != 0 ||
+			strncmp (token, user, strlen (user)) != 0 ||
+			token[strlen (user)] != '-') {
+		fail ("mock: request %s does not match its session\n", line);
+		BufferPrintf (resp, "{\"stat\":\"fail\",\"code\":1001}");
+	} else if (strcmp (method, "user.getStationList") == 0) {
+		BufferPrintf (resp, "{\"stat\":\"ok\",\"result\":{\"stations\":[");
+		for (unsigned int i = 0; i < stationCount; i++) {
+			BufferPrintf (resp, "%s{\"stationName\":\"Station %u\","
+					"\"stationToken\":\"%s.%u\",\"isShared\":false,"
+					"\"isQuickMix\":%s%s}", i > 0 ? "," : "", i, user, i,
+					i == 0 ? "true" : "false",
+					i == 0 ? ",\"quickMixStationIds\":[]" : "");
+		}
+		BufferPrintf (resp, "]}}");
+	} else if (strcmp (method, "station.getPlaylist") == 0) {
+		const char * const station = MockGetStr (j, "stationToken");
+		if (station == NULL || strncmp (station, user, strlen (user)) != 0 ||
+				station[strlen (user)] != '.') {
+			fail ("mock: %s asked for station %s\n", user,
+					station != NULL ? station : "(none)");
+		}
+		BufferPrintf (resp, "{\"stat\":\"ok\",\"result\":{\"items\":[");
+		for (unsigned int i = 0; i < songCount; i++) {
+			BufferPrintf (resp, "%s{\"artistName\":\"Artist\","
+					"\"albumName\":\"Album\",\"songName\":\"Song %u\","
+					"\"trackToken\":\"%s/%u\",\"stationId\":\"%s\","
+					"\"trackLength\":240,\"trackGain\":\"-3.5\","
+					"\"songRating\":0,\"audioUrlMap\":{", i > 0 ? "," : "", i,
+					station != NULL ? station : "", i,
+					station != NULL ? station : "");
+			const char * const qualities[] = {"lowQuality", "mediumQuality",
+					"highQuality"};
+			for (size_t q = 0; q < sizeof (qualities) / sizeof (*qualities);
+					q++) {
+				BufferPrintf (resp, "%s\"%s\":{\"bitrate\":\"64\","
+						"\"encoding\":\"aacplus\",\"audioUrl\":"
+						"\"http://127.0.0.1/%s/%u/%zu\"}", q > 0 ? "," : "",
+						qualities[q], station != NULL ? station : "", i, q);
+			}
+			BufferPrintf (resp, "}}");
+		}
+		BufferPrintf (resp, "]}}");
+	} else {
+		fail ("mock: unexpected method %s\n", method);
+		BufferPrintf (resp, "{\"stat\":\"fail\",\"code\":0}");
+	}
+	json_object_put (j);
+}
+
+/*	serve one keep-alive connection
+ */
+static void *MockConnection (void * const data) {
+	const int fd = (int) (intptr_t) data;
+	gcry_cipher_hd_t in, out;
+	gcry_cipher_open (&in, GCRY_CIPHER_BLOWFISH, GCRY_CIPHER_MODE_ECB, 0);
+	gcry_cipher_setkey (in, inkey, strlen (inkey));
+	gcry_cipher_open (&out, GCRY_CIPHER_BLOWFISH, GCRY_CIPHER_MODE_ECB, 0);
+	gcry_cipher_setkey (out, outkey, strlen (outkey));
+
+	char buf[65536];
+	size_t have = 0;
+	while (true) {
+		/* head */
+		char *end;
+		while ((end = memmem (buf, have, "\r\n\r\n", 4)) == NULL) {
+			const ssize_t ret = read (fd, buf + have, sizeof (buf) - 1 - have);
+			if (ret <= 0 || have + ret >= sizeof (buf) - 1) {
+				goto done;
+			}
+			have += ret;
+		}
+		*end = '\0';
+		const char * const cl = strcasestr (buf, "\r\nContent-Length:");
+		const size_t bodyLen = cl != NULL ? strtoul (cl + 17, NULL, 10) : 0;
+		const size_t headLen = end - buf + 4;
+		if (headLen + bodyLen >= sizeof (buf)) {
+			fail ("mock: request too large\n");
+			goto done;
+		}
+		while (have < headLen + bodyLen) {
+			const ssize_t ret = read (fd, buf + have, sizeof (buf) - 1 - have);
+			if (ret <= 0) {
+				goto done;
+			}
+			have += ret;
+		}
+		char * const body = buf + headLen;
+		const char saved = body[bodyLen];
+		body[bodyLen] = '\0';
+		*strchr (buf, '\r') = '\0';
+
+		Buffer_t resp = {NULL, 0};
+		MockAnswer (in, out, buf, body, &resp);
+		char head[128];
+		const int n = snprintf (head, sizeof (head), "HTTP/1.1 200 OK\r\n"
+				"Content-Type: application/json\r\n"
+				"Content-Length: %zu\r\n\r\n", resp.len);
+		const bool ok = write (fd, head, n) == n &&
+				write (fd, resp.data, resp.len) == (ssize_t) resp.len;
+		free (resp.data);
+		if (!ok) {
+			goto done;
+		}
+
+		body[bodyLen] = saved;
+		memmove (buf, buf + headLen + bodyLen, have - headLen - bodyLen);
+		have -= headLen + bodyLen;
+	}
+
+done:
+	close (fd);
+	gcry_cipher_close (in);
+	gcry_cipher_close (out);
+	return NULL;
+}
+
+static void *MockServer (void * const data) {
+	const int sfd = (int) (intptr_t) data;
+	while (true) {
+		const int fd = accept (sfd, NULL, NULL);
+		if (fd == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		pthread_t t;
+		if (pthread_create (&t, NULL, MockConnection,
+				(void *) (intptr_t) fd) != 0) {
+			close (fd);
+			continue;
+		}
+		pthread_detach (t);
+	}
+	return NULL;
+}
+
+typedef struct {
+	unsigned int id, iterations;
+	unsigned short port;
+	PianoHandle_t ph;
+	CURL *http;
+	char name[32];
+	unsigned long errors;
+} Client_t;
+
+static size_t ClientFetch (char * const ptr, size_t size, size_t nmemb,
+		void * const data) {
+	BufferPrintf (data, "%.*s", (int) (size * nmemb), ptr);
+	return size * nmemb;
+}
+
+static void ClientErrMsg (void * const data, const char * const format,
+		va_list ap) {
+	Client_t * const c = data;
+	++c->errors;
+}
+
+/*	run a piano call to completion, like BarUiPianoCall without the retries
+ */
+static PianoReturn_t ClientCall (Client_t * const c,
+		const PianoRequestType_t type, void * const data) {
+	PianoRequest_t req;
+	memset (&req, 0, sizeof (req));
+	req.data = data;
+
+	PianoReturn_t ret;
+	do {
+		if ((ret = PianoRequest (&c->ph, &req, type)) != PIANO_RET_OK) {
+			break;
+		}
+		char url[2048];
+		snprintf (url, sizeof (url), "http://127.0.0.1:%hu%s", c->port,
+				req.urlPath);
+		Buffer_t resp = {NULL, 0};
+		curl_easy_setopt (c->http, CURLOPT_URL, url);
+		curl_easy_setopt (c->http, CURLOPT_POSTFIELDS, req.postData);
+		curl_easy_setopt (c->http, CURLOPT_WRITEFUNCTION, ClientFetch);
+		curl_easy_setopt (c->http, CURLOPT_WRITEDATA, &resp);
+		const CURLcode cret = curl_easy_perform (c->http);
+		if (cret != CURLE_OK || resp.data == NULL) {
+			fail ("client %u: %s\n", c->id, curl_easy_strerror (cret));
+			free (resp.data);
+			ret = PIANO_RET_ERR;
+			break;
+		}
+		req.responseData = resp.data;
+		ret = PianoResponse (&c->ph, &req);
+		free (resp.data);
+		req.responseData = NULL;
+		PianoDestroyRequest (&req);
+		req.data = data;
+	} while (ret == PIANO_RET_CONTINUE_REQUEST);
+	PianoDestroyRequest (&req);
+	return ret;
+}
+
+static bool ClientLogin (Client_t * const c) {
+	PianoRequestDataLogin_t login = {c->name, "secret", 0};
+	const PianoReturn_t ret = ClientCall (c, PIANO_REQUEST_LOGIN, &login);
+	if (ret != PIANO_RET_OK) {
+		fail ("client %u: login: %s\n", c->id, PianoErrorToStr (ret));
+		return false;
+	}
+	if (strcmp (c->ph.user.listenerId, c->name) != 0) {
+		fail ("client %u: logged in as %s\n", c->id, c->ph.user.listenerId);
+	}
+	return true;
+}
+
+/*	log in and fetch the station list on a new handle
+ */
+static bool ClientSession (Client_t * const c) {
+	if (PianoInit (&c->ph, "android", "password", "android-generic", inkey,
+			outkey) != PIANO_RET_OK) {
+		fail ("client %u: cannot init handle\n", c->id);
+		return false;
+	}
+	PianoSetErrMsgCallback (&c->ph, ClientErrMsg, c);
+	if (!ClientLogin (c)) {
+		return false;
+	}
+
+	const PianoReturn_t ret = ClientCall (c, PIANO_REQUEST_GET_STATIONS, NULL);
+	if (ret != PIANO_RET_OK) {
+		fail ("client %u: stations: %s\n", c->id, PianoErrorToStr (ret));
+		return false;
+	}
+	unsigned int count = 0;
+	for (PianoStation_t *s = c->ph.stations; s != NULL;
+			s = PianoListNextP (s)) {
+		if (strncmp (s->id, c->name, strlen (c->name)) != 0 ||
+				s->id[strlen (c->name)] != '.') {
+			fail ("client %u: got station %s\n", c->id, s->id);
+		}
+		++count;
+	}
+	if (count != stationCount) {
+		fail ("client %u: got %u stations\n", c->id, count);
+		return false;
+	}
+	return true;
+}
+
+/*	a handle lives for reloginEvery playlists and logs in again halfway
+ */
+static void *ClientRun (void * const data) {
+	Client_t * const c = data;
+	snprintf (c->name, sizeof (c->name), "user%u", c->id);
+	c->http = curl_easy_init ();
+	assert (c->http != NULL);
+
+	bool ok = true;
+	for (unsigned int i = 0; i < c->iterations && ok; i++) {
+		if (i % reloginEvery == 0) {
+			if (i > 0) {
+				PianoDestroy (&c->ph);
+			}
+			if (!(ok = ClientSession (c))) {
+				break;
+			}
+		} else if (i % reloginEvery == reloginEvery / 2 &&
+				!(ok = ClientLogin (c))) {
+			break;
+		}
+
+		PianoRequestDataGetPlaylist_t reqData;
+		memset (&reqData, 0, sizeof (reqData));
+		reqData.station = PianoListGetP (c->ph.stations, i % stationCount);
+		reqData.quality = PIANO_AQ_MEDIUM;
+		assert (reqData.station != NULL);
+		const PianoReturn_t ret = ClientCall (c, PIANO_REQUEST_GET_PLAYLIST,
+				&reqData);
+		if (ret != PIANO_RET_OK) {
+			fail ("client %u: playlist: %s\n", c->id, PianoErrorToStr (ret));
+			break;
+		}
+		const char * const id = reqData.station->id;
+		unsigned int count = 0;
+		for (PianoSong_t *s = reqData.retPlaylist; s != NULL;
+				s = PianoListNextP (s)) {
+			if (strncmp (s->trackToken, id, strlen (id)) != 0 ||
+					s->trackToken[strlen (id)] != '/' || s->audioUrl == NULL ||
+					strstr (s->audioUrl, id) == NULL) {
+				fail ("client %u: song %s on station %s\n", c->id,
+						s->trackToken, id);
+			}
+			++count;
+		}
+		if (count != songCount) {
+			fail ("client %u: got %u songs\n", c->id, count);
+		}
+		PianoDestroyPlaylist (reqData.retPlaylist);
+	}
+
+	if (c->errors > 0) {
+		fail ("client %u: %lu libpiano errors\n", c->id, c->errors);
+	}
+	curl_easy_cleanup (c->http);
+	PianoDestroy (&c->ph);
+	return NULL;
+}
+
+int main (int argc, char **argv) {
+	const unsigned int handles = argc > 1 ? strtoul (argv[1], NULL, 10) : 32;
+	const unsigned int iterations = argc > 2 ? strtoul (argv[2], NULL, 10) :
+			50;
+
+	/* before any thread starts, see piano.h */
+	gcry_check_version (NULL);
+	curl_global_init (CURL_GLOBAL_DEFAULT);
+
+	const int sfd = socket (AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	socklen_t addrLen = sizeof (addr);
+	if (sfd == -1 || bind (sfd, (struct sockaddr *) &addr, sizeof (addr))
+			!= 0 || listen (sfd, 128) != 0 || getsockname (sfd,
+			(struct sockaddr *) &addr, &addrLen) != 0) {
+		perror ("mock server");
+		return EXIT_FAILURE;
+	}
+	pthread_t server;
+	pthread_create (&server, NULL, MockServer, (void *) (intptr_t) sfd);
+	pthread_detach (server);
+
+	Client_t * const clients = calloc (handles, sizeof (*clients));
+	pthread_t * const threads = calloc (handles, sizeof (*threads));
+	assert (clients != NULL && threads != NULL);
+	for (unsigned int i = 0; i < handles; i++) {
+		clients[i].id = i;
+		clients[i].iterations = iterations;
+		clients[i].port = ntohs (addr.sin_port);
+		pthread_create (&threads[i], NULL, ClientRun, &clients[i]);
+	}
+	for (unsigned int i = 0; i < handles; i++) {
+		pthread_join (threads[i], NULL);
+	}
+	free (clients);
+	free (threads);
+
+	const unsigned long failed = __atomic_load_n (&failures, __ATOMIC_RELAXED);
+	printf ("%u handles, %u iterations, %lu logins: %s\n", handles,
+			iterations, __atomic_load_n (&logins, __ATOMIC_RELAXED),
+			failed == 0 ? "ok" : "FAILED");
+	curl_global_cleanup ();
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}